@@ -0,0 +1,88 @@
+/**** Helpers shared by the benchmarks of the host build.
+Benchmarks register with a static NativeHal::NativeBench and print one line per metric. A metric
+with a budget fails the run when it is exceeded, so CI catches the regression.
+
+static void runExample()
+{
+  Bench::online();
+  uint64_t start = Bench::nanos();
+  NativeHal::step();
+  Bench::report("loop pass", (Bench::nanos() - start) / 1000.0, "us");
+}
+
+static NativeHal::NativeBench example("example", runExample);
+*/
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <Arduino.h>
+#include <time.h>
+
+#include "NativeHal.h"
+
+namespace Bench {
+
+// host monotonic clock
+inline uint64_t nanos() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+inline uint32_t allocations() {
+    return NativeHal::heapCounters().allocations;
+}
+
+// boot the firmware once, then run it until it is subscribed at the broker
+inline void online() {
+    static bool isBooted = false;
+    if (!isBooted) {
+        isBooted = true;
+        NativeHal::boot();
+    }
+
+    NativeHal::broker.online = true;
+    NativeHal::accessPoint.available = true;
+    for (uint32_t i = 0; i < 100000 && NativeHal::broker.subscriptions.empty(); i++)
+        NativeHal::step();
+
+    // let the boot messages and the queued telemetry go out
+    for (uint32_t i = 0; i < 200; i++)
+        NativeHal::step();
+    NativeHal::broker.fromDevice.clear();
+}
+
+// a topic of the device, below the base of its command subscription "<base>/set/#"
+inline std::string topic(const char *suffix) {
+    if (NativeHal::broker.subscriptions.empty())
+        return suffix;
+    const std::string &filter = NativeHal::broker.subscriptions.front();
+    return filter.substr(0, filter.rfind("/set/")) + suffix;
+}
+
+// run the firmware until it published on the topic, returns the message or NULL
+inline const NativeHal::MqttMessage *stepUntilPublished(const char *topic, uint32_t maxSteps = 1000) {
+    for (uint32_t steps = 0; steps < maxSteps; steps++) {
+        NativeHal::step();
+        for (const NativeHal::MqttMessage &message : NativeHal::broker.fromDevice) {
+            if (message.topic == topic)
+                return &message;
+        }
+    }
+    return NULL;
+}
+
+inline void report(const char *metric, double value, const char *unit) {
+    printf("%-40s %12.2f %s\n", metric, value, unit);
+}
+
+// report and fail the run when the value is above its budget
+inline void report(const char *metric, double value, const char *unit, double budget) {
+    printf("%-40s %12.2f %s (budget %.2f)\n", metric, value, unit, budget);
+    if (value > budget)
+        NativeHal::fail(metric);
+}
+
+}  // namespace Bench
+
+#endif
@@ -0,0 +1,85 @@
+/**** Wall clock: cost of the log timestamps and the error of the clock between SNTP syncs.
+The timestamp of a log line is only written when the second has changed, lines in the same second
+take the kept text. The crystal of the device is set 40 ppm fast against the time server; the
+system time set by SNTP drifts away from the server until the next sync, the clock of the firmware
+is corrected by the drift it measured over the syncs before.
+*/
+#include "../src/LatencyStats.cpp"
+#include "../src/SystemClock.cpp"
+#include "Bench.h"
+
+extern SystemClock systemClock;
+
+size_t printLogTime(Print &out, uint32_t time);
+
+static int64_t systemTimeMicros() {
+    timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void runClockBench() {
+    // formats of known times, with the leap days of 2000 and the missing one of 2100
+    struct Sample {
+        uint32_t time;
+        const char *text;
+    };
+    const Sample samples[] = {
+        {0, "01-Jan-1970 00:00:00"},          {951782400, "29-Feb-2000 00:00:00"},
+        {1609477200, "01-Jan-2021 05:00:00"}, {1604533977, "04-Nov-2020 23:52:57"},
+        {4107542399, "28-Feb-2100 23:59:59"}, {4107542400, "01-Mar-2100 00:00:00"},
+    };
+    SystemClock clock;
+    uint32_t mismatches = 0;
+    for (const Sample &sample : samples) {
+        const char *text = clock.format(sample.time);
+        if (strcmp(text, sample.text) != 0) {
+            printf("format %u: %s, not %s\n", sample.time, text, sample.text);
+            mismatches++;
+        }
+    }
+    Bench::report("format: mismatches", mismatches, "", 0);
+
+    // the timestamps of a batch of log lines, mostly in the same second
+    const uint32_t lines = 10000;
+    PrintCounter counter;
+    uint64_t start = Bench::nanos();
+    for (uint32_t i = 0; i < lines; i++)
+        printLogTime(counter, 1609477200);
+    Bench::report("log timestamp, same second: host time", (Bench::nanos() - start) / (double)lines, "ns");
+
+    start = Bench::nanos();
+    for (uint32_t i = 0; i < lines; i++)
+        printLogTime(counter, 1609477200 + i);
+    Bench::report("log timestamp, new second: host time", (Bench::nanos() - start) / (double)lines, "ns");
+
+    // a day on a fast crystal, sampled every minute, after the drift estimate settled on the
+    // change, the first sync after it measures only a part of the interval at the new drift
+    Bench::online();
+    NativeHal::sntp.driftPpm = 40;
+    uint32_t syncs = NativeHal::sntp.syncs;
+    while (NativeHal::sntp.syncs < syncs + 10) {
+        NativeHal::advanceMillis(60000);
+        NativeHal::step();
+    }
+
+    uint64_t worstSystem = 0;
+    uint64_t worstClock = 0;
+    for (uint32_t minute = 0; minute < 24 * 60; minute++) {
+        NativeHal::advanceMillis(60000);
+        int64_t server = (int64_t)NativeHal::sntp.timeUs;
+        worstSystem = max(worstSystem, (uint64_t)llabs(systemTimeMicros() - server));
+        worstClock = max(worstClock, (uint64_t)llabs(systemClock.utcMicros() - server));
+        NativeHal::step();
+    }
+    NativeHal::broker.fromDevice.clear();
+
+    Bench::report("40 ppm: measured drift", systemClock.driftPpb / 1000.0, "ppm");
+    Bench::report("40 ppm: worst error of the system time", worstSystem / 1000.0, "ms");
+    Bench::report("40 ppm: worst error of the clock", worstClock / 1000.0, "ms", 1);
+    Bench::report("40 ppm: clock steps", systemClock.steps, "", 0);
+
+    NativeHal::sntp.driftPpm = 0;
+}
+
+static NativeHal::NativeBench clockBench("clock", runClockBench);
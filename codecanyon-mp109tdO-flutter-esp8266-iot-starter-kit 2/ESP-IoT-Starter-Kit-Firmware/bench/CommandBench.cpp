@@ -0,0 +1,96 @@
+/**** Command to acknowledge latency of the MQTT commands.
+Each command arrives at the device at a different point of its idle sleep, and the firmware runs
+until it published the acknowledge. Device latency is measured on the simulated clock from the
+arrival to the acknowledge, so it shows how long the device takes to notice a command. Host time
+is the processing cost of the whole round trip. TCP writes count what the command sent until the
+acknowledge, each write is a segment on the air since Nagle is off. The publish queue writes
+the packets of a loop pass together. Last, a batch asks for the statistics, which reply on their
+own topic and are refused inside a batch.
+*/
+#include "Bench.h"
+
+struct Command {
+    const char *name;
+    const char *suffix;
+    const char *payload;
+    const char *ackSuffix;
+};
+
+static const Command commands[] = {
+    {"ping", "/set/ping", "ping", "/get/ping"},
+    {"port1 open", "/set/port1", "open", "/get/port1"},
+    {"port2 open", "/set/port2", "open", "/get/port2"},
+    {"beeper", "/set/beeper", "beep", "/get/beeper"},
+    {"sensor data", "/set/sensor_data", "data", "/get/sensor_data"},
+    // a scene of four commands in one message
+    {"batch", "/set/batch", "port2 open; beeper beep; port1 open; ping ping", "/get/batch"},
+};
+
+static void runCommandBench() {
+    const uint32_t repeats = 50;
+
+    Bench::online();
+
+    for (const Command &command : commands) {
+        std::string topic = Bench::topic(command.suffix);
+        std::string ackTopic = Bench::topic(command.ackSuffix);
+
+        uint64_t hostTime = 0;
+        uint64_t deviceTime = 0;
+        uint32_t allocations = 0;
+        uint32_t tcpWrites = 0;
+        uint32_t failed = 0;
+
+        for (uint32_t i = 0; i < repeats; i++) {
+            // let the beeper and port timers of the previous command run out
+            for (uint32_t idle = millis(); millis() - idle < 1500;)
+                NativeHal::step();
+            NativeHal::broker.fromDevice.clear();
+
+            uint32_t startAllocations = Bench::allocations();
+            uint32_t startWrites = NativeHal::broker.tcpWrites;
+            uint64_t start = Bench::nanos();
+
+            // arrive somewhere within the next 100 ms
+            uint32_t delayMs = (i * 37) % 100;
+            uint64_t arrival = micros64() + (uint64_t)delayMs * 1000;
+            NativeHal::broker.inject(topic, command.payload, delayMs);
+
+            const NativeHal::MqttMessage *ack = Bench::stepUntilPublished(ackTopic.c_str());
+            if (ack)
+                deviceTime += ack->timeUs - arrival;
+            else
+                failed++;
+
+            hostTime += Bench::nanos() - start;
+            allocations += Bench::allocations() - startAllocations;
+            tcpWrites += NativeHal::broker.tcpWrites - startWrites;
+        }
+
+        char metric[64];
+        snprintf(metric, sizeof(metric), "%s: device latency", command.name);
+        Bench::report(metric, deviceTime / 1000.0 / repeats, "ms");
+        snprintf(metric, sizeof(metric), "%s: host time", command.name);
+        Bench::report(metric, hostTime / 1000.0 / repeats, "us");
+        snprintf(metric, sizeof(metric), "%s: allocations", command.name);
+        Bench::report(metric, (double)allocations / repeats, "");
+        snprintf(metric, sizeof(metric), "%s: tcp writes", command.name);
+        // the acknowledge and the log lines of a command share a segment
+        Bench::report(metric, (double)tcpWrites / repeats, "", 1.5);
+        snprintf(metric, sizeof(metric), "%s: unanswered", command.name);
+        Bench::report(metric, failed, "", 0);
+    }
+
+    NativeHal::broker.fromDevice.clear();
+    NativeHal::broker.inject(Bench::topic("/set/batch"), "stats stats; ping ping", 0);
+    const NativeHal::MqttMessage *reply = Bench::stepUntilPublished(Bench::topic("/get/batch").c_str());
+    std::string statsTopic = Bench::topic("/get/stats");
+    uint32_t reports = 0;
+    for (const NativeHal::MqttMessage &message : NativeHal::broker.fromDevice)
+        reports += message.topic == statsTopic;
+    bool isRefused = reply && reply->payload.find("\"results\":[\"unknown\",\"ok\"]") != std::string::npos;
+    Bench::report("batch with a report: not refused", !isRefused, "", 0);
+    Bench::report("batch with a report: published", reports, "", 0);
+}
+
+static NativeHal::NativeBench commandBench("command", runCommandBench);
@@ -0,0 +1,68 @@
+/**** Loading the settings at boot: the JSON file against the binary record.
+Writes a config file as older versions left it, imports it with the JSON parser, then loads the
+same settings from the EEPROM record. The record is checked in place and copied, it must not
+allocate more than the buffer of the EEPROM library. The old file has no device ID, the import
+must keep the fixed ID of the old firmware.
+*/
+#include <FS.h>
+
+#include "Bench.h"
+
+bool loadConfig();
+bool saveConfig();
+bool loadConfigFile();
+
+static void writeConfigFile() {
+    File file = SPIFFS.open("/config.json", "w");
+    file.print("{\"mqttServer\":\"broker.example.com\",\"mqttPort\":\"1883\","
+               "\"mqttUser\":\"esp-iot-device\",\"mqttPass\":\"s3cret-passw0rd\"}");
+    file.close();
+}
+
+// the binary load may allocate the EEPROM buffer only
+static void measure(const char *name, bool (*load)(), bool isBinary) {
+    const uint32_t repeats = 100;
+
+    uint32_t failures = 0;
+    uint32_t startAllocations = Bench::allocations();
+    NativeHal::resetHeapPeak();
+    uint32_t startBytes = NativeHal::heapCounters().liveBytes;
+    uint64_t start = Bench::nanos();
+    for (uint32_t i = 0; i < repeats; i++) {
+        if (!load())
+            failures++;
+    }
+    uint64_t elapsed = Bench::nanos() - start;
+
+    char metric[64];
+    snprintf(metric, sizeof(metric), "%s: host time", name);
+    Bench::report(metric, elapsed / 1000.0 / repeats, "us");
+    snprintf(metric, sizeof(metric), "%s: allocations", name);
+    double allocations = (double)(Bench::allocations() - startAllocations) / repeats;
+    if (isBinary)
+        Bench::report(metric, allocations, "", 1);
+    else
+        Bench::report(metric, allocations, "");
+    snprintf(metric, sizeof(metric), "%s: peak heap", name);
+    Bench::report(metric, NativeHal::heapCounters().peakBytes - startBytes, "bytes");
+    snprintf(metric, sizeof(metric), "%s: failures", name);
+    Bench::report(metric, failures, "", 0);
+}
+
+static void runConfigBench() {
+    Bench::online();
+
+    writeConfigFile();
+    measure("json import", loadConfigFile, false);
+
+    // the record as the import or the config portal leave it, exported to the file again
+    saveConfig();
+    measure("binary record", loadConfig, true);
+
+    File file = SPIFFS.open("/config.json", "r");
+    String exported = file.readString();
+    file.close();
+    Bench::report("json import: device ID changed", exported.indexOf("\"deviceId\":\"esp01\"") < 0, "", 0);
+}
+
+static NativeHal::NativeBench configBench("config", runConfigBench);
@@ -0,0 +1,87 @@
+/**** Topic matching cost of the MQTT dispatcher, against the String based callback it replaced.
+Both sides run the same five command topics with handlers that only count, so the numbers show
+the matching and copying overhead per message, not the cost of the commands themselves.
+*/
+#include "../src/MqttDispatcher.cpp"
+#include "Bench.h"
+
+static uint32_t hits = 0;
+
+static bool onCommand(const byte *payload, unsigned int length) {
+    (void)payload;
+    (void)length;
+    hits++;
+    return true;
+}
+
+static const MqttRoute routes[] = {
+    MQTT_ROUTE("/set/ping", onCommand),   MQTT_ROUTE("/set/sensor_data", onCommand),
+    MQTT_ROUTE("/set/beeper", onCommand), MQTT_ROUTE("/set/port1", onCommand),
+    MQTT_ROUTE("/set/port2", onCommand),
+};
+
+static MqttDispatcher dispatcher("devices/esp01", routes, sizeof(routes) / sizeof(routes[0]));
+
+// the callback of v1.4.0, with the handlers reduced to counting and the serial log left out
+static void legacyCallback(char *topic, byte *payload, unsigned int length) {
+    String strPayload = "";
+    String strTopic = String(topic);
+
+    for (uint8_t i = 0; i < length; i++) {
+        strPayload += (char)payload[i];
+    }
+
+    String msg = "MQTT: " + strTopic + ": " + strPayload;
+
+    if (strTopic.indexOf("devices/esp01/set/ping") >= 0 && strPayload == "ping")
+        hits++;
+    if (strTopic.indexOf("devices/esp01/set/sensor_data") >= 0 && strPayload == "data")
+        hits++;
+    if (strTopic.indexOf("devices/esp01/set/beeper") >= 0 && strPayload == "beep")
+        hits++;
+    if (strTopic.indexOf("devices/esp01/set/port1") >= 0 && strPayload == "open")
+        hits++;
+    if (strTopic.indexOf("devices/esp01/set/port2") >= 0) {
+        if (strPayload == "open")
+            hits++;
+        if (strPayload == "close")
+            hits++;
+    }
+}
+
+static void dispatchCallback(char *topic, byte *payload, unsigned int length) {
+    dispatcher.dispatch(topic, payload, length);
+}
+
+// returns the allocations per message
+static double measure(const char *name, void (*callback)(char *, byte *, unsigned int)) {
+    const uint32_t repeats = 20000;
+    static char topics[][40] = {"devices/esp01/set/ping", "devices/esp01/set/sensor_data", "devices/esp01/set/beeper",
+                                "devices/esp01/set/port1", "devices/esp01/set/port2"};
+    static byte payloads[][8] = {"ping", "data", "beep", "open", "close"};
+    const uint32_t count = sizeof(topics) / sizeof(topics[0]);
+
+    hits = 0;
+    uint32_t startAllocations = Bench::allocations();
+    uint64_t start = Bench::nanos();
+    for (uint32_t i = 0; i < repeats; i++) {
+        uint32_t n = i % count;
+        callback(topics[n], payloads[n], strlen((const char *)payloads[n]));
+    }
+    uint64_t elapsed = Bench::nanos() - start;
+
+    char metric[64];
+    snprintf(metric, sizeof(metric), "dispatch %s: host time", name);
+    Bench::report(metric, (double)elapsed / repeats, "ns");
+    if (hits != repeats)
+        NativeHal::fail("dispatch: a command was not matched");
+
+    return (double)(Bench::allocations() - startAllocations) / repeats;
+}
+
+static void runDispatchBench() {
+    Bench::report("dispatch String callback: allocations", measure("String callback", legacyCallback), "");
+    Bench::report("dispatch route table: allocations", measure("route table", dispatchCallback), "", 0);
+}
+
+static NativeHal::NativeBench dispatchBench("dispatch", runDispatchBench);
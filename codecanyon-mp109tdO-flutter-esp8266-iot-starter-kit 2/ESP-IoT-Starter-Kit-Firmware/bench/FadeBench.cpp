@@ -0,0 +1,88 @@
+/**** Dimmer fades: their timing over MQTT, the gamma curve and the cost of a frame.
+Dimmer 1 fades up over a second on a command, and must reach full duty within one frame of that
+second, rising at every frame. A linear fade of the levels must give the duties of the gamma curve,
+half the perceived brightness at about a fifth of the duty. The cost of one frame is measured on
+an engine with 8 channels, all fading. Frames over the budget are counted in host time, which the
+host scheduler can stretch now and then, so a few in a thousand are allowed.
+*/
+#include "../src/FadeEngine.cpp"
+#include "Bench.h"
+
+extern FadeEngine<1> fades;
+
+static const uint8_t dimmerPin = 0;
+
+static void runFadeBench() {
+    Bench::online();
+
+    NativeHal::broker.inject(Bench::topic("/set/fade1"), "0");
+    Bench::stepUntilPublished(Bench::topic("/get/fade1").c_str());
+    NativeHal::broker.fromDevice.clear();
+
+    // full duty a second after the command, rising on the way
+    uint64_t start = micros();
+    NativeHal::broker.inject(Bench::topic("/set/fade1"), "255 1000");
+    const NativeHal::MqttMessage *reply = Bench::stepUntilPublished(Bench::topic("/get/fade1").c_str());
+    Bench::report("fade: wrong replies", !reply || reply->payload != "255", "", 0);
+
+    uint32_t falls = 0;
+    int duty = NativeHal::analogLevel(dimmerPin);
+    while (NativeHal::analogLevel(dimmerPin) < FadeEngine<1>::pwmRange && micros() - start < 2000000) {
+        NativeHal::step();
+        if (NativeHal::analogLevel(dimmerPin) < duty)
+            falls++;
+        duty = NativeHal::analogLevel(dimmerPin);
+    }
+    // the duty is written by the frame Ticker, which runs while the loop sleeps
+    uint64_t lengthUs = NativeHal::outputChangeUs(dimmerPin) - start;
+    NativeHal::broker.fromDevice.clear();
+
+    Bench::report("fade over 1000 ms: length", lengthUs / 1000.0, "ms");
+    Bench::report("fade over 1000 ms: end error", llabs((int64_t)lengthUs - 1000000) / 1000.0, "ms", 20);
+    Bench::report("fade over 1000 ms: falling frames", falls, "", 0);
+    Bench::report("fade over 1000 ms: frames left running", fades.ticker.active(), "", 0);
+
+    // a linear fade of the levels, a level per frame
+    const uint8_t pins[] = {dimmerPin};
+    FadeEngine<1> engine(pins, 20);
+    engine.begin();
+    FadeSequence sequence;
+    sequence.parse("255 5100", 8);
+    engine.play(0, sequence);
+
+    uint32_t worstDuty = 0;
+    uint32_t now = millis();
+    for (uint32_t level = 0; level <= 255; level++) {
+        engine.frame(now + level * 20);
+        double expected = pow(level / 255.0, FadeEngine<1>::gammaExponent) * FadeEngine<1>::pwmRange;
+        worstDuty = max(worstDuty, (uint32_t)lround(fabs(engine.channels[0].duty - expected)));
+        if (level == 128)
+            Bench::report("gamma: duty at level 128", engine.channels[0].duty, "");
+    }
+    Bench::report("gamma: worst duty error", worstDuty, "", 1);
+
+    // every channel of an 8 channel engine fades in every frame, each at its own phase
+    const uint8_t pins8[] = {0, 1, 3, 6, 7, 8, 9, 10};
+    FadeEngine<8> engine8(pins8, 20);
+    engine8.begin();
+    const char breathe[] = "255 800 in-out, 20 1200 out, 128 300 in, repeat";
+    sequence.parse(breathe, strlen(breathe));
+    for (uint8_t channel = 0; channel < 8; channel++) {
+        engine8.play(channel, sequence);
+        engine8.channels[channel].start -= channel * 250;
+    }
+
+    const uint32_t frames = 10000;
+    now = millis();
+    uint32_t allocations = Bench::allocations();
+    uint64_t frameStart = Bench::nanos();
+    for (uint32_t i = 0; i < frames; i++) {
+        now += 20;
+        engine8.frame(now);
+    }
+    Bench::report("frame, 8 channels: host time", (Bench::nanos() - frameStart) / (double)frames, "ns");
+    Bench::report("frame, 8 channels: allocations", Bench::allocations() - allocations, "", 0);
+    Bench::report("frame, 8 channels: over budget", 100.0 * engine8.overruns / frames, "%", 0.3);
+}
+
+static NativeHal::NativeBench fadeBench("fades", runFadeBench);
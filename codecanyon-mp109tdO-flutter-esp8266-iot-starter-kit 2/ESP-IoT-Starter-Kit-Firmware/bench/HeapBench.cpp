@@ -0,0 +1,93 @@
+/**** Heap allocations per operation of the firmware.
+Calls the publishing functions of main.cpp directly while online, and once more while the broker
+is down, when the telemetry goes to the flash queue instead. The live bytes of every subsystem,
+as attributed by the heap tracer, must not grow over the repeats: growth is a leak. Publishing
+while online must not allocate at all.
+*/
+#include "../src/HeapTracer.cpp"
+#include "Bench.h"
+
+void log(const char *message, bool sendMQTT);
+void publishUptime();
+void publishSensorData();
+void publishSensorStats();
+
+static void logToMqtt() {
+    log("Benchmark message", true);
+}
+
+struct Operation {
+    const char *name;
+    void (*run)();
+};
+
+static const Operation operations[] = {
+    {"log to MQTT", logToMqtt},
+    {"publish uptime", publishUptime},
+    {"publish sensor data", publishSensorData},
+    {"publish sensor stats", publishSensorStats},
+};
+
+static uint32_t liveBytes() {
+    uint32_t bytes = 0;
+    for (uint8_t i = 0; i < HeapTracer::maxTags; i++)
+        bytes += heapTracer().liveBytes[i];
+    return bytes;
+}
+
+static void measure(const char *state, bool isAllocationFree) {
+    const uint32_t repeats = 100;
+
+    for (const Operation &operation : operations) {
+        // once before measuring, buffers that are kept after the first call are not leaks
+        operation.run();
+
+        uint32_t startAllocations = Bench::allocations();
+        uint32_t startBytes = liveBytes();
+        uint64_t start = Bench::nanos();
+        for (uint32_t i = 0; i < repeats; i++)
+            operation.run();
+        uint64_t elapsed = Bench::nanos() - start;
+
+        char metric[64];
+        snprintf(metric, sizeof(metric), "%s (%s): allocations", operation.name, state);
+        double allocations = (double)(Bench::allocations() - startAllocations) / repeats;
+        if (isAllocationFree)
+            Bench::report(metric, allocations, "", 0);
+        else
+            Bench::report(metric, allocations, "");
+        snprintf(metric, sizeof(metric), "%s (%s): host time", operation.name, state);
+        Bench::report(metric, elapsed / 1000.0 / repeats, "us");
+        snprintf(metric, sizeof(metric), "%s (%s): heap growth", operation.name, state);
+        Bench::report(metric, (int32_t)(liveBytes() - startBytes), "bytes", 0);
+
+        // the simulated heap also holds what the broker received
+        NativeHal::broker.fromDevice.clear();
+    }
+}
+
+// the heap report of the firmware, with the live bytes per subsystem
+static void reportTags() {
+    NativeHal::broker.inject(Bench::topic("/set/heap"), "heap");
+    const NativeHal::MqttMessage *message = Bench::stepUntilPublished(Bench::topic("/get/heap").c_str());
+    if (message)
+        printf("heap report: %s\n", message->payload.c_str());
+    Bench::report("heap report: unanswered", message ? 0 : 1, "", 0);
+    Bench::report("untracked allocations", heapTracer().untracked, "", 0);
+}
+
+static void runHeapBench() {
+    Bench::online();
+    measure("online", true);
+
+    // a few passes to notice the lost broker, then everything is queued
+    NativeHal::broker.online = false;
+    for (uint32_t i = 0; i < 10; i++)
+        NativeHal::step();
+    measure("offline", false);
+
+    Bench::online();
+    reportTags();
+}
+
+static NativeHal::NativeBench heapBench("heap", runHeapBench);
@@ -0,0 +1,216 @@
+/**** Sensor history on flash: its size, its round trip and its replies over MQTT.
+Three days of one minute samples of a room, a daily swing with some noise, are kept in a history
+of its own. They must take a few bytes per sample, come back unchanged from a query in chunks that
+fit the packet buffer of PubSubClient, and survive a reboot but for the samples not yet saved.
+Twenty days tell how much of the history the 24 KiB hold. Then the firmware keeps its own history for half
+an hour and streams the last 10 minutes of it on a command.
+*/
+#include "../src/LatencyStats.cpp"
+#include "../src/SeriesHistory.cpp"
+#include "Bench.h"
+
+#include <vector>
+
+typedef SeriesHistory<2> BenchHistory;
+
+struct HistorySample {
+    uint32_t time;
+    int32_t values[2];
+};
+
+// the samples of the chunks of a query, parsed as they come so they do not pile up on the heap
+static std::vector<HistorySample> received;
+static uint32_t chunks = 0;
+static size_t largestChunk = 0;
+static bool isLastReceived = false;
+
+// {"seq":0,"time":1760788800,"samples":[[0,23.1,45.2],..]}
+static void parseChunk(const char *chunk, size_t length) {
+    chunks++;
+    largestChunk = max(largestChunk, length);
+
+    uint32_t start = strtoul(strstr(chunk, "\"time\":") + 7, NULL, 10);
+    const char *row = strstr(chunk, "\"samples\":[") + 11;
+    while (*row == '[') {
+        char *end;
+        HistorySample sample;
+        sample.time = start + strtol(row + 1, &end, 10);
+        for (int32_t &value : sample.values)
+            value = lround(strtod(end + 1, &end) * 10);
+        received.push_back(sample);
+        row = end + 1;
+        if (*row == ',')
+            row++;
+    }
+    isLastReceived = strstr(row, "\"last\":true") != NULL;
+}
+
+static bool collectChunk(const char *payload, size_t length) {
+    std::string chunk(payload, length);
+    parseChunk(chunk.c_str(), length);
+    return true;
+}
+
+static void clearReceived() {
+    received.clear();
+    chunks = 0;
+    largestChunk = 0;
+    isLastReceived = false;
+}
+
+// stream a query of the history into `received`
+static void runQuery(BenchHistory &history, uint32_t from, uint32_t to) {
+    clearReceived();
+    history.query(from, to);
+    while (history.isQuerying) {
+        NativeHal::advanceMillis(BenchHistory::chunkInterval);
+        history.loop(true);
+    }
+}
+
+static uint32_t storedBytes(const BenchHistory &history) {
+    uint32_t bytes = 0;
+    for (uint32_t sequence = history.head; sequence <= history.tail; sequence++) {
+        BenchHistory::Header header;
+        if (history.readHeader(sequence, header))
+            bytes += sizeof(header) + (header.bits + 7) / 8;
+    }
+    return bytes;
+}
+
+static uint32_t mismatches(const std::vector<HistorySample> &expected, const std::vector<HistorySample> &actual) {
+    uint32_t wrong = expected.size() > actual.size() ? expected.size() - actual.size() : actual.size() - expected.size();
+    for (size_t i = 0; i < min(expected.size(), actual.size()); i++) {
+        wrong += expected[i].time != actual[i].time || expected[i].values[0] != actual[i].values[0] ||
+                 expected[i].values[1] != actual[i].values[1];
+    }
+    return wrong;
+}
+
+static uint32_t noise = 777;
+
+// one minute samples with a second late now and then, the filtered values swing over the day
+static HistorySample roomSample(uint32_t i) {
+    noise = noise * 1103515245 + 12345;
+    double day = sin(i * 2 * M_PI / 1440);
+    HistorySample sample;
+    sample.time = 1760000000 + i * 60 + i / 200;
+    sample.values[0] = lround(220 + 20 * day + (noise >> 16) % 3 * 0.5);
+    sample.values[1] = lround(450 - 50 * day + (noise >> 20) % 5 * 0.5);
+    return sample;
+}
+
+static void runHistoryBench() {
+    SPIFFS.remove("/bench_history.bin");
+    BenchHistory history("/bench_history.bin", collectChunk);
+    history.begin();
+
+    const uint32_t days = 3;
+    std::vector<HistorySample> samples;
+    uint64_t start = Bench::nanos();
+    for (uint32_t i = 0; i < days * 1440; i++) {
+        samples.push_back(roomSample(i));
+        history.add(samples.back().time, samples.back().values);
+    }
+    double addNs = (Bench::nanos() - start) / (double)samples.size();
+
+    uint32_t bytes = storedBytes(history);
+    Bench::report("3 days of 1 minute samples: bytes", bytes, "bytes", BenchHistory::blockSize * BenchHistory::maxBlocks);
+    Bench::report("3 days of 1 minute samples: per sample", bytes / (double)samples.size(), "bytes", 3);
+    Bench::report("3 days of 1 minute samples: uncompressed", 12, "bytes");
+    Bench::report("add: host time, flash writes included", addNs, "ns");
+    // two blocks and the headers of all slots
+    Bench::report("history: memory", sizeof(BenchHistory), "bytes", 2560);
+
+    // the statistics come from RAM
+    uint32_t opens = SPIFFS.opens;
+    PrintCounter counter;
+    history.printJson(counter);
+    Bench::report("statistics: flash opens", SPIFFS.opens - opens, "", 0);
+
+    // everything back, in chunks that fit, a block is read with a single open
+    opens = SPIFFS.opens;
+    runQuery(history, 0, UINT32_MAX);
+    Bench::report("query, 3 days: flash opens per block", (SPIFFS.opens - opens) / (double)(history.tail - history.head + 1), "", 1);
+    Bench::report("query, 3 days: wrong samples", mismatches(samples, received), "", 0);
+    Bench::report("query, 3 days: chunks", chunks, "");
+    Bench::report("query, 3 days: largest chunk", largestChunk, "bytes", BenchHistory::maxChunk);
+    Bench::report("query, 3 days: last chunk missing", !isLastReceived, "", 0);
+
+    // a range inside a block
+    runQuery(history, samples[1000].time, samples[1099].time);
+    std::vector<HistorySample> range(samples.begin() + 1000, samples.begin() + 1100);
+    Bench::report("query, 100 minutes: wrong samples", mismatches(range, received), "", 0);
+
+    // the longest row fits its buffer
+    char row[BenchHistory::maxRow + 1];
+    const int32_t extremes[2] = {INT32_MIN, INT32_MAX};
+    int rowLength = BenchHistory::formatRow(row, sizeof(row), INT32_MIN, extremes);
+    Bench::report("row of extreme values: wrong",
+                  strcmp(row, "[-2147483648,-214748364.8,214748364.7]") != 0 || rowLength != (int)strlen(row), "", 0);
+
+    // a query waits for the broker without keeping the loop awake
+    history.query(0, UINT32_MAX);
+    history.loop(false);
+    Bench::report("query while offline: no idle sleep", history.timeToNext() != UINT32_MAX, "", 0);
+    history.isQuerying = false;
+    history.loop(true);
+
+    // a reboot keeps the saved samples, and goes on where they end
+    BenchHistory rebooted("/bench_history.bin", collectChunk);
+    rebooted.begin();
+    uint32_t lost = history.unsaved;
+    samples.resize(samples.size() - lost);
+    for (uint32_t i = days * 1440; i < days * 1440 + 60; i++) {
+        samples.push_back(roomSample(i));
+        rebooted.add(samples.back().time, samples.back().values);
+    }
+    runQuery(rebooted, 0, UINT32_MAX);
+    Bench::report("reboot: samples not saved", lost, "", BenchHistory::saveInterval - 1);
+    Bench::report("reboot: wrong samples after it", mismatches(samples, received), "", 0);
+
+    // the oldest blocks make room
+    for (uint32_t i = days * 1440 + 60; i < 20 * 1440; i++) {
+        HistorySample sample = roomSample(i);
+        rebooted.add(sample.time, sample.values);
+    }
+    runQuery(rebooted, 0, UINT32_MAX);
+    double kept = received.empty() ? 0 : (received.back().time - received.front().time) / 86400.0;
+    Bench::report("20 days: days kept", kept, "days");
+    Bench::report("20 days: days kept, short of 3", max(0.0, 3 - kept), "days", 0);
+    Bench::report("20 days: bytes", storedBytes(rebooted), "bytes", BenchHistory::blockSize * BenchHistory::maxBlocks);
+    SPIFFS.remove("/bench_history.bin");
+    samples = std::vector<HistorySample>();
+
+    // the firmware, half an hour of its own history
+    Bench::online();
+    start = micros();
+    while (micros() - start < 30 * 60 * 1000000ULL)
+        NativeHal::step();
+    NativeHal::broker.fromDevice.clear();
+
+    const std::string historyTopic = Bench::topic("/get/history");
+    NativeHal::broker.inject(Bench::topic("/set/history"), "600");
+    clearReceived();
+    for (uint32_t steps = 0; steps < 1000 && !isLastReceived; steps++) {
+        NativeHal::step();
+        for (const NativeHal::MqttMessage &message : NativeHal::broker.fromDevice) {
+            if (message.topic != historyTopic)
+                continue;
+            if (chunks == 0)
+                printf("history reply: %s\n", message.payload.c_str());
+            parseChunk(message.payload.c_str(), message.payload.size());
+        }
+        NativeHal::broker.fromDevice.clear();
+    }
+    Bench::report("10 minutes over MQTT: samples", received.size(), "");
+    Bench::report("10 minutes over MQTT: missing samples", received.size() >= 10 ? 0 : 10 - received.size(), "", 0);
+
+    NativeHal::broker.inject(Bench::topic("/set/history"), "1760000000 1750000000");
+    const NativeHal::MqttMessage *reply = Bench::stepUntilPublished(historyTopic.c_str());
+    Bench::report("invalid range: taken", !reply || reply->payload != "{\"error\":\"invalid range\"}", "", 0);
+    NativeHal::broker.fromDevice.clear();
+    received = std::vector<HistorySample>();
+}
+
+static NativeHal::NativeBench historyBench("history", runHistoryBench);
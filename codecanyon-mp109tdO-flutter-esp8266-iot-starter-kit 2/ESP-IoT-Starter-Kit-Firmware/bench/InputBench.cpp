@@ -0,0 +1,61 @@
+/**** Time from a button press to its action, with bouncing contacts.
+Presses button 2 while the device is online and idle, every edge followed by a few bounces.
+Every press must toggle port 2 exactly once, also a press shorter than the debounce time. The
+time from the release edge to the toggle is the press to action latency of the firmware.
+*/
+#include "../src/LatencyStats.cpp"
+#include "Bench.h"
+
+extern LatencyHistogram latencyPressToAction;
+
+static const uint8_t buttonPin = 2;
+static const uint8_t portPin = 5;
+
+// the contact settles after a few bounces within 2 ms
+static void scheduleBouncyEdge(uint8_t level, uint64_t delayUs) {
+    const uint32_t bounces[] = {0, 150, 400, 700, 1200, 2000};
+    for (uint8_t i = 0; i < sizeof(bounces) / sizeof(bounces[0]); i++)
+        NativeHal::scheduleInput(buttonPin, i % 2 ? !level : level, delayUs + bounces[i]);
+}
+
+// press for `lengthUs`, returns how often the port toggled until some time after the release
+static uint32_t press(uint64_t lengthUs) {
+    uint64_t end = micros() + lengthUs + 300000;
+    scheduleBouncyEdge(LOW, 1000);
+    scheduleBouncyEdge(HIGH, 1000 + lengthUs);
+
+    uint32_t toggles = 0;
+    uint8_t level = NativeHal::outputLevel(portPin);
+    while (micros() < end) {
+        NativeHal::step();
+        if (NativeHal::outputLevel(portPin) != level) {
+            level = NativeHal::outputLevel(portPin);
+            toggles++;
+        }
+    }
+    return toggles;
+}
+
+static void runInputBench() {
+    const uint32_t presses = 20;
+
+    Bench::online();
+    latencyPressToAction.reset();
+
+    uint32_t wrongToggles = 0;
+    for (uint32_t i = 0; i < presses; i++) {
+        // lengths from 100 to 290 ms
+        wrongToggles += press(100000 + i * 10000) != 1;
+    }
+    bool isShortPressMissed = press(5000) != 1;
+    NativeHal::broker.fromDevice.clear();
+
+    const LatencyHistogram &latency = latencyPressToAction;
+    Bench::report("press to action: actions", latency.count, "");
+    Bench::report("press to action: mean", latency.count ? latency.sumUs / 1000.0 / latency.count : 0, "ms");
+    Bench::report("press to action: worst", latency.maxUs / 1000.0, "ms", 15);
+    Bench::report("presses not toggled once", wrongToggles, "", 0);
+    Bench::report("5 ms press not toggled once", isShortPressMissed, "", 0);
+}
+
+static NativeHal::NativeBench inputBench("inputs", runInputBench);
@@ -0,0 +1,32 @@
+/**** Cost of one pass of loop() while the device is online and idle.
+Reports host time per pass, the device time the loop sleeps between passes and the heap
+allocations per pass. The periodic uptime and sensor reports fall into the measured time.
+*/
+#include "Bench.h"
+
+static void runLoopBench() {
+    const uint32_t passes = 20000;
+
+    Bench::online();
+
+    uint32_t startMillis = millis();
+    uint32_t startAllocations = Bench::allocations();
+    uint64_t worst = 0;
+    uint64_t total = 0;
+
+    for (uint32_t i = 0; i < passes; i++) {
+        uint64_t start = Bench::nanos();
+        NativeHal::step();
+        uint64_t elapsed = Bench::nanos() - start;
+        total += elapsed;
+        if (elapsed > worst)
+            worst = elapsed;
+    }
+
+    Bench::report("loop: host time per pass", total / 1000.0 / passes, "us");
+    Bench::report("loop: worst host time per pass", worst / 1000.0, "us");
+    Bench::report("loop: device time per pass", (double)(millis() - startMillis) / passes, "ms");
+    Bench::report("loop: allocations per pass", (double)(Bench::allocations() - startAllocations) / passes, "");
+}
+
+static NativeHal::NativeBench loopBench("loop", runLoopBench);
@@ -0,0 +1,100 @@
+/**** Sensor node: the batches it publishes over its deep sleep wakes.
+Only in a build with _SENSOR_NODE (the native_sensor_node environment). The node boots once, which
+reports right away, then wakes batchWakes times and must publish one batch of all their samples,
+valid JSON whose ages are a sample period apart. A batch the broker does not take stays in RTC
+memory and goes out with the next one.
+*/
+#ifdef _SENSOR_NODE
+
+#include "../src/SensorNode.cpp"
+#include "Bench.h"
+
+extern SensorNode sensorNode;
+
+void setup();
+
+// one wake, from the boot to the deep sleep, returns the time the node was awake
+static uint32_t wake(uint64_t *sleepUs = NULL) {
+    try {
+        setup();
+    } catch (const NativeHal::DeepSleep &sleep) {
+        uint32_t awakeMs = sensorNode.awakeTime();
+        if (sleepUs)
+            *sleepUs = sleep.timeUs;
+        NativeHal::advanceMicros(sleep.timeUs);
+        return awakeMs;
+    }
+    return 0;
+}
+
+// the batches published since the last clear
+static std::vector<std::string> batches() {
+    std::vector<std::string> payloads;
+    for (const NativeHal::MqttMessage &message : NativeHal::broker.fromDevice) {
+        if (message.topic.size() > 17 && message.topic.compare(message.topic.size() - 17, 17, "/get/sensor_batch") == 0)
+            payloads.push_back(message.payload);
+    }
+    return payloads;
+}
+
+// samples of a batch that miss or are not a sample period apart, all of them for a batch cut short
+// {"samples":[{"age":1500,"Temp":23.1,"Hum":45.2},..],"wakes":6,..,"energyPerSample":239.399}
+static uint32_t wrongSamples(const std::string &payload, uint8_t expected, uint32_t periodMs) {
+    const char *json = payload.c_str();
+    if (strncmp(json, "{\"samples\":[", 12) != 0 || !strstr(json, "\"energyPerSample\":") ||
+        payload[payload.size() - 1] != '}')
+        return expected;
+
+    uint32_t count = 0;
+    uint32_t wrong = 0;
+    long older = 0;
+    for (const char *age = strstr(json, "\"age\":"); age; age = strstr(age + 1, "\"age\":")) {
+        long newer = strtol(age + 6, NULL, 10);
+        if (count++ > 0)
+            wrong += labs(older - newer - (long)(periodMs / 1000)) > 1;
+        older = newer;
+    }
+    return wrong + (count == expected ? 0 : expected);
+}
+
+static void runNodeBench() {
+    const uint16_t batchWakes = sensorNode.batchWakes;
+
+    // the first boot reports at once
+    uint64_t sleepUs = 0;
+    uint32_t periodMs = wake(&sleepUs) + sleepUs / 1000;
+    Bench::report("first boot: batches", batches().size(), "", 1);
+    NativeHal::broker.fromDevice.clear();
+
+    uint32_t awakeMs = 0;
+    for (uint16_t i = 0; i < batchWakes; i++)
+        awakeMs += wake();
+    std::vector<std::string> published = batches();
+    Bench::report("wake: awake time", (double)awakeMs / batchWakes, "ms");
+    Bench::report("batch: not published", published.size() != 1, "", 0);
+    if (published.size() == 1) {
+        printf("batch: %s\n", published[0].c_str());
+        Bench::report("batch: bytes", published[0].size(), "bytes");
+        Bench::report("batch: wrong samples", wrongSamples(published[0], batchWakes, periodMs), "", 0);
+    }
+    NativeHal::broker.fromDevice.clear();
+
+    // the broker is down for one batch, its samples go out with the next
+    for (uint16_t i = 0; i < batchWakes; i++) {
+        NativeHal::broker.online = i != batchWakes - 1;
+        wake();
+    }
+    NativeHal::broker.online = true;
+    Bench::report("broker down: published anyway", batches().size(), "", 0);
+    for (uint16_t i = 0; i < batchWakes; i++)
+        wake();
+    published = batches();
+    Bench::report("broker down: batches after", published.size(), "", 1);
+    if (published.size() == 1)
+        Bench::report("broker down: wrong samples", wrongSamples(published[0], 2 * batchWakes, periodMs), "", 0);
+    NativeHal::broker.fromDevice.clear();
+}
+
+static NativeHal::NativeBench nodeBench("node", runNodeBench);
+
+#endif
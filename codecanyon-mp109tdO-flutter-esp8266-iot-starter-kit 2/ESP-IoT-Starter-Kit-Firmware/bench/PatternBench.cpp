@@ -0,0 +1,95 @@
+/**** LED patterns from the timer interrupt while the loop is blocked.
+A ping blinks the LED three times over the ready pattern, and right after it starts the loop is
+held for a second, as a blocking call would. The blinks must keep their lengths all the same, and
+the ready pattern must go on at its own timing once they are over. With the ready pattern stopped
+the timer interrupt must not fire, also not when the cycle counter wraps. The cost of one interrupt is measured on an engine with 8
+outputs and 3 layers that all end a step at once.
+*/
+#include "../src/PatternEngine.cpp"
+#include "Bench.h"
+
+extern PatternEngine<2, 3> patterns;
+
+static const uint8_t ledPin = 15;
+
+// the ready pattern, 800 ms on and 1600 ms off
+static const uint64_t readyOnUs = 800000;
+static const uint64_t readyPeriodUs = 2400000;
+
+static void runPatternBench() {
+    Bench::online();
+
+    std::vector<uint64_t> edges;
+    NativeHal::traceOutput(ledPin, &edges);
+
+    // from the start of a ready off step, the blinks end long before it
+    while (edges.empty() || NativeHal::outputLevel(ledPin) != LOW)
+        NativeHal::step();
+    uint64_t readyOff = edges.back();
+    edges.clear();
+
+    NativeHal::broker.inject(Bench::topic("/set/ping"), "ping");
+    Bench::stepUntilPublished(Bench::topic("/get/ping").c_str());
+    NativeHal::advanceMillis(1000);
+
+    // on 100, off 80, three times
+    const uint64_t blinkUs[] = {100000, 80000, 100000, 80000, 100000};
+    uint64_t worstBlink = 0;
+    if (edges.size() >= 6) {
+        for (uint8_t i = 0; i < 5; i++) {
+            uint64_t length = edges[i + 1] - edges[i];
+            worstBlink = max(worstBlink, length > blinkUs[i] ? length - blinkUs[i] : blinkUs[i] - length);
+        }
+    }
+    Bench::report("ping with a blocked loop: edges", edges.size(), "");
+    Bench::report("ping with a blocked loop: worst edge error", worstBlink / 1000.0, "ms", 1);
+
+    // the ready pattern goes on, every edge at its time counted from before the ping
+    edges.clear();
+    uint64_t end = micros() + 3 * readyPeriodUs;
+    while (micros() < end)
+        NativeHal::step();
+    NativeHal::traceOutput(ledPin, NULL);
+    NativeHal::broker.fromDevice.clear();
+
+    uint64_t worstReady = 0;
+    for (uint64_t edge : edges) {
+        // off at the start of a period from readyOff, on at 1600 ms
+        uint64_t phase = (edge - readyOff) % readyPeriodUs;
+        uint64_t onAt = readyPeriodUs - readyOnUs;
+        uint64_t error = min(min(phase, readyPeriodUs - phase), phase > onAt ? phase - onAt : onAt - phase);
+        worstReady = max(worstReady, error);
+    }
+    Bench::report("ready after the ping: edges", edges.size(), "");
+    Bench::report("ready after the ping: worst edge error", worstReady / 1000.0, "ms", 1);
+    Bench::report("timer interrupt: latest step end", patterns.maxLateUs, "us", 1000);
+
+    // no pattern plays for two wraps of the cycle counter, then the ready pattern starts again
+    patterns.stop(0, 0);
+    uint32_t wakes = patterns.wakes;
+    NativeHal::advanceMillis(120000);
+    Bench::report("no pattern: timer interrupts", patterns.wakes - wakes, "", 0);
+    patterns.play(0, 0, 0);
+
+    // every layer of every output ends a step in the same interrupt
+    const uint16_t steps[] = {1, 1, 0};
+    const Pattern table[] = {{steps, true}};
+    const PatternOutput outputs[] = {{0, false}, {1, false}, {3, false}, {6, false},
+                                     {7, false}, {8, false}, {9, false}, {10, false}};
+    PatternEngine<8, 3> engine(outputs, table);
+    for (uint8_t channel = 0; channel < 8; channel++) {
+        for (uint8_t layer = 0; layer < 3; layer++)
+            engine.play(channel, layer, 0);
+    }
+
+    const uint32_t updates = 10000;
+    uint32_t now = micros();
+    uint64_t start = Bench::nanos();
+    for (uint32_t i = 0; i < updates; i++) {
+        now += 1000;
+        engine.update(now);
+    }
+    Bench::report("interrupt, 8 outputs x 3 layers: host time", (Bench::nanos() - start) / (double)updates, "ns");
+}
+
+static NativeHal::NativeBench patternBench("patterns", runPatternBench);
@@ -0,0 +1,102 @@
+/**** Cost of the port engine with many ports on I2C expanders.
+Drives a table of 32 ports on two MCP23017 of the fake I2C bus. Switching a port must cost the
+same for the first and the last port, changing all 32 ports in one loop pass must write each
+expander once, the latches on the bus must match the port states, and timed pulses must end when
+they are due. A write to an expander that is gone from the bus must be retried after a backoff
+until it comes back.
+*/
+#include "../src/PortEngine.cpp"
+#include "Bench.h"
+
+static const uint8_t portCount = 32;
+
+static PortDescriptor benchPorts[portCount];
+static PortExpander benchExpanders[] = {
+    PortExpander(PortExpander::MCP23017, 0x20),
+    PortExpander(PortExpander::MCP23017, 0x21),
+};
+
+static PortEngine<portCount> engine(benchPorts, benchExpanders, 2, NULL);
+
+// ns per set() of one port
+static double setTime(uint8_t port) {
+    const uint32_t repeats = 100000;
+    uint64_t start = Bench::nanos();
+    for (uint32_t i = 0; i < repeats; i++)
+        engine.set(port, i & 1);
+    return (double)(Bench::nanos() - start) / repeats;
+}
+
+// ports whose level on the bus is not the one of their state
+static uint32_t latchMismatches() {
+    uint32_t mismatches = 0;
+    for (uint8_t i = 0; i < portCount; i++) {
+        const PortDescriptor &port = benchPorts[i];
+        const uint8_t *latch = NativeHal::i2c.registers[benchExpanders[port.expander].address];
+        uint16_t outputs = latch[PortExpander::mcpOLatA] | latch[PortExpander::mcpOLatA + 1] << 8;
+        bool level = outputs & (1 << port.pin);
+        if (level != (engine.isActive(i) != port.isActiveLow))
+            mismatches++;
+    }
+    return mismatches;
+}
+
+static void runPortBench() {
+    // every fourth port is timed, the rest toggle
+    for (uint8_t i = 0; i < portCount; i++)
+        benchPorts[i] = {(uint8_t)(i / 16), (uint8_t)(i % 16), i % 4 ? PORT_TOGGLE : PORT_TIMED, 1000u + i * 10, i % 2 == 0};
+    NativeHal::i2c.present[0x20] = true;
+    NativeHal::i2c.present[0x21] = true;
+    engine.begin();
+    engine.loop();
+
+    Bench::report("set port 1: host time", setTime(0), "ns");
+    Bench::report("set port 32: host time", setTime(portCount - 1), "ns");
+    for (uint8_t i = 0; i < portCount; i++)
+        engine.set(i, false);
+    engine.loop();
+
+    uint32_t transmissions = NativeHal::i2c.transmissions;
+    for (uint8_t i = 0; i < portCount; i++)
+        engine.set(i, true);
+    engine.loop();
+    Bench::report("32 ports in one pass: i2c writes", NativeHal::i2c.transmissions - transmissions, "", 2);
+    Bench::report("latch mismatches", latchMismatches(), "", 0);
+
+    // the timed ports end one by one, each pass writes only what changed
+    uint32_t late = 0;
+    for (uint32_t elapsed = 0; elapsed < 2000; elapsed += 10) {
+        NativeHal::advanceMillis(10);
+        engine.loop();
+        for (uint8_t i = 0; i < portCount; i += 4) {
+            bool isDue = elapsed + 10 >= benchPorts[i].pulseMs;
+            if (isDue && engine.isActive(i))
+                late++;
+        }
+    }
+    Bench::report("late pulses", late, "", 0);
+    Bench::report("latch mismatches after pulses", latchMismatches(), "", 0);
+    Bench::report("i2c failures", benchExpanders[0].failures + benchExpanders[1].failures, "", 0);
+
+    // the second expander drops off the bus for a second, its latch is written once it is back
+    NativeHal::i2c.present[0x21] = false;
+    for (uint8_t i = 16; i < portCount; i++)
+        engine.set(i, !engine.isActive(i));
+    transmissions = NativeHal::i2c.transmissions;
+    uint32_t busyPasses = 0;
+    for (uint32_t elapsed = 0; elapsed < 1000;) {
+        engine.loop();
+        uint32_t idle = min(engine.timeToNext(), (uint32_t)100);
+        busyPasses += idle == 0;
+        NativeHal::advanceMillis(idle ? idle : 1);
+        elapsed += idle ? idle : 1;
+    }
+    Bench::report("expander gone: passes without idle", busyPasses, "", 0);
+    Bench::report("expander gone: i2c writes", NativeHal::i2c.transmissions - transmissions, "", 10);
+    NativeHal::i2c.present[0x21] = true;
+    NativeHal::advanceMillis(benchExpanders[1].timeToNext());
+    engine.loop();
+    Bench::report("expander back: latch mismatches", latchMismatches(), "", 0);
+}
+
+static NativeHal::NativeBench portBench("ports", runPortBench);
@@ -0,0 +1,154 @@
+/**** Time from boot, or from a lost access point, until the broker is connected.
+Boots the firmware without the RTC cache, which scans and asks DHCP, then again with the cache
+of that association, then with a corrupted cache that must be rejected. The reconnect after the
+access point was lost uses the cache too. Times are on the virtual clock of the host build, with
+the association times of NativeHal::accessPoint. Every connect should cost the broker a single
+SUBSCRIBE. Sensor data published right before the access point or the broker goes away must
+still arrive once the device is back, and the uptime published offline must arrive before the
+uptime published once online. A flash that fills up while telemetry is queued loses messages,
+but the count of queued messages must stay exact, or live telemetry would go through flash.
+*/
+#include "../src/ConnectionManager.cpp"
+#include "../src/TelemetryQueue.cpp"
+#include "Bench.h"
+
+extern ConnectionManager connection;
+extern TelemetryQueue telemetryQueue;
+extern uint32_t bootToMqttMs;
+
+void publishSensorData();
+void publishUptime();
+
+static bool stepUntilOnline() {
+    for (uint32_t i = 0; i < 100000 && !connection.isConnected(); i++)
+        NativeHal::step();
+    return connection.isConnected();
+}
+
+// sensor data published since the last clear
+static uint32_t sensorMessages() {
+    const std::string topic = Bench::topic("/get/sensor_data");
+    uint32_t messages = 0;
+    for (const NativeHal::MqttMessage &message : NativeHal::broker.fromDevice)
+        messages += message.topic == topic;
+    return messages;
+}
+
+// uptime messages that arrived after a later one, since the last clear
+static uint32_t uptimesOutOfOrder() {
+    const std::string topic = Bench::topic("/uptime");
+    std::string last;
+    uint32_t inversions = 0;
+    for (const NativeHal::MqttMessage &message : NativeHal::broker.fromDevice) {
+        if (message.topic != topic)
+            continue;
+        // "d:hh:mm:ss" within the same day
+        inversions += message.payload.length() == last.length() && message.payload < last;
+        last = message.payload;
+    }
+    return inversions;
+}
+
+// boot again like after a reset, RTC memory keeps its content
+static void measureBoot(const char *name) {
+    uint32_t subscribePackets = NativeHal::broker.subscribePackets;
+    NativeHal::boot();
+    bool isOnline = stepUntilOnline();
+
+    char metric[64];
+    snprintf(metric, sizeof(metric), "%s: not online", name);
+    Bench::report(metric, isOnline ? 0 : 1, "", 0);
+    snprintf(metric, sizeof(metric), "%s: boot to MQTT", name);
+    Bench::report(metric, bootToMqttMs, "ms");
+    snprintf(metric, sizeof(metric), "%s: association", name);
+    Bench::report(metric, connection.associationMs, "ms");
+    // one wildcard subscription for all commands
+    snprintf(metric, sizeof(metric), "%s: subscribe packets", name);
+    Bench::report(metric, NativeHal::broker.subscribePackets - subscribePackets, "", 1);
+}
+
+static void runReconnectBench() {
+    Bench::online();
+
+    connection.wifiCache.invalidate();
+    measureBoot("cold boot");
+    uint32_t coldBootMs = bootToMqttMs;
+    Bench::report("cold boot: used cache", connection.isFastAssociation, "", 0);
+
+    measureBoot("cached boot");
+    Bench::report("cached boot: scanned", !connection.isFastAssociation, "", 0);
+    Bench::report("cached boot: boot to MQTT vs cold", 100.0 * bootToMqttMs / coldBootMs, "%", 75);
+
+    // a flipped bit in RTC memory
+    uint32_t block;
+    ESP.rtcUserMemoryRead(WiFiCache::rtcOffset + 1, &block, sizeof(block));
+    block ^= 0x10;
+    ESP.rtcUserMemoryWrite(WiFiCache::rtcOffset + 1, &block, sizeof(block));
+    measureBoot("corrupted cache");
+    Bench::report("corrupted cache: used cache", connection.isFastAssociation, "", 0);
+
+    // the access point goes away for a moment, right after sensor data was published
+    NativeHal::broker.fromDevice.clear();
+    publishSensorData();
+    NativeHal::accessPoint.available = false;
+    for (uint32_t i = 0; i < 100 && connection.isConnected(); i++)
+        NativeHal::step();
+    NativeHal::accessPoint.available = true;
+    bool isOnline = stepUntilOnline();
+    Bench::report("lost access point: not online", isOnline ? 0 : 1, "", 0);
+    Bench::report("lost access point: outage", connection.outageMs, "ms");
+    Bench::report("lost access point: scanned", !connection.isFastAssociation, "", 0);
+    for (uint32_t i = 0; i < 200; i++)
+        NativeHal::step();
+    Bench::report("lost access point: sensor data lost", 1 - min(sensorMessages(), 1u), "", 0);
+
+    // the broker goes away, the sensor data waits on flash
+    NativeHal::broker.fromDevice.clear();
+    publishSensorData();
+    NativeHal::broker.online = false;
+    for (uint32_t i = 0; i < 100 && connection.isConnected(); i++)
+        NativeHal::step();
+    NativeHal::broker.online = true;
+    isOnline = stepUntilOnline();
+    for (uint32_t i = 0; i < 200; i++)
+        NativeHal::step();
+    Bench::report("lost broker: not online", isOnline ? 0 : 1, "", 0);
+    Bench::report("lost broker: sensor data lost", 1 - min(sensorMessages(), 1u), "", 0);
+
+    // more uptimes wait on flash than a drain sends, a newer uptime published once online must not
+    // overtake them
+    NativeHal::broker.fromDevice.clear();
+    NativeHal::broker.online = false;
+    for (uint32_t i = 0; i < 100 && connection.isConnected(); i++)
+        NativeHal::step();
+    for (uint8_t i = 0; i < 8; i++) {
+        publishUptime();
+        NativeHal::advanceMillis(1000);
+    }
+    NativeHal::broker.online = true;
+    stepUntilOnline();
+    publishUptime();
+    for (uint32_t i = 0; i < 200; i++)
+        NativeHal::step();
+    Bench::report("lost broker: telemetry out of order", uptimesOutOfOrder(), "", 0);
+
+    // the flash fills up in the middle of a record while telemetry is queued
+    NativeHal::broker.online = false;
+    for (uint32_t i = 0; i < 100 && connection.isConnected(); i++)
+        NativeHal::step();
+    for (uint8_t i = 0; i < 8; i++) {
+        publishUptime();
+        NativeHal::advanceMillis(1000);
+    }
+    SPIFFS.writeLimit = 30;
+    telemetryQueue.flush();
+    SPIFFS.writeLimit = SIZE_MAX;
+    NativeHal::broker.online = true;
+    stepUntilOnline();
+    for (uint32_t i = 0; i < 200; i++)
+        NativeHal::step();
+    Bench::report("full flash: messages still counted", telemetryQueue.pending, "", 0);
+    Bench::report("full flash: queue not drained", !telemetryQueue.isEmpty(), "", 0);
+}
+
+static NativeHal::NativeBench reconnectBench("reconnect", runReconnectBench);
@@ -0,0 +1,108 @@
+/**** Local automation rules: their cost, and their reaction while the broker is down.
+Times the evaluation of a full rule set of the largest rules on the host, and checks that a rule
+set that does not compile leaves it running. Then programs the
+firmware over MQTT to switch port 2 on the temperature, takes the network down and changes the
+temperature: the port must follow within the sensor read, without the broker. Rules read the
+filtered temperature, so the filter is turned off for the step to cross in one sample.
+*/
+#include "../src/RuleEngine.cpp"
+#include "Bench.h"
+
+void getSensorData();
+
+static const uint8_t portPin = 5;
+
+static bool readBenchVariable(RuleEngine::Variable variable, uint8_t index, int32_t &value) {
+    value = variable == RuleEngine::VAR_TEMP ? 2500 : index & 1;
+    return true;
+}
+
+static uint32_t benchCommands = 0;
+
+static bool runBenchCommand(uint8_t rule, const char *name, const char *payload) {
+    benchCommands++;
+    return true;
+}
+
+// host time of one event that evaluates 16 rules of 5 terms each
+static void measureEvaluation() {
+    std::string text;
+    for (uint8_t i = 0; i < RuleEngine::maxRules; i++)
+        text += "when temp > 30 and input1 or port2 and not input2 or hum >= 99.5 do beeper beep;";
+
+    RuleEngine engine("/bench_rules.bin", 2, 2, readBenchVariable, runBenchCommand);
+    bool isCompiled = engine.compile(text.c_str(), text.length());
+    if (!isCompiled)
+        printf("rule %u: %s\n", engine.errorRule, engine.error);
+    Bench::report("16 rules: compile errors", !isCompiled, "", 0);
+    Bench::report("16 rules: code bytes", engine.program.length, "bytes");
+
+    const uint32_t repeats = 10000;
+    uint64_t start = Bench::nanos();
+    for (uint32_t i = 0; i < repeats; i++)
+        engine.notify(RuleEngine::SOURCE_ALL);
+    uint64_t elapsed = Bench::nanos() - start;
+    Bench::report("16 rules: host time per event", elapsed / 1000.0 / repeats, "us");
+    Bench::report("16 rules: evaluations per event", (double)engine.evaluations / repeats, "", RuleEngine::maxRules);
+
+    // a rule set that does not compile leaves the running rules and their hits
+    uint32_t hits = engine.hits[0];
+    bool isRejected = !engine.compile("when temp > 30 do beeper beep; when bogus do ping ping", 54);
+    bool isKept = engine.program.count == RuleEngine::maxRules && engine.hits[0] == hits;
+    Bench::report("invalid rules: not rejected", !isRejected, "", 0);
+    Bench::report("invalid rules: running rules lost", !isKept, "", 0);
+}
+
+// set the temperature and read the sensor, returns the device time until port 2 switched to the level
+static double react(float temperature, uint8_t level) {
+    // a sample is reused for 2 s
+    NativeHal::advanceMillis(2100);
+    NativeHal::dht.temperature = temperature;
+
+    uint64_t start = micros();
+    getSensorData();
+    for (uint32_t i = 0; i < 100 && NativeHal::outputLevel(portPin) != level; i++)
+        NativeHal::step();
+    if (NativeHal::outputLevel(portPin) != level)
+        return -1;
+    return (NativeHal::outputChangeUs(portPin) - start) / 1000.0;
+}
+
+static void runRuleBench() {
+    measureEvaluation();
+
+    Bench::online();
+    NativeHal::broker.inject(Bench::topic("/set/sensors"), "temp median 1 ema 100");
+    Bench::stepUntilPublished(Bench::topic("/get/sensors").c_str());
+    NativeHal::broker.inject(Bench::topic("/set/rules"), "when temp > 30 do port2 close\nwhen temp < 28 do port2 open");
+    const NativeHal::MqttMessage *reply = Bench::stepUntilPublished(Bench::topic("/get/rules").c_str());
+    if (reply)
+        printf("rules reply: %s\n", reply->payload.c_str());
+    Bench::report("rules: not accepted", !reply || reply->payload.find("\"rules\":2") == std::string::npos, "", 0);
+
+    NativeHal::accessPoint.available = false;
+    NativeHal::broker.online = false;
+    for (uint32_t i = 0; i < 10; i++)
+        NativeHal::step();
+
+    // the periodic samples of 23.1 C opened port 2 as soon as the rules were set
+    uint32_t missed = 0;
+    double worst = 0;
+    for (uint8_t i = 0; i < 10; i++) {
+        double reaction = react(i % 2 ? 20 : 35, i % 2 ? HIGH : LOW);
+        missed += reaction < 0;
+        worst = max(worst, reaction);
+    }
+    Bench::report("offline: reactions missed", missed, "", 0);
+    Bench::report("offline: worst sensor read to port", worst, "ms", 20);
+
+    NativeHal::dht.temperature = 23.1f;
+    Bench::online();
+    NativeHal::broker.inject(Bench::topic("/set/rules"), "clear");
+    Bench::stepUntilPublished(Bench::topic("/get/rules").c_str());
+    NativeHal::broker.inject(Bench::topic("/set/sensors"), "defaults");
+    Bench::stepUntilPublished(Bench::topic("/get/sensors").c_str());
+    NativeHal::broker.fromDevice.clear();
+}
+
+static NativeHal::NativeBench ruleBench("rules", runRuleBench);
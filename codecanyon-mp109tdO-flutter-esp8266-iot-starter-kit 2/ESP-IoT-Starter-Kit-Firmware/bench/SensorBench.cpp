@@ -0,0 +1,99 @@
+/**** Sensor reports of a stable room, and how fast they catch a real change.
+The DHT22 reads a steady room with a tenth of a degree of noise and the odd bad reading of 3
+degrees too much. Over 3 hours the device must send far fewer reports than the fixed 5 minute
+period did. Then the room warms by a degree at once, and a report must show it within a few
+samples. Last, the settings are changed over MQTT, and rejected for an unknown setting.
+*/
+#include "../src/SensorPipeline.cpp"
+#include "Bench.h"
+
+static uint32_t noise = 12345;
+
+// the next read of the sensor, around the temperature of the room
+static void nextReading(float room) {
+    noise = noise * 1103515245 + 12345;
+    uint32_t random = noise >> 16;
+    float temperature = room + ((int32_t)(random % 3) - 1) * 0.1f;
+    if (NativeHal::dht.reads % 50 == 0)
+        temperature += 3;
+    NativeHal::dht.temperature = temperature;
+    NativeHal::dht.humidity = 45.2f + ((int32_t)(random / 3 % 5) - 2) * 0.1f;
+}
+
+// run the firmware for a time, with a new reading for every sample, returns the sensor reports
+static uint32_t runRoom(float room, uint64_t lengthUs, const std::string &topic) {
+    uint32_t reports = 0;
+    uint32_t reads = NativeHal::dht.reads;
+    uint64_t end = micros() + lengthUs;
+    while (micros() < end) {
+        NativeHal::step();
+        if (NativeHal::dht.reads != reads) {
+            reads = NativeHal::dht.reads;
+            nextReading(room);
+        }
+        for (const NativeHal::MqttMessage &message : NativeHal::broker.fromDevice)
+            reports += message.topic == topic;
+        NativeHal::broker.fromDevice.clear();
+    }
+    return reports;
+}
+
+static void runSensorBench() {
+    Bench::online();
+    const std::string dataTopic = Bench::topic("/get/sensor_data");
+
+    // settle the filters on the room first
+    runRoom(23.1f, 60 * 1000000ULL, dataTopic);
+
+    uint32_t reports = runRoom(23.1f, 3 * 3600 * 1000000ULL, dataTopic);
+    Bench::report("stable room, 3 hours: reports", reports, "", 36 / 10.0);
+    Bench::report("stable room, 3 hours: fixed 5 minute period", 36, "");
+
+    // a degree warmer, until a report shows at least half of it
+    nextReading(24.1f);
+    uint64_t start = micros();
+    double reaction = -1;
+    uint32_t reads = NativeHal::dht.reads;
+    while (reaction < 0 && micros() - start < 300 * 1000000ULL) {
+        NativeHal::step();
+        if (NativeHal::dht.reads != reads) {
+            reads = NativeHal::dht.reads;
+            nextReading(24.1f);
+        }
+        for (const NativeHal::MqttMessage &message : NativeHal::broker.fromDevice) {
+            if (message.topic == dataTopic && atof(message.payload.c_str() + message.payload.find("\"Temp\":\"") + 8) >= 23.6)
+                reaction = (micros() - start) / 1000000.0;
+        }
+        NativeHal::broker.fromDevice.clear();
+    }
+    Bench::report("one degree warmer: time to report", reaction < 0 ? 300 : reaction, "s", 30);
+
+    // settings over MQTT, all taken or none
+    const std::string settingsTopic = Bench::topic("/get/sensors");
+    NativeHal::broker.inject(Bench::topic("/set/sensors"), "dht period 5 interval 600, temp deadband 0.5 ema 30");
+    const NativeHal::MqttMessage *reply = Bench::stepUntilPublished(settingsTopic.c_str());
+    if (reply)
+        printf("sensors reply: %s\n", reply->payload.c_str());
+    bool isTaken = reply && reply->payload.find("\"period\":5,\"interval\":600") != std::string::npos &&
+                   reply->payload.find("\"ema\":30,\"deadband\":0.50") != std::string::npos;
+    NativeHal::broker.fromDevice.clear();
+
+    NativeHal::broker.inject(Bench::topic("/set/sensors"), "dht period 20, temp colour 3");
+    reply = Bench::stepUntilPublished(settingsTopic.c_str());
+    bool isRejected = reply && reply->payload == "{\"error\":\"unknown setting\"}";
+    NativeHal::broker.fromDevice.clear();
+
+    NativeHal::broker.inject(Bench::topic("/set/sensors"), "sensors");
+    reply = Bench::stepUntilPublished(settingsTopic.c_str());
+    isRejected = isRejected && reply && reply->payload.find("\"period\":5,") != std::string::npos;
+    Bench::report("settings: not taken", !isTaken, "", 0);
+    Bench::report("settings: invalid taken", !isRejected, "", 0);
+
+    NativeHal::broker.inject(Bench::topic("/set/sensors"), "defaults");
+    Bench::stepUntilPublished(settingsTopic.c_str());
+    NativeHal::broker.fromDevice.clear();
+    NativeHal::dht.temperature = 23.1f;
+    NativeHal::dht.humidity = 45.2f;
+}
+
+static NativeHal::NativeBench sensorBench("sensors", runSensorBench);
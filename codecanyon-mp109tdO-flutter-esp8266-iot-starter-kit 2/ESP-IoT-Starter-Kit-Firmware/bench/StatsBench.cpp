@@ -0,0 +1,117 @@
+/**** Window statistics: their accuracy, their cost, and the spikes they catch.
+The streaming mean, deviation and percentiles of noisy room temperatures with the odd spike are
+compared with the exact values of the stored and sorted samples. Then the firmware samples a
+steady room at the native rate of the DHT22 for 30 minutes with a 4 second spike in it: it must
+send one statistics record per 5 minute window, the rate of the old fixed period, and the record
+of the spike must show it.
+*/
+#include "../src/WindowStats.cpp"
+#include "Bench.h"
+
+#include <algorithm>
+#include <vector>
+
+static uint32_t noise = 54321;
+
+// room temperatures around 23, noise of about 0.3 C and a spike of 3 degrees every 100th sample
+static float nextSample(uint32_t i) {
+    float sum = 0;
+    for (uint8_t k = 0; k < 3; k++) {
+        noise = noise * 1103515245 + 12345;
+        sum += (noise >> 16) % 1000 / 1000.0f;
+    }
+    return 23 + (sum - 1.5f) * 0.6f + (i % 100 == 0 ? 3 : 0);
+}
+
+// the temperature after "Temp":{ in a statistics record, NAN without it
+static float recordValue(const std::string &payload, const char *key) {
+    size_t sensor = payload.find("\"Temp\":{");
+    if (sensor == std::string::npos)
+        return NAN;
+    size_t value = payload.find(key, sensor);
+    return value == std::string::npos ? NAN : atof(payload.c_str() + value + strlen(key));
+}
+
+static void runStatsBench() {
+    // accuracy against the exact values
+    const uint32_t count = 10000;
+    std::vector<float> samples;
+    WindowStats stats;
+    for (uint32_t i = 0; i < count; i++) {
+        float sample = nextSample(i);
+        samples.push_back(sample);
+        stats.add(sample);
+    }
+
+    double sum = 0;
+    for (float sample : samples)
+        sum += sample;
+    double mean = sum / count;
+    double squares = 0;
+    for (float sample : samples)
+        squares += (sample - mean) * (sample - mean);
+    double deviation = sqrt(squares / (count - 1));
+
+    std::sort(samples.begin(), samples.end());
+    double median = samples[(count - 1) / 2];
+    double high = samples[(uint32_t)lround((count - 1) * 0.95)];
+
+    Bench::report("10000 samples: mean error", fabs(stats.mean - mean) * 1000, "mC", 1);
+    Bench::report("10000 samples: deviation error", fabs(stats.deviation() - deviation) * 1000, "mC", 1);
+    Bench::report("10000 samples: p50 error", fabs(stats.median.value() - median) * 1000, "mC", 20);
+    Bench::report("10000 samples: p95 error", fabs(stats.high.value() - high) * 1000, "mC", 50);
+    Bench::report("10000 samples: max", stats.maximum, "C");
+    Bench::report("statistics: memory", sizeof(WindowStats), "bytes", 128);
+
+    // the cost of a sample
+    stats.reset();
+    uint32_t allocations = Bench::allocations();
+    uint64_t start = Bench::nanos();
+    for (uint32_t i = 0; i < count; i++)
+        stats.add(23 + (i % 37) * 0.01f);
+    Bench::report("add: host time", (Bench::nanos() - start) / (double)count, "ns");
+    Bench::report("add: allocations", Bench::allocations() - allocations, "", 0);
+
+    // the firmware, from the end of a window
+    Bench::online();
+    const std::string statsTopic = Bench::topic("/get/sensor_stats");
+    NativeHal::dht.temperature = 23.1f;
+    NativeHal::dht.humidity = 45.2f;
+    const NativeHal::MqttMessage *record = Bench::stepUntilPublished(statsTopic.c_str(), 100000);
+    Bench::report("first window: missing", !record, "", 0);
+    NativeHal::broker.fromDevice.clear();
+
+    uint32_t records = 0;
+    uint32_t windowSamples = 0;
+    float spikeMax = NAN;
+    uint32_t spikeReads = 0;
+    start = micros();
+    while (micros() - start < (30 * 60 + 5) * 1000000ULL) {
+        // two samples of 30 C, 2 minutes into the first window
+        if (micros() - start >= 120 * 1000000ULL && spikeReads == 0) {
+            NativeHal::dht.temperature = 30;
+            spikeReads = NativeHal::dht.reads;
+        }
+        if (spikeReads > 0 && NativeHal::dht.reads >= spikeReads + 2)
+            NativeHal::dht.temperature = 23.1f;
+
+        NativeHal::step();
+        for (const NativeHal::MqttMessage &message : NativeHal::broker.fromDevice) {
+            if (message.topic != statsTopic)
+                continue;
+            if (records++ == 0) {
+                printf("stats record: %s\n", message.payload.c_str());
+                spikeMax = recordValue(message.payload, "\"max\":");
+                windowSamples = recordValue(message.payload, "\"n\":");
+            }
+        }
+        NativeHal::broker.fromDevice.clear();
+    }
+
+    Bench::report("30 minutes: records", records, "", 6);
+    Bench::report("30 minutes: fixed 5 minute period", 6, "");
+    Bench::report("record: samples", windowSamples, "");
+    Bench::report("4 second spike: missing from the record", !(spikeMax >= 29.9f), "", 0);
+}
+
+static NativeHal::NativeBench statsBench("stats", runStatsBench);
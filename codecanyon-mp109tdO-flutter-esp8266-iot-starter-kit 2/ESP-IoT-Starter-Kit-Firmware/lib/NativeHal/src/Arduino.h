@@ -0,0 +1,179 @@
+/**** Host build of the Arduino core used by the firmware.
+Only what the firmware sources use is provided. Time is simulated: `millis()`, `micros()` and
+`gettimeofday()` follow a virtual clock that `delay()` advances instantly, so hours of device time run in
+milliseconds of host time. `ESP.getCycleCount()` is the exception and reads the host monotonic
+clock in nanoseconds, which is what the timing code in the firmware measures on the host.
+See NativeHal.h for the controls the benchmarks use to drive pins, WiFi and the MQTT broker.
+*/
+#ifndef NATIVE_HAL_ARDUINO_H
+#define NATIVE_HAL_ARDUINO_H
+
+#include <ctype.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+
+#include "Print.h"
+#include "WString.h"
+
+typedef uint8_t byte;
+typedef bool boolean;
+typedef unsigned int word;
+
+#define HIGH 0x1
+#define LOW 0x0
+
+#define INPUT 0x00
+#define INPUT_PULLUP 0x02
+#define OUTPUT 0x01
+
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+
+#define IRAM_ATTR
+#define ICACHE_RAM_ATTR
+#define ICACHE_FLASH_ATTR
+#define PROGMEM
+#define PSTR(s) (s)
+#define F(s) (reinterpret_cast<const __FlashStringHelper *>(PSTR(s)))
+#define FPSTR(p) (reinterpret_cast<const __FlashStringHelper *>(p))
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t *)(addr))
+#define strlen_P strlen
+#define strcmp_P strcmp
+#define memcpy_P memcpy
+
+#define digitalPinToInterrupt(pin) (pin)
+#define NOT_AN_INTERRUPT -1
+
+using std::max;
+using std::min;
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+// sketch entry points, implemented by the firmware
+void setup();
+void loop();
+
+unsigned long millis();
+unsigned long micros();
+uint64_t micros64();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+void analogWrite(uint8_t pin, int value);
+void analogWriteRange(uint32_t range);
+void analogWriteFreq(uint32_t freq);
+
+void attachInterrupt(uint8_t pin, std::function<void(void)> handler, int mode);
+void attachInterruptArg(uint8_t pin, void (*handler)(void *), void *arg, int mode);
+void detachInterrupt(uint8_t pin);
+void interrupts();
+void noInterrupts();
+
+// timer0, the compare interrupt of the cycle counter; the cycle counter is host time, so the
+// interrupt fires when the virtual clock has passed the cycles from the write to the compare value,
+// and again on every wrap of the counter until it is written or detached
+typedef void (*timercallback)(void);
+void timer0_isr_init();
+void timer0_attachInterrupt(timercallback userFunc);
+void timer0_detachInterrupt();
+void timer0_write(uint32_t count);
+
+long random(long howbig);
+long random(long howsmall, long howbig);
+void randomSeed(unsigned long seed);
+
+inline bool isDigit(int c) {
+    return isdigit(c) != 0;
+}
+
+inline bool isAlpha(int c) {
+    return isalpha(c) != 0;
+}
+
+inline bool isSpace(int c) {
+    return isspace(c) != 0;
+}
+
+char *dtostrf(double number, signed char width, unsigned char prec, char *s);
+
+// the SNTP client of the core, answered by NativeHal::sntp, the offsets are not supported
+void configTime(int timezone, int daylightOffset_sec, const char *server1, const char *server2 = nullptr,
+                const char *server3 = nullptr);
+
+// the system time, set by the simulated SNTP server and counted on the virtual clock
+int nativeGettimeofday(struct timeval *tv, void *tz);
+#define gettimeofday nativeGettimeofday
+
+// in the newlib of the core, glibc has it only from 2.38
+#if defined(__GLIBC__) && (__GLIBC__ < 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ < 38))
+extern "C" size_t strlcpy(char *dst, const char *src, size_t size);
+#endif
+
+class HardwareSerial : public Stream {
+  public:
+    void begin(unsigned long baud) { (void)baud; }
+    void end() {}
+
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+
+    using Print::write;
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t *buffer, size_t size) override;
+
+    operator bool() const { return true; }
+};
+
+extern HardwareSerial Serial;
+
+enum RFMode { RF_DEFAULT = 0, RF_CAL = 1, RF_NO_CAL = 2, RF_DISABLED = 4 };
+
+#define WAKE_RF_DEFAULT RF_DEFAULT
+#define WAKE_RFCAL RF_CAL
+#define WAKE_NO_RFCAL RF_NO_CAL
+#define WAKE_RF_DISABLED RF_DISABLED
+
+class EspClass {
+  public:
+    // host monotonic clock in nanoseconds, truncated like the 32-bit cycle counter
+    uint32_t getCycleCount();
+    // the cycle counter ticks once per nanosecond, so cycle to time conversions stay right
+    uint16_t getCpuFreqMHz() { return 1000; }
+
+    uint32_t getChipId() { return 0x00c0ffee; }
+    uint32_t getFreeHeap();
+    uint32_t getMaxFreeBlockSize();
+    uint8_t getHeapFragmentation();
+
+    void restart();
+    void reset() { restart(); }
+    void deepSleep(uint64_t timeUs, RFMode mode = RF_DEFAULT);
+    uint64_t deepSleepMax() { return 0x0000000fffffffffULL; }
+
+    bool rtcUserMemoryRead(uint32_t offset, uint32_t *data, size_t size);
+    bool rtcUserMemoryWrite(uint32_t offset, uint32_t *data, size_t size);
+
+    String getResetReason();
+};
+
+extern EspClass ESP;
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef NATIVE_HAL_EEPROM_H
+#define NATIVE_HAL_EEPROM_H
+
+#include <Arduino.h>
+
+// EEPROM emulation like the ESP8266 core: begin() copies the flash sector into a RAM buffer that
+// is allocated on the heap, commit() writes it back, the sector survives a restart
+class EEPROMClass {
+  public:
+    void begin(size_t size);
+    bool commit();
+    bool end();
+
+    uint8_t read(int address) { return address >= 0 && (size_t)address < size ? data[address] : 0; }
+    void write(int address, uint8_t value);
+
+    uint8_t *getDataPtr() {
+        isDirty = true;
+        return data;
+    }
+
+    const uint8_t *getConstDataPtr() const { return data; }
+    size_t length() const { return size; }
+
+  private:
+    uint8_t *data = nullptr;
+    size_t size = 0;
+    bool isDirty = false;
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef NATIVE_HAL_ESP8266WIFI_H
+#define NATIVE_HAL_ESP8266WIFI_H
+
+#include <Arduino.h>
+
+#include "IPAddress.h"
+#include "WiFiClient.h"
+
+typedef enum {
+    WL_NO_SHIELD = 255,
+    WL_IDLE_STATUS = 0,
+    WL_NO_SSID_AVAIL = 1,
+    WL_SCAN_COMPLETED = 2,
+    WL_CONNECTED = 3,
+    WL_CONNECT_FAILED = 4,
+    WL_CONNECTION_LOST = 5,
+    WL_WRONG_PASSWORD = 6,
+    WL_DISCONNECTED = 7
+} wl_status_t;
+
+typedef enum { WIFI_OFF = 0, WIFI_STA = 1, WIFI_AP = 2, WIFI_AP_STA = 3 } WiFiMode_t;
+typedef enum { WIFI_NONE_SLEEP = 0, WIFI_LIGHT_SLEEP = 1, WIFI_MODEM_SLEEP = 2 } WiFiSleepType_t;
+
+// station side of the simulated access point in NativeHal::accessPoint
+class ESP8266WiFiClass {
+  public:
+    bool mode(WiFiMode_t mode);
+    WiFiMode_t getMode() { return wifiMode; }
+    bool enableAP(bool enable) {
+        (void)enable;
+        return true;
+    }
+    bool setSleepMode(WiFiSleepType_t type, uint8_t listenInterval = 0) {
+        (void)listenInterval;
+        sleepType = type;
+        return true;
+    }
+    WiFiSleepType_t getSleepMode() { return sleepType; }
+    bool setAutoReconnect(bool autoReconnect) {
+        (void)autoReconnect;
+        return true;
+    }
+    void persistent(bool persistent) { (void)persistent; }
+    bool forceSleepBegin() {
+        wifiMode = WIFI_OFF;
+        return true;
+    }
+    bool forceSleepWake() { return true; }
+
+    wl_status_t begin();
+    wl_status_t begin(const char *ssid, const char *passphrase = NULL, int32_t channel = 0,
+                      const uint8_t *bssid = NULL, bool connect = true);
+    bool config(IPAddress localIP, IPAddress gateway, IPAddress subnet, IPAddress dns1 = (uint32_t)0,
+                IPAddress dns2 = (uint32_t)0);
+    bool disconnect(bool wifioff = false);
+    bool reconnect() { return begin() != WL_CONNECT_FAILED; }
+    wl_status_t status();
+    bool isConnected() { return status() == WL_CONNECTED; }
+
+    String SSID() const { return String(ssid); }
+    String psk() const { return String(passphrase); }
+    uint8_t *BSSID() { return bssid; }
+    String BSSIDstr() const { return String("02:00:00:00:00:01"); }
+    int32_t channel() { return 6; }
+    int32_t RSSI() { return -60; }
+
+    IPAddress localIP();
+    IPAddress gatewayIP() { return IPAddress(192, 168, 1, 1); }
+    IPAddress subnetMask() { return IPAddress(255, 255, 255, 0); }
+    IPAddress dnsIP(uint8_t index = 0) {
+        (void)index;
+        return IPAddress(192, 168, 1, 1);
+    }
+    IPAddress softAPIP() { return IPAddress(192, 168, 4, 1); }
+
+    String macAddress() { return String("5C:CF:7F:12:34:56"); }
+    uint8_t *macAddress(uint8_t *mac);
+    bool hostname(const String &name) {
+        hostName = name;
+        return true;
+    }
+    String hostname() { return hostName; }
+
+    int hostByName(const char *host, IPAddress &result) { return hostByName(host, result, 10000); }
+    int hostByName(const char *host, IPAddress &result, uint32_t timeout_ms);
+
+  private:
+    WiFiMode_t wifiMode = WIFI_STA;
+    WiFiSleepType_t sleepType = WIFI_MODEM_SLEEP;
+    wl_status_t wifiStatus = WL_DISCONNECTED;
+    uint64_t connectedAtUs = 0;
+    bool staticIP = false;
+    uint32_t localAddress = 0;
+    char ssid[33] = "native";
+    char passphrase[65] = "native";
+    uint8_t bssid[6] = {0x02, 0, 0, 0, 0, 0x01};
+    String hostName;
+};
+
+extern ESP8266WiFiClass WiFi;
+
+#endif
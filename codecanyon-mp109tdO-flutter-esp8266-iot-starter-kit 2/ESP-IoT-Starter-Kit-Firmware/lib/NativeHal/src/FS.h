@@ -0,0 +1,105 @@
+/**** SPIFFS on a host directory.
+The directory is $NATIVE_FS_ROOT if set, otherwise a fresh temporary directory per run, removed
+when the run exits.
+*/
+#ifndef NATIVE_HAL_FS_H
+#define NATIVE_HAL_FS_H
+
+#include <Arduino.h>
+
+#include <string>
+#include <vector>
+
+namespace fs {
+
+enum SeekMode { SeekSet = 0, SeekCur = 1, SeekEnd = 2 };
+
+class File : public Stream {
+  public:
+    File() : file(NULL) {}
+    File(FILE *file, const std::string &path) : file(file), path(path) {}
+
+    using Print::write;
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t *buffer, size_t size) override;
+    int available() override;
+    int read() override;
+    int peek() override;
+    size_t read(uint8_t *buffer, size_t size);
+    size_t readBytes(char *buffer, size_t length) override { return read((uint8_t *)buffer, length); }
+    void flush() override;
+    bool seek(uint32_t pos, SeekMode mode = SeekSet);
+    size_t position() const;
+    size_t size() const;
+    void close();
+    const char *name() const { return path.c_str(); }
+    operator bool() const { return file != NULL; }
+
+  private:
+    FILE *file;
+    std::string path;
+};
+
+class Dir {
+  public:
+    Dir() {}
+    Dir(const std::string &root, const std::string &prefix);
+
+    bool next();
+    String fileName() const { return String(current.c_str()); }
+    size_t fileSize() const;
+    File openFile(const char *mode);
+
+  private:
+    std::string root;
+    std::vector<std::string> entries;
+    size_t index = 0;
+    std::string current;
+};
+
+struct FSInfo {
+    size_t totalBytes;
+    size_t usedBytes;
+    size_t blockSize;
+    size_t pageSize;
+    size_t maxOpenFiles;
+    size_t maxPathLength;
+};
+
+class FS {
+  public:
+    bool begin();
+    void end() {}
+    bool format();
+    bool info(FSInfo &info);
+
+    File open(const char *path, const char *mode);
+    File open(const String &path, const char *mode) { return open(path.c_str(), mode); }
+    bool exists(const char *path);
+    bool exists(const String &path) { return exists(path.c_str()); }
+    bool remove(const char *path);
+    bool remove(const String &path) { return remove(path.c_str()); }
+    bool rename(const char *from, const char *to);
+    Dir openDir(const char *path);
+    Dir openDir(const String &path) { return openDir(path.c_str()); }
+
+    std::string hostPath(const char *path);
+
+    // host only: files opened so far, and the bytes writes may still take, for the benchmarks
+    uint32_t opens = 0;
+    size_t writeLimit = SIZE_MAX;
+};
+
+}  // namespace fs
+
+using fs::Dir;
+using fs::File;
+using fs::FS;
+using fs::FSInfo;
+using fs::SeekCur;
+using fs::SeekEnd;
+using fs::SeekSet;
+
+extern fs::FS SPIFFS;
+
+#endif
@@ -0,0 +1,1377 @@
+/**** Simulated hardware of the host build: clock, pins, heap counters, WiFi, the loopback MQTT
+broker, SPIFFS on a host directory, and the stand-ins of the third party libraries.
+*/
+#include "NativeHal.h"
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <ESP8266WiFi.h>
+#include <FS.h>
+#include <PubSubClient.h>
+#include <Ticker.h>
+#include <WiFiManager.h>
+#include <Wire.h>
+#include <coredecls.h>
+#include <dirent.h>
+#include <malloc.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <map>
+
+// ==========================================================
+// heap counters, the native environment links with --wrap for these four symbols
+extern "C" {
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+// the allocation tracer of the firmware, see src/HeapTracer.cpp
+void heapTraceAllocation(void *ptr, size_t size) __attribute__((weak));
+void heapTraceReallocation(void *ptr, void *result, size_t size) __attribute__((weak));
+void heapTraceFree(void *ptr) __attribute__((weak));
+}
+
+static NativeHal::HeapCounters heap;
+
+// allocations of the simulation itself, like the messages kept by the broker, are not counted
+// as firmware allocations, their bytes still count against the simulated heap
+static int uncountedDepth = 0;
+
+struct Uncounted {
+    Uncounted() { uncountedDepth++; }
+    ~Uncounted() { uncountedDepth--; }
+};
+
+static void countAllocation(void *ptr) {
+    if (!ptr)
+        return;
+    if (uncountedDepth == 0)
+        heap.allocations++;
+    heap.liveBytes += malloc_usable_size(ptr);
+    if (heap.liveBytes > heap.peakBytes)
+        heap.peakBytes = heap.liveBytes;
+}
+
+static void countFree(void *ptr) {
+    if (!ptr)
+        return;
+    heap.frees++;
+    heap.liveBytes -= malloc_usable_size(ptr);
+}
+
+// these replace the weak wrappers of the tracer, so they pass the firmware allocations on to it
+extern "C" void *__wrap_malloc(size_t size) {
+    void *ptr = __real_malloc(size);
+    countAllocation(ptr);
+    if (heapTraceAllocation && uncountedDepth == 0)
+        heapTraceAllocation(ptr, size);
+    return ptr;
+}
+
+extern "C" void *__wrap_calloc(size_t count, size_t size) {
+    void *ptr = __real_calloc(count, size);
+    countAllocation(ptr);
+    if (heapTraceAllocation && uncountedDepth == 0)
+        heapTraceAllocation(ptr, count * size);
+    return ptr;
+}
+
+extern "C" void *__wrap_realloc(void *ptr, size_t size) {
+    countFree(ptr);
+    void *result = __real_realloc(ptr, size);
+    countAllocation(result ? result : ptr);
+    if (heapTraceReallocation && result)
+        heapTraceReallocation(ptr, result, size);
+    return result;
+}
+
+extern "C" void __wrap_free(void *ptr) {
+    countFree(ptr);
+    if (heapTraceFree)
+        heapTraceFree(ptr);
+    __real_free(ptr);
+}
+
+// route C++ allocations through the wrapped malloc as well
+void *operator new(size_t size) {
+    return malloc(size ? size : 1);
+}
+
+void *operator new[](size_t size) {
+    return malloc(size ? size : 1);
+}
+
+void operator delete(void *ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+    free(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept {
+    free(ptr);
+}
+
+namespace NativeHal {
+
+HeapCounters heapCounters() {
+    return heap;
+}
+
+void resetHeapPeak() {
+    heap.peakBytes = heap.liveBytes;
+}
+
+FakeAccessPoint accessPoint;
+FakeBroker broker;
+FakeSntp sntp;
+FakeDht dht;
+FakeI2c i2c;
+
+static uint64_t nowUs = 0;
+
+static void passTime(uint64_t us);
+
+void advanceMicros(uint64_t us) {
+    passTime(us);
+}
+
+void advanceMillis(uint32_t ms) {
+    passTime((uint64_t)ms * 1000);
+}
+
+// ==========================================================
+// pins and interrupts
+struct PinState {
+    uint8_t mode = INPUT;
+    uint8_t level = HIGH;
+    int analog = 0;
+    uint32_t writes = 0;
+    uint64_t changeUs = 0;
+    std::function<void(void)> isr;
+    int isrMode = 0;
+};
+
+static PinState pins[17];
+static std::vector<uint64_t> *outputTraces[17];
+
+void traceOutput(uint8_t pin, std::vector<uint64_t> *edges) {
+    if (pin < 17)
+        outputTraces[pin] = edges;
+}
+
+void setInput(uint8_t pin, uint8_t level) {
+    if (pin >= 17)
+        return;
+    PinState &state = pins[pin];
+    uint8_t previous = state.level;
+    state.level = level ? HIGH : LOW;
+
+    if (!state.isr || previous == state.level)
+        return;
+
+    bool rising = state.level == HIGH;
+    if (state.isrMode == CHANGE || (state.isrMode == RISING && rising) || (state.isrMode == FALLING && !rising))
+        state.isr();
+}
+
+// input levels driven by the simulated devices, applied as the clock passes their time
+struct PinEvent {
+    uint64_t timeUs;
+    uint8_t pin;
+    uint8_t level;
+};
+
+static std::deque<PinEvent> pinEvents;
+
+void scheduleInput(uint8_t pin, uint8_t level, uint64_t delayUs) {
+    Uncounted uncounted;
+    PinEvent event{nowUs + delayUs, pin, level};
+    auto position = pinEvents.end();
+    while (position != pinEvents.begin() && (position - 1)->timeUs > event.timeUs)
+        position--;
+    pinEvents.insert(position, event);
+}
+
+// the server time runs slower than the virtual clock by the drift, the remainder of the division is
+// carried so short steps do not lose it
+static int64_t driftRemainder = 0;
+
+// timer0, armed for a time of the virtual clock
+static timercallback timer0Callback = NULL;
+static bool isTimer0Armed = false;
+static uint64_t timer0DueUs = 0;
+
+static void passTime(uint64_t us) {
+    int64_t skew = (int64_t)us * sntp.driftPpm + driftRemainder;
+    sntp.timeUs += us - skew / 1000000;
+    driftRemainder = skew % 1000000;
+
+    uint64_t target = nowUs + us;
+    for (;;) {
+        uint64_t pinTime = pinEvents.empty() ? UINT64_MAX : pinEvents.front().timeUs;
+        uint64_t timerTime = isTimer0Armed && timer0Callback ? max(timer0DueUs, nowUs) : UINT64_MAX;
+        if (min(pinTime, timerTime) > target)
+            break;
+
+        if (timerTime <= pinTime) {
+            // the compare stays armed, it matches again once the cycle counter wraps
+            nowUs = timerTime;
+            timer0DueUs = timerTime + (((uint64_t)1 << 32) + ESP.getCpuFreqMHz() - 1) / ESP.getCpuFreqMHz();
+            timer0Callback();
+            continue;
+        }
+
+        PinEvent event = pinEvents.front();
+        pinEvents.pop_front();
+        nowUs = event.timeUs;
+        setInput(event.pin, event.level);
+    }
+    nowUs = target;
+}
+
+// the DHT22 answers 30 us after the line is released: 80 us low, 80 us high, then every bit as
+// 50 us low and 27 us (0) or 70 us (1) high, and a last 50 us low
+static void answerDht() {
+    Uncounted uncounted;
+    dht.reads++;
+    if (dht.fail)
+        return;
+
+    uint16_t humidity = (uint16_t)lroundf(dht.humidity * 10);
+    uint16_t temperature = (uint16_t)lroundf(fabsf(dht.temperature) * 10) | (dht.temperature < 0 ? 0x8000 : 0);
+    uint8_t data[5] = {(uint8_t)(humidity >> 8), (uint8_t)humidity, (uint8_t)(temperature >> 8), (uint8_t)temperature, 0};
+    data[4] = data[0] + data[1] + data[2] + data[3];
+
+    uint64_t time = nowUs + 30;
+    pinEvents.push_back(PinEvent{time, dht.pin, LOW});
+    pinEvents.push_back(PinEvent{time += 80, dht.pin, HIGH});
+    pinEvents.push_back(PinEvent{time += 80, dht.pin, LOW});
+    for (uint8_t i = 0; i < 40; i++) {
+        bool bit = data[i / 8] & (0x80 >> (i % 8));
+        pinEvents.push_back(PinEvent{time += 50, dht.pin, HIGH});
+        pinEvents.push_back(PinEvent{time += bit ? 70 : 27, dht.pin, LOW});
+    }
+    pinEvents.push_back(PinEvent{time += 50, dht.pin, HIGH});
+}
+
+// the start pulse of the host is at least 1 ms low
+static uint64_t dhtLowSinceUs = 0;
+
+static void onDhtPin(uint8_t mode, uint8_t level) {
+    PinState &state = pins[dht.pin];
+    if (mode == OUTPUT && level == LOW && (state.mode != OUTPUT || state.level != LOW))
+        dhtLowSinceUs = nowUs;
+    else if (mode != OUTPUT && state.mode == OUTPUT && state.level == LOW && nowUs - dhtLowSinceUs >= 1000)
+        answerDht();
+}
+
+uint8_t outputLevel(uint8_t pin) {
+    return pin < 17 ? pins[pin].level : LOW;
+}
+
+int analogLevel(uint8_t pin) {
+    return pin < 17 ? pins[pin].analog : 0;
+}
+
+uint32_t outputWrites(uint8_t pin) {
+    return pin < 17 ? pins[pin].writes : 0;
+}
+
+uint64_t outputChangeUs(uint8_t pin) {
+    return pin < 17 ? pins[pin].changeUs : 0;
+}
+
+// ==========================================================
+// SNTP, the system time is set from the server and counts on the virtual clock from there
+static bool isSntpStarted = false;
+static uint64_t sntpDueUs = 0;
+static int64_t systemTimeUs = 0;
+static uint64_t systemSetUs = 0;
+static std::function<void(bool)> timeSetCallback;
+
+static bool isNetworkUp();
+
+static void answerSntp() {
+    if (!isSntpStarted || nowUs < sntpDueUs)
+        return;
+
+    // lwIP asks again after 15 seconds when there was no answer
+    if (!sntp.available || !isNetworkUp()) {
+        sntpDueUs = nowUs + 15000000;
+        return;
+    }
+
+    systemTimeUs = (int64_t)sntp.timeUs;
+    systemSetUs = nowUs;
+    sntp.syncs++;
+    sntpDueUs = nowUs + (uint64_t)sntp_update_delay_MS_rfc_not_less_than_15000() * 1000;
+    if (timeSetCallback)
+        timeSetCallback(true);
+}
+
+void runTimers() {
+    Ticker::runDue(nowUs);
+    answerSntp();
+}
+
+// ==========================================================
+// loopback broker
+void FakeBroker::inject(const std::string &topic, const std::string &payload, uint32_t delayMs) {
+    Uncounted uncounted;
+    toDevice.push_back(MqttMessage{topic, payload, false, nowUs + (uint64_t)delayMs * 1000});
+}
+
+bool FakeBroker::hasArrived() const {
+    return !toDevice.empty() && toDevice.front().timeUs <= nowUs;
+}
+
+bool FakeBroker::matches(const std::string &filter, const std::string &topic) {
+    size_t f = 0, t = 0;
+    while (f < filter.size()) {
+        if (filter[f] == '#')
+            return true;
+        if (filter[f] == '+') {
+            while (t < topic.size() && topic[t] != '/')
+                t++;
+            f++;
+            continue;
+        }
+        if (t >= topic.size() || filter[f] != topic[t])
+            return false;
+        f++;
+        t++;
+    }
+    return t == topic.size();
+}
+
+bool FakeBroker::isSubscribed(const std::string &topic) const {
+    for (const std::string &filter : subscriptions) {
+        if (matches(filter, topic))
+            return true;
+    }
+    return false;
+}
+
+// ==========================================================
+static std::string fsRootPath;
+
+// the temporary file system goes with the process, it is flat like SPIFFS
+static void removeFsRoot() {
+    DIR *dir = opendir(fsRootPath.c_str());
+    if (dir) {
+        while (struct dirent *entry = readdir(dir)) {
+            if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
+                unlink((fsRootPath + "/" + entry->d_name).c_str());
+        }
+        closedir(dir);
+    }
+    rmdir(fsRootPath.c_str());
+}
+
+// NATIVE_FS_ROOT keeps the files for a later run, otherwise they live in a temporary directory
+const char *fsRoot() {
+    if (fsRootPath.empty()) {
+        const char *root = getenv("NATIVE_FS_ROOT");
+        if (root) {
+            fsRootPath = root;
+            mkdir(root, 0755);
+        } else {
+            char tmpl[] = "/tmp/native-spiffs-XXXXXX";
+            if (mkdtemp(tmpl) == NULL) {
+                perror("mkdtemp");
+                exit(1);
+            }
+            fsRootPath = tmpl;
+            atexit(removeFsRoot);
+        }
+    }
+    return fsRootPath.c_str();
+}
+
+static NativeBench *benches = NULL;
+
+NativeBench::NativeBench(const char *name, void (*run)()) : name(name), run(run), next(benches) {
+    benches = this;
+}
+
+NativeBench *firstBench() {
+    return benches;
+}
+
+static uint32_t failureCount = 0;
+
+void fail(const char *message) {
+    printf("FAILED: %s\n", message);
+    failureCount++;
+}
+
+uint32_t failures() {
+    return failureCount;
+}
+
+}  // namespace NativeHal
+
+using NativeHal::nowUs;
+using NativeHal::pins;
+
+// ==========================================================
+// core
+unsigned long millis() {
+    return (unsigned long)(nowUs / 1000);
+}
+
+unsigned long micros() {
+    return (unsigned long)nowUs;
+}
+
+uint64_t micros64() {
+    return nowUs;
+}
+
+void delay(unsigned long ms) {
+    NativeHal::passTime((uint64_t)ms * 1000);
+    NativeHal::runTimers();
+}
+
+void delayMicroseconds(unsigned int us) {
+    NativeHal::passTime(us);
+}
+
+void yield() {
+    NativeHal::runTimers();
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+    if (pin >= 17)
+        return;
+    if (pin == NativeHal::dht.pin)
+        NativeHal::onDhtPin(mode, pins[pin].level);
+    pins[pin].mode = mode;
+    if (mode == INPUT_PULLUP)
+        pins[pin].level = HIGH;
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+    if (pin >= 17)
+        return;
+    if (pin == NativeHal::dht.pin)
+        NativeHal::onDhtPin(pins[pin].mode, value ? HIGH : LOW);
+    if (pins[pin].level != (value ? HIGH : LOW)) {
+        pins[pin].changeUs = NativeHal::nowUs;
+        if (NativeHal::outputTraces[pin]) {
+            Uncounted uncounted;
+            NativeHal::outputTraces[pin]->push_back(NativeHal::nowUs);
+        }
+    }
+    pins[pin].level = value ? HIGH : LOW;
+    pins[pin].writes++;
+}
+
+int digitalRead(uint8_t pin) {
+    return pin < 17 ? pins[pin].level : LOW;
+}
+
+int analogRead(uint8_t pin) {
+    (void)pin;
+    return 0;
+}
+
+void analogWrite(uint8_t pin, int value) {
+    if (pin >= 17)
+        return;
+    if (value != pins[pin].analog)
+        pins[pin].changeUs = NativeHal::nowUs;
+    pins[pin].analog = value;
+    pins[pin].writes++;
+}
+
+void analogWriteRange(uint32_t range) {
+    (void)range;
+}
+
+void analogWriteFreq(uint32_t freq) {
+    (void)freq;
+}
+
+void attachInterrupt(uint8_t pin, std::function<void(void)> handler, int mode) {
+    if (pin >= 17)
+        return;
+    pins[pin].isr = handler;
+    pins[pin].isrMode = mode;
+}
+
+void attachInterruptArg(uint8_t pin, void (*handler)(void *), void *arg, int mode) {
+    attachInterrupt(pin, [handler, arg]() { handler(arg); }, mode);
+}
+
+void detachInterrupt(uint8_t pin) {
+    if (pin >= 17)
+        return;
+    pins[pin].isr = nullptr;
+}
+
+void interrupts() {
+}
+
+void timer0_isr_init() {
+}
+
+void timer0_attachInterrupt(timercallback userFunc) {
+    NativeHal::timer0Callback = userFunc;
+}
+
+void timer0_detachInterrupt() {
+    NativeHal::timer0Callback = NULL;
+    NativeHal::isTimer0Armed = false;
+}
+
+// a count behind the cycle counter fires right away, the device would wait for the counter to wrap
+void timer0_write(uint32_t count) {
+    int32_t cycles = (int32_t)(count - ESP.getCycleCount());
+    uint32_t mhz = ESP.getCpuFreqMHz();
+    NativeHal::timer0DueUs = nowUs + (cycles > 0 ? ((uint32_t)cycles + mhz - 1) / mhz : 0);
+    NativeHal::isTimer0Armed = true;
+}
+
+void noInterrupts() {
+}
+
+static uint32_t randomState = 1;
+
+long random(long howbig) {
+    if (howbig <= 0)
+        return 0;
+    // xorshift32, deterministic across runs
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    return randomState % howbig;
+}
+
+long random(long howsmall, long howbig) {
+    if (howsmall >= howbig)
+        return howsmall;
+    return howsmall + random(howbig - howsmall);
+}
+
+void randomSeed(unsigned long seed) {
+    randomState = seed ? seed : 1;
+}
+
+char *dtostrf(double number, signed char width, unsigned char prec, char *s) {
+    sprintf(s, "%*.*f", width, prec, number);
+    return s;
+}
+
+#if defined(__GLIBC__) && (__GLIBC__ < 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ < 38))
+extern "C" size_t strlcpy(char *dst, const char *src, size_t size) {
+    size_t length = strlen(src);
+    if (size > 0) {
+        size_t n = length < size - 1 ? length : size - 1;
+        memcpy(dst, src, n);
+        dst[n] = '\0';
+    }
+    return length;
+}
+#endif
+
+// ==========================================================
+// Print and Stream
+size_t Print::write(const uint8_t *buffer, size_t size) {
+    size_t n = 0;
+    while (size--)
+        n += write(*buffer++);
+    return n;
+}
+
+size_t Print::printf(const char *format, ...) {
+    char buf[256];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    if (length < 0)
+        return 0;
+    return write((const uint8_t *)buf, (size_t)length < sizeof(buf) ? length : sizeof(buf) - 1);
+}
+
+size_t Print::printNumber(unsigned long long value, int base) {
+    char buf[66];
+    char *p = &buf[sizeof(buf) - 1];
+    *p = 0;
+    if (base < 2)
+        base = 10;
+    do {
+        int digit = value % base;
+        *--p = digit < 10 ? '0' + digit : 'A' + digit - 10;
+        value /= base;
+    } while (value);
+    return write(p);
+}
+
+size_t Print::printSigned(long long value, int base) {
+    if (value < 0 && base == 10)
+        return print('-') + printNumber((unsigned long long)(-(value + 1)) + 1, base);
+    return printNumber((unsigned long long)value, base);
+}
+
+size_t Print::print(double value, int digits) {
+    char buf[48];
+    snprintf(buf, sizeof(buf), "%.*f", digits, value);
+    return write(buf);
+}
+
+size_t Stream::readBytes(char *buffer, size_t length) {
+    size_t count = 0;
+    while (count < length) {
+        int c = read();
+        if (c < 0)
+            break;
+        *buffer++ = (char)c;
+        count++;
+    }
+    return count;
+}
+
+String Stream::readString() {
+    String out;
+    int c;
+    while ((c = read()) >= 0)
+        out += (char)c;
+    return out;
+}
+
+HardwareSerial Serial;
+
+size_t HardwareSerial::write(uint8_t c) {
+    return fwrite(&c, 1, 1, stdout);
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size) {
+    return fwrite(buffer, 1, size, stdout);
+}
+
+// ==========================================================
+// ESP
+EspClass ESP;
+
+static uint32_t rtcMemory[128];
+
+uint32_t EspClass::getCycleCount() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+// a simulated 48 KiB heap, the host build does not fragment
+uint32_t EspClass::getFreeHeap() {
+    const uint32_t size = 48 * 1024;
+    return heap.liveBytes < size ? size - heap.liveBytes : 0;
+}
+
+uint32_t EspClass::getMaxFreeBlockSize() {
+    return getFreeHeap();
+}
+
+uint8_t EspClass::getHeapFragmentation() {
+    return 0;
+}
+
+void EspClass::restart() {
+    throw NativeHal::Restart();
+}
+
+void EspClass::deepSleep(uint64_t timeUs, RFMode mode) {
+    (void)mode;
+    throw NativeHal::DeepSleep{timeUs};
+}
+
+bool EspClass::rtcUserMemoryRead(uint32_t offset, uint32_t *data, size_t size) {
+    if (offset * 4 + size > sizeof(rtcMemory))
+        return false;
+    memcpy(data, (uint8_t *)rtcMemory + offset * 4, size);
+    return true;
+}
+
+bool EspClass::rtcUserMemoryWrite(uint32_t offset, uint32_t *data, size_t size) {
+    if (offset * 4 + size > sizeof(rtcMemory))
+        return false;
+    memcpy((uint8_t *)rtcMemory + offset * 4, data, size);
+    return true;
+}
+
+String EspClass::getResetReason() {
+    return String("External System");
+}
+
+// ==========================================================
+// EEPROM
+EEPROMClass EEPROM;
+
+static uint8_t eepromSector[4096];
+static bool isEepromErased = false;
+
+void EEPROMClass::begin(size_t size) {
+    if (!isEepromErased) {
+        memset(eepromSector, 0xff, sizeof(eepromSector));
+        isEepromErased = true;
+    }
+
+    end();
+    this->size = size < sizeof(eepromSector) ? size : sizeof(eepromSector);
+    data = new uint8_t[this->size];
+    memcpy(data, eepromSector, this->size);
+    isDirty = false;
+}
+
+void EEPROMClass::write(int address, uint8_t value) {
+    if (address < 0 || (size_t)address >= size)
+        return;
+    data[address] = value;
+    isDirty = true;
+}
+
+bool EEPROMClass::commit() {
+    if (!data)
+        return false;
+    if (isDirty)
+        memcpy(eepromSector, data, size);
+    isDirty = false;
+    return true;
+}
+
+bool EEPROMClass::end() {
+    bool isCommitted = commit();
+    delete[] data;
+    data = nullptr;
+    size = 0;
+    return isCommitted;
+}
+
+// ==========================================================
+// I2C
+TwoWire Wire;
+
+void TwoWire::beginTransmission(uint8_t address) {
+    this->address = address & 0x7f;
+    length = 0;
+}
+
+size_t TwoWire::write(uint8_t data) {
+    if (length >= sizeof(buffer))
+        return 0;
+    buffer[length++] = data;
+    return 1;
+}
+
+size_t TwoWire::write(const uint8_t *data, size_t size) {
+    size_t n = 0;
+    while (n < size && write(data[n]))
+        n++;
+    return n;
+}
+
+uint8_t TwoWire::endTransmission(bool sendStop) {
+    NativeHal::i2c.transmissions++;
+    NativeHal::i2c.bytes += 1 + length;
+    if (!NativeHal::i2c.present[address])
+        return 2;
+
+    // the first byte selects the register, the following bytes go to it and the ones after it
+    uint8_t *registers = NativeHal::i2c.registers[address];
+    for (size_t i = 1; i < length; i++)
+        registers[(buffer[0] + i - 1) % sizeof(NativeHal::i2c.registers[0])] = buffer[i];
+    if (length == 1)
+        registers[0] = buffer[0];
+    return 0;
+}
+
+// ==========================================================
+// WiFi
+ESP8266WiFiClass WiFi;
+
+bool ESP8266WiFiClass::mode(WiFiMode_t mode) {
+    wifiMode = mode;
+    if (mode == WIFI_OFF)
+        wifiStatus = WL_DISCONNECTED;
+    return true;
+}
+
+wl_status_t ESP8266WiFiClass::begin() {
+    return begin(ssid, passphrase);
+}
+
+wl_status_t ESP8266WiFiClass::begin(const char *ssid, const char *passphrase, int32_t channel, const uint8_t *bssid,
+                                    bool connect) {
+    if (ssid && ssid != this->ssid)
+        strncpy(this->ssid, ssid, sizeof(this->ssid) - 1);
+    if (passphrase && passphrase != this->passphrase)
+        strncpy(this->passphrase, passphrase, sizeof(this->passphrase) - 1);
+    if (!connect)
+        return wifiStatus;
+
+    wifiMode = WIFI_STA;
+    wifiStatus = WL_DISCONNECTED;
+    NativeHal::accessPoint.connects++;
+
+    // a known channel and BSSID skips the scan, a static address skips DHCP
+    bool fast = channel > 0 && bssid != NULL && staticIP;
+    connectedAtUs = nowUs + (uint64_t)(fast ? NativeHal::accessPoint.fastAssociateMs
+                                            : NativeHal::accessPoint.associateMs) * 1000;
+    return wifiStatus;
+}
+
+bool ESP8266WiFiClass::config(IPAddress localIP, IPAddress gateway, IPAddress subnet, IPAddress dns1,
+                              IPAddress dns2) {
+    (void)gateway;
+    (void)subnet;
+    (void)dns1;
+    (void)dns2;
+    staticIP = localIP.isSet();
+    localAddress = localIP;
+    return true;
+}
+
+bool ESP8266WiFiClass::disconnect(bool wifioff) {
+    wifiStatus = WL_DISCONNECTED;
+    connectedAtUs = 0;
+    if (wifioff)
+        wifiMode = WIFI_OFF;
+    return true;
+}
+
+wl_status_t ESP8266WiFiClass::status() {
+    if (!NativeHal::accessPoint.available) {
+        if (wifiStatus == WL_CONNECTED)
+            wifiStatus = WL_CONNECTION_LOST;
+        return wifiStatus;
+    }
+    if (wifiStatus != WL_CONNECTED && connectedAtUs && nowUs >= connectedAtUs)
+        wifiStatus = WL_CONNECTED;
+    return wifiStatus;
+}
+
+IPAddress ESP8266WiFiClass::localIP() {
+    if (status() != WL_CONNECTED)
+        return IPAddress();
+    return staticIP ? IPAddress(localAddress) : IPAddress(192, 168, 1, 42);
+}
+
+// the resolver answers from the local network, but needs the network to be up
+int ESP8266WiFiClass::hostByName(const char *host, IPAddress &result, uint32_t timeout_ms) {
+    (void)host;
+    if (status() != WL_CONNECTED) {
+        NativeHal::advanceMillis(timeout_ms);
+        return 0;
+    }
+    NativeHal::advanceMillis(2);
+    result = IPAddress(192, 168, 1, 10);
+    return 1;
+}
+
+uint8_t *ESP8266WiFiClass::macAddress(uint8_t *mac) {
+    const uint8_t address[6] = {0x5c, 0xcf, 0x7f, 0x12, 0x34, 0x56};
+    memcpy(mac, address, 6);
+    return mac;
+}
+
+// blocks for the connect time, or the client timeout when the broker is down
+int WiFiClient::connect(IPAddress ip, uint16_t port) {
+    (void)ip;
+    return connect("", port);
+}
+
+int WiFiClient::connect(const char *host, uint16_t port) {
+    (void)host;
+    (void)port;
+    if (WiFi.status() != WL_CONNECTED || !NativeHal::broker.online) {
+        NativeHal::advanceMillis(_timeout);
+        isConnected = false;
+        return 0;
+    }
+    NativeHal::advanceMillis(NativeHal::broker.connectMs);
+    isConnected = true;
+    NativeHal::broker.stream.clear();
+    return 1;
+}
+
+// hand the complete PUBLISH packets of the stream to the broker, QoS 0 only
+static void receivePackets() {
+    std::string &stream = NativeHal::broker.stream;
+    for (;;) {
+        size_t pos = 1;
+        uint32_t remaining = 0;
+        uint8_t shift = 0;
+        uint8_t digit;
+        do {
+            if (pos >= stream.size())
+                return;
+            digit = stream[pos++];
+            remaining |= (uint32_t)(digit & 0x7f) << shift;
+            shift += 7;
+        } while (digit & 0x80);
+        if (stream.size() < pos + remaining)
+            return;
+
+        if (((uint8_t)stream[0] >> 4) == 3) {
+            size_t topicLength = ((uint8_t)stream[pos] << 8) | (uint8_t)stream[pos + 1];
+            NativeHal::broker.fromDevice.push_back(NativeHal::MqttMessage{
+                stream.substr(pos + 2, topicLength), stream.substr(pos + 2 + topicLength, remaining - 2 - topicLength),
+                (stream[0] & 1) != 0, nowUs});
+        }
+        stream.erase(0, pos + remaining);
+    }
+}
+
+size_t WiFiClient::write(const uint8_t *buffer, size_t size) {
+    if (!connected())
+        return 0;
+    Uncounted uncounted;
+    NativeHal::broker.tcpWrites++;
+    NativeHal::broker.tcpBytes += size;
+    NativeHal::broker.stream.append((const char *)buffer, size);
+    receivePackets();
+    return size;
+}
+
+int WiFiClient::available() {
+    return connected() && NativeHal::broker.hasArrived() ? 1 : 0;
+}
+
+uint8_t WiFiClient::connected() {
+    if (isConnected && (!NativeHal::broker.online || WiFi.status() != WL_CONNECTED))
+        isConnected = false;
+    return isConnected;
+}
+
+bool WiFiManager::autoConnect(const char *apName, const char *apPassword) {
+    (void)apName;
+    (void)apPassword;
+    WiFi.begin();
+    // the manager waits for the connection, or runs the portal until it times out
+    uint64_t deadline = nowUs + (uint64_t)(connectTimeout ? connectTimeout : 30) * 1000000;
+    while (WiFi.status() != WL_CONNECTED && nowUs < deadline)
+        delay(100);
+    if (WiFi.status() == WL_CONNECTED)
+        return true;
+    return startConfigPortal(apName, apPassword);
+}
+
+bool WiFiManager::startConfigPortal(const char *apName, const char *apPassword) {
+    (void)apName;
+    (void)apPassword;
+    if (apCallback)
+        apCallback(this);
+    delay(portalTimeout * 1000);
+    return false;
+}
+
+// ==========================================================
+// MQTT
+bool PubSubClient::connect(const char *id, const char *user, const char *pass) {
+    return connect(id, user, pass, NULL, 0, false, NULL);
+}
+
+bool PubSubClient::connect(const char *id, const char *user, const char *pass, const char *willTopic,
+                           uint8_t willQos, bool willRetain, const char *willMessage, bool cleanSession) {
+    (void)id;
+    (void)user;
+    (void)pass;
+    (void)willTopic;
+    (void)willQos;
+    (void)willRetain;
+    (void)willMessage;
+    (void)cleanSession;
+
+    NativeHal::broker.connectAttempts++;
+    if (!client->connect("broker", 1883)) {
+        connectionState = MQTT_CONNECT_FAILED;
+        return false;
+    }
+
+    Uncounted uncounted;
+    NativeHal::broker.connects++;
+    NativeHal::broker.subscriptions.clear();
+    connectionState = MQTT_CONNECTED;
+    return true;
+}
+
+void PubSubClient::disconnect() {
+    client->stop();
+    connectionState = MQTT_DISCONNECTED;
+}
+
+bool PubSubClient::connected() {
+    if (connectionState == MQTT_CONNECTED && !client->connected())
+        connectionState = MQTT_CONNECTION_LOST;
+    return connectionState == MQTT_CONNECTED;
+}
+
+// fixed header, remaining length and topic of a QoS 0 PUBLISH packet
+static std::string publishHeader(const char *topic, size_t length, bool retained) {
+    size_t topicLength = strlen(topic);
+    size_t remaining = 2 + topicLength + length;
+
+    std::string header(1, (char)(0x30 | (retained ? 1 : 0)));
+    do {
+        uint8_t digit = remaining & 0x7f;
+        remaining >>= 7;
+        header += (char)(remaining ? digit | 0x80 : digit);
+    } while (remaining);
+    header += (char)(topicLength >> 8);
+    header += (char)(topicLength & 0xff);
+    header += topic;
+    return header;
+}
+
+bool PubSubClient::publish(const char *topic, const uint8_t *payload, unsigned int length, bool retained) {
+    if (!connected())
+        return false;
+    if (bufferSize < MQTT_MAX_HEADER_SIZE + 2 + strnlen(topic, bufferSize) + length)
+        return false;
+
+    std::string packet;
+    {
+        Uncounted uncounted;
+        packet = publishHeader(topic, length, retained);
+        packet.append((const char *)payload, length);
+    }
+    bool isWritten = client->write((const uint8_t *)packet.data(), packet.size()) == packet.size();
+    {
+        Uncounted uncounted;
+        packet = std::string();
+    }
+    return isWritten;
+}
+
+bool PubSubClient::beginPublish(const char *topic, unsigned int length, bool retained) {
+    if (!connected())
+        return false;
+
+    std::string header;
+    {
+        Uncounted uncounted;
+        header = publishHeader(topic, length, retained);
+    }
+    bool isWritten = client->write((const uint8_t *)header.data(), header.size()) == header.size();
+    {
+        Uncounted uncounted;
+        header = std::string();
+    }
+    return isWritten;
+}
+
+size_t PubSubClient::write(const uint8_t *buffer, size_t size) {
+    if (!connected())
+        return 0;
+    return client->write(buffer, size);
+}
+
+int PubSubClient::endPublish() {
+    return connected() ? 1 : 0;
+}
+
+bool PubSubClient::subscribe(const char *topic, uint8_t qos) {
+    (void)qos;
+    if (!connected())
+        return false;
+    Uncounted uncounted;
+    NativeHal::broker.subscriptions.push_back(topic);
+    NativeHal::broker.subscribePackets++;
+    return true;
+}
+
+bool PubSubClient::unsubscribe(const char *topic) {
+    std::vector<std::string> &subscriptions = NativeHal::broker.subscriptions;
+    for (size_t i = 0; i < subscriptions.size(); i++) {
+        if (subscriptions[i] == topic) {
+            subscriptions.erase(subscriptions.begin() + i);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool PubSubClient::loop() {
+    if (!connected())
+        return false;
+
+    std::deque<NativeHal::MqttMessage> &queue = NativeHal::broker.toDevice;
+    while (NativeHal::broker.hasArrived()) {
+        // the real client hands out its packet buffer, topic and payload are not const
+        char topic[MQTT_MAX_PACKET_SIZE];
+        uint8_t payload[MQTT_MAX_PACKET_SIZE];
+        size_t length;
+        {
+            Uncounted uncounted;
+            NativeHal::MqttMessage message = queue.front();
+            queue.pop_front();
+            if (!NativeHal::broker.isSubscribed(message.topic) || message.topic.size() >= sizeof(topic) ||
+                message.payload.size() >= sizeof(payload))
+                continue;
+
+            memcpy(topic, message.topic.c_str(), message.topic.size() + 1);
+            length = message.payload.size();
+            memcpy(payload, message.payload.data(), length);
+            payload[length] = 0;
+        }
+        if (callback)
+            callback(topic, payload, length);
+        break;
+    }
+    return true;
+}
+
+// ==========================================================
+// SNTP client of the core
+void configTime(int timezone, int daylightOffset_sec, const char *server1, const char *server2, const char *server3) {
+    (void)timezone;
+    (void)daylightOffset_sec;
+    (void)server2;
+    (void)server3;
+    Uncounted uncounted;
+    NativeHal::sntp.server = server1 ? server1 : "";
+    NativeHal::isSntpStarted = true;
+    NativeHal::sntpDueUs = nowUs + (uint64_t)NativeHal::sntp.answerMs * 1000;
+}
+
+void settimeofday_cb(const std::function<void(bool)> &cb) {
+    Uncounted uncounted;
+    NativeHal::timeSetCallback = cb;
+}
+
+extern "C" uint32_t __attribute__((weak)) sntp_update_delay_MS_rfc_not_less_than_15000() {
+    return 60 * 60 * 1000;
+}
+
+int nativeGettimeofday(struct timeval *tv, void *tz) {
+    (void)tz;
+    int64_t us = NativeHal::systemTimeUs + (int64_t)(nowUs - NativeHal::systemSetUs);
+    tv->tv_sec = (time_t)(us / 1000000);
+    tv->tv_usec = (suseconds_t)(us % 1000000);
+    return 0;
+}
+
+namespace NativeHal {
+
+static bool isNetworkUp() {
+    return WiFi.status() == WL_CONNECTED;
+}
+
+}  // namespace NativeHal
+
+// ==========================================================
+// Ticker
+static Ticker *tickers = NULL;
+
+Ticker::Ticker() : next(tickers) {
+    tickers = this;
+}
+
+Ticker::~Ticker() {
+    for (Ticker **t = &tickers; *t; t = &(*t)->next) {
+        if (*t == this) {
+            *t = next;
+            break;
+        }
+    }
+}
+
+void Ticker::arm(uint32_t milliseconds, bool repeat, callback_function_t callback) {
+    this->callback = callback;
+    this->repeat = repeat;
+    periodUs = milliseconds * 1000;
+    dueUs = nowUs + periodUs;
+    armed = true;
+}
+
+void Ticker::runDue(uint64_t nowUs) {
+    for (Ticker *t = tickers; t; t = t->next) {
+        while (t->armed && nowUs >= t->dueUs) {
+            t->armed = t->repeat;
+            t->dueUs += t->periodUs ? t->periodUs : 1;
+            if (t->callback)
+                t->callback();
+        }
+    }
+}
+
+// ==========================================================
+// SPIFFS
+fs::FS SPIFFS;
+
+namespace fs {
+
+size_t File::write(const uint8_t *buffer, size_t size) {
+    if (!file)
+        return 0;
+
+    // a full flash writes what still fits
+    size_t written = fwrite(buffer, 1, min(size, SPIFFS.writeLimit), file);
+    if (SPIFFS.writeLimit != SIZE_MAX)
+        SPIFFS.writeLimit -= written;
+    return written;
+}
+
+int File::available() {
+    if (!file)
+        return 0;
+    return (int)(size() - position());
+}
+
+int File::read() {
+    return file ? fgetc(file) : -1;
+}
+
+int File::peek() {
+    if (!file)
+        return -1;
+    int c = fgetc(file);
+    if (c >= 0)
+        ungetc(c, file);
+    return c;
+}
+
+size_t File::read(uint8_t *buffer, size_t size) {
+    return file ? fread(buffer, 1, size, file) : 0;
+}
+
+void File::flush() {
+    if (file)
+        fflush(file);
+}
+
+bool File::seek(uint32_t pos, SeekMode mode) {
+    return file && fseek(file, pos, mode == SeekSet ? SEEK_SET : mode == SeekCur ? SEEK_CUR : SEEK_END) == 0;
+}
+
+size_t File::position() const {
+    return file ? ftell(file) : 0;
+}
+
+size_t File::size() const {
+    if (!file)
+        return 0;
+    struct stat st;
+    fflush(file);
+    return fstat(fileno(file), &st) == 0 ? st.st_size : 0;
+}
+
+void File::close() {
+    if (file)
+        fclose(file);
+    file = NULL;
+}
+
+// host file names encode the SPIFFS path, see FS::hostPath()
+Dir::Dir(const std::string &root, const std::string &prefix) : root(root) {
+    DIR *dir = opendir(root.c_str());
+    if (!dir)
+        return;
+    while (dirent *entry = readdir(dir)) {
+        if (entry->d_type != DT_REG)
+            continue;
+        std::string name = std::string("/") + entry->d_name;
+        for (char &c : name) {
+            if (c == '\x01')
+                c = '/';
+        }
+        if (name.compare(0, prefix.size(), prefix) == 0)
+            entries.push_back(name);
+    }
+    closedir(dir);
+    std::sort(entries.begin(), entries.end());
+}
+
+bool Dir::next() {
+    if (index >= entries.size())
+        return false;
+    current = entries[index++];
+    return true;
+}
+
+size_t Dir::fileSize() const {
+    struct stat st;
+    return stat(SPIFFS.hostPath(current.c_str()).c_str(), &st) == 0 ? st.st_size : 0;
+}
+
+File Dir::openFile(const char *mode) {
+    return SPIFFS.open(current.c_str(), mode);
+}
+
+// SPIFFS has a flat namespace, slashes after the first are part of the file name
+std::string FS::hostPath(const char *path) {
+    std::string name = path;
+    if (!name.empty() && name[0] == '/')
+        name = name.substr(1);
+    for (char &c : name) {
+        if (c == '/')
+            c = '\x01';
+    }
+    return std::string(NativeHal::fsRoot()) + "/" + name;
+}
+
+bool FS::begin() {
+    NativeHal::fsRoot();
+    return true;
+}
+
+bool FS::format() {
+    Dir dir = openDir("/");
+    while (dir.next())
+        remove(dir.fileName());
+    return true;
+}
+
+bool FS::info(FSInfo &info) {
+    info.totalBytes = 1024 * 1024;
+    info.usedBytes = 0;
+    Dir dir = openDir("/");
+    while (dir.next())
+        info.usedBytes += dir.fileSize();
+    info.blockSize = 8192;
+    info.pageSize = 256;
+    info.maxOpenFiles = 5;
+    info.maxPathLength = 32;
+    return true;
+}
+
+File FS::open(const char *path, const char *mode) {
+    const char *hostMode = mode[0] == 'r' ? (mode[1] == '+' ? "r+b" : "rb")
+                           : mode[0] == 'a' ? (mode[1] == '+' ? "a+b" : "ab")
+                                            : (mode[1] == '+' ? "w+b" : "wb");
+    FILE *file = fopen(hostPath(path).c_str(), hostMode);
+    opens++;
+    return File(file, path);
+}
+
+bool FS::exists(const char *path) {
+    struct stat st;
+    return stat(hostPath(path).c_str(), &st) == 0;
+}
+
+bool FS::remove(const char *path) {
+    return unlink(hostPath(path).c_str()) == 0;
+}
+
+bool FS::rename(const char *from, const char *to) {
+    return ::rename(hostPath(from).c_str(), hostPath(to).c_str()) == 0;
+}
+
+// lists the files whose name starts with the given prefix, like SPIFFS does
+Dir FS::openDir(const char *path) {
+    return Dir(NativeHal::fsRoot(), path);
+}
+
+}  // namespace fs
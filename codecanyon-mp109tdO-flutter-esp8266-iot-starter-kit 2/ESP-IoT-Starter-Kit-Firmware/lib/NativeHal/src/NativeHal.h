@@ -0,0 +1,149 @@
+/**** Controls of the host build, used by the native runner and the benchmarks.
+Everything here is host only and never compiled into the firmware image.
+*/
+#ifndef NATIVE_HAL_H
+#define NATIVE_HAL_H
+
+#include <stdint.h>
+
+#include <deque>
+#include <string>
+#include <vector>
+
+namespace NativeHal {
+
+// thrown by ESP.restart() and ESP.deepSleep(), the runner catches them and boots again
+struct Restart {};
+struct DeepSleep {
+    uint64_t timeUs;
+};
+
+// run setup() and one pass of loop(), a restart or deep sleep boots the firmware again
+void boot();
+void step();
+uint32_t boots();
+
+// virtual clock
+void advanceMicros(uint64_t us);
+void advanceMillis(uint32_t ms);
+
+// drive an input pin from outside, firing attached interrupts on matching edges
+void setInput(uint8_t pin, uint8_t level);
+// set the level of an input pin once the clock has passed `delayUs` from now
+void scheduleInput(uint8_t pin, uint8_t level, uint64_t delayUs);
+uint8_t outputLevel(uint8_t pin);
+int analogLevel(uint8_t pin);
+uint32_t outputWrites(uint8_t pin);
+// the clock when the output last changed its level or its duty
+uint64_t outputChangeUs(uint8_t pin);
+// append the clock at every level change of the output, NULL stops
+void traceOutput(uint8_t pin, std::vector<uint64_t> *edges);
+
+// run pending Ticker callbacks, as the SDK does whenever the sketch yields
+void runTimers();
+
+// heap counters, fed by the malloc/free wrappers of the host build
+struct HeapCounters {
+    uint32_t allocations;
+    uint32_t frees;
+    uint32_t liveBytes;
+    uint32_t peakBytes;
+};
+HeapCounters heapCounters();
+
+// start a new peak from the current live bytes
+void resetHeapPeak();
+
+// simulated access point
+struct FakeAccessPoint {
+    bool available = true;
+    uint32_t associateMs = 1200;  // scan, association and DHCP
+    uint32_t fastAssociateMs = 300;  // association with known channel and BSSID, static IP
+    uint32_t connects = 0;
+};
+extern FakeAccessPoint accessPoint;
+
+// loopback MQTT broker
+struct MqttMessage {
+    std::string topic;
+    std::string payload;
+    bool retained;
+    uint64_t timeUs;  // when the device published it, or when an injected message arrives
+};
+
+struct FakeBroker {
+    bool online = true;
+    uint32_t connectMs = 30;
+    std::vector<std::string> subscriptions;
+    std::deque<MqttMessage> toDevice;
+    std::vector<MqttMessage> fromDevice;
+    uint32_t connects = 0;
+    uint32_t connectAttempts = 0;
+    uint32_t subscribePackets = 0;
+
+    // writes to the TCP connection, each a segment when Nagle is off, and their bytes
+    uint32_t tcpWrites = 0;
+    uint32_t tcpBytes = 0;
+
+    // bytes written by the device, PUBLISH packets move to fromDevice once complete
+    std::string stream;
+
+    // messages arrive at the device after the delay, in the order they were injected
+    void inject(const std::string &topic, const std::string &payload, uint32_t delayMs = 0);
+    bool hasArrived() const;
+    bool isSubscribed(const std::string &topic) const;
+    static bool matches(const std::string &filter, const std::string &topic);
+};
+extern FakeBroker broker;
+
+// SNTP server, answers configTime() once WiFi is up and again after every update delay; the
+// virtual clock runs `driftPpm` fast against the server time `timeUs`, in microseconds since 1970
+struct FakeSntp {
+    bool available = true;
+    uint64_t timeUs = 1609459200000000ULL;  // 1-Jan-2021 00:00:00 at boot
+    int32_t driftPpm = 0;
+    uint32_t answerMs = 40;
+    uint32_t syncs = 0;
+    std::string server;
+};
+extern FakeSntp sntp;
+
+// DHT22 on its data pin, answers a start pulse with the pulse train of these readings
+struct FakeDht {
+    uint8_t pin = 12;
+    float temperature = 23.1f;
+    float humidity = 45.2f;
+    bool fail = false;
+    uint32_t reads = 0;
+};
+extern FakeDht dht;
+
+// I2C bus, a write is a register address and its data (MCP23017), a single byte goes to register 0
+// like the port of a PCF8574
+struct FakeI2c {
+    bool present[128] = {};
+    uint8_t registers[128][32] = {};
+    uint32_t transmissions = 0;
+    uint32_t bytes = 0;
+};
+extern FakeI2c i2c;
+
+// directory that backs SPIFFS
+const char *fsRoot();
+
+// benchmarks register themselves with a static NativeBench instance
+struct NativeBench {
+    const char *name;
+    void (*run)();
+    NativeBench *next;
+
+    NativeBench(const char *name, void (*run)());
+};
+
+// a benchmark that exceeds its budget reports it here, the runner then exits with an error
+void fail(const char *message);
+uint32_t failures();
+
+}  // namespace NativeHal
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef NATIVE_HAL_PRINT_H
+#define NATIVE_HAL_PRINT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "WString.h"
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+class Print {
+  public:
+    virtual ~Print() {}
+
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size);
+    size_t write(const char *str) { return str ? write((const uint8_t *)str, strlen(str)) : 0; }
+    size_t write(const char *buffer, size_t size) { return write((const uint8_t *)buffer, size); }
+    virtual void flush() {}
+
+    size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+    size_t print(const __FlashStringHelper *str) { return print(reinterpret_cast<const char *>(str)); }
+    size_t print(const String &str) { return write((const uint8_t *)str.c_str(), str.length()); }
+    size_t print(const char *str) { return write(str); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(unsigned char value, int base = DEC) { return printNumber(value, base); }
+    size_t print(int value, int base = DEC) { return printSigned(value, base); }
+    size_t print(unsigned int value, int base = DEC) { return printNumber(value, base); }
+    size_t print(long value, int base = DEC) { return printSigned(value, base); }
+    size_t print(unsigned long value, int base = DEC) { return printNumber(value, base); }
+    size_t print(long long value, int base = DEC) { return printSigned(value, base); }
+    size_t print(unsigned long long value, int base = DEC) { return printNumber(value, base); }
+    size_t print(double value, int digits = 2);
+
+    size_t println() { return write("\r\n"); }
+    template <typename T>
+    size_t println(const T &value) {
+        size_t n = print(value);
+        return n + println();
+    }
+    template <typename T>
+    size_t println(const T &value, int format) {
+        size_t n = print(value, format);
+        return n + println();
+    }
+
+  private:
+    size_t printNumber(unsigned long long value, int base);
+    size_t printSigned(long long value, int base);
+};
+
+class Stream : public Print {
+  public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+
+    void setTimeout(unsigned long timeout) { _timeout = timeout; }
+    unsigned long getTimeout() const { return _timeout; }
+
+    virtual size_t readBytes(char *buffer, size_t length);
+    size_t readBytes(uint8_t *buffer, size_t length) { return readBytes((char *)buffer, length); }
+    String readString();
+
+  protected:
+    unsigned long _timeout = 1000;
+};
+
+#endif
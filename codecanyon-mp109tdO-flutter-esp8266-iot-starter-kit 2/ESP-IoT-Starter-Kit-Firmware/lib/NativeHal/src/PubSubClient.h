@@ -0,0 +1,100 @@
+/**** Loopback stand-in for knolleary/PubSubClient on the host build.
+Talks to NativeHal::broker instead of a socket. Keeps the behaviour the firmware depends on:
+connect() blocks like the real client, publish() fails when the packet does not fit the buffer,
+and loop() delivers at most one incoming message per call. PUBLISH packets are written to the
+client like the real library does: publish() in one write, beginPublish() writes the header and
+every write() of the payload goes straight to the client.
+*/
+#ifndef NATIVE_HAL_PUBSUBCLIENT_H
+#define NATIVE_HAL_PUBSUBCLIENT_H
+
+#include <Arduino.h>
+
+#include <string>
+
+#include "Client.h"
+#include "IPAddress.h"
+
+#define MQTT_MAX_PACKET_SIZE 256
+#define MQTT_MAX_HEADER_SIZE 5
+#define MQTT_KEEPALIVE 15
+#define MQTT_SOCKET_TIMEOUT 15
+
+#define MQTT_CONNECTION_TIMEOUT -4
+#define MQTT_CONNECTION_LOST -3
+#define MQTT_CONNECT_FAILED -2
+#define MQTT_DISCONNECTED -1
+#define MQTT_CONNECTED 0
+
+#define MQTT_CALLBACK_SIGNATURE std::function<void(char *, uint8_t *, unsigned int)> callback
+
+class PubSubClient : public Print {
+  public:
+    PubSubClient(Client &client) : client(&client) {}
+
+    PubSubClient &setServer(const char *domain, uint16_t port) {
+        (void)domain;
+        (void)port;
+        return *this;
+    }
+    PubSubClient &setServer(IPAddress ip, uint16_t port) {
+        (void)ip;
+        (void)port;
+        return *this;
+    }
+    PubSubClient &setCallback(MQTT_CALLBACK_SIGNATURE) {
+        this->callback = callback;
+        return *this;
+    }
+    PubSubClient &setKeepAlive(uint16_t keepAlive) {
+        this->keepAlive = keepAlive;
+        return *this;
+    }
+    PubSubClient &setSocketTimeout(uint16_t timeout) {
+        socketTimeout = timeout;
+        return *this;
+    }
+    bool setBufferSize(uint16_t size) {
+        bufferSize = size;
+        return true;
+    }
+    uint16_t getBufferSize() { return bufferSize; }
+
+    bool connect(const char *id) { return connect(id, NULL, NULL); }
+    bool connect(const char *id, const char *user, const char *pass);
+    bool connect(const char *id, const char *user, const char *pass, const char *willTopic, uint8_t willQos,
+                 bool willRetain, const char *willMessage, bool cleanSession = true);
+    void disconnect();
+    bool connected();
+    int state() { return connectionState; }
+
+    bool publish(const char *topic, const char *payload) { return publish(topic, payload, false); }
+    bool publish(const char *topic, const char *payload, bool retained) {
+        return publish(topic, (const uint8_t *)payload, payload ? strlen(payload) : 0, retained);
+    }
+    bool publish(const char *topic, const uint8_t *payload, unsigned int length) {
+        return publish(topic, payload, length, false);
+    }
+    bool publish(const char *topic, const uint8_t *payload, unsigned int length, bool retained);
+
+    bool beginPublish(const char *topic, unsigned int length, bool retained);
+    int endPublish();
+    using Print::write;
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t *buffer, size_t size) override;
+
+    bool subscribe(const char *topic, uint8_t qos = 0);
+    bool unsubscribe(const char *topic);
+
+    bool loop();
+
+  private:
+    Client *client;
+    MQTT_CALLBACK_SIGNATURE;
+    uint16_t bufferSize = MQTT_MAX_PACKET_SIZE;
+    uint16_t keepAlive = MQTT_KEEPALIVE;
+    uint16_t socketTimeout = MQTT_SOCKET_TIMEOUT;
+    int connectionState = MQTT_DISCONNECTED;
+};
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef NATIVE_HAL_TICKER_H
+#define NATIVE_HAL_TICKER_H
+
+#include <Arduino.h>
+
+// Ticker callbacks run from NativeHal::runTimers(), which delay(), yield() and the runner call
+// whenever the sketch gives control back, like the SDK timer task on the ESP8266
+class Ticker {
+  public:
+    typedef std::function<void(void)> callback_function_t;
+
+    Ticker();
+    ~Ticker();
+
+    void attach(float seconds, callback_function_t callback) { arm((uint32_t)(seconds * 1000), true, callback); }
+    void attach_ms(uint32_t milliseconds, callback_function_t callback) { arm(milliseconds, true, callback); }
+    void once(float seconds, callback_function_t callback) { arm((uint32_t)(seconds * 1000), false, callback); }
+    void once_ms(uint32_t milliseconds, callback_function_t callback) { arm(milliseconds, false, callback); }
+    void detach() { armed = false; }
+    bool active() const { return armed; }
+
+    // used by NativeHal::runTimers()
+    static void runDue(uint64_t nowUs);
+
+  private:
+    void arm(uint32_t milliseconds, bool repeat, callback_function_t callback);
+
+    callback_function_t callback;
+    uint64_t dueUs = 0;
+    uint32_t periodUs = 0;
+    bool repeat = false;
+    bool armed = false;
+    Ticker *next;
+};
+
+#endif
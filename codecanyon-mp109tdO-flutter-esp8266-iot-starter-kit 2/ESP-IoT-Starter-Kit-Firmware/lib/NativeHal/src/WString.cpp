@@ -0,0 +1,467 @@
+#include "WString.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void formatInteger(char *buf, unsigned long long value, bool negative, unsigned char base) {
+    char tmp[66];
+    int i = 0;
+    do {
+        int digit = value % base;
+        tmp[i++] = digit < 10 ? '0' + digit : 'a' + digit - 10;
+        value /= base;
+    } while (value);
+
+    if (negative)
+        *buf++ = '-';
+    while (i)
+        *buf++ = tmp[--i];
+    *buf = 0;
+}
+
+static void formatSigned(char *buf, long long value, unsigned char base) {
+    if (value < 0 && base == 10)
+        formatInteger(buf, (unsigned long long)(-(value + 1)) + 1, true, base);
+    else
+        formatInteger(buf, (unsigned long long)value, false, base);
+}
+
+String::String(const char *cstr) {
+    if (cstr)
+        copy(cstr, strlen(cstr));
+}
+
+String::String(const String &str) {
+    *this = str;
+}
+
+String::String(String &&rval) {
+    move(rval);
+}
+
+String::String(char c) {
+    char buf[2] = {c, 0};
+    *this = buf;
+}
+
+String::String(unsigned char value, unsigned char base) {
+    char buf[66];
+    formatInteger(buf, value, false, base);
+    *this = buf;
+}
+
+String::String(int value, unsigned char base) {
+    char buf[66];
+    formatSigned(buf, value, base);
+    *this = buf;
+}
+
+String::String(unsigned int value, unsigned char base) {
+    char buf[66];
+    formatInteger(buf, value, false, base);
+    *this = buf;
+}
+
+String::String(long value, unsigned char base) {
+    char buf[66];
+    formatSigned(buf, value, base);
+    *this = buf;
+}
+
+String::String(unsigned long value, unsigned char base) {
+    char buf[66];
+    formatInteger(buf, value, false, base);
+    *this = buf;
+}
+
+String::String(long long value, unsigned char base) {
+    char buf[66];
+    formatSigned(buf, value, base);
+    *this = buf;
+}
+
+String::String(unsigned long long value, unsigned char base) {
+    char buf[66];
+    formatInteger(buf, value, false, base);
+    *this = buf;
+}
+
+String::String(float value, unsigned char decimalPlaces) : String((double)value, decimalPlaces) {
+}
+
+String::String(double value, unsigned char decimalPlaces) {
+    char buf[48];
+    snprintf(buf, sizeof(buf), "%.*f", decimalPlaces, value);
+    *this = buf;
+}
+
+String::~String() {
+    free(buffer);
+}
+
+void String::invalidate() {
+    free(buffer);
+    buffer = nullptr;
+    capacity = len = 0;
+}
+
+bool String::reserve(unsigned int size) {
+    if (buffer && capacity >= size)
+        return true;
+
+    char *newBuffer = (char *)realloc(buffer, size + 1);
+    if (!newBuffer)
+        return false;
+
+    if (!buffer)
+        newBuffer[0] = 0;
+    buffer = newBuffer;
+    capacity = size;
+    return true;
+}
+
+String &String::copy(const char *cstr, unsigned int length) {
+    if (!reserve(length)) {
+        invalidate();
+        return *this;
+    }
+    len = length;
+    memmove(buffer, cstr, length);
+    buffer[len] = 0;
+    return *this;
+}
+
+void String::move(String &rhs) {
+    free(buffer);
+    buffer = rhs.buffer;
+    capacity = rhs.capacity;
+    len = rhs.len;
+    rhs.buffer = nullptr;
+    rhs.capacity = rhs.len = 0;
+}
+
+String &String::operator=(const String &rhs) {
+    if (this == &rhs)
+        return *this;
+    if (rhs.buffer)
+        copy(rhs.buffer, rhs.len);
+    else
+        invalidate();
+    return *this;
+}
+
+String &String::operator=(String &&rval) {
+    if (this != &rval)
+        move(rval);
+    return *this;
+}
+
+String &String::operator=(const char *cstr) {
+    if (cstr)
+        copy(cstr, strlen(cstr));
+    else
+        invalidate();
+    return *this;
+}
+
+String &String::operator=(char c) {
+    char buf[2] = {c, 0};
+    return *this = buf;
+}
+
+bool String::concat(const char *cstr, unsigned int length) {
+    if (!cstr)
+        return false;
+    if (length == 0)
+        return true;
+    if (!reserve(len + length))
+        return false;
+    memmove(buffer + len, cstr, length);
+    len += length;
+    buffer[len] = 0;
+    return true;
+}
+
+bool String::concat(const String &str) {
+    // copy first, the argument may be this string
+    String tmp(str);
+    return concat(tmp.c_str(), tmp.len);
+}
+
+bool String::concat(const char *cstr) {
+    return cstr ? concat(cstr, strlen(cstr)) : false;
+}
+
+bool String::concat(char c) {
+    return concat(&c, 1);
+}
+
+bool String::concat(unsigned char num) {
+    return concat(String(num));
+}
+
+bool String::concat(int num) {
+    return concat(String(num));
+}
+
+bool String::concat(unsigned int num) {
+    return concat(String(num));
+}
+
+bool String::concat(long num) {
+    return concat(String(num));
+}
+
+bool String::concat(unsigned long num) {
+    return concat(String(num));
+}
+
+bool String::concat(long long num) {
+    return concat(String(num));
+}
+
+bool String::concat(unsigned long long num) {
+    return concat(String(num));
+}
+
+bool String::concat(float num) {
+    return concat(String(num));
+}
+
+bool String::concat(double num) {
+    return concat(String(num));
+}
+
+StringSumHelper &operator+(const StringSumHelper &lhs, const String &rhs) {
+    StringSumHelper &a = const_cast<StringSumHelper &>(lhs);
+    a.concat(rhs);
+    return a;
+}
+
+StringSumHelper &operator+(const StringSumHelper &lhs, const char *cstr) {
+    StringSumHelper &a = const_cast<StringSumHelper &>(lhs);
+    a.concat(cstr);
+    return a;
+}
+
+StringSumHelper &operator+(const StringSumHelper &lhs, char c) {
+    StringSumHelper &a = const_cast<StringSumHelper &>(lhs);
+    a.concat(c);
+    return a;
+}
+
+StringSumHelper &operator+(const StringSumHelper &lhs, unsigned char num) {
+    StringSumHelper &a = const_cast<StringSumHelper &>(lhs);
+    a.concat(num);
+    return a;
+}
+
+StringSumHelper &operator+(const StringSumHelper &lhs, int num) {
+    StringSumHelper &a = const_cast<StringSumHelper &>(lhs);
+    a.concat(num);
+    return a;
+}
+
+StringSumHelper &operator+(const StringSumHelper &lhs, unsigned int num) {
+    StringSumHelper &a = const_cast<StringSumHelper &>(lhs);
+    a.concat(num);
+    return a;
+}
+
+StringSumHelper &operator+(const StringSumHelper &lhs, long num) {
+    StringSumHelper &a = const_cast<StringSumHelper &>(lhs);
+    a.concat(num);
+    return a;
+}
+
+StringSumHelper &operator+(const StringSumHelper &lhs, unsigned long num) {
+    StringSumHelper &a = const_cast<StringSumHelper &>(lhs);
+    a.concat(num);
+    return a;
+}
+
+StringSumHelper &operator+(const StringSumHelper &lhs, float num) {
+    StringSumHelper &a = const_cast<StringSumHelper &>(lhs);
+    a.concat(num);
+    return a;
+}
+
+StringSumHelper &operator+(const StringSumHelper &lhs, double num) {
+    StringSumHelper &a = const_cast<StringSumHelper &>(lhs);
+    a.concat(num);
+    return a;
+}
+
+int String::compareTo(const String &s) const {
+    return strcmp(c_str(), s.c_str());
+}
+
+bool String::equals(const String &s) const {
+    return len == s.len && compareTo(s) == 0;
+}
+
+bool String::equals(const char *cstr) const {
+    return strcmp(c_str(), cstr ? cstr : "") == 0;
+}
+
+bool String::equalsIgnoreCase(const String &s) const {
+    return len == s.len && strcasecmp(c_str(), s.c_str()) == 0;
+}
+
+bool String::startsWith(const String &prefix) const {
+    return prefix.len <= len && strncmp(c_str(), prefix.c_str(), prefix.len) == 0;
+}
+
+bool String::endsWith(const String &suffix) const {
+    return suffix.len <= len && strcmp(c_str() + len - suffix.len, suffix.c_str()) == 0;
+}
+
+char String::charAt(unsigned int index) const {
+    return operator[](index);
+}
+
+void String::setCharAt(unsigned int index, char c) {
+    if (index < len)
+        buffer[index] = c;
+}
+
+char String::operator[](unsigned int index) const {
+    return index < len ? buffer[index] : 0;
+}
+
+char &String::operator[](unsigned int index) {
+    static char dummy;
+    if (index >= len) {
+        dummy = 0;
+        return dummy;
+    }
+    return buffer[index];
+}
+
+void String::getBytes(unsigned char *buf, unsigned int bufsize, unsigned int index) const {
+    if (!bufsize || !buf)
+        return;
+    if (index >= len) {
+        buf[0] = 0;
+        return;
+    }
+    unsigned int n = bufsize - 1;
+    if (n > len - index)
+        n = len - index;
+    memcpy(buf, buffer + index, n);
+    buf[n] = 0;
+}
+
+int String::indexOf(char ch, unsigned int fromIndex) const {
+    if (fromIndex >= len)
+        return -1;
+    const char *found = strchr(buffer + fromIndex, ch);
+    return found ? found - buffer : -1;
+}
+
+int String::indexOf(const String &str, unsigned int fromIndex) const {
+    return indexOf(str.c_str(), fromIndex);
+}
+
+int String::indexOf(const char *str, unsigned int fromIndex) const {
+    if (fromIndex >= len)
+        return -1;
+    const char *found = strstr(buffer + fromIndex, str);
+    return found ? found - buffer : -1;
+}
+
+int String::lastIndexOf(char ch) const {
+    if (!len)
+        return -1;
+    const char *found = strrchr(buffer, ch);
+    return found ? found - buffer : -1;
+}
+
+String String::substring(unsigned int left, unsigned int right) const {
+    if (left > right) {
+        unsigned int tmp = left;
+        left = right;
+        right = tmp;
+    }
+    String out;
+    if (left >= len)
+        return out;
+    if (right > len)
+        right = len;
+    out.copy(buffer + left, right - left);
+    return out;
+}
+
+void String::replace(char find, char replace) {
+    for (unsigned int i = 0; i < len; i++) {
+        if (buffer[i] == find)
+            buffer[i] = replace;
+    }
+}
+
+void String::replace(const String &find, const String &replace) {
+    if (!len || !find.len)
+        return;
+
+    String out;
+    unsigned int pos = 0;
+    int found;
+    while ((found = indexOf(find, pos)) >= 0) {
+        out.concat(buffer + pos, found - pos);
+        out.concat(replace);
+        pos = found + find.len;
+    }
+    out.concat(buffer + pos, len - pos);
+    move(out);
+}
+
+void String::remove(unsigned int index) {
+    remove(index, (unsigned int)-1);
+}
+
+void String::remove(unsigned int index, unsigned int count) {
+    if (index >= len)
+        return;
+    if (count > len - index)
+        count = len - index;
+    memmove(buffer + index, buffer + index + count, len - index - count + 1);
+    len -= count;
+}
+
+void String::toLowerCase() {
+    for (unsigned int i = 0; i < len; i++)
+        buffer[i] = tolower(buffer[i]);
+}
+
+void String::toUpperCase() {
+    for (unsigned int i = 0; i < len; i++)
+        buffer[i] = toupper(buffer[i]);
+}
+
+void String::trim() {
+    if (!len)
+        return;
+    unsigned int begin = 0;
+    while (begin < len && isspace(buffer[begin]))
+        begin++;
+    unsigned int end = len;
+    while (end > begin && isspace(buffer[end - 1]))
+        end--;
+    len = end - begin;
+    memmove(buffer, buffer + begin, len);
+    buffer[len] = 0;
+}
+
+long String::toInt() const {
+    return atol(c_str());
+}
+
+float String::toFloat() const {
+    return atof(c_str());
+}
+
+double String::toDouble() const {
+    return atof(c_str());
+}
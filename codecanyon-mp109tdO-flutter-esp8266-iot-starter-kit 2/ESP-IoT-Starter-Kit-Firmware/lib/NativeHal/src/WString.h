@@ -0,0 +1,140 @@
+/**** Host build of the Arduino String class.
+Follows the ESP8266 core API closely enough for the firmware sources, including the
+StringSumHelper rules that make expressions like `Days + ":" + Hours` legal. Storage goes
+through malloc/realloc/free so the allocation counters of the host build see every String.
+*/
+#ifndef NATIVE_HAL_WSTRING_H
+#define NATIVE_HAL_WSTRING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+class __FlashStringHelper;
+class StringSumHelper;
+
+class String {
+  public:
+    String(const char *cstr = "");
+    String(const String &str);
+    String(String &&rval);
+    String(const __FlashStringHelper *str) : String(reinterpret_cast<const char *>(str)) {}
+    explicit String(char c);
+    explicit String(unsigned char value, unsigned char base = 10);
+    explicit String(int value, unsigned char base = 10);
+    explicit String(unsigned int value, unsigned char base = 10);
+    explicit String(long value, unsigned char base = 10);
+    explicit String(unsigned long value, unsigned char base = 10);
+    explicit String(long long value, unsigned char base = 10);
+    explicit String(unsigned long long value, unsigned char base = 10);
+    explicit String(float value, unsigned char decimalPlaces = 2);
+    explicit String(double value, unsigned char decimalPlaces = 2);
+    ~String();
+
+    bool reserve(unsigned int size);
+    unsigned int length() const { return len; }
+    bool isEmpty() const { return len == 0; }
+
+    String &operator=(const String &rhs);
+    String &operator=(String &&rval);
+    String &operator=(const char *cstr);
+    String &operator=(char c);
+
+    bool concat(const String &str);
+    bool concat(const char *cstr);
+    bool concat(const char *cstr, unsigned int length);
+    bool concat(char c);
+    bool concat(unsigned char num);
+    bool concat(int num);
+    bool concat(unsigned int num);
+    bool concat(long num);
+    bool concat(unsigned long num);
+    bool concat(long long num);
+    bool concat(unsigned long long num);
+    bool concat(float num);
+    bool concat(double num);
+
+    template <typename T>
+    String &operator+=(const T &rhs) {
+        concat(rhs);
+        return *this;
+    }
+
+    friend StringSumHelper &operator+(const StringSumHelper &lhs, const String &rhs);
+    friend StringSumHelper &operator+(const StringSumHelper &lhs, const char *cstr);
+    friend StringSumHelper &operator+(const StringSumHelper &lhs, char c);
+    friend StringSumHelper &operator+(const StringSumHelper &lhs, unsigned char num);
+    friend StringSumHelper &operator+(const StringSumHelper &lhs, int num);
+    friend StringSumHelper &operator+(const StringSumHelper &lhs, unsigned int num);
+    friend StringSumHelper &operator+(const StringSumHelper &lhs, long num);
+    friend StringSumHelper &operator+(const StringSumHelper &lhs, unsigned long num);
+    friend StringSumHelper &operator+(const StringSumHelper &lhs, float num);
+    friend StringSumHelper &operator+(const StringSumHelper &lhs, double num);
+
+    int compareTo(const String &s) const;
+    bool equals(const String &s) const;
+    bool equals(const char *cstr) const;
+    bool equalsIgnoreCase(const String &s) const;
+    bool operator==(const String &rhs) const { return equals(rhs); }
+    bool operator==(const char *cstr) const { return equals(cstr); }
+    bool operator!=(const String &rhs) const { return !equals(rhs); }
+    bool operator!=(const char *cstr) const { return !equals(cstr); }
+    bool operator<(const String &rhs) const { return compareTo(rhs) < 0; }
+    bool startsWith(const String &prefix) const;
+    bool endsWith(const String &suffix) const;
+
+    char charAt(unsigned int index) const;
+    void setCharAt(unsigned int index, char c);
+    char operator[](unsigned int index) const;
+    char &operator[](unsigned int index);
+    void getBytes(unsigned char *buf, unsigned int bufsize, unsigned int index = 0) const;
+    void toCharArray(char *buf, unsigned int bufsize, unsigned int index = 0) const {
+        getBytes((unsigned char *)buf, bufsize, index);
+    }
+    const char *c_str() const { return buffer ? buffer : ""; }
+    char *begin() { return buffer; }
+    char *end() { return buffer + len; }
+
+    int indexOf(char ch, unsigned int fromIndex = 0) const;
+    int indexOf(const String &str, unsigned int fromIndex = 0) const;
+    int indexOf(const char *str, unsigned int fromIndex = 0) const;
+    int lastIndexOf(char ch) const;
+    String substring(unsigned int beginIndex) const { return substring(beginIndex, len); }
+    String substring(unsigned int beginIndex, unsigned int endIndex) const;
+
+    void replace(char find, char replace);
+    void replace(const String &find, const String &replace);
+    void remove(unsigned int index);
+    void remove(unsigned int index, unsigned int count);
+    void toLowerCase();
+    void toUpperCase();
+    void trim();
+
+    long toInt() const;
+    float toFloat() const;
+    double toDouble() const;
+
+  protected:
+    char *buffer = nullptr;
+    unsigned int capacity = 0;
+    unsigned int len = 0;
+
+    void invalidate();
+    String &copy(const char *cstr, unsigned int length);
+    void move(String &rhs);
+};
+
+class StringSumHelper : public String {
+  public:
+    StringSumHelper(const String &s) : String(s) {}
+    StringSumHelper(const char *p) : String(p) {}
+    StringSumHelper(char c) : String(c) {}
+    StringSumHelper(unsigned char num) : String(num) {}
+    StringSumHelper(int num) : String(num) {}
+    StringSumHelper(unsigned int num) : String(num) {}
+    StringSumHelper(long num) : String(num) {}
+    StringSumHelper(unsigned long num) : String(num) {}
+    StringSumHelper(float num) : String(num) {}
+    StringSumHelper(double num) : String(num) {}
+};
+
+#endif
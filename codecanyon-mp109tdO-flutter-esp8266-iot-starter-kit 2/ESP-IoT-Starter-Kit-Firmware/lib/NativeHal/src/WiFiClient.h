@@ -0,0 +1,39 @@
+#ifndef NATIVE_HAL_WIFICLIENT_H
+#define NATIVE_HAL_WIFICLIENT_H
+
+#include "Client.h"
+
+// TCP client towards the loopback broker. Connecting blocks the virtual clock for the broker
+// connect time, or for the whole client timeout while the broker is offline, like lwIP does.
+class WiFiClient : public Client {
+  public:
+    WiFiClient() { _timeout = 5000; }
+
+    int connect(IPAddress ip, uint16_t port) override;
+    int connect(const char *host, uint16_t port) override;
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t *buffer, size_t size) override;
+    // bytes waiting from the broker, the loopback client reads them itself
+    int available() override;
+    int read() override { return -1; }
+    int read(uint8_t *buffer, size_t size) override {
+        (void)buffer;
+        (void)size;
+        return -1;
+    }
+    int peek() override { return -1; }
+    void flush() override {}
+    void stop() override { isConnected = false; }
+    uint8_t connected() override;
+    operator bool() override { return connected(); }
+
+    void setNoDelay(bool noDelay) { this->noDelay = noDelay; }
+    bool getNoDelay() const { return noDelay; }
+    size_t availableForWrite() { return 1460; }
+
+  private:
+    bool isConnected = false;
+    bool noDelay = false;
+};
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef NATIVE_HAL_WIFIMANAGER_H
+#define NATIVE_HAL_WIFIMANAGER_H
+
+#include <ESP8266WiFi.h>
+
+class WiFiManagerParameter {
+  public:
+    WiFiManagerParameter(const char *custom) : id(NULL), label(custom), length(0) { value[0] = 0; }
+    WiFiManagerParameter(const char *id, const char *label, const char *defaultValue, int length)
+        : id(id), label(label), length(length) {
+        strncpy(value, defaultValue ? defaultValue : "", sizeof(value) - 1);
+        value[sizeof(value) - 1] = 0;
+    }
+
+    const char *getID() const { return id; }
+    const char *getValue() const { return value; }
+    int getValueLength() const { return length; }
+
+  private:
+    const char *id;
+    const char *label;
+    int length;
+    char value[128];
+};
+
+// the captive portal never opens on the host, autoConnect() joins NativeHal::accessPoint
+// or gives up after the portal timeout
+class WiFiManager {
+  public:
+    bool autoConnect(const char *apName = NULL, const char *apPassword = NULL);
+    bool startConfigPortal(const char *apName = NULL, const char *apPassword = NULL);
+    void resetSettings() {}
+
+    void setAPCallback(void (*func)(WiFiManager *)) { apCallback = func; }
+    void setSaveConfigCallback(void (*func)()) { saveCallback = func; }
+    void setConfigPortalTimeout(unsigned long seconds) { portalTimeout = seconds; }
+    void setConnectTimeout(unsigned long seconds) { connectTimeout = seconds; }
+    bool addParameter(WiFiManagerParameter *p) {
+        (void)p;
+        return true;
+    }
+    String getConfigPortalSSID() { return String("native-ConfigAP"); }
+
+  private:
+    void (*apCallback)(WiFiManager *) = NULL;
+    void (*saveCallback)() = NULL;
+    unsigned long portalTimeout = 0;
+    unsigned long connectTimeout = 0;
+};
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef NATIVE_HAL_WIRE_H
+#define NATIVE_HAL_WIRE_H
+
+#include <Arduino.h>
+
+// I2C master like the ESP8266 core, transmissions go to the devices of NativeHal::i2c
+class TwoWire {
+  public:
+    void begin() {}
+    void begin(int sda, int scl) {}
+    void setClock(uint32_t frequency) {}
+
+    void beginTransmission(uint8_t address);
+    size_t write(uint8_t data);
+    size_t write(const uint8_t *data, size_t size);
+
+    // 0 on success, 2 when no device acknowledged the address
+    uint8_t endTransmission(bool sendStop = true);
+
+  private:
+    uint8_t address = 0;
+    uint8_t buffer[32];
+    size_t length = 0;
+};
+
+extern TwoWire Wire;
+
+#endif
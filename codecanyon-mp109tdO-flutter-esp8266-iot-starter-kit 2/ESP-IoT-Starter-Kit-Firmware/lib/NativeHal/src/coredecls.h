@@ -0,0 +1,14 @@
+#ifndef NATIVE_HAL_COREDECLS_H
+#define NATIVE_HAL_COREDECLS_H
+
+#include <Arduino.h>
+
+// called when the system time was set, with true when SNTP set it
+void settimeofday_cb(const std::function<void(bool)> &cb);
+
+extern "C" {
+// the sketch may define how often SNTP asks the server, the core default is one hour
+uint32_t sntp_update_delay_MS_rfc_not_less_than_15000();
+}
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef NATIVE_HAL_INTERRUPTS_H
+#define NATIVE_HAL_INTERRUPTS_H
+
+#include <Arduino.h>
+
+namespace esp8266 {
+
+// holds off interrupts for its scope on the device, the interrupts of the host build only run from
+// step(), so there is nothing to hold off
+class InterruptLock {
+  public:
+    InterruptLock() {
+        noInterrupts();
+    }
+
+    ~InterruptLock() {
+        interrupts();
+    }
+};
+
+}  // namespace esp8266
+
+#endif
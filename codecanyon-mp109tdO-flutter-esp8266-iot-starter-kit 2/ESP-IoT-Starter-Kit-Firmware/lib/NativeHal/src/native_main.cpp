@@ -0,0 +1,103 @@
+/**** Entry point of the host build.
+Runs the firmware like the ESP8266 core does, setup() once and loop() forever, against the
+simulated clock, pins, WiFi and loopback broker of NativeHal.
+
+  program [--loops N]      run N passes of loop() and print the cost per pass
+  program --bench [name]   run the registered benchmarks, or only the named one
+*/
+#include <Arduino.h>
+#include <time.h>
+
+#include "NativeHal.h"
+
+namespace NativeHal {
+
+NativeBench *firstBench();
+
+static uint32_t bootCount = 0;
+
+void boot() {
+    for (;;) {
+        try {
+            bootCount++;
+            setup();
+            return;
+        } catch (const Restart &) {
+            Serial.println("[native] restart");
+        } catch (const DeepSleep &sleep) {
+            advanceMicros(sleep.timeUs);
+        }
+    }
+}
+
+void step() {
+    try {
+        loop();
+        runTimers();
+    } catch (const Restart &) {
+        Serial.println("[native] restart");
+        boot();
+    } catch (const DeepSleep &sleep) {
+        advanceMicros(sleep.timeUs);
+        boot();
+    }
+}
+
+uint32_t boots() {
+    return bootCount;
+}
+
+}  // namespace NativeHal
+
+static uint64_t hostNanos() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int main(int argc, char **argv) {
+    long loops = 10000;
+    bool bench = false;
+    const char *benchName = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--loops") == 0 && i + 1 < argc) {
+            loops = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--bench") == 0) {
+            bench = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+                benchName = argv[++i];
+        }
+    }
+
+    if (bench) {
+        int ran = 0;
+        for (NativeHal::NativeBench *b = NativeHal::firstBench(); b; b = b->next) {
+            if (benchName && strcmp(benchName, b->name) != 0)
+                continue;
+            printf("\n===== bench: %s =====\n", b->name);
+            b->run();
+            ran++;
+        }
+        return (ran && NativeHal::failures() == 0) ? 0 : 1;
+    }
+
+    NativeHal::boot();
+
+    uint64_t total = 0, worst = 0;
+    NativeHal::HeapCounters before = NativeHal::heapCounters();
+    for (long i = 0; i < loops; i++) {
+        uint64_t start = hostNanos();
+        NativeHal::step();
+        uint64_t elapsed = hostNanos() - start;
+        total += elapsed;
+        if (elapsed > worst)
+            worst = elapsed;
+    }
+    NativeHal::HeapCounters after = NativeHal::heapCounters();
+
+    printf("\n[native] %ld loops, %lu ms device time, %.0f ns/loop avg, %lu ns worst, %.2f allocations/loop\n", loops,
+           millis(), loops ? (double)total / loops : 0.0, (unsigned long)worst,
+           loops ? (double)(after.allocations - before.allocations) / loops : 0.0);
+    return 0;
+}
@@ -0,0 +1,201 @@
+/**** A list of MQTT commands received in one message, run in order.
+The list is copied and split in place, so it can wait between commands and go on from a scheduled
+task. Commands are separated by ';' or a new line, and each is the last level of its command topic
+and its payload. A command that starts with "+<ms>" waits that long after the previous one:
+
+  port2 open; beeper beep; +1500 port2 close; sensor_data data
+
+`next()` hands out one command at a time, or tells to wait, and the result of every command is
+collected for one reply at the end.
+
+void runBatch()
+{
+  CommandBatch::Command command;
+  for (;;) {
+    switch (batch.next(command)) {
+      case CommandBatch::STEP_COMMAND:
+        batch.add(run(command.name, command.payload, command.payloadLength));
+        break;
+      case CommandBatch::STEP_WAIT:
+        scheduler.after(runBatch, command.delayMs);
+        return;
+      case CommandBatch::STEP_END:
+        batch.printJson(Serial);
+        return;
+    }
+  }
+}
+*/
+#ifndef COMMAND_BATCH_CPP
+#define COMMAND_BATCH_CPP
+
+#include <Arduino.h>
+
+struct CommandBatch {
+    // an MQTT packet of the client
+    static const uint16_t capacity = 256;
+    static const uint8_t maxCommands = 16;
+
+    // longest wait before a single command
+    static const uint32_t maxDelayMs = 60000;
+
+    enum Result : uint8_t {
+        RESULT_OK,
+        RESULT_UNKNOWN,    // no such command
+        RESULT_INVALID,    // the command rejected its payload, or the wait is too long
+        RESULT_CANCELLED,  // a newer batch arrived while this one was waiting
+        RESULT_COUNT
+    };
+
+    enum Step : uint8_t {
+        STEP_COMMAND,
+        STEP_WAIT,
+        STEP_END
+    };
+
+    struct Command {
+        const char *name;
+        const byte *payload;
+        unsigned int payloadLength;
+        uint32_t delayMs;
+    };
+
+    char text[capacity + 1];
+    uint16_t length = 0;
+    uint16_t cursor = 0;
+
+    uint8_t results[maxCommands];
+    uint8_t count = 0;
+    uint8_t failed = 0;
+
+    bool isRunning = false;
+    bool hasWaited = false;
+
+    // copy the list, false when it is too long or has too many commands
+    bool begin(const byte *payload, unsigned int payloadLength) {
+        isRunning = false;
+        if (payloadLength > capacity)
+            return false;
+
+        memcpy(text, payload, payloadLength);
+        text[payloadLength] = 0;
+        length = payloadLength;
+        cursor = 0;
+        count = 0;
+        failed = 0;
+        hasWaited = false;
+
+        uint8_t commands = 0;
+        bool isCommand = false;
+        for (uint16_t i = 0; i < length; i++) {
+            if (text[i] == ';' || text[i] == '\n' || text[i] == 0) {
+                text[i] = 0;
+                isCommand = false;
+            } else if (!isCommand && !isspace((uint8_t)text[i])) {
+                isCommand = true;
+                commands++;
+            }
+        }
+        if (commands == 0 || commands > maxCommands)
+            return false;
+
+        isRunning = true;
+        return true;
+    }
+
+    Step next(Command &command) {
+        while (cursor < length) {
+            char *item = text + cursor;
+            size_t itemLength = strlen(item);
+            char *end = item + itemLength;
+
+            while (item < end && isspace((uint8_t)*item))
+                item++;
+            while (end > item && isspace((uint8_t)end[-1]))
+                end--;
+            *end = 0;
+
+            if (item == end) {
+                cursor += itemLength + 1;
+                continue;
+            }
+
+            // "+<ms>" waits first, the command is read again after the wait
+            command.delayMs = 0;
+            if (*item == '+') {
+                char *number = item + 1;
+                command.delayMs = strtoul(number, &item, 10);
+                if (item == number || command.delayMs > maxDelayMs) {
+                    add(RESULT_INVALID);
+                    cursor += itemLength + 1;
+                    continue;
+                }
+                while (isspace((uint8_t)*item))
+                    item++;
+
+                if (!hasWaited && command.delayMs > 0) {
+                    hasWaited = true;
+                    return STEP_WAIT;
+                }
+            }
+            hasWaited = false;
+            cursor += itemLength + 1;
+
+            // "<name> <payload>"
+            char *separator = item;
+            while (*separator && !isspace((uint8_t)*separator))
+                separator++;
+            char *payload = separator;
+            while (isspace((uint8_t)*payload))
+                payload++;
+            *separator = 0;
+
+            command.name = item;
+            command.payload = (const byte *)payload;
+            command.payloadLength = end - payload;
+            return STEP_COMMAND;
+        }
+
+        isRunning = false;
+        return STEP_END;
+    }
+
+    void add(Result result) {
+        if (count < maxCommands)
+            results[count++] = result;
+        if (result != RESULT_OK)
+            failed++;
+    }
+
+    // the commands that did not run yet
+    void cancel() {
+        Command command;
+        for (;;) {
+            // read past the waits
+            hasWaited = true;
+            if (next(command) == STEP_END)
+                return;
+            add(RESULT_CANCELLED);
+        }
+    }
+
+    // {"commands":3,"failed":1,"results":["ok","unknown","ok"]}
+    size_t printJson(Print &out) const {
+        static const char *const names[RESULT_COUNT] = {"ok", "unknown", "invalid", "cancelled"};
+
+        size_t n = out.print("{\"commands\":");
+        n += out.print(count);
+        n += out.print(",\"failed\":");
+        n += out.print(failed);
+        n += out.print(",\"results\":[");
+        for (uint8_t i = 0; i < count; i++) {
+            n += out.print(i ? ",\"" : "\"");
+            n += out.print(names[results[i]]);
+            n += out.print('"');
+        }
+        n += out.print("]}");
+        return n;
+    }
+};
+
+#endif
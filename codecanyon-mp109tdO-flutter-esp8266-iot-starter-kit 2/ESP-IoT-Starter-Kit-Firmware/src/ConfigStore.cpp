@@ -0,0 +1,90 @@
+/**** Settings kept as one binary record in the EEPROM sector of the flash.
+The record is the settings struct itself with a header (magic, version, size) and a CRC32 over
+both. `load()` checks the record in place in the EEPROM buffer and copies the settings out with a
+single memcpy, there is no parsing. A record of another version or size, an erased sector or a
+corrupted one is rejected, the caller then falls back to defaults or imports older settings.
+
+struct Settings {
+  char server[40];
+  uint16_t port;
+};
+
+Settings settings = {"broker.example.com", 1883};
+ConfigStore<Settings> store(1);
+
+void setup()
+{
+  if (!store.load(settings))
+    store.save(settings);
+}
+*/
+#ifndef CONFIG_STORE_CPP
+#define CONFIG_STORE_CPP
+
+#include <Arduino.h>
+#include <EEPROM.h>
+
+// CRC-32 (IEEE 802.3), bitwise, records are small
+inline uint32_t crc32(const void *data, size_t length, uint32_t crc = 0) {
+    const uint8_t *bytes = (const uint8_t *)data;
+    crc = ~crc;
+    while (length--) {
+        crc ^= *bytes++;
+        for (uint8_t bit = 0; bit < 8; bit++)
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+    return ~crc;
+}
+
+template <typename T>
+struct ConfigStore {
+    static const uint32_t magic = 0x47464345;  // "ECFG"
+
+    struct Record {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t size;
+        T data;
+        uint32_t crc;  // over everything before it
+    };
+
+    // change when T changes, older records are then rejected
+    const uint16_t version;
+
+    ConfigStore(uint16_t version) : version(version) {
+    }
+
+    bool load(T &data) const {
+        EEPROM.begin(sizeof(Record));
+
+        const Record *record = (const Record *)EEPROM.getConstDataPtr();
+        bool isValid = isValidRecord(record);
+        if (isValid)
+            memcpy(&data, &record->data, sizeof(T));
+
+        EEPROM.end();
+        return isValid;
+    }
+
+    bool save(const T &data) const {
+        EEPROM.begin(sizeof(Record));
+
+        Record *record = (Record *)EEPROM.getDataPtr();
+        record->magic = magic;
+        record->version = version;
+        record->size = sizeof(Record);
+        memcpy(&record->data, &data, sizeof(T));
+        record->crc = crc32(record, offsetof(Record, crc));
+
+        bool isSaved = EEPROM.commit();
+        EEPROM.end();
+        return isSaved;
+    }
+
+    bool isValidRecord(const Record *record) const {
+        return record->magic == magic && record->version == version && record->size == sizeof(Record) &&
+               record->crc == crc32(record, offsetof(Record, crc));
+    }
+};
+
+#endif
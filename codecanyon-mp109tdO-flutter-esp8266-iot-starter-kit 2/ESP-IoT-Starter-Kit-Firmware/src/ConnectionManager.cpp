@@ -0,0 +1,344 @@
+/**** Non-blocking WiFi and MQTT (re)connection state machine.
+Call `loop()` on every pass of the main loop. Each call does at most one bounded step: check the
+WiFi association, resolve the broker, or try one MQTT connect. Failed steps are retried after a
+jittered exponential backoff, so a broker outage costs one short connect attempt every few
+seconds instead of stalling the whole loop. The DNS lookup is a step of its own, limited to
+`budgetMs`. The MQTT connect cannot be split, PubSubClient opens the TCP connection and waits for
+CONNACK in one call, each limited to `budgetMs` by the client timeouts.
+
+The access point (BSSID, channel) and the DHCP lease of the last association are kept in RTC
+memory, which survives a reset and deep sleep. The next association goes straight to that access
+point with the leased address, without a scan and without DHCP, and falls back to the full
+association when it does not connect within `fastTimeout`.
+
+bool connectBroker(IPAddress ip)
+{
+  mqttClient.setServer(ip, 1883);
+  return mqttClient.connect("client-id");
+}
+
+ConnectionManager connection(connectBroker, onConnectionChange, 1000);
+
+void setup()
+{
+  connection.begin(mqttServer);
+}
+
+void loop()
+{
+  connection.loop();
+  if (connection.state == ConnectionManager::STATE_ONLINE)
+    mqttClient.loop();
+}
+*/
+#ifndef CONNECTION_MANAGER_CPP
+#define CONNECTION_MANAGER_CPP
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+
+#include "ConfigStore.cpp"
+
+// exponential backoff with "equal jitter": half of the delay is fixed, the other half random,
+// so devices that lost the broker together do not all come back in the same second
+struct Backoff {
+    const uint32_t minDelay;
+    const uint32_t maxDelay;
+    uint32_t current;
+
+    Backoff(uint32_t minDelay, uint32_t maxDelay) : minDelay(minDelay), maxDelay(maxDelay), current(minDelay) {
+    }
+
+    uint32_t next() {
+        uint32_t delay = current / 2 + random(current / 2 + 1);
+        current = current < maxDelay / 2 ? current * 2 : maxDelay;
+        return delay;
+    }
+
+    void reset() {
+        current = minDelay;
+    }
+};
+
+// access point and DHCP lease of the last association, in RTC user memory
+struct WiFiCache {
+    static const uint32_t magic = 0x43465749;  // "IWFC"
+
+    // RTC user memory blocks 0-7
+    static const uint32_t rtcOffset = 0;
+
+    struct Record {
+        uint32_t magic;
+        uint32_t ip;
+        uint32_t gateway;
+        uint32_t subnet;
+        uint32_t dns;
+        uint8_t bssid[6];
+        uint8_t channel;
+        uint8_t reserved;
+        uint32_t crc;  // over everything before it
+    };
+
+    Record record;
+    bool isValid = false;
+
+    // a cold boot leaves random data, the CRC rejects it
+    bool load() {
+        isValid = ESP.rtcUserMemoryRead(rtcOffset, (uint32_t *)&record, sizeof(record)) && record.magic == magic &&
+                  record.crc == crc32(&record, offsetof(Record, crc));
+        return isValid;
+    }
+
+    // remember the current association, RTC memory is only written when it changed
+    void save() {
+        Record current;
+        memset(&current, 0, sizeof(current));
+        current.magic = magic;
+        current.ip = WiFi.localIP();
+        current.gateway = WiFi.gatewayIP();
+        current.subnet = WiFi.subnetMask();
+        current.dns = WiFi.dnsIP(0);
+        memcpy(current.bssid, WiFi.BSSID(), sizeof(current.bssid));
+        current.channel = WiFi.channel();
+        current.crc = crc32(&current, offsetof(Record, crc));
+
+        if (isValid && memcmp(&current, &record, sizeof(record)) == 0)
+            return;
+
+        record = current;
+        isValid = ESP.rtcUserMemoryWrite(rtcOffset, (uint32_t *)&record, sizeof(record));
+    }
+
+    void invalidate() {
+        isValid = false;
+        record.magic = 0;
+        ESP.rtcUserMemoryWrite(rtcOffset, (uint32_t *)&record, sizeof(record));
+    }
+
+    // associate with the cached access point and address
+    void begin(const char *ssid, const char *psk) {
+        WiFi.config(IPAddress(record.ip), IPAddress(record.gateway), IPAddress(record.subnet), IPAddress(record.dns));
+        WiFi.begin(ssid, psk, record.channel, record.bssid);
+    }
+};
+
+struct ConnectionManager {
+    enum State : uint8_t {
+        STATE_WIFI_CONNECTING,
+        STATE_WIFI_BACKOFF,
+        STATE_BROKER_BACKOFF,
+        STATE_ONLINE
+    };
+
+    typedef bool (*ConnectFunction)(IPAddress ip);
+    typedef void (*StateFunction)(State state);
+
+    const ConnectFunction connectBroker;
+    const StateFunction onStateChange;
+    const uint32_t budgetMs;
+
+    // association timeout before WiFi is restarted
+    const uint32_t wifiTimeout = 15000;
+
+    // an association with the cached access point takes a few hundred ms, else the cache is stale
+    const uint32_t fastTimeout = 2000;
+
+    State state = STATE_WIFI_CONNECTING;
+    State previousState = STATE_WIFI_CONNECTING;
+    const char *server = "";
+    IPAddress serverIP;
+
+    // credentials stored by the config portal, WiFi.disconnect() clears those of the station
+    char ssid[33] = "";
+    char psk[65] = "";
+
+    Backoff wifiBackoff{1000, 60000};
+    Backoff mqttBackoff{500, 30000};
+
+    WiFiCache wifiCache;
+    bool isFastAssociation = false;
+
+    uint32_t stateTime = 0;
+    uint32_t waitTime = 0;
+
+    // statistics of the current outage, the longest step is the worst loop stall it caused
+    uint32_t attempts = 0;
+    uint32_t longestStepMs = 0;
+
+    // time the radio searched for the access point, and from begin() or a lost connection to online
+    uint32_t associateTime = 0;
+    uint32_t associationMs = 0;
+    uint32_t outageTime = 0;
+    uint32_t outageMs = 0;
+    uint32_t fastAssociations = 0;
+    uint32_t fullAssociations = 0;
+
+    ConnectionManager(ConnectFunction connectBroker, StateFunction onStateChange, uint32_t budgetMs)
+        : connectBroker(connectBroker), onStateChange(onStateChange), budgetMs(budgetMs) {
+    }
+
+    void begin(const char *mqttServer) {
+        server = mqttServer;
+        serverIP = IPAddress();
+
+        strlcpy(ssid, WiFi.SSID().c_str(), sizeof(ssid));
+        strlcpy(psk, WiFi.psk().c_str(), sizeof(psk));
+
+        // the fast association changes channel and BSSID of the station, keep that out of flash
+        WiFi.persistent(false);
+        WiFi.mode(WIFI_STA);
+        WiFi.setAutoReconnect(false);
+        wifiCache.load();
+        associate(true);
+
+        state = STATE_WIFI_CONNECTING;
+        stateTime = millis();
+        outageTime = stateTime;
+        if (onStateChange)
+            onStateChange(state);
+    }
+
+    bool isConnected() const {
+        return state == STATE_ONLINE;
+    }
+
+    void loop() {
+        uint32_t now = millis();
+
+        switch (state) {
+            case STATE_WIFI_CONNECTING:
+                if (WiFi.status() == WL_CONNECTED) {
+                    associationMs = now - associateTime;
+                    if (isFastAssociation) {
+                        fastAssociations++;
+                    } else {
+                        fullAssociations++;
+                        wifiCache.save();
+                    }
+                    wifiBackoff.reset();
+                    setState(STATE_BROKER_BACKOFF, 0);
+                } else if (isFastAssociation && now - associateTime >= fastTimeout) {
+                    // the access point changed channel or is down, scan, the cache is replaced once it connects
+                    WiFi.disconnect();
+                    associate(false);
+                    stateTime = now;
+                } else if (now - stateTime >= wifiTimeout) {
+                    WiFi.disconnect();
+                    setState(STATE_WIFI_BACKOFF, wifiBackoff.next());
+                }
+                break;
+
+            case STATE_WIFI_BACKOFF:
+                if (now - stateTime >= waitTime) {
+                    associate(true);
+                    setState(STATE_WIFI_CONNECTING, 0);
+                }
+                break;
+
+            case STATE_BROKER_BACKOFF:
+                if (WiFi.status() != WL_CONNECTED) {
+                    associate(true);
+                    setState(STATE_WIFI_CONNECTING, 0);
+                } else if (now - stateTime >= waitTime) {
+                    tryConnect();
+                }
+                break;
+
+            case STATE_ONLINE:
+                if (WiFi.status() != WL_CONNECTED) {
+                    associate(true);
+                    setState(STATE_WIFI_CONNECTING, 0);
+                }
+                break;
+        }
+    }
+
+    // milliseconds until a backoff ends, for the idle sleep of the main loop; the association is
+    // only watched, the idle cap of the loop covers it
+    uint32_t timeToNext() const {
+        if (state != STATE_WIFI_BACKOFF && state != STATE_BROKER_BACKOFF)
+            return UINT32_MAX;
+        uint32_t elapsed = millis() - stateTime;
+        return elapsed < waitTime ? waitTime - elapsed : 0;
+    }
+
+    // the cached access point first, a scan and DHCP without a cache or when it failed
+    void associate(bool isCacheUsed) {
+        isFastAssociation = isCacheUsed && wifiCache.isValid;
+        associateTime = millis();
+
+        if (isFastAssociation) {
+            wifiCache.begin(ssid, psk);
+        } else {
+            WiFi.config(IPAddress(), IPAddress(), IPAddress());
+            WiFi.begin(ssid, psk);
+        }
+    }
+
+    // call when the MQTT client reports a lost connection
+    void disconnected() {
+        if (state == STATE_ONLINE)
+            setState(STATE_BROKER_BACKOFF, mqttBackoff.next());
+    }
+
+    // resolve the broker, or connect to its address, in separate passes of loop()
+    void tryConnect() {
+        uint32_t start = millis();
+
+        // resolve once and keep the address, re-resolve after a failed connect
+        if (!serverIP.isSet()) {
+            bool resolved = WiFi.hostByName(server, serverIP, budgetMs) == 1;
+            countStep(start);
+            if (resolved) {
+                // connect on the next pass
+                setState(STATE_BROKER_BACKOFF, 0);
+            } else {
+                // without name resolution the cached lease may be taken, get a new one next time
+                wifiCache.invalidate();
+                serverIP = IPAddress();
+                setState(STATE_BROKER_BACKOFF, mqttBackoff.next());
+            }
+            return;
+        }
+
+        attempts++;
+        bool connected = connectBroker(serverIP);
+        countStep(start);
+
+        if (connected) {
+            mqttBackoff.reset();
+            outageMs = millis() - outageTime;
+            setState(STATE_ONLINE, 0);
+
+            // statistics cover one outage
+            attempts = 0;
+            longestStepMs = 0;
+        } else {
+            serverIP = IPAddress();
+            setState(STATE_BROKER_BACKOFF, mqttBackoff.next());
+        }
+    }
+
+    void countStep(uint32_t start) {
+        uint32_t elapsed = millis() - start;
+        if (elapsed > longestStepMs)
+            longestStepMs = elapsed;
+    }
+
+    void setState(State newState, uint32_t wait) {
+        stateTime = millis();
+        waitTime = wait;
+        if (newState == state)
+            return;
+
+        if (state == STATE_ONLINE)
+            outageTime = stateTime;
+
+        previousState = state;
+        state = newState;
+        if (onStateChange)
+            onStateChange(state);
+    }
+};
+
+#endif
@@ -0,0 +1,174 @@
+/**** DHT22 (AM2302) reader that never blocks the loop.
+`start()` sends the 1.1 ms start pulse and releases the data line. The 5 ms pulse train of the
+reading is captured by a falling edge interrupt that only stores timestamps. `loop()` decodes the
+timestamps once all edges arrived, or gives up after a timeout, and reports the result to the
+read function. A valid sample stays current for the 2 seconds the sensor needs between two
+measurements, `isFresh()` tells when it can be used without measuring again.
+
+void onRead(bool isValid)
+{
+  if (isValid)
+    Serial.println(sensor.temperature);
+}
+
+Dht22 sensor(12, onRead);
+
+void setup()
+{
+  sensor.begin();
+  sensor.start();
+}
+
+void loop()
+{
+  sensor.loop();
+}
+*/
+#ifndef DHT22_CPP
+#define DHT22_CPP
+
+#include <Arduino.h>
+
+struct Dht22 {
+    typedef void (*ReadFunction)(bool isValid);
+
+    // falling edges of a reading: the response, the start of the data, and the end of every bit
+    static const uint8_t edgeCount = 42;
+
+    // the sensor measures at most every 2 seconds
+    static const uint32_t refreshInterval = 2000;
+
+    static const uint16_t startPulseUs = 1100;
+    static const uint16_t timeoutMs = 10;
+
+    // a bit is 50 us low and 26-28 us (0) or 70 us (1) high, measured from falling edge to falling edge
+    static const uint16_t minBitUs = 60;
+    static const uint16_t oneBitUs = 100;
+    static const uint16_t maxBitUs = 160;
+
+    const uint8_t pin;
+    const ReadFunction onRead;
+
+    volatile uint32_t edges[edgeCount];
+    volatile uint8_t edgeIndex = 0;
+
+    bool isMeasuring = false;
+    bool isRequested = false;
+    bool hasStarted = false;
+    uint32_t startTime = 0;
+
+    // last valid sample
+    float temperature = NAN;
+    float humidity = NAN;
+    bool hasSample = false;
+    uint32_t sampleTime = 0;
+
+    uint32_t failures = 0;
+
+    Dht22(uint8_t pin, ReadFunction onRead) : pin(pin), onRead(onRead) {
+    }
+
+    void begin() {
+        pinMode(pin, INPUT_PULLUP);
+    }
+
+    // the last sample is younger than the sensor's refresh interval
+    bool isFresh() const {
+        return hasSample && millis() - sampleTime < refreshInterval;
+    }
+
+    // measure as soon as the sensor is ready, requests during a measurement share its result
+    void start() {
+        if (isMeasuring)
+            return;
+
+        if (hasStarted && millis() - startTime < refreshInterval) {
+            isRequested = true;
+            return;
+        }
+
+        isRequested = false;
+        isMeasuring = true;
+        hasStarted = true;
+        startTime = millis();
+        edgeIndex = 0;
+
+        // the only busy wait: the start pulse, interrupts stay enabled
+        pinMode(pin, OUTPUT);
+        digitalWrite(pin, LOW);
+        delayMicroseconds(startPulseUs);
+
+        attachInterruptArg(digitalPinToInterrupt(pin), onEdge, this, FALLING);
+        pinMode(pin, INPUT_PULLUP);
+    }
+
+    void loop() {
+        if (isMeasuring) {
+            if (edgeIndex < edgeCount && millis() - startTime < timeoutMs)
+                return;
+            finish();
+        } else if (isRequested && millis() - startTime >= refreshInterval) {
+            start();
+        }
+    }
+
+    // milliseconds until loop() has work, for the idle sleep of the main loop
+    uint32_t timeToNext() const {
+        uint32_t elapsed = millis() - startTime;
+        if (isMeasuring)
+            return edgeIndex >= edgeCount || elapsed >= timeoutMs ? 0 : timeoutMs - elapsed;
+        if (isRequested)
+            return elapsed >= refreshInterval ? 0 : refreshInterval - elapsed;
+        return UINT32_MAX;
+    }
+
+    static void IRAM_ATTR onEdge(void *arg) {
+        Dht22 *sensor = (Dht22 *)arg;
+        if (sensor->edgeIndex < edgeCount)
+            sensor->edges[sensor->edgeIndex++] = micros();
+    }
+
+    void finish() {
+        detachInterrupt(digitalPinToInterrupt(pin));
+        isMeasuring = false;
+
+        bool isValid = decode();
+        if (isValid) {
+            hasSample = true;
+            sampleTime = startTime;
+        } else {
+            failures++;
+        }
+
+        if (onRead)
+            onRead(isValid);
+    }
+
+    bool decode() {
+        if (edgeIndex < edgeCount)
+            return false;
+
+        uint8_t data[5] = {0, 0, 0, 0, 0};
+        for (uint8_t i = 0; i < 40; i++) {
+            uint32_t period = edges[i + 2] - edges[i + 1];
+            if (period < minBitUs || period > maxBitUs)
+                return false;
+
+            data[i / 8] <<= 1;
+            if (period > oneBitUs)
+                data[i / 8] |= 1;
+        }
+
+        if (((data[0] + data[1] + data[2] + data[3]) & 0xff) != data[4])
+            return false;
+
+        // tenths of a percent, tenths of a degree with a sign bit
+        humidity = ((data[0] << 8) | data[1]) * 0.1f;
+        temperature = (((data[2] & 0x7f) << 8) | data[3]) * 0.1f;
+        if (data[2] & 0x80)
+            temperature = -temperature;
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,357 @@
+/**** Dimmable PWM outputs, faded through keyframe sequences at a fixed frame rate.
+A sequence is a list of keyframes, each a level from 0 to 255, the time to fade to it from the one
+before and the easing curve of the fade, and it plays once or repeats. Levels are perceived
+brightness: a gamma table maps them to the PWM duty, so a fade looks even over its whole range
+instead of jumping at the dark end. The table is built once at begin(), the frames only look it up.
+
+The frames are run by a Ticker, which only runs while a channel fades. A frame computes the level
+of every channel from millis() in 16.16 fixed point, without floats, with one division per
+keyframe for its rate. It writes a channel only when its duty changed, so a late frame costs no
+timing, the fade is just where its time says. The cost of every frame is measured, and frames
+over frameBudgetUs are counted.
+
+Sequences are written as text, keyframes separated by ',', "repeat" at the end repeats them:
+
+  128                                   // jump to 128
+  255 1500                              // fade to 255 in 1.5 s, linear
+  255 800 in-out, 20 1200 out, repeat   // breathe
+
+FadeEngine<2> fades(dimmerPins, 20);  // 50 frames per second
+
+void setup()
+{
+  fades.begin();
+
+  FadeSequence sequence;
+  if (sequence.parse("255 800 in-out, 20 1200 out, repeat", 35))
+    fades.play(0, sequence);
+}
+*/
+#ifndef FADE_ENGINE_CPP
+#define FADE_ENGINE_CPP
+
+#include <Arduino.h>
+#include <Ticker.h>
+
+enum FadeEasing : uint8_t {
+    FADE_LINEAR,
+    FADE_IN,      // starts slow
+    FADE_OUT,     // ends slow
+    FADE_IN_OUT,  // starts and ends slow
+    FADE_EASING_COUNT
+};
+
+struct FadeKeyframe {
+    uint8_t level;    // perceived brightness, 0 to 255
+    uint8_t easing;   // FadeEasing
+    uint16_t timeMs;  // to fade from the keyframe before, 0 jumps
+};
+
+struct FadeSequence {
+    static const uint8_t maxKeyframes = 8;
+
+    FadeKeyframe keyframes[maxKeyframes];
+    uint8_t count = 0;
+    bool isRepeating = false;
+
+    // the length of one pass through all keyframes
+    uint32_t cycleMs() const {
+        uint32_t total = 0;
+        for (uint8_t i = 0; i < count; i++)
+            total += keyframes[i].timeMs;
+        return total;
+    }
+
+    // "level [time] [easing], ..., [repeat]", false for anything else
+    bool parse(const char *text, size_t length) {
+        static const char *const easings[FADE_EASING_COUNT] = {"linear", "in", "out", "in-out"};
+
+        const char *end = text + length;
+        count = 0;
+        isRepeating = false;
+
+        for (;;) {
+            FadeKeyframe keyframe = {0, FADE_LINEAR, 0};
+            uint8_t fields = 0;
+
+            const char *word;
+            size_t wordLength;
+            while (readWord(text, end, word, wordLength)) {
+                uint32_t value;
+                if (fields == 0 && isWord(word, wordLength, "repeat")) {
+                    isRepeating = true;
+                    fields = 3;
+                } else if (fields == 0 && readNumber(word, wordLength, value) && value <= 255) {
+                    keyframe.level = value;
+                    fields = 1;
+                } else if (fields == 1 && readNumber(word, wordLength, value) && value <= UINT16_MAX) {
+                    keyframe.timeMs = value;
+                    fields = 2;
+                } else if (fields == 1 || fields == 2) {
+                    uint8_t easing = 0;
+                    while (easing < FADE_EASING_COUNT && !isWord(word, wordLength, easings[easing]))
+                        easing++;
+                    if (easing == FADE_EASING_COUNT)
+                        return false;
+                    keyframe.easing = easing;
+                    fields = 3;
+                } else {
+                    return false;
+                }
+            }
+
+            // "repeat" ends the sequence
+            if (isRepeating)
+                return text == end && count > 0;
+            if (fields == 0 || count == maxKeyframes)
+                return false;
+            keyframes[count++] = keyframe;
+
+            if (text == end)
+                return true;
+            text++;  // ','
+        }
+    }
+
+    // the next word before a ',' or the end, moves text past it
+    static bool readWord(const char *&text, const char *end, const char *&word, size_t &wordLength) {
+        while (text < end && *text == ' ')
+            text++;
+        word = text;
+        while (text < end && *text != ' ' && *text != ',')
+            text++;
+        wordLength = text - word;
+        while (text < end && *text == ' ')
+            text++;
+        return wordLength > 0;
+    }
+
+    static bool readNumber(const char *word, size_t wordLength, uint32_t &value) {
+        if (wordLength == 0 || wordLength > 5)
+            return false;
+        value = 0;
+        for (size_t i = 0; i < wordLength; i++) {
+            if (word[i] < '0' || word[i] > '9')
+                return false;
+            value = value * 10 + (word[i] - '0');
+        }
+        return true;
+    }
+
+    static bool isWord(const char *word, size_t wordLength, const char *expected) {
+        return strlen(expected) == wordLength && memcmp(word, expected, wordLength) == 0;
+    }
+};
+
+template <uint8_t Channels>
+struct FadeEngine {
+    // PWM duty of a level of 255
+    static const uint16_t pwmRange = 1023;
+    // exponent of the gamma curve from perceived brightness to duty
+    static constexpr float gammaExponent = 2.2f;
+    // a frame longer than this takes too much from the network stack
+    static const uint32_t frameBudgetUs = 1000;
+
+    struct Channel {
+        FadeSequence sequence;
+        uint32_t cycleMs;
+        uint8_t index;   // the keyframe faded to, sequence.count while idle
+        uint16_t from;   // level at the start of the keyframe, 8.8 fixed point
+        uint16_t level;  // level now, 8.8 fixed point
+        uint16_t duty;
+        uint32_t start;  // millis() at the start of the keyframe
+        uint32_t rate;   // 2^24 / time of the keyframe, elapsed * rate is its progress in 8.24
+    };
+
+    const uint8_t *pins;
+    const uint32_t frameMs;
+
+    Channel channels[Channels];
+    // duty of every level, with 4 fractional bits, and one more entry to interpolate the last level
+    uint16_t dutyOfLevel[257];
+
+    Ticker ticker;
+    uint32_t cyclesPerUs = 80;
+
+    // frames run, their total and longest time, and the frames over frameBudgetUs
+    uint32_t frames = 0;
+    uint64_t frameUs = 0;
+    uint32_t maxFrameUs = 0;
+    uint32_t overruns = 0;
+
+    FadeEngine(const uint8_t *pins, uint32_t frameMs) : pins(pins), frameMs(frameMs) {
+        for (Channel &channel : channels) {
+            channel.index = 0;
+            channel.from = 0;
+            channel.level = 0;
+            channel.duty = 0;
+        }
+    }
+
+    void begin() {
+        cyclesPerUs = ESP.getCpuFreqMHz();
+        for (uint16_t i = 0; i < 256; i++)
+            dutyOfLevel[i] = lroundf(powf(i / 255.0f, gammaExponent) * pwmRange * 16);
+        dutyOfLevel[256] = dutyOfLevel[255];
+
+        analogWriteRange(pwmRange);
+        for (uint8_t i = 0; i < Channels; i++) {
+            pinMode(pins[i], OUTPUT);
+            analogWrite(pins[i], 0);
+        }
+    }
+
+    // fade a channel through a sequence, from the level it is at; false for a sequence that
+    // repeats without taking any time
+    bool play(uint8_t channel, const FadeSequence &sequence) {
+        if (sequence.count == 0 || (sequence.isRepeating && sequence.cycleMs() == 0))
+            return false;
+
+        Channel &target = channels[channel];
+        target.sequence = sequence;
+        target.cycleMs = sequence.cycleMs();
+        target.index = 0;
+        target.from = target.level;
+        target.start = millis();
+        target.rate = rateOf(sequence.keyframes[0].timeMs);
+
+        // keyframes that jump are shown right away
+        if (step(channel, target.start) && !ticker.active())
+            ticker.attach_ms(frameMs, [this]() { frame(millis()); });
+        return true;
+    }
+
+    // keep the level the channel is at
+    void stop(uint8_t channel) {
+        channels[channel].index = channels[channel].sequence.count;
+    }
+
+    bool isFading(uint8_t channel) const {
+        return channels[channel].index < channels[channel].sequence.count;
+    }
+
+    // perceived brightness, 0 to 255
+    uint8_t level(uint8_t channel) const {
+        return (channels[channel].level + 128) >> 8;
+    }
+
+    // the levels of all channels at `now`, the Ticker stops when none is fading anymore
+    void frame(uint32_t now) {
+        uint32_t start = ESP.getCycleCount();
+
+        bool isAnyFading = false;
+        for (uint8_t i = 0; i < Channels; i++) {
+            if (step(i, now))
+                isAnyFading = true;
+        }
+        if (!isAnyFading)
+            ticker.detach();
+
+        uint32_t us = (ESP.getCycleCount() - start) / cyclesPerUs;
+        frames++;
+        frameUs += us;
+        if (us > maxFrameUs)
+            maxFrameUs = us;
+        if (us > frameBudgetUs)
+            overruns++;
+    }
+
+    // the level of a channel at `now`, false once its sequence has ended
+    bool step(uint8_t i, uint32_t now) {
+        Channel &channel = channels[i];
+        const FadeSequence &sequence = channel.sequence;
+        if (channel.index >= sequence.count)
+            return false;
+
+        uint32_t elapsed = now - channel.start;
+
+        // more than a whole cycle behind, only the last one counts
+        if (sequence.isRepeating && elapsed >= channel.cycleMs) {
+            uint32_t skipped = elapsed - elapsed % channel.cycleMs;
+            channel.start += skipped;
+            elapsed -= skipped;
+            channel.from = sequence.keyframes[(channel.index ? channel.index : sequence.count) - 1].level << 8;
+        }
+
+        while (elapsed >= sequence.keyframes[channel.index].timeMs) {
+            const FadeKeyframe &reached = sequence.keyframes[channel.index];
+            elapsed -= reached.timeMs;
+            channel.start += reached.timeMs;
+            channel.from = reached.level << 8;
+
+            if (++channel.index == sequence.count) {
+                if (!sequence.isRepeating) {
+                    show(i, channel.from);
+                    return false;
+                }
+                channel.index = 0;
+            }
+            channel.rate = rateOf(sequence.keyframes[channel.index].timeMs);
+        }
+
+        // elapsed is below the time of the keyframe, the progress below 1.0
+        const FadeKeyframe &keyframe = sequence.keyframes[channel.index];
+        uint32_t progress = (elapsed * channel.rate) >> 8;
+        int32_t distance = (int32_t)(keyframe.level << 8) - channel.from;
+        show(i, channel.from + ((distance * (int32_t)(ease(keyframe.easing, progress) >> 2)) >> 14));
+        return true;
+    }
+
+    // write the duty of a level, 8.8 fixed point, when it changed
+    void show(uint8_t i, uint16_t level) {
+        Channel &channel = channels[i];
+        channel.level = level;
+
+        // between the duties of the two nearest levels
+        uint32_t index = level >> 8;
+        uint32_t fraction = level & 0xFF;
+        uint16_t duty = (dutyOfLevel[index] * (256 - fraction) + dutyOfLevel[index + 1] * fraction + 2048) >> 12;
+
+        if (duty != channel.duty) {
+            channel.duty = duty;
+            analogWrite(pins[i], duty);
+        }
+    }
+
+    static uint32_t rateOf(uint16_t timeMs) {
+        return timeMs ? (1UL << 24) / timeMs : 0;
+    }
+
+    // the eased progress, both 16.16 fixed point from 0 to 1.0
+    static uint32_t ease(uint8_t easing, uint32_t progress) {
+        switch (easing) {
+            case FADE_IN:
+                return square(progress);
+            case FADE_OUT:
+                return 65536 - square(65536 - progress);
+            case FADE_IN_OUT:
+                if (progress < 32768)
+                    return square(progress * 2) >> 1;
+                return 65536 - (square((65536 - progress) * 2) >> 1);
+            default:
+                return progress;
+        }
+    }
+
+    // x * x in 16.16 fixed point, for x up to 1.0, with one bit less precision not to overflow
+    static uint32_t square(uint32_t x) {
+        uint32_t half = x >> 1;
+        return (half * half) >> 14;
+    }
+
+    // {"frames":1500,"mean":18,"max":42,"overruns":0}, times in us
+    size_t printJson(Print &out) const {
+        size_t n = out.print("{\"frames\":");
+        n += out.print(frames);
+        n += out.print(",\"mean\":");
+        n += out.print(frames ? (uint32_t)(frameUs / frames) : 0);
+        n += out.print(",\"max\":");
+        n += out.print(maxFrameUs);
+        n += out.print(",\"overruns\":");
+        n += out.print(overruns);
+        n += out.print('}');
+        return n;
+    }
+};
+
+#endif
@@ -0,0 +1,279 @@
+/**** Heap tracer that attributes allocations to subsystems.
+The linker routes malloc, calloc, realloc and free through the wrappers below when the firmware
+is linked with `-Wl,--wrap=malloc` and friends (see platformio.ini). Each allocation is tagged
+with the subsystem of the innermost `HeapScope` and kept in a small fixed table, so the live
+bytes of every subsystem are known at any time. `sample()` tracks free heap, the largest free
+block and the fragmentation reported by the core, and tells when the largest block drops below
+the alarm level. The host build has its own wrappers in NativeHal, which report to the same
+`heapTraceAllocation()`, `heapTraceReallocation()` and `heapTraceFree()` functions.
+
+The wrappers hold off interrupts while they allocate and update the table: lwIP and the SDK
+allocate from their callbacks, and an interrupt in the middle of a probe or a backward shift would
+leave the table corrupted.
+
+enum HeapTag : uint8_t { HEAP_OTHER, HEAP_LOG, HEAP_COUNT };
+
+void log(String message)
+{
+  HeapScope scope(HEAP_LOG);
+  Serial.println("Log: " + message);
+}
+
+void loop()
+{
+  if (heapTracer().sample(1024) == HeapTracer::ALARM_RAISED)
+    Serial.println("Low memory");
+}
+*/
+#ifndef HEAP_TRACER_CPP
+#define HEAP_TRACER_CPP
+
+#include <Arduino.h>
+#include <interrupts.h>
+
+struct HeapTracer {
+    static const uint8_t maxTags = 10;
+    static const uint16_t tableSize = 128;  // power of two
+    static const uint16_t tableLimit = tableSize * 3 / 4;
+
+    enum Alarm : uint8_t { ALARM_NONE, ALARM_RAISED, ALARM_CLEARED };
+
+    struct Block {
+        void *ptr;
+        uint16_t size;
+        uint8_t tag;
+    };
+
+    // live allocations, open addressing with linear probing
+    Block table[tableSize];
+    uint16_t tableCount;
+
+    uint8_t tag;
+
+    // per subsystem
+    uint32_t liveBytes[maxTags];
+    uint16_t liveBlocks[maxTags];
+    uint32_t allocations[maxTags];
+
+    // allocations that did not fit the table, their frees are not attributed
+    uint32_t untracked;
+
+    // heap of the core, minimum or maximum since the last report
+    uint32_t minFreeHeap;
+    uint32_t minMaxBlock;
+    uint8_t maxFragmentation;
+    bool isAlarmRaised;
+
+    static uint16_t slotOf(void *ptr) {
+        // blocks are 8 byte aligned, mix the higher bits in
+        uint32_t value = (uint32_t)(uintptr_t)ptr >> 3;
+        value ^= value >> 7;
+        return value & (tableSize - 1);
+    }
+
+    void allocated(void *ptr, size_t size) {
+        allocated(ptr, size, tag < maxTags ? tag : 0);
+    }
+
+    void allocated(void *ptr, size_t size, uint8_t owner) {
+        if (ptr == NULL)
+            return;
+
+        allocations[owner]++;
+
+        if (tableCount >= tableLimit) {
+            untracked++;
+            return;
+        }
+
+        uint16_t slot = slotOf(ptr);
+        while (table[slot].ptr != NULL)
+            slot = (slot + 1) & (tableSize - 1);
+
+        table[slot].ptr = ptr;
+        table[slot].size = size > UINT16_MAX ? UINT16_MAX : size;
+        table[slot].tag = owner;
+        tableCount++;
+
+        liveBytes[owner] += table[slot].size;
+        liveBlocks[owner]++;
+    }
+
+    // a block keeps its subsystem when it grows, a String built by the log stays a log String
+    void reallocated(void *ptr, void *result, size_t size) {
+        int16_t slot = find(ptr);
+        uint8_t owner = slot >= 0 ? table[slot].tag : (tag < maxTags ? tag : 0);
+        freed(ptr);
+        allocated(result, size, owner);
+    }
+
+    int16_t find(void *ptr) const {
+        if (ptr == NULL)
+            return -1;
+
+        uint16_t slot = slotOf(ptr);
+        while (table[slot].ptr != ptr) {
+            if (table[slot].ptr == NULL)
+                return -1;
+            slot = (slot + 1) & (tableSize - 1);
+        }
+        return slot;
+    }
+
+    void freed(void *ptr) {
+        int16_t slot = find(ptr);
+        if (slot < 0)
+            return;  // untracked
+
+        liveBytes[table[slot].tag] -= table[slot].size;
+        liveBlocks[table[slot].tag]--;
+        tableCount--;
+
+        // backward shift deletion keeps the probe sequences intact without tombstones
+        uint16_t hole = slot;
+        uint16_t next = (hole + 1) & (tableSize - 1);
+        while (table[next].ptr != NULL) {
+            uint16_t home = slotOf(table[next].ptr);
+            if (((next - home) & (tableSize - 1)) >= ((next - hole) & (tableSize - 1))) {
+                table[hole] = table[next];
+                hole = next;
+            }
+            next = (next + 1) & (tableSize - 1);
+        }
+        table[hole].ptr = NULL;
+    }
+
+    // update the minimums, returns a change of the alarm for the largest free block
+    Alarm sample(uint32_t alarmBlock) {
+        uint32_t freeHeap = ESP.getFreeHeap();
+        uint32_t maxBlock = ESP.getMaxFreeBlockSize();
+        uint8_t fragmentation = ESP.getHeapFragmentation();
+
+        if (minFreeHeap == 0 || freeHeap < minFreeHeap)
+            minFreeHeap = freeHeap;
+        if (minMaxBlock == 0 || maxBlock < minMaxBlock)
+            minMaxBlock = maxBlock;
+        if (fragmentation > maxFragmentation)
+            maxFragmentation = fragmentation;
+
+        // clear only well above the level, so a block size that wobbles does not repeat the alarm
+        if (!isAlarmRaised && maxBlock < alarmBlock) {
+            isAlarmRaised = true;
+            return ALARM_RAISED;
+        }
+        if (isAlarmRaised && maxBlock >= alarmBlock + alarmBlock / 4) {
+            isAlarmRaised = false;
+            return ALARM_CLEARED;
+        }
+        return ALARM_NONE;
+    }
+
+    // {"free":..,"minFree":..,"maxBlock":..,"minMaxBlock":..,"frag":..,"maxFrag":..,"untracked":..,
+    //  "tags":{"<name>":{"bytes":..,"blocks":..,"allocs":..},..}}
+    size_t printJson(Print &out, const char *const names[], uint8_t count) const {
+        size_t n = out.print("{\"free\":");
+        n += out.print(ESP.getFreeHeap());
+        n += out.print(",\"minFree\":");
+        n += out.print(minFreeHeap);
+        n += out.print(",\"maxBlock\":");
+        n += out.print(ESP.getMaxFreeBlockSize());
+        n += out.print(",\"minMaxBlock\":");
+        n += out.print(minMaxBlock);
+        n += out.print(",\"frag\":");
+        n += out.print(ESP.getHeapFragmentation());
+        n += out.print(",\"maxFrag\":");
+        n += out.print(maxFragmentation);
+        n += out.print(",\"untracked\":");
+        n += out.print(untracked);
+        n += out.print(",\"tags\":{");
+        for (uint8_t i = 0; i < count && i < maxTags; i++) {
+            n += out.print(i ? ",\"" : "\"");
+            n += out.print(names[i]);
+            n += out.print("\":{\"bytes\":");
+            n += out.print(liveBytes[i]);
+            n += out.print(",\"blocks\":");
+            n += out.print(liveBlocks[i]);
+            n += out.print(",\"allocs\":");
+            n += out.print(allocations[i]);
+            n += out.print('}');
+        }
+        n += out.print("}}");
+        return n;
+    }
+
+    // start the next report period from the current values
+    void resetPeriod() {
+        minFreeHeap = ESP.getFreeHeap();
+        minMaxBlock = ESP.getMaxFreeBlockSize();
+        maxFragmentation = ESP.getHeapFragmentation();
+    }
+};
+
+// one tracer for all translation units, zero initialized before any constructor allocates
+inline HeapTracer &heapTracer() {
+    static HeapTracer tracer;
+    return tracer;
+}
+
+// tags the allocations of the enclosing scope
+struct HeapScope {
+    const uint8_t previous;
+
+    HeapScope(uint8_t tag) : previous(heapTracer().tag) {
+        heapTracer().tag = tag;
+    }
+
+    ~HeapScope() {
+        heapTracer().tag = previous;
+    }
+};
+
+// weak, because this file is compiled on its own and included from main.cpp as well
+extern "C" {
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+__attribute__((weak)) void heapTraceAllocation(void *ptr, size_t size) {
+    heapTracer().allocated(ptr, size);
+}
+
+__attribute__((weak)) void heapTraceReallocation(void *ptr, void *result, size_t size) {
+    heapTracer().reallocated(ptr, result, size);
+}
+
+__attribute__((weak)) void heapTraceFree(void *ptr) {
+    heapTracer().freed(ptr);
+}
+
+__attribute__((weak)) void *__wrap_malloc(size_t size) {
+    esp8266::InterruptLock lock;
+    void *ptr = __real_malloc(size);
+    heapTraceAllocation(ptr, size);
+    return ptr;
+}
+
+__attribute__((weak)) void *__wrap_calloc(size_t count, size_t size) {
+    esp8266::InterruptLock lock;
+    void *ptr = __real_calloc(count, size);
+    heapTraceAllocation(ptr, count * size);
+    return ptr;
+}
+
+__attribute__((weak)) void *__wrap_realloc(void *ptr, size_t size) {
+    esp8266::InterruptLock lock;
+    void *result = __real_realloc(ptr, size);
+    if (result != NULL || size == 0)
+        heapTraceReallocation(ptr, result, size);
+    return result;
+}
+
+__attribute__((weak)) void __wrap_free(void *ptr) {
+    esp8266::InterruptLock lock;
+    heapTraceFree(ptr);
+    __real_free(ptr);
+}
+}
+
+#endif
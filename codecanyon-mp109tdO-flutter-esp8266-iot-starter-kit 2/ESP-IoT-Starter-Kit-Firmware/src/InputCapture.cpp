@@ -0,0 +1,221 @@
+/**** Button presses captured by GPIO interrupts and classified from the times of their edges.
+The interrupt handler of an input only stores the time and level of the edge in a ring, which the
+loop empties: one producer and one consumer, so neither side needs a lock. The loop may be busy
+for a while, the edges keep their times and even a press shorter than a loop pass is seen.
+
+Debouncing works on the edge times. The first edge that changes the level of an input is taken at
+its own time, the bounces after it are ignored for `debounceMs`, and the level at the end of that
+time is taken again when it differs. A press shorter than the debounce time is reported as one of
+the debounce time. The inputs are active low with the pull-ups enabled, and start released.
+
+Every press and release is passed to the event function with the time of the edge in
+microseconds, so the time from the press to its action can be measured, and a release with the
+length of the press.
+
+const uint8_t buttonPins[] = {14, 2};
+
+InputCapture<2> buttons(buttonPins, 40, onButton, wakeLoop);
+
+void onButton(const InputCapture<2>::Event &event)
+{
+  if (event.type == InputCapture<2>::RELEASE && event.lengthMs >= 8000)
+    resetSettings();
+}
+
+void setup()
+{
+  buttons.begin();
+}
+
+void loop()
+{
+  buttons.loop();
+  delay(buttons.timeToNext());
+}
+*/
+#ifndef INPUT_CAPTURE_CPP
+#define INPUT_CAPTURE_CPP
+
+#include <Arduino.h>
+
+template <uint8_t Count, uint8_t Size = 32>
+struct InputCapture {
+    static_assert((Size & (Size - 1)) == 0, "the ring size is a power of two");
+
+    enum EventType : uint8_t {
+        PRESS,
+        RELEASE
+    };
+
+    struct Event {
+        uint8_t input;
+        EventType type;
+        uint32_t time;      // micros() of the edge
+        uint32_t lengthMs;  // of the press, on release
+    };
+
+    typedef void (*EventFunction)(const Event &event);
+    typedef void (*WakeFunction)();
+
+    struct Edge {
+        uint32_t time;
+        uint8_t input;
+        uint8_t level;
+    };
+
+    // the argument of the interrupt handler of an input
+    struct Input {
+        InputCapture *capture;
+        uint8_t index;
+        uint8_t pin;
+
+        bool isPressed;
+        bool isRawPressed;  // level of the last edge
+        bool isLocked;      // within the debounce time of the last change
+        uint32_t changeTime;
+        uint32_t pressTime;
+    };
+
+    const uint32_t debounceUs;
+    const EventFunction onEvent;
+    const WakeFunction onWake;
+
+    Input inputs[Count];
+
+    // written by the interrupt handlers only
+    Edge edges[Size];
+    volatile uint8_t head = 0;
+    volatile bool isOverflowed = false;
+    volatile uint32_t overflows = 0;
+
+    // written by the loop only
+    volatile uint8_t tail = 0;
+
+    InputCapture(const uint8_t *pins, uint32_t debounceMs, EventFunction onEvent, WakeFunction onWake = NULL)
+        : debounceUs(debounceMs * 1000), onEvent(onEvent), onWake(onWake) {
+        for (uint8_t i = 0; i < Count; i++) {
+            inputs[i].capture = this;
+            inputs[i].index = i;
+            inputs[i].pin = pins[i];
+        }
+    }
+
+    void begin() {
+        for (Input &input : inputs) {
+            input.isPressed = false;
+            input.isRawPressed = false;
+            input.isLocked = false;
+            pinMode(input.pin, INPUT_PULLUP);
+            attachInterruptArg(digitalPinToInterrupt(input.pin), onEdge, &input, CHANGE);
+        }
+    }
+
+    // edges that the loop did not take yet
+    bool isPending() const {
+        return head != tail || isOverflowed;
+    }
+
+    // classify the captured edges, and end the debounce times that are over
+    void loop() {
+        // edges captured from here on are not older than now
+        uint32_t now = micros();
+
+        while (tail != head) {
+            // the edge is read after its index
+            __asm__ __volatile__("" ::: "memory");
+            const Edge &edge = edges[tail];
+            Input &input = inputs[edge.input];
+            settle(input, edge.time);
+            input.isRawPressed = edge.level == LOW;
+            if (!input.isLocked && input.isRawPressed != input.isPressed)
+                change(input, edge.time);
+            tail = (tail + 1) & (Size - 1);
+        }
+
+        // edges were lost, the levels are read again
+        if (isOverflowed) {
+            isOverflowed = false;
+            for (Input &input : inputs) {
+                settle(input, now);
+                input.isRawPressed = digitalRead(input.pin) == LOW;
+                if (!input.isLocked && input.isRawPressed != input.isPressed)
+                    change(input, now);
+            }
+        }
+
+        for (Input &input : inputs)
+            settle(input, now);
+    }
+
+    // milliseconds until loop() has work, for the idle sleep of the main loop
+    uint32_t timeToNext() const {
+        if (isPending())
+            return 0;
+
+        uint32_t next = UINT32_MAX;
+        uint32_t now = micros();
+        for (const Input &input : inputs) {
+            if (!input.isLocked || input.isRawPressed == input.isPressed)
+                continue;
+            int32_t remaining = input.changeTime + debounceUs - now;
+            next = min(next, remaining > 0 ? (uint32_t)(remaining + 999) / 1000 : 0);
+        }
+        return next;
+    }
+
+    // the level at the end of a debounce time that is over by `time`, an edge after `time` may
+    // have been taken already
+    void settle(Input &input, uint32_t time) {
+        if (!input.isLocked || (int32_t)(time - input.changeTime) < (int32_t)debounceUs)
+            return;
+
+        input.isLocked = false;
+        if (input.isRawPressed != input.isPressed)
+            change(input, input.changeTime + debounceUs);
+    }
+
+    void change(Input &input, uint32_t time) {
+        input.isPressed = input.isRawPressed;
+        input.isLocked = true;
+        input.changeTime = time;
+
+        Event event;
+        event.input = input.index;
+        event.time = time;
+        if (input.isPressed) {
+            input.pressTime = time;
+            event.type = PRESS;
+            event.lengthMs = 0;
+        } else {
+            event.type = RELEASE;
+            event.lengthMs = (time - input.pressTime) / 1000;
+        }
+        onEvent(event);
+    }
+
+    static void IRAM_ATTR onEdge(void *arg) {
+        Input &input = *(Input *)arg;
+        input.capture->push(input.index, digitalRead(input.pin), micros());
+    }
+
+    void IRAM_ATTR push(uint8_t input, uint8_t level, uint32_t time) {
+        uint8_t next = (head + 1) & (Size - 1);
+        if (next == tail) {
+            overflows++;
+            isOverflowed = true;
+        } else {
+            edges[head].time = time;
+            edges[head].input = input;
+            edges[head].level = level;
+
+            // the edge is stored before the loop can see it
+            __asm__ __volatile__("" ::: "memory");
+            head = next;
+        }
+
+        if (onWake)
+            onWake();
+    }
+};
+
+#endif
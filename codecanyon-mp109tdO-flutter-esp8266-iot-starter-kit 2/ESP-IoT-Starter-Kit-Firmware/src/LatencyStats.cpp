@@ -0,0 +1,148 @@
+/**** Fixed-size latency histograms timed with the CPU cycle counter.
+Each histogram counts samples in log2 buckets of microseconds: bucket 0 holds 0 us, bucket i
+holds [2^(i-1), 2^i) us and the last bucket everything from about half a second up. Together
+with count, min, max and sum this gives p50/p99 estimates without storing samples. On the host
+build the cycle counter is a monotonic nanosecond clock, with the CPU reported at 1000 MHz.
+
+LatencyHistogram readStats;
+
+void loop()
+{
+  {
+    LatencyTimer timer(readStats);
+    sensor.read();
+  }
+
+  readStats.printJson(Serial);  // {"n":10,"min":250,"mean":260,"p50":270,"p99":270,"max":270,"h":[0,...]}
+}
+*/
+#ifndef LATENCY_STATS_CPP
+#define LATENCY_STATS_CPP
+
+#include <Arduino.h>
+
+inline uint32_t cyclesToMicros(uint32_t cycles) {
+    return cycles / ESP.getCpuFreqMHz();
+}
+
+struct LatencyHistogram {
+    static const uint8_t bucketCount = 21;
+
+    uint32_t buckets[bucketCount];
+    uint32_t count;
+    uint32_t minUs;
+    uint32_t maxUs;
+    uint64_t sumUs;
+
+    LatencyHistogram() {
+        reset();
+    }
+
+    void reset() {
+        memset(buckets, 0, sizeof(buckets));
+        count = 0;
+        minUs = UINT32_MAX;
+        maxUs = 0;
+        sumUs = 0;
+    }
+
+    static uint8_t bucketOf(uint32_t us) {
+        uint8_t bucket = 0;
+        while (us > 0 && bucket < bucketCount - 1) {
+            us >>= 1;
+            bucket++;
+        }
+        return bucket;
+    }
+
+    void add(uint32_t us) {
+        buckets[bucketOf(us)]++;
+        count++;
+        sumUs += us;
+        if (us < minUs)
+            minUs = us;
+        if (us > maxUs)
+            maxUs = us;
+    }
+
+    void addCycles(uint32_t cycles) {
+        add(cyclesToMicros(cycles));
+    }
+
+    // upper bound of the bucket that holds the percentile, never above the largest sample
+    uint32_t percentile(uint8_t percent) const {
+        if (count == 0)
+            return 0;
+
+        uint32_t rank = ((uint64_t)count * percent + 99) / 100;
+        uint32_t seen = 0;
+        for (uint8_t i = 0; i < bucketCount; i++) {
+            seen += buckets[i];
+            if (seen >= rank && rank > 0) {
+                uint32_t upper = (i == 0) ? 0 : (1UL << i) - 1;
+                return (i == bucketCount - 1 || upper > maxUs) ? maxUs : upper;
+            }
+        }
+        return maxUs;
+    }
+
+    // {"n":..,"min":..,"mean":..,"p50":..,"p99":..,"max":..,"h":[..]}, times in microseconds
+    size_t printJson(Print &out) const {
+        size_t n = 0;
+        n += out.print("{\"n\":");
+        n += out.print(count);
+        n += out.print(",\"min\":");
+        n += out.print(count ? minUs : 0);
+        n += out.print(",\"mean\":");
+        n += out.print(count ? (uint32_t)(sumUs / count) : 0);
+        n += out.print(",\"p50\":");
+        n += out.print(percentile(50));
+        n += out.print(",\"p99\":");
+        n += out.print(percentile(99));
+        n += out.print(",\"max\":");
+        n += out.print(maxUs);
+
+        // buckets up to the last one in use
+        uint8_t used = bucketCount;
+        while (used > 0 && buckets[used - 1] == 0)
+            used--;
+        n += out.print(",\"h\":[");
+        for (uint8_t i = 0; i < used; i++) {
+            if (i > 0)
+                n += out.print(',');
+            n += out.print(buckets[i]);
+        }
+        n += out.print("]}");
+        return n;
+    }
+};
+
+// times the enclosing scope into a histogram
+struct LatencyTimer {
+    LatencyHistogram &histogram;
+    const uint32_t start;
+
+    LatencyTimer(LatencyHistogram &histogram) : histogram(histogram), start(ESP.getCycleCount()) {
+    }
+
+    ~LatencyTimer() {
+        histogram.addCycles(ESP.getCycleCount() - start);
+    }
+};
+
+// counts what would be printed, to know a payload length before streaming it
+struct PrintCounter : public Print {
+    size_t length = 0;
+
+    size_t write(uint8_t) override {
+        length++;
+        return 1;
+    }
+
+    size_t write(const uint8_t *, size_t size) override {
+        length += size;
+        return size;
+    }
+};
+
+#endif
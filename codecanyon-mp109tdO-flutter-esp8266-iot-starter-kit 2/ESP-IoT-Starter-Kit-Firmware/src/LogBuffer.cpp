@@ -0,0 +1,162 @@
+/**** Fixed buffer of log records, sent to MQTT in batches.
+`push()` only copies the message and its time into a statically allocated buffer, so logging
+costs a memcpy. The records are formatted when the buffer is flushed, one line per record with
+the time printed by the given function in front: `<time> | <message>`. A flush prints as many
+records as fit the requested length and removes them, so the whole buffer can go out in one
+streamed publish, or in several smaller messages where the payload size is limited.
+
+size_t printTime(Print &out, uint32_t time)
+{
+  return out.print(time);
+}
+
+LogBuffer logBuffer(printTime);
+
+void log(const char *message)
+{
+  if (!logBuffer.push(now(), message, strlen(message))) {
+    flushLog();
+    logBuffer.push(now(), message, strlen(message));
+  }
+}
+
+void flushLog()
+{
+  size_t length;
+  uint16_t records = logBuffer.fit(SIZE_MAX, length);
+  if (mqttClient.beginPublish("log", length, false)) {
+    logBuffer.printTo(mqttClient, records);
+    mqttClient.endPublish();
+    logBuffer.remove(records);
+  }
+}
+*/
+#ifndef LOG_BUFFER_CPP
+#define LOG_BUFFER_CPP
+
+#include <Arduino.h>
+
+#include "LatencyStats.cpp"
+
+struct LogBuffer {
+    typedef size_t (*PrintTimeFunction)(Print &out, uint32_t time);
+
+    // record header: time (little endian), message length
+    static const uint8_t headerSize = 5;
+    static const uint8_t maxMessage = 255;
+
+    static const uint16_t capacity = 1024;
+
+    const PrintTimeFunction printTime;
+
+    uint8_t buffer[capacity];
+    uint16_t length = 0;
+    uint16_t count = 0;
+
+    LogBuffer(PrintTimeFunction printTime) : printTime(printTime) {
+    }
+
+    bool isEmpty() const {
+        return count == 0;
+    }
+
+    // copy a message, longer ones are cut, returns false when the buffer must be flushed first
+    bool push(uint32_t time, const char *message, size_t messageLength) {
+        if (messageLength > maxMessage)
+            messageLength = maxMessage;
+        if (length + headerSize + messageLength > capacity)
+            return false;
+
+        uint8_t *record = buffer + length;
+        record[0] = time & 0xff;
+        record[1] = (time >> 8) & 0xff;
+        record[2] = (time >> 16) & 0xff;
+        record[3] = time >> 24;
+        record[4] = messageLength;
+        memcpy(record + headerSize, message, messageLength);
+
+        length += headerSize + messageLength;
+        count++;
+        return true;
+    }
+
+    // how many records from the oldest fit into maxLength once printed, at least one
+    uint16_t fit(size_t maxLength, size_t &printedLength) const {
+        printedLength = 0;
+
+        uint16_t records = 0;
+        for (uint16_t offset = 0; records < count; records++) {
+            size_t lineLength = (records ? 1 : 0) + printedTimeLength(offset) + 3 + buffer[offset + 4];
+            if (records > 0 && printedLength + lineLength > maxLength)
+                break;
+
+            printedLength += lineLength;
+            offset += headerSize + buffer[offset + 4];
+        }
+        return records;
+    }
+
+    // print the oldest records, separated by new lines
+    size_t printTo(Print &out, uint16_t records) const {
+        size_t n = 0;
+        uint16_t offset = 0;
+        for (uint16_t i = 0; i < records && i < count; i++) {
+            if (i > 0)
+                n += out.print('\n');
+            n += printTime(out, timeAt(offset));
+            n += out.print(" | ");
+            n += out.write(buffer + offset + headerSize, buffer[offset + 4]);
+            offset += headerSize + buffer[offset + 4];
+        }
+        return n;
+    }
+
+    // drop the oldest records, after they were sent
+    void remove(uint16_t records) {
+        uint16_t offset = 0;
+        for (; records > 0 && count > 0; records--, count--)
+            offset += headerSize + buffer[offset + 4];
+
+        memmove(buffer, buffer + offset, length - offset);
+        length -= offset;
+    }
+
+    uint32_t timeAt(uint16_t offset) const {
+        const uint8_t *record = buffer + offset;
+        return record[0] | (record[1] << 8) | ((uint32_t)record[2] << 16) | ((uint32_t)record[3] << 24);
+    }
+
+    size_t printedTimeLength(uint16_t offset) const {
+        PrintCounter counter;
+        printTime(counter, timeAt(offset));
+        return counter.length;
+    }
+};
+
+// prints into a char array, cutting what does not fit, the text is always terminated
+struct BufferPrint : public Print {
+    char *const text;
+    const size_t size;
+    size_t length = 0;
+
+    BufferPrint(char *text, size_t size) : text(text), size(size) {
+        text[0] = '\0';
+    }
+
+    size_t write(uint8_t c) override {
+        if (length + 1 >= size)
+            return 0;
+        text[length++] = c;
+        text[length] = '\0';
+        return 1;
+    }
+
+    size_t write(const uint8_t *data, size_t count) override {
+        size_t n = 0;
+        while (n < count && write(data[n]))
+            n++;
+        return n;
+    }
+};
+
+#endif
@@ -0,0 +1,133 @@
+/**** Table-driven dispatcher for incoming MQTT commands.
+Handlers are registered against topic suffixes below a base topic. The suffixes are hashed at
+compile time with FNV-1a, so matching an incoming topic costs one prefix compare, one hash pass
+over the suffix and a short scan of the route table, with no heap allocation. Payloads are handed
+to the handlers in place as byte pointer and length. The base can be set at runtime with
+`setBase()`, for a base topic that contains the device ID. A handler returns false when the
+payload is not one of its commands. A route that ends in '+' takes a number instead, "/set/port+"
+matches "/set/port1" to "/set/port255" and `find()` passes the number out.
+
+bool onPing(const byte *payload, unsigned int length)
+{
+  if (!payloadIs(payload, length, "ping"))
+    return false;
+  mqttClient.publish("devices/esp01/get/ping", "pong");
+  return true;
+}
+
+const MqttRoute routes[] = {
+    MQTT_ROUTE("/set/ping", onPing),
+};
+
+MqttDispatcher dispatcher("devices/esp01", routes, sizeof(routes) / sizeof(routes[0]));
+
+void mqttCallback(char *topic, byte *payload, unsigned int length)
+{
+  dispatcher.dispatch(topic, payload, length);
+}
+*/
+#ifndef MQTT_DISPATCHER_CPP
+#define MQTT_DISPATCHER_CPP
+
+#include <Arduino.h>
+
+typedef bool (*MqttHandler)(const byte *payload, unsigned int length);
+
+// 32-bit FNV-1a over a zero terminated string, evaluated at compile time for route keys
+constexpr uint32_t topicHash(const char *str, uint32_t hash = 2166136261u) {
+    return *str ? topicHash(str + 1, (hash ^ (uint8_t)*str) * 16777619u) : hash;
+}
+
+// same hash over a length bounded buffer, evaluated at runtime for incoming topics
+inline uint32_t topicHash(const char *str, size_t length) {
+    uint32_t hash = 2166136261u;
+    while (length--) {
+        hash = (hash ^ (uint8_t)*str++) * 16777619u;
+    }
+    return hash;
+}
+
+// compare a payload in place against a command word
+inline bool payloadIs(const byte *payload, unsigned int length, const char *word) {
+    return strlen(word) == length && memcmp(payload, word, length) == 0;
+}
+
+struct MqttRoute {
+    uint32_t hash;
+    const char *suffix;
+    MqttHandler handler;
+};
+
+#define MQTT_ROUTE(suffix, handler) \
+    { topicHash(suffix), suffix, handler }
+
+struct MqttDispatcher {
+    const char *base;
+    size_t baseLength;
+    const MqttRoute *routes;
+    const uint8_t routeCount;
+
+    MqttDispatcher(const char *base, const MqttRoute *routes, uint8_t routeCount)
+        : base(base), baseLength(strlen(base)), routes(routes), routeCount(routeCount) {
+    }
+
+    // the string is not copied, it has to outlive the dispatcher
+    void setBase(const char *base) {
+        this->base = base;
+        baseLength = strlen(base);
+    }
+
+    // find the route for a topic, or NULL if the topic is not below the base or not registered
+    const MqttRoute *find(const char *topic, uint8_t *number = NULL) const {
+        if (strncmp(topic, base, baseLength) != 0)
+            return NULL;
+
+        return findSuffix(topic + baseLength, number);
+    }
+
+    // find the route for a suffix below the base, "/set/ping"
+    const MqttRoute *findSuffix(const char *suffix, uint8_t *number = NULL) const {
+        size_t length = strlen(suffix);
+        uint32_t hash = topicHash(suffix, length);
+
+        for (uint8_t i = 0; i < routeCount; i++) {
+            // hashes can collide, so confirm with the full suffix
+            if (routes[i].hash == hash && strcmp(routes[i].suffix, suffix) == 0)
+                return &routes[i];
+        }
+
+        // "/set/port12" is "/set/port+" with the number 12, without leading zeros
+        size_t digits = length;
+        while (digits > 0 && isdigit((uint8_t)suffix[digits - 1]))
+            digits--;
+        if (digits == 0 || digits == length || length - digits > 3 || suffix[digits] == '0')
+            return NULL;
+
+        uint16_t value = atoi(suffix + digits);
+        if (value > UINT8_MAX)
+            return NULL;
+
+        hash = (topicHash(suffix, digits) ^ '+') * 16777619u;
+        for (uint8_t i = 0; i < routeCount; i++) {
+            const char *key = routes[i].suffix;
+            if (routes[i].hash == hash && strncmp(key, suffix, digits) == 0 && key[digits] == '+' && !key[digits + 1]) {
+                if (number)
+                    *number = value;
+                return &routes[i];
+            }
+        }
+
+        return NULL;
+    }
+
+    // run the handler registered for the topic, returns false if there is none or it rejected the payload
+    bool dispatch(const char *topic, const byte *payload, unsigned int length) const {
+        const MqttRoute *route = find(topic);
+        if (route == NULL)
+            return false;
+
+        return route->handler(payload, length);
+    }
+};
+
+#endif
@@ -0,0 +1,235 @@
+/**** On/off patterns of the LED, the beeper and other GPIO outputs, clocked by the timer interrupt.
+A pattern is a list of step lengths in milliseconds, on first, then off, and so on, ended by 0, and
+plays once or repeats. The patterns are kept in one table and every output plays them in layers:
+the highest layer with a pattern drives the output, the lower ones keep running underneath it, so
+a short pattern such as a ping blinks over the background pattern, which shows again right where
+its own timing is when the short one ends.
+
+The steps end in the interrupt of timer0, armed for the next step of all outputs, so the edges do
+not move with the work of the loop, a DHT read or a blocking reconnect. An edge is late only by
+the latency of the interrupt, which the engine measures. Nothing runs while no pattern plays, the
+interrupt is detached once the last step ends.
+
+const uint16_t stepsBlink[] = {100, 80, 100, 80, 0};
+const uint16_t stepsReady[] = {800, 1600, 0};
+
+const Pattern patterns[] = {{stepsBlink, false}, {stepsReady, true}};
+const PatternOutput outputs[] = {{15, false}, {13, true}};  // LED, beeper active low
+
+PatternEngine<2, 2> engine(outputs, patterns);
+
+void setup()
+{
+  engine.begin();
+  engine.play(0, 0, 1);  // LED, background layer, ready
+}
+
+void onPing()
+{
+  engine.play(0, 1, 0);  // blink twice over the ready pattern
+}
+*/
+#ifndef PATTERN_ENGINE_CPP
+#define PATTERN_ENGINE_CPP
+
+#include <Arduino.h>
+
+struct Pattern {
+    const uint16_t *steps;  // milliseconds on, off, on and so on, ended by 0
+    bool isRepeating;
+};
+
+struct PatternOutput {
+    uint8_t pin;
+    bool isActiveLow;
+};
+
+template <uint8_t Channels, uint8_t Layers>
+struct PatternEngine {
+    // the timer is armed at most this far ahead, the cycle counter wraps after 26 s at 160 MHz
+    static const uint32_t maxIntervalUs = 1000000;
+    // the timer fires only for a compare value ahead of the cycle counter
+    static const uint32_t minIntervalUs = 10;
+
+    struct Layer {
+        const uint16_t *steps;
+        const uint16_t *step;  // NULL while the layer plays nothing
+        bool isRepeating;
+        bool isOn;
+        uint32_t due;  // micros() at the end of the step
+    };
+
+    struct Channel {
+        Layer layers[Layers];
+        bool isOn;
+    };
+
+    const PatternOutput *outputs;
+    const Pattern *patterns;
+
+    Channel channels[Channels];
+    uint32_t cyclesPerUs = 80;
+
+    volatile bool isArmed = false;
+
+    // timer interrupts, and the latest a step ended after its time
+    volatile uint32_t wakes = 0;
+    volatile uint32_t maxLateUs = 0;
+
+    // the engine of the timer interrupt, there is one timer0
+    static PatternEngine *instance;
+
+    PatternEngine(const PatternOutput *outputs, const Pattern *patterns) : outputs(outputs), patterns(patterns) {
+        for (Channel &channel : channels) {
+            for (Layer &layer : channel.layers)
+                layer.step = NULL;
+            channel.isOn = false;
+        }
+    }
+
+    void begin() {
+        cyclesPerUs = ESP.getCpuFreqMHz();
+        for (uint8_t i = 0; i < Channels; i++) {
+            pinMode(outputs[i].pin, OUTPUT);
+            write(i, channels[i].isOn);
+        }
+
+        instance = this;
+        timer0_isr_init();
+    }
+
+    // start a pattern of the table on a layer of a channel, from its first step
+    void play(uint8_t channel, uint8_t layer, uint8_t pattern) {
+        const Pattern &source = patterns[pattern];
+
+        // the interrupt must not see the layer half written
+        noInterrupts();
+        uint32_t now = micros();
+        Layer &target = channels[channel].layers[layer];
+        target.steps = source.steps;
+        target.step = source.steps;
+        target.isRepeating = source.isRepeating;
+        target.isOn = true;
+        target.due = now + source.steps[0] * 1000UL;
+        update(now);
+        interrupts();
+    }
+
+    void stop(uint8_t channel, uint8_t layer) {
+        noInterrupts();
+        channels[channel].layers[layer].step = NULL;
+        update(micros());
+        interrupts();
+    }
+
+    bool isPlaying(uint8_t channel, uint8_t layer) const {
+        return channels[channel].layers[layer].step != NULL;
+    }
+
+    bool isOn(uint8_t channel) const {
+        return channels[channel].isOn;
+    }
+
+    // end the steps due by `now`, write the outputs and arm the timer for the next step
+    void IRAM_ATTR update(uint32_t now) {
+        bool hasSteps = false;
+        uint32_t next = now + maxIntervalUs;
+
+        for (uint8_t i = 0; i < Channels; i++) {
+            Channel &channel = channels[i];
+            bool isOn = false;
+            bool isShown = false;
+
+            // from the top layer, the first one that plays is shown
+            for (uint8_t l = Layers; l-- > 0;) {
+                Layer &layer = channel.layers[l];
+                if (!layer.step)
+                    continue;
+
+                int32_t late = (int32_t)(now - layer.due);
+                if (late >= 0) {
+                    if ((uint32_t)late > maxLateUs)
+                        maxLateUs = late;
+                    advance(layer);
+                    if (!layer.step)
+                        continue;
+                }
+
+                hasSteps = true;
+                if ((int32_t)(layer.due - next) < 0)
+                    next = layer.due;
+                if (!isShown) {
+                    isShown = true;
+                    isOn = layer.isOn;
+                }
+            }
+
+            if (isOn != channel.isOn) {
+                channel.isOn = isOn;
+                write(i, isOn);
+            }
+        }
+
+        // only the engine that began drives timer0
+        if (this != instance)
+            return;
+        if (hasSteps) {
+            arm(next);
+        } else if (isArmed) {
+            // the compare would still fire when the cycle counter wraps
+            isArmed = false;
+            timer0_detachInterrupt();
+        }
+    }
+
+    // the next step of a layer, timed from the end of the last one so the pattern does not drift
+    static void IRAM_ATTR advance(Layer &layer) {
+        layer.step++;
+        if (*layer.step == 0) {
+            if (!layer.isRepeating) {
+                layer.step = NULL;
+                return;
+            }
+            layer.step = layer.steps;
+            layer.isOn = true;
+        } else {
+            layer.isOn = !layer.isOn;
+        }
+        layer.due += *layer.step * 1000UL;
+    }
+
+    void IRAM_ATTR arm(uint32_t due) {
+        int32_t interval = (int32_t)(due - micros());
+        if (interval < (int32_t)minIntervalUs)
+            interval = minIntervalUs;
+        if (!isArmed) {
+            isArmed = true;
+            timer0_attachInterrupt(onTimer);
+        }
+        timer0_write(ESP.getCycleCount() + (uint32_t)interval * cyclesPerUs);
+    }
+
+    void IRAM_ATTR write(uint8_t channel, bool isOn) {
+        digitalWrite(outputs[channel].pin, isOn != outputs[channel].isActiveLow ? HIGH : LOW);
+    }
+
+    static void IRAM_ATTR onTimer() {
+        instance->wakes++;
+        instance->update(micros());
+    }
+
+    // {"wakes":1200,"maxLate":12}, maxLate in us
+    size_t printJson(Print &out) const {
+        size_t n = out.print("{\"wakes\":");
+        n += out.print(wakes);
+        n += out.print(",\"maxLate\":");
+        n += out.print(maxLateUs);
+        n += out.print('}');
+        return n;
+    }
+};
+
+template <uint8_t Channels, uint8_t Layers>
+PatternEngine<Channels, Layers> *PatternEngine<Channels, Layers>::instance = NULL;
+
+#endif
@@ -0,0 +1,115 @@
+/**** Streaming JSON writer for telemetry payloads.
+Writes an object field by field to any `Print`: a char buffer, a `PrintCounter` to know the length
+first, or the MQTT client between `beginPublish()` and `endPublish()`. Nothing is allocated and
+floats are printed with integer arithmetic at a fixed number of decimals.
+
+char payload[64];
+BufferPrint out(payload, sizeof(payload));
+
+PayloadWriter json(out);
+json.beginObject();
+json.fixed("Temp", 23.1, 2, true);
+json.field("TempUnit", "C");
+json.field("Count", 42);
+json.endObject();  // {"Temp":"23.10","TempUnit":"C","Count":42}
+*/
+#ifndef PAYLOAD_WRITER_CPP
+#define PAYLOAD_WRITER_CPP
+
+#include <Arduino.h>
+
+struct PayloadWriter {
+    Print &out;
+    size_t length = 0;
+    bool isFirst = true;
+
+    PayloadWriter(Print &out) : out(out) {
+    }
+
+    void beginObject() {
+        length += out.print('{');
+        isFirst = true;
+    }
+
+    void endObject() {
+        length += out.print('}');
+    }
+
+    void field(const char *key, const char *value) {
+        name(key);
+        string(value);
+    }
+
+    void field(const char *key, int32_t value) {
+        name(key);
+        length += out.print(value);
+    }
+
+    void field(const char *key, uint32_t value) {
+        name(key);
+        length += out.print(value);
+    }
+
+    // a float rounded to `decimals` places, quoted for readers that expect the value as text
+    void fixed(const char *key, float value, uint8_t decimals, bool isQuoted = false) {
+        name(key);
+        if (isQuoted)
+            length += out.print('"');
+        length += printFixed(out, value, decimals);
+        if (isQuoted)
+            length += out.print('"');
+    }
+
+    void name(const char *key) {
+        if (!isFirst)
+            length += out.print(',');
+        isFirst = false;
+        string(key);
+        length += out.print(':');
+    }
+
+    void string(const char *value) {
+        length += out.print('"');
+        for (const char *c = value; *c; c++) {
+            if (*c == '"' || *c == '\\') {
+                length += out.print('\\');
+                length += out.print(*c);
+            } else if ((uint8_t)*c < 0x20) {
+                length += out.print(' ');
+            } else {
+                length += out.print(*c);
+            }
+        }
+        length += out.print('"');
+    }
+
+    // "-12.30" for -12.3 at 2 decimals, "nan" when there is no value
+    static size_t printFixed(Print &out, float value, uint8_t decimals) {
+        if (isnan(value) || isinf(value))
+            return out.print("nan");
+
+        uint32_t scale = 1;
+        for (uint8_t i = 0; i < decimals; i++)
+            scale *= 10;
+
+        bool isNegative = value < 0;
+        uint32_t scaled = (uint32_t)((isNegative ? -value : value) * scale + 0.5f);
+
+        size_t n = 0;
+        if (isNegative && scaled > 0)
+            n += out.print('-');
+        n += out.print(scaled / scale);
+        if (decimals == 0)
+            return n;
+
+        // the fraction with its leading zeros
+        n += out.print('.');
+        uint32_t fraction = scaled % scale;
+        for (uint32_t digit = scale / 10; digit > 1 && fraction < digit; digit /= 10)
+            n += out.print('0');
+        n += out.print(fraction);
+        return n;
+    }
+};
+
+#endif
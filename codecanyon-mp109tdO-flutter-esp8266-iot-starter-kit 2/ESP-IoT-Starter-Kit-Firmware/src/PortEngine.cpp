@@ -0,0 +1,273 @@
+/**** Output ports driven from a table of port descriptors.
+Every port is a GPIO pin or a channel of an I2C expander (PCF8574 or MCP23017), with its mode,
+pulse length and active level:
+
+- momentary: `open` activates the port for its pulse length, like a button press
+- toggle: `open` and `close` set the state, it stays until changed
+- timed: `open` activates the port for its pulse length, `close` ends it early
+
+The pulses of all ports share one deadline, so switching a port costs the same for any number of
+ports and only an expiry scans the table. GPIO pins are written right away. Changes to an expander
+only update its output latch in memory, `loop()` writes each changed expander once per pass, so
+changing all 16 channels of an MCP23017 in one pass is a single I2C write. A write that fails keeps
+the latch dirty and is retried after a backoff that doubles while the expander keeps failing.
+
+constexpr PortDescriptor ports[] = {
+    {PORT_GPIO, 4, PORT_MOMENTARY, 500, true},  // relay on GPIO4 for 500 ms, active low
+    {0, 0, PORT_TOGGLE, 0, true},               // channel 0 of the first expander
+    {0, 1, PORT_TIMED, 600000, true},           // pump for up to 10 minutes
+};
+
+PortExpander expanders[] = {PortExpander(PortExpander::MCP23017, 0x20)};
+
+PortEngine<3> engine(ports, expanders, 1, onExpired);
+
+void setup()
+{
+  engine.begin();
+  engine.set(2, true);
+}
+
+void loop()
+{
+  engine.loop();
+}
+*/
+#ifndef PORT_ENGINE_CPP
+#define PORT_ENGINE_CPP
+
+#include <Arduino.h>
+#include <Wire.h>
+
+enum PortMode : uint8_t {
+    PORT_MOMENTARY,
+    PORT_TOGGLE,
+    PORT_TIMED
+};
+
+// the expander index of a port on a GPIO pin of the ESP
+#define PORT_GPIO 0xff
+
+struct PortDescriptor {
+    uint8_t expander;  // PORT_GPIO, or the index of the expander
+    uint8_t pin;       // GPIO, or the channel of the expander
+    PortMode mode;
+    uint32_t pulseMs;  // momentary and timed ports
+    bool isActiveLow;
+};
+
+struct PortExpander {
+    enum Type : uint8_t {
+        PCF8574,   // 8 channels, quasi-bidirectional, an output is written as one byte
+        MCP23017,  // 16 channels, both output latches in one register write
+    };
+
+    // MCP23017 registers with IOCON.BANK = 0
+    static const uint8_t mcpIoDirA = 0x00;
+    static const uint8_t mcpOLatA = 0x14;
+
+    // backoff between retries of a failed write
+    static const uint32_t minBackoffMs = 10;
+    static const uint32_t maxBackoffMs = 5000;
+
+    const Type type;
+    const uint8_t address;
+
+    uint16_t outputs = 0xffff;
+    bool isDirty = false;
+
+    // 0 while the last write succeeded
+    uint32_t backoffMs = 0;
+    uint32_t retryTime = 0;
+
+    uint32_t writes = 0;
+    uint32_t failures = 0;
+
+    PortExpander(Type type, uint8_t address) : type(type), address(address) {
+    }
+
+    // all channels as outputs, the latch is written first so the outputs start at their levels
+    bool begin() {
+        isDirty = true;
+        if (!flush())
+            return false;
+
+        if (type == MCP23017) {
+            uint8_t directions[] = {mcpIoDirA, 0x00, 0x00};
+            return transmit(directions, sizeof(directions));
+        }
+        return true;
+    }
+
+    void set(uint8_t channel, bool level) {
+        uint16_t mask = 1 << channel;
+        uint16_t next = level ? outputs | mask : outputs & ~mask;
+        isDirty = isDirty || next != outputs;
+        outputs = next;
+    }
+
+    // write the latch if it changed, one I2C transmission
+    bool flush() {
+        if (!isDirty)
+            return true;
+        if (timeToNext() > 0)
+            return false;
+
+        bool isWritten;
+        if (type == MCP23017) {
+            uint8_t latch[] = {mcpOLatA, (uint8_t)(outputs & 0xff), (uint8_t)(outputs >> 8)};
+            isWritten = transmit(latch, sizeof(latch));
+        } else {
+            uint8_t port = outputs & 0xff;
+            isWritten = transmit(&port, 1);
+        }
+
+        if (isWritten) {
+            isDirty = false;
+            backoffMs = 0;
+        } else {
+            backoffMs = backoffMs == 0 ? minBackoffMs : min(2 * backoffMs, maxBackoffMs);
+            retryTime = millis() + backoffMs;
+        }
+        return isWritten;
+    }
+
+    // milliseconds until flush() writes the latch
+    uint32_t timeToNext() const {
+        if (!isDirty)
+            return UINT32_MAX;
+        if (backoffMs == 0)
+            return 0;
+        int32_t remaining = retryTime - millis();
+        return remaining > 0 ? remaining : 0;
+    }
+
+    bool transmit(const uint8_t *data, size_t size) {
+        Wire.beginTransmission(address);
+        Wire.write(data, size);
+        writes++;
+        if (Wire.endTransmission() == 0)
+            return true;
+
+        failures++;
+        return false;
+    }
+};
+
+template <uint8_t Count>
+struct PortEngine {
+    typedef void (*ExpireFunction)(uint8_t port);
+
+    const PortDescriptor *ports;
+    PortExpander *expanders;
+    const uint8_t expanderCount;
+    const ExpireFunction onExpire;
+
+    bool active[Count];
+    uint32_t due[Count];
+    bool isPulsing[Count];
+
+    // the earliest deadline of all pulses
+    bool hasPulse = false;
+    uint32_t nextDue = 0;
+
+    PortEngine(const PortDescriptor *ports, PortExpander *expanders, uint8_t expanderCount, ExpireFunction onExpire)
+        : ports(ports), expanders(expanders), expanderCount(expanderCount), onExpire(onExpire) {
+    }
+
+    // all ports inactive
+    void begin() {
+        for (uint8_t i = 0; i < Count; i++) {
+            active[i] = false;
+            isPulsing[i] = false;
+            if (ports[i].expander == PORT_GPIO)
+                pinMode(ports[i].pin, OUTPUT);
+            write(i);
+        }
+
+        if (expanderCount > 0)
+            Wire.begin();
+        for (uint8_t i = 0; i < expanderCount; i++)
+            expanders[i].begin();
+    }
+
+    bool isActive(uint8_t port) const {
+        return active[port];
+    }
+
+    // switch a port, a momentary or timed port starts its pulse, false for an unknown port
+    bool set(uint8_t port, bool isActive) {
+        if (port >= Count)
+            return false;
+
+        active[port] = isActive;
+        isPulsing[port] = isActive && ports[port].mode != PORT_TOGGLE;
+        if (isPulsing[port]) {
+            due[port] = millis() + ports[port].pulseMs;
+            if (!hasPulse || (int32_t)(due[port] - nextDue) < 0)
+                nextDue = due[port];
+            hasPulse = true;
+        }
+
+        write(port);
+        return true;
+    }
+
+    bool toggle(uint8_t port) {
+        return port < Count && set(port, !active[port]);
+    }
+
+    // end the pulses that are due, then write the expanders that changed
+    void loop() {
+        if (hasPulse && (int32_t)(millis() - nextDue) >= 0)
+            expire();
+
+        for (uint8_t i = 0; i < expanderCount; i++)
+            expanders[i].flush();
+    }
+
+    // milliseconds until loop() has work, for the idle sleep of the main loop
+    uint32_t timeToNext() const {
+        uint32_t next = UINT32_MAX;
+        for (uint8_t i = 0; i < expanderCount; i++)
+            next = min(next, expanders[i].timeToNext());
+
+        if (!hasPulse)
+            return next;
+        int32_t remaining = nextDue - millis();
+        return min(next, remaining > 0 ? (uint32_t)remaining : 0);
+    }
+
+    void expire() {
+        uint32_t now = millis();
+        hasPulse = false;
+
+        for (uint8_t i = 0; i < Count; i++) {
+            if (!isPulsing[i])
+                continue;
+
+            if ((int32_t)(now - due[i]) >= 0) {
+                isPulsing[i] = false;
+                active[i] = false;
+                write(i);
+                if (onExpire)
+                    onExpire(i);
+            } else if (!hasPulse || (int32_t)(due[i] - nextDue) < 0) {
+                nextDue = due[i];
+                hasPulse = true;
+            }
+        }
+    }
+
+    void write(uint8_t port) {
+        const PortDescriptor &descriptor = ports[port];
+        bool level = active[port] != descriptor.isActiveLow;
+
+        if (descriptor.expander == PORT_GPIO)
+            digitalWrite(descriptor.pin, level ? HIGH : LOW);
+        else if (descriptor.expander < expanderCount)
+            expanders[descriptor.expander].set(descriptor.pin, level);
+    }
+};
+
+#endif
@@ -0,0 +1,277 @@
+/**** Outbound MQTT publishes, coalesced into few TCP writes.
+Publishing only encodes the PUBLISH packet (QoS 0) into a buffer the size of one TCP segment.
+`loop()` writes the packets that are waiting in one write, so a command that answers, reports
+its uptime and logs sends one segment instead of one per packet. Nagle's algorithm should be off
+on the connection (`setNoDelay(true)`), the queue does the coalescing without its delay. A
+payload is streamed in with `beginPublish()`, `write()`/`print()` and `endPublish()`; packets
+larger than the buffer go out in full segments while they are written.
+
+Only whole packets are left in the buffer between calls, so the packets of the MQTT client
+itself (PINGREQ, SUBSCRIBE) can be written to the same connection at any time. They wait there
+while the connection is down, and go out once it is up again.
+
+A publish only means the packet is in the buffer. The packets that never reach the connection,
+because a write broke off or the queue was cleared, are handed to the unsent function, so the
+telemetry among them can be queued again.
+
+void onUnsent(const uint8_t *topic, uint16_t topicLength, const uint8_t *payload, size_t length)
+{
+  // store it for later if it is telemetry
+}
+
+PublishQueue publishQueue(wifiClient, onUnsent);
+
+void onPing()
+{
+  publishQueue.publish("devices/esp01/get/ping", "pong");
+  publishQueue.beginPublish("devices/esp01/uptime", 10, true);
+  publishQueue.print("0:01:02:03");
+  publishQueue.endPublish();
+}
+
+void loop()
+{
+  mqttClient.loop();
+  publishQueue.loop(1460);
+}
+*/
+#ifndef PUBLISH_QUEUE_CPP
+#define PUBLISH_QUEUE_CPP
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+
+struct PublishQueue : public Print {
+    typedef void (*UnsentFunction)(const uint8_t *topic, uint16_t topicLength, const uint8_t *payload, size_t length);
+
+    // one TCP segment of lwIP on the ESP8266
+    static const uint16_t capacity = 1460;
+
+    WiFiClient &client;
+    const UnsentFunction unsent;
+
+    uint8_t buffer[capacity];
+    uint16_t length = 0;
+
+    // the packet being written, and whether a part of it was written out already
+    uint16_t packetStart = 0;
+    size_t packetRemaining = 0;
+    bool isPacketOpen = false;
+    bool isPacketSplit = false;
+
+    // statistics
+    uint32_t packets = 0;
+    uint32_t writes = 0;
+    uint32_t bytes = 0;
+    uint32_t dropped = 0;
+
+    PublishQueue(WiFiClient &client, UnsentFunction unsent = NULL) : client(client), unsent(unsent) {
+    }
+
+    bool isEmpty() const {
+        return length == 0;
+    }
+
+    bool publish(const char *topic, const char *payload, bool retained = false) {
+        return publish(topic, (const uint8_t *)payload, strlen(payload), retained);
+    }
+
+    bool publish(const char *topic, const uint8_t *payload, size_t payloadLength, bool retained = false) {
+        if (!beginPublish(topic, payloadLength, retained))
+            return false;
+        write(payload, payloadLength);
+        return endPublish();
+    }
+
+    // encode the header of a PUBLISH packet, the payload follows with write()
+    bool beginPublish(const char *topic, size_t payloadLength, bool retained) {
+        if (!client.connected())
+            return false;
+
+        size_t topicLength = strlen(topic);
+        size_t remaining = 2 + topicLength + payloadLength;
+
+        uint8_t header[5];
+        uint8_t headerLength = 0;
+        header[headerLength++] = 0x30 | (retained ? 1 : 0);
+        do {
+            uint8_t digit = remaining & 0x7f;
+            remaining >>= 7;
+            header[headerLength++] = remaining ? digit | 0x80 : digit;
+        } while (remaining);
+
+        // keep a packet that fits the buffer in one piece
+        size_t packetLength = headerLength + 2 + topicLength + payloadLength;
+        if (packetLength <= capacity && length + packetLength > capacity)
+            flush();
+
+        isPacketOpen = true;
+        isPacketSplit = false;
+        packetStart = length;
+        packetRemaining = packetLength;
+
+        append(header, headerLength);
+        uint8_t topicHeader[2] = {(uint8_t)(topicLength >> 8), (uint8_t)(topicLength & 0xff)};
+        append(topicHeader, 2);
+        append((const uint8_t *)topic, topicLength);
+        return true;
+    }
+
+    // false when the payload was not as long as announced or the connection broke
+    bool endPublish() {
+        bool isComplete = isPacketOpen && packetRemaining == 0;
+        isPacketOpen = false;
+
+        if (!isComplete) {
+            // a packet cut short cannot be completed, the connection has to be dropped
+            if (isPacketSplit)
+                client.stop();
+            length = packetStart;
+            dropped++;
+            return false;
+        }
+
+        packets++;
+
+        // the head of this packet went out already, the client may write next
+        if (isPacketSplit)
+            flush();
+        return true;
+    }
+
+    size_t write(uint8_t c) override {
+        return write(&c, 1);
+    }
+
+    size_t write(const uint8_t *data, size_t size) override {
+        if (!isPacketOpen)
+            return 0;
+        if (size > packetRemaining)
+            size = packetRemaining;
+        append(data, size);
+        return size;
+    }
+
+    // write whole packets, at most `budget` bytes unless the first packet is larger
+    size_t loop(size_t budget) {
+        if (length == 0 || isPacketOpen || !client.connected())
+            return 0;
+
+        size_t space = client.availableForWrite();
+        return send(sentLength(budget < space ? budget : space));
+    }
+
+    // write everything now, the buffer is needed or the connection is closed next
+    void flush() {
+        send(length);
+    }
+
+    // flush(), false when the connection broke and the packets were thrown away
+    bool sendAll() {
+        size_t size = length;
+        return send(size) == size;
+    }
+
+    // throw the packets away, the unsent function gets the whole ones
+    void clear() {
+        returnUnsent(0);
+        reset();
+    }
+
+    void reset() {
+        length = 0;
+        packetStart = 0;
+        isPacketOpen = false;
+    }
+
+    void append(const uint8_t *data, size_t size) {
+        while (size > 0) {
+            // a packet larger than the buffer goes out in full segments
+            if (length == capacity) {
+                isPacketSplit = true;
+                flush();
+                packetStart = 0;
+            }
+
+            size_t n = min(size, (size_t)(capacity - length));
+            memcpy(buffer + length, data, n);
+            length += n;
+            data += n;
+            size -= n;
+            if (isPacketOpen)
+                packetRemaining -= min(n, packetRemaining);
+        }
+    }
+
+    // bytes of the whole packets from the start of the buffer that fit the budget, at least one
+    size_t sentLength(size_t budget) const {
+        size_t end = 0;
+        while (end < length) {
+            size_t next = end + packetSize(end);
+            if (next > length || (end > 0 && next > budget))
+                break;
+            end = next;
+        }
+        return end;
+    }
+
+    // length of the packet that starts at offset, from its remaining length
+    size_t packetSize(size_t offset) const {
+        size_t pos = offset + 1;
+        size_t remaining = 0;
+        uint8_t shift = 0;
+        uint8_t digit;
+        do {
+            digit = buffer[pos++];
+            remaining |= (size_t)(digit & 0x7f) << shift;
+            shift += 7;
+        } while (digit & 0x80);
+        return pos - offset + remaining;
+    }
+
+    // hand the whole packets that were not written completely up to `written` to the unsent function
+    void returnUnsent(size_t written) {
+        // a packet cut in two by a full buffer leaves no whole packet before it
+        size_t end = isPacketOpen ? packetStart : length;
+        size_t start = 0;
+        while (unsent && start < end) {
+            size_t next = start + packetSize(start);
+            if (next > end)
+                break;
+
+            if (next > written) {
+                size_t pos = start + 1;
+                while (buffer[pos++] & 0x80) {
+                }
+                uint16_t topicLength = (buffer[pos] << 8) | buffer[pos + 1];
+                const uint8_t *topic = buffer + pos + 2;
+                unsent(topic, topicLength, topic + topicLength, buffer + next - (topic + topicLength));
+            }
+            start = next;
+        }
+    }
+
+    size_t send(size_t size) {
+        if (size == 0)
+            return 0;
+
+        size_t written = client.write(buffer, size);
+        writes++;
+        bytes += written;
+        if (written < size) {
+            // the connection broke, what is left would be a torn stream
+            dropped++;
+            client.stop();
+            returnUnsent(written);
+            reset();
+            return written;
+        }
+
+        memmove(buffer, buffer + size, length - size);
+        length -= size;
+        packetStart = packetStart > size ? packetStart - size : 0;
+        return written;
+    }
+};
+
+#endif
@@ -0,0 +1,618 @@
+/**** Local automation rules, compiled to bytecode and run on the events of the device.
+A rule set is a text of rules separated by new lines or ';'. A rule runs a command, written as in
+a batch, when its condition becomes true, or every few seconds:
+
+  when temp > 30 do port2 close
+  when temp < 28.5 or not online do port2 open
+  when input2 and port1 == 0 do beeper beep
+  every 600 do sensor_data data
+
+Conditions compare `temp`, `hum` (the filtered sensor values), `online` (connected to the broker),
+`inputN` (button N is pressed) and `portN` (port N is active) with numbers, joined by `and`, `or`
+and `not`. A condition fires once when it becomes true, and again only after it was false. A
+condition that reads the sensor before its first sample is not evaluated.
+
+`compile()` turns the text into postfix bytecode for a small stack machine, in a scratch program
+that replaces the running one only when all of it compiled. The code has no jumps and its length
+and stack depth are checked when it is compiled, so a rule runs in bounded time.
+`notify()` evaluates only the rules that read what changed. The commands a rule runs may change
+what other rules read, those rules are evaluated by the next `loop()`, so rules cannot recurse.
+The compiled rules are stored in SPIFFS and evaluated without the broker, also while offline.
+
+RuleEngine rules("/rules.bin", 2, 2, readVariable, runCommand);
+
+void setup()
+{
+  SPIFFS.begin();
+  rules.load();
+}
+
+void onSensorRead()
+{
+  rules.notify(RuleEngine::SOURCE_SENSOR);
+}
+
+void loop()
+{
+  rules.loop();
+}
+*/
+#ifndef RULE_ENGINE_CPP
+#define RULE_ENGINE_CPP
+
+#include <Arduino.h>
+#include <FS.h>
+
+#include <new>
+
+#include "ConfigStore.cpp"
+
+struct RuleEngine {
+    static const uint32_t magic = 0x454c5552;  // "RULE"
+    static const uint16_t version = 1;
+
+    static const uint8_t maxRules = 16;
+    static const uint16_t codeCapacity = 1024;  // conditions and commands of all rules
+    static const uint8_t maxRuleCode = 64;
+    static const uint8_t maxStack = 8;
+    static const uint32_t maxIntervalSeconds = 86400;
+
+    // values are hundredths, a true flag is 1.00
+    static const int32_t scale = 100;
+
+    enum Variable : uint8_t {
+        VAR_TEMP,
+        VAR_HUM,
+        // flags from here on
+        VAR_ONLINE,
+        VAR_INPUT,
+        VAR_PORT,
+        VAR_COUNT
+    };
+
+    enum Source : uint8_t {
+        SOURCE_SENSOR = 1,
+        SOURCE_NETWORK = 2,
+        SOURCE_INPUT = 4,
+        SOURCE_PORT = 8,
+        SOURCE_ALL = 15
+    };
+
+    enum Op : uint8_t {
+        OP_VAR,    // variable, index
+        OP_CONST,  // 4 bytes
+        OP_GT,
+        OP_LT,
+        OP_GE,
+        OP_LE,
+        OP_EQ,
+        OP_NE,
+        OP_AND,
+        OP_OR,
+        OP_NOT
+    };
+
+    enum State : uint8_t {
+        STATE_FALSE,
+        STATE_TRUE,
+        STATE_UNKNOWN
+    };
+
+    struct Rule {
+        uint16_t condition;  // offset of the code in `code`
+        uint8_t conditionLength;  // 0 for a timer rule
+        uint8_t sources;
+        uint16_t command;  // offset of "<name>\0<payload>\0" in `code`
+        uint32_t intervalMs;
+    };
+
+    struct Program {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t size;
+        uint8_t count;
+        uint16_t length;
+        Rule rules[maxRules];
+        uint8_t code[codeCapacity];
+        uint32_t crc;  // over everything before it
+    };
+
+    // false when the variable has no value yet, flags are 0 or 1
+    typedef bool (*VariableFunction)(Variable variable, uint8_t index, int32_t &value);
+    typedef bool (*CommandFunction)(uint8_t rule, const char *name, const char *payload);
+
+    const char *const path;
+    const uint8_t inputCount;
+    const uint8_t portCount;
+    const VariableFunction readVariable;
+    const CommandFunction runCommand;
+
+    Program program;
+    uint8_t states[maxRules];
+    uint32_t due[maxRules];
+    uint32_t hits[maxRules];
+
+    uint8_t pendingSources = 0;
+    bool isEvaluating = false;
+    uint32_t evaluations = 0;
+
+    // why the last rule set did not compile, and its rule from 1
+    const char *error = NULL;
+    uint8_t errorRule = 0;
+
+    RuleEngine(const char *path, uint8_t inputCount, uint8_t portCount, VariableFunction readVariable,
+               CommandFunction runCommand)
+        : path(path), inputCount(inputCount), portCount(portCount), readVariable(readVariable), runCommand(runCommand) {
+        clear();
+    }
+
+    void clear() {
+        memset(&program, 0, sizeof(program));
+        reset();
+    }
+
+    // load the stored rules, no rules when there are none or they are corrupted
+    bool load() {
+        File file = SPIFFS.open(path, "r");
+        bool isValid = file && file.read((uint8_t *)&program, sizeof(program)) == sizeof(program) &&
+                       program.magic == magic && program.version == version && program.size == sizeof(program) &&
+                       program.crc == crc32(&program, offsetof(Program, crc));
+        if (file)
+            file.close();
+
+        if (!isValid)
+            clear();
+        reset();
+        return isValid;
+    }
+
+    bool save() {
+        program.magic = magic;
+        program.version = version;
+        program.size = sizeof(program);
+        program.crc = crc32(&program, offsetof(Program, crc));
+
+        File file = SPIFFS.open(path, "w");
+        if (!file)
+            return false;
+        bool isSaved = file.write((const uint8_t *)&program, sizeof(program)) == sizeof(program);
+        file.close();
+        return isSaved;
+    }
+
+    // the rules start over, every condition is evaluated on its next event
+    void reset() {
+        uint32_t now = millis();
+        for (uint8_t i = 0; i < maxRules; i++) {
+            states[i] = STATE_UNKNOWN;
+            due[i] = now + program.rules[i].intervalMs;
+            hits[i] = 0;
+        }
+        pendingSources = SOURCE_ALL;
+    }
+
+    // replace the rules, a text that does not compile keeps the running rules and their hits, and
+    // sets `error`
+    bool compile(const char *text, size_t length) {
+        error = NULL;
+        errorRule = 0;
+
+        // compiled aside on the heap, the stack of the MQTT callback has no room for it
+        output = new (std::nothrow) Program();
+        if (output == NULL)
+            return fail("out of memory");
+
+        bool isCompiled = compileText(text, length);
+        if (isCompiled) {
+            program = *output;
+            errorRule = 0;
+            reset();
+        }
+        delete output;
+        output = NULL;
+        return isCompiled;
+    }
+
+    // evaluate the rules that read one of the sources
+    void notify(uint8_t sources) {
+        pendingSources |= sources;
+
+        // the command of a rule changed something, the next loop() evaluates the rules it affects
+        if (isEvaluating)
+            return;
+
+        isEvaluating = true;
+        uint8_t changed = pendingSources;
+        pendingSources = 0;
+        for (uint8_t i = 0; i < program.count; i++) {
+            const Rule &rule = program.rules[i];
+            if (rule.conditionLength == 0 || !(rule.sources & changed))
+                continue;
+
+            evaluations++;
+            uint8_t state = evaluate(rule);
+            if (state == STATE_UNKNOWN)
+                continue;
+            if (state == STATE_TRUE && states[i] != STATE_TRUE)
+                fire(i);
+            states[i] = state;
+        }
+        isEvaluating = false;
+    }
+
+    // the rules whose sources changed meanwhile, and the timer rules that are due
+    void loop() {
+        if (pendingSources)
+            notify(0);
+
+        uint32_t now = millis();
+        for (uint8_t i = 0; i < program.count; i++) {
+            const Rule &rule = program.rules[i];
+            if (rule.intervalMs == 0 || (int32_t)(now - due[i]) < 0)
+                continue;
+
+            // a constant period, unless the loop was held up for longer than one
+            due[i] += rule.intervalMs;
+            if ((int32_t)(now - due[i]) >= 0)
+                due[i] = now + rule.intervalMs;
+            fire(i);
+        }
+    }
+
+    // milliseconds until loop() has work, for the idle sleep of the main loop
+    uint32_t timeToNext() const {
+        if (pendingSources && program.count)
+            return 0;
+
+        uint32_t next = UINT32_MAX;
+        uint32_t now = millis();
+        for (uint8_t i = 0; i < program.count; i++) {
+            if (program.rules[i].intervalMs == 0)
+                continue;
+            int32_t remaining = due[i] - now;
+            next = min(next, remaining > 0 ? (uint32_t)remaining : 0);
+        }
+        return next;
+    }
+
+    void fire(uint8_t i) {
+        hits[i]++;
+        const char *name = (const char *)program.code + program.rules[i].command;
+        runCommand(i, name, name + strlen(name) + 1);
+    }
+
+    uint8_t evaluate(const Rule &rule) const {
+        int32_t stack[maxStack];
+        uint8_t top = 0;
+
+        const uint8_t *pc = program.code + rule.condition;
+        const uint8_t *end = pc + rule.conditionLength;
+        while (pc < end) {
+            uint8_t op = *pc++;
+            if (op == OP_VAR || op == OP_CONST) {
+                if (top == maxStack)
+                    return STATE_UNKNOWN;
+
+                int32_t value;
+                if (op == OP_CONST) {
+                    memcpy(&value, pc, sizeof(value));
+                    pc += sizeof(value);
+                } else {
+                    Variable variable = (Variable)pc[0];
+                    if (!readVariable(variable, pc[1], value))
+                        return STATE_UNKNOWN;
+                    if (variable >= VAR_ONLINE)
+                        value = value ? scale : 0;
+                    pc += 2;
+                }
+                stack[top++] = value;
+                continue;
+            }
+
+            if (op == OP_NOT) {
+                if (top < 1)
+                    return STATE_UNKNOWN;
+                stack[top - 1] = stack[top - 1] ? 0 : scale;
+                continue;
+            }
+
+            if (top < 2)
+                return STATE_UNKNOWN;
+            int32_t b = stack[--top];
+            int32_t a = stack[top - 1];
+            bool result;
+            switch (op) {
+                case OP_GT: result = a > b; break;
+                case OP_LT: result = a < b; break;
+                case OP_GE: result = a >= b; break;
+                case OP_LE: result = a <= b; break;
+                case OP_EQ: result = a == b; break;
+                case OP_NE: result = a != b; break;
+                case OP_AND: result = a && b; break;
+                case OP_OR: result = a || b; break;
+                default: return STATE_UNKNOWN;
+            }
+            stack[top - 1] = result ? scale : 0;
+        }
+
+        if (top != 1)
+            return STATE_UNKNOWN;
+        return stack[0] ? STATE_TRUE : STATE_FALSE;
+    }
+
+    // {"rules":3,"hits":[2,0,14],"evaluations":120}, or {"error":"..","rule":2}
+    size_t printJson(Print &out) const {
+        if (error) {
+            size_t n = out.print("{\"error\":\"");
+            n += out.print(error);
+            n += out.print("\",\"rule\":");
+            n += out.print(errorRule);
+            n += out.print('}');
+            return n;
+        }
+
+        size_t n = out.print("{\"rules\":");
+        n += out.print(program.count);
+        n += out.print(",\"hits\":[");
+        for (uint8_t i = 0; i < program.count; i++) {
+            if (i)
+                n += out.print(',');
+            n += out.print(hits[i]);
+        }
+        n += out.print("],\"evaluations\":");
+        n += out.print(evaluations);
+        n += out.print('}');
+        return n;
+    }
+
+    // ========== compiler
+
+    struct Scanner {
+        const char *p;
+        const char *end;
+
+        void skipSpace() {
+            while (p < end && isspace((uint8_t)*p))
+                p++;
+        }
+
+        bool isAtEnd() {
+            skipSpace();
+            return p == end;
+        }
+
+        // a keyword or operator, a keyword has to end at a word boundary
+        bool take(const char *token) {
+            skipSpace();
+            size_t length = strlen(token);
+            if ((size_t)(end - p) < length || memcmp(p, token, length) != 0)
+                return false;
+            if (isalpha((uint8_t)token[0]) && p + length < end && (isalnum((uint8_t)p[length]) || p[length] == '_'))
+                return false;
+            p += length;
+            return true;
+        }
+
+        // letters, digits and '_', returns the length
+        size_t name(const char *&start) {
+            skipSpace();
+            start = p;
+            while (p < end && (isalnum((uint8_t)*p) || *p == '_'))
+                p++;
+            return p - start;
+        }
+
+        // a decimal number in hundredths, "-2.5" is -250
+        bool number(int32_t &value) {
+            skipSpace();
+            bool isNegative = p < end && *p == '-';
+            if (isNegative)
+                p++;
+
+            const char *start = p;
+            int64_t result = 0;
+            while (p < end && isdigit((uint8_t)*p) && result < INT32_MAX)
+                result = result * 10 + (*p++ - '0');
+            if (p == start)
+                return false;
+            result *= scale;
+
+            if (p < end && *p == '.') {
+                p++;
+                int64_t unit = scale / 10;
+                while (p < end && isdigit((uint8_t)*p)) {
+                    result += (*p++ - '0') * unit;
+                    unit /= 10;
+                }
+            }
+            if (result > INT32_MAX)
+                return false;
+
+            value = isNegative ? -(int32_t)result : (int32_t)result;
+            return true;
+        }
+    };
+
+    // the rule set and rule being compiled
+    Program *output;
+    uint8_t depth;
+    uint8_t maxDepth;
+
+    bool compileText(const char *text, size_t length) {
+        const char *end = text + length;
+        while (text < end) {
+            const char *lineEnd = text;
+            while (lineEnd < end && *lineEnd != '\n' && *lineEnd != ';')
+                lineEnd++;
+
+            Scanner scanner = {text, lineEnd};
+            if (!scanner.isAtEnd()) {
+                errorRule = output->count + 1;
+                if (output->count == maxRules)
+                    return fail("too many rules");
+                if (!compileRule(scanner))
+                    return false;
+                output->count++;
+            }
+            text = lineEnd + 1;
+        }
+        return true;
+    }
+
+    bool fail(const char *message) {
+        if (!error)
+            error = message;
+        return false;
+    }
+
+    bool emit(const void *data, size_t size) {
+        if (output->length + size > codeCapacity)
+            return fail("rules too long");
+        memcpy(output->code + output->length, data, size);
+        output->length += size;
+        return true;
+    }
+
+    bool emitOp(uint8_t op) {
+        return emit(&op, 1);
+    }
+
+    bool compileRule(Scanner &scanner) {
+        Rule &rule = output->rules[output->count];
+
+        if (scanner.take("every")) {
+            int32_t seconds;
+            if (!scanner.number(seconds) || seconds < scale || seconds > (int32_t)maxIntervalSeconds * scale)
+                return fail("interval from 1 to 86400 seconds");
+            rule.intervalMs = (uint32_t)seconds * (1000 / scale);
+        } else if (scanner.take("when")) {
+            rule.condition = output->length;
+            depth = 0;
+            maxDepth = 0;
+            if (!compileOr(scanner, rule))
+                return false;
+            if (output->length - rule.condition > maxRuleCode)
+                return fail("condition too long");
+            if (maxDepth > maxStack)
+                return fail("condition too deep");
+            rule.conditionLength = output->length - rule.condition;
+        } else {
+            return fail("expected when or every");
+        }
+
+        if (!scanner.take("do"))
+            return fail("expected do");
+
+        // "<name> <payload>", as a command of a batch
+        const char *name;
+        size_t nameLength = scanner.name(name);
+        if (nameLength == 0)
+            return fail("expected a command");
+        scanner.skipSpace();
+        const char *payloadEnd = scanner.end;
+        while (payloadEnd > scanner.p && isspace((uint8_t)payloadEnd[-1]))
+            payloadEnd--;
+
+        rule.command = output->length;
+        return emit(name, nameLength) && emitOp(0) && emit(scanner.p, payloadEnd - scanner.p) && emitOp(0);
+    }
+
+    bool compileOr(Scanner &scanner, Rule &rule) {
+        if (!compileAnd(scanner, rule))
+            return false;
+        while (scanner.take("or")) {
+            if (!compileAnd(scanner, rule) || !emitBinary(OP_OR))
+                return false;
+        }
+        return true;
+    }
+
+    bool compileAnd(Scanner &scanner, Rule &rule) {
+        if (!compileNot(scanner, rule))
+            return false;
+        while (scanner.take("and")) {
+            if (!compileNot(scanner, rule) || !emitBinary(OP_AND))
+                return false;
+        }
+        return true;
+    }
+
+    bool compileNot(Scanner &scanner, Rule &rule) {
+        if (scanner.take("not"))
+            return compileNot(scanner, rule) && emitOp(OP_NOT);
+        return compileComparison(scanner, rule);
+    }
+
+    // "<operand>" or "<operand> <comparator> <number>"
+    bool compileComparison(Scanner &scanner, Rule &rule) {
+        if (!compileOperand(scanner, rule))
+            return false;
+
+        static const char *const comparators[] = {">=", "<=", "==", "!=", ">", "<"};
+        static const Op ops[] = {OP_GE, OP_LE, OP_EQ, OP_NE, OP_GT, OP_LT};
+        for (uint8_t i = 0; i < sizeof(ops); i++) {
+            if (!scanner.take(comparators[i]))
+                continue;
+
+            int32_t value;
+            if (!scanner.number(value))
+                return fail("expected a number");
+            return emitConst(value) && emitBinary(ops[i]);
+        }
+        return true;
+    }
+
+    bool compileOperand(Scanner &scanner, Rule &rule) {
+        const char *name;
+        size_t length = scanner.name(name);
+
+        // "input2" and "port12" are numbered from 1
+        size_t digits = length;
+        while (digits > 0 && isdigit((uint8_t)name[digits - 1]))
+            digits--;
+        uint16_t number = digits < length && length - digits <= 3 ? atoi(name + digits) : 0;
+
+        if (length == 4 && memcmp(name, "temp", 4) == 0)
+            return emitVar(VAR_TEMP, 0, SOURCE_SENSOR, rule);
+        if (length == 3 && memcmp(name, "hum", 3) == 0)
+            return emitVar(VAR_HUM, 0, SOURCE_SENSOR, rule);
+        if (length == 6 && memcmp(name, "online", 6) == 0)
+            return emitVar(VAR_ONLINE, 0, SOURCE_NETWORK, rule);
+        if (digits == 5 && memcmp(name, "input", 5) == 0) {
+            if (number < 1 || number > inputCount)
+                return fail("no such input");
+            return emitVar(VAR_INPUT, number - 1, SOURCE_INPUT, rule);
+        }
+        if (digits == 4 && memcmp(name, "port", 4) == 0) {
+            if (number < 1 || number > portCount)
+                return fail("no such port");
+            return emitVar(VAR_PORT, number - 1, SOURCE_PORT, rule);
+        }
+        return fail("expected temp, hum, online, inputN or portN");
+    }
+
+    bool emitVar(Variable variable, uint8_t index, Source source, Rule &rule) {
+        rule.sources |= source;
+        push();
+        const uint8_t code[] = {OP_VAR, (uint8_t)variable, index};
+        return emit(code, sizeof(code));
+    }
+
+    bool emitConst(int32_t value) {
+        push();
+        return emitOp(OP_CONST) && emit(&value, sizeof(value));
+    }
+
+    // two values make one
+    bool emitBinary(Op op) {
+        depth--;
+        return emitOp(op);
+    }
+
+    void push() {
+        depth++;
+        maxDepth = max(maxDepth, depth);
+    }
+};
+
+#endif
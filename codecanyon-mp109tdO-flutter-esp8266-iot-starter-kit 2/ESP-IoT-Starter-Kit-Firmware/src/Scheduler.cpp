@@ -0,0 +1,234 @@
+/**** Cooperative deadline scheduler for periodic and one-shot tasks.
+Tasks are plain functions kept in a small min-heap ordered by their next deadline. A function is
+scheduled at most once: scheduling it again moves its deadline. `run()` calls every task that is
+due and returns the time until the next deadline, which the main loop hands to `sleep()` so the
+device idles until there is work again. An interrupt handler can end the sleep early with `wake()`.
+
+Engines whose deadlines move on every call, like a connection backoff, a sensor read or a port
+pulse, are not tasks. They run from `loop()` every pass and report the time until they have work
+through their own `timeToNext()`. The loop sleeps for the shortest of these times and the one from
+`run()`, which saves rescheduling a task on every change of their state.
+
+Scheduler scheduler;
+
+void blink()
+{
+  digitalWrite(LED, !digitalRead(LED));
+}
+
+void ledOff()
+{
+  scheduler.cancel(blink);
+  digitalWrite(LED, LOW);
+}
+
+bool isIdle()
+{
+  return wifiClient.available() == 0;
+}
+
+void setup()
+{
+  scheduler.every(blink, 500);
+  scheduler.after(ledOff, 10000);
+}
+
+void loop()
+{
+  scheduler.sleep(scheduler.run(), isIdle);
+}
+*/
+#ifndef SCHEDULER_CPP
+#define SCHEDULER_CPP
+
+#include <Arduino.h>
+
+#if defined(ESP8266)
+#include <core_version.h>
+#endif
+
+// core 3 can end a delay early when an interrupt calls esp_schedule()
+#if defined(ARDUINO_ESP8266_MAJOR) && ARDUINO_ESP8266_MAJOR >= 3
+#include <coredecls.h>
+#define SCHEDULER_ESP_DELAY
+#endif
+
+struct Scheduler {
+    typedef void (*TaskFunction)();
+    typedef bool (*IdleFunction)();
+
+    static const uint8_t maxTasks = 16;
+    static const uint32_t never = UINT32_MAX;
+
+    struct Task {
+        TaskFunction function;
+        uint32_t due;
+        uint32_t interval;  // 0 for one-shot tasks
+    };
+
+    // binary min-heap on the deadline
+    Task heap[maxTasks];
+    uint8_t count = 0;
+
+    // longest sleep, and how often a sleep checks `isIdle`
+    const uint32_t maxSleep;
+    const uint32_t pollInterval;
+
+    volatile bool isWakeRequested = false;
+
+    Scheduler(uint32_t maxSleep = 1000, uint32_t pollInterval = 10) : maxSleep(maxSleep), pollInterval(pollInterval) {
+    }
+
+    // run once after a delay
+    bool after(TaskFunction function, uint32_t delay) {
+        return schedule(function, delay, 0);
+    }
+
+    // run periodically, the first time after `interval` unless `firstDelay` is given
+    bool every(TaskFunction function, uint32_t interval, uint32_t firstDelay = never) {
+        if (interval == 0)
+            return false;
+        return schedule(function, firstDelay == never ? interval : firstDelay, interval);
+    }
+
+    void cancel(TaskFunction function) {
+        int8_t index = find(function);
+        if (index >= 0)
+            remove(index);
+    }
+
+    bool isScheduled(TaskFunction function) const {
+        return find(function) >= 0;
+    }
+
+    // call the due tasks, returns the milliseconds until the next deadline
+    uint32_t run() {
+        uint32_t now = millis();
+
+        // every task runs at most once per call, even if it reschedules itself as due
+        for (uint8_t runs = 0; count > 0 && runs < maxTasks && isDue(heap[0].due, now); runs++) {
+            Task task = heap[0];
+
+            // update the heap before calling the task, so it may schedule or cancel freely
+            if (task.interval > 0) {
+                // fixed rate without drift, but skip the missed periods after a long stall
+                heap[0].due += task.interval;
+                if (isDue(heap[0].due, now))
+                    heap[0].due = now + task.interval;
+                siftDown(0);
+            } else {
+                remove(0);
+            }
+
+            task.function();
+            now = millis();
+        }
+
+        if (count == 0)
+            return never;
+        return isDue(heap[0].due, now) ? 0 : heap[0].due - now;
+    }
+
+    // idle until the timeout, a wake() or until `isIdle` returns false
+    void sleep(uint32_t timeout, IdleFunction isIdle) {
+        if (timeout > maxSleep)
+            timeout = maxSleep;
+
+#ifdef SCHEDULER_ESP_DELAY
+        esp_delay(timeout, [this, isIdle]() { return !isWakeRequested && isIdle(); }, pollInterval);
+#else
+        // the delay cannot be interrupted, check for work between short delays
+        uint32_t start = millis();
+        uint32_t elapsed = 0;
+        while (elapsed < timeout && !isWakeRequested && isIdle()) {
+            delay(min(pollInterval, timeout - elapsed));
+            elapsed = millis() - start;
+        }
+#endif
+        isWakeRequested = false;
+    }
+
+    // end a sleep early, safe to call from an interrupt handler
+    void IRAM_ATTR wake() {
+        isWakeRequested = true;
+#ifdef SCHEDULER_ESP_DELAY
+        esp_schedule();
+#endif
+    }
+
+    bool schedule(TaskFunction function, uint32_t delay, uint32_t interval) {
+        int8_t index = find(function);
+        if (index < 0) {
+            if (count == maxTasks)
+                return false;
+            index = count++;
+        }
+
+        heap[index].function = function;
+        heap[index].due = millis() + delay;
+        heap[index].interval = interval;
+        siftDown(siftUp(index));
+        return true;
+    }
+
+    // deadlines are compared relative to now, so millis() rollover is harmless
+    static bool isDue(uint32_t due, uint32_t now) {
+        return (int32_t)(due - now) <= 0;
+    }
+
+    static bool isBefore(const Task &a, const Task &b) {
+        return (int32_t)(a.due - b.due) < 0;
+    }
+
+    int8_t find(TaskFunction function) const {
+        for (uint8_t i = 0; i < count; i++) {
+            if (heap[i].function == function)
+                return i;
+        }
+        return -1;
+    }
+
+    void remove(uint8_t index) {
+        count--;
+        if (index == count)
+            return;
+        heap[index] = heap[count];
+        siftDown(siftUp(index));
+    }
+
+    // returns the new position of the task
+    uint8_t siftUp(uint8_t index) {
+        while (index > 0) {
+            uint8_t parent = (index - 1) / 2;
+            if (!isBefore(heap[index], heap[parent]))
+                break;
+            swap(index, parent);
+            index = parent;
+        }
+        return index;
+    }
+
+    void siftDown(uint8_t index) {
+        while (true) {
+            uint8_t smallest = index;
+            uint8_t left = index * 2 + 1;
+            uint8_t right = left + 1;
+            if (left < count && isBefore(heap[left], heap[smallest]))
+                smallest = left;
+            if (right < count && isBefore(heap[right], heap[smallest]))
+                smallest = right;
+            if (smallest == index)
+                break;
+            swap(index, smallest);
+            index = smallest;
+        }
+    }
+
+    void swap(uint8_t a, uint8_t b) {
+        Task task = heap[a];
+        heap[a] = heap[b];
+        heap[b] = task;
+    }
+};
+
+#endif
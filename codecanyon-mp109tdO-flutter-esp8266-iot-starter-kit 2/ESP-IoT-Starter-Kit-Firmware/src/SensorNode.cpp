@@ -0,0 +1,208 @@
+/**** Sensor node that sleeps between samples and publishes them in batches.
+The state of the node lives in RTC memory, which keeps its content through deep sleep: a ring of
+samples, a clock that adds up the sleep and awake times, and the time spent awake with and without
+the radio since the last batch. Most wakes only take a sample and sleep again with the radio
+disabled. The wake before a publish sleeps with the radio enabled, so the publishing wake can
+connect. `printJson()` reports the batch with an estimate of the energy it cost, from typical
+currents of an ESP-12 module. It takes the awake time of the wake, read once, so the pass that
+measures the payload and the pass that writes it print the same ages and figures.
+
+SensorNode node(6);
+
+void setup()
+{
+  node.begin();
+  node.add(readTemperature(), readHumidity());
+
+  if (node.isPublishDue() && connect()) {
+    uint32_t awake = node.awakeTime();
+    PrintCounter counter;
+    node.printJson(counter, awake);
+    mqttClient.beginPublish("batch", counter.length, false);
+    node.printJson(mqttClient, awake);
+    mqttClient.endPublish();
+    node.published();
+  }
+
+  node.sleep(300000);  // never returns
+}
+*/
+#ifndef SENSOR_NODE_CPP
+#define SENSOR_NODE_CPP
+
+#include <Arduino.h>
+
+#include "ConfigStore.cpp"
+#include "PayloadWriter.cpp"
+
+struct SensorNode {
+    static const uint32_t magic = 0x45444f4e;  // "NODE"
+
+    // RTC user memory from block 8, after the WiFi cache of the connection manager
+    static const uint32_t rtcOffset = 8;
+
+    static const uint8_t capacity = 32;
+
+    // typical currents of an ESP-12 module and the DHT22
+    static const uint32_t sleepMicroAmps = 25;
+    static const uint32_t awakeMicroAmps = 16000;  // radio disabled
+    static const uint32_t radioMicroAmps = 75000;  // average of association, DHCP and transmitting
+    static const uint32_t supplyMilliVolts = 3300;
+
+    struct Sample {
+        int16_t temperature;  // tenths of a degree
+        uint16_t humidity;    // tenths of a percent
+        uint32_t time;        // node clock
+    };
+
+    struct State {
+        uint32_t magic;
+        uint32_t clock;  // ms of sleep and wakes since the first boot
+        uint32_t lastSleep;
+
+        // since the last batch
+        uint32_t sleepMs;
+        uint32_t awakeMs;
+        uint32_t radioMs;
+        uint16_t wakes;
+
+        uint16_t wakesToPublish;
+        uint16_t failures;  // samples or publishes that failed
+        uint8_t head;
+        uint8_t count;
+
+        Sample samples[capacity];
+        uint32_t crc;  // over everything before it
+    };
+
+    // wakes per published batch
+    const uint16_t batchWakes;
+
+    State state;
+    bool isRadioOn = false;
+
+    // millis() at the wake, and the part of this wake already counted by a published batch
+    uint32_t wakeTime = 0;
+    uint32_t reportedMs = 0;
+
+    SensorNode(uint16_t batchWakes) : batchWakes(batchWakes) {
+    }
+
+    // load the state and count the sleep that just ended, returns false after a power up
+    bool begin() {
+        wakeTime = millis();
+        reportedMs = 0;
+
+        bool isValid = ESP.rtcUserMemoryRead(rtcOffset, (uint32_t *)&state, sizeof(state)) && state.magic == magic &&
+                       state.crc == crc32(&state, offsetof(State, crc));
+        if (!isValid) {
+            memset(&state, 0, sizeof(state));
+            state.magic = magic;
+            state.wakesToPublish = 1;  // the first wake reports, it shows the node works
+            return false;
+        }
+
+        state.clock += state.lastSleep;
+        state.sleepMs += state.lastSleep;
+        state.lastSleep = 0;
+        return true;
+    }
+
+    // the oldest sample is overwritten when batches could not be published for a while
+    void add(float temperature, float humidity) {
+        Sample &sample = state.samples[(state.head + state.count) % capacity];
+        sample.temperature = (int16_t)lroundf(temperature * 10);
+        sample.humidity = (uint16_t)lroundf(humidity * 10);
+        sample.time = state.clock + awakeTime();
+
+        if (state.count < capacity)
+            state.count++;
+        else
+            state.head = (state.head + 1) % capacity;
+    }
+
+    void failed() {
+        state.failures++;
+    }
+
+    uint32_t awakeTime() const {
+        return millis() - wakeTime;
+    }
+
+    bool isPublishDue() const {
+        return state.wakesToPublish <= 1;
+    }
+
+    // the batch is out, start the next one
+    void published() {
+        reportedMs = awakeTime();
+        state.head = 0;
+        state.count = 0;
+        state.sleepMs = 0;
+        state.awakeMs = 0;
+        state.radioMs = 0;
+        state.wakes = 0;
+        state.failures = 0;
+    }
+
+    // store the state and sleep, the wake before a publish keeps the radio calibrated and enabled
+    void sleep(uint32_t periodMs) {
+        uint32_t awake = awakeTime();
+        state.clock += awake;
+        state.awakeMs += awake - reportedMs;
+        if (isRadioOn)
+            state.radioMs += awake - reportedMs;
+        if (reportedMs == 0)
+            state.wakes++;
+
+        state.wakesToPublish = isPublishDue() ? batchWakes : state.wakesToPublish - 1;
+
+        // a constant sample period, however long this wake took
+        state.lastSleep = awake < periodMs ? periodMs - awake : 1;
+        state.crc = crc32(&state, offsetof(State, crc));
+        ESP.rtcUserMemoryWrite(rtcOffset, (uint32_t *)&state, sizeof(state));
+
+        ESP.deepSleep((uint64_t)state.lastSleep * 1000, isPublishDue() ? WAKE_RF_DEFAULT : WAKE_RF_DISABLED);
+    }
+
+    // {"samples":[{"age":..,"Temp":..,"Hum":..},..],"wakes":..,"failures":..,"duty":..,"avgCurrent":..,
+    //  "energyPerSample":..}, age in seconds, duty in percent, current in uA, energy in mJ, for the
+    // awake time of this wake
+    size_t printJson(Print &out, uint32_t awake) const {
+        uint32_t now = state.clock + awake;
+
+        size_t n = out.print("{\"samples\":[");
+        for (uint8_t i = 0; i < state.count; i++) {
+            const Sample &sample = state.samples[(state.head + i) % capacity];
+            n += out.print(i ? ",{\"age\":" : "{\"age\":");
+            n += out.print((now - sample.time) / 1000);
+            n += out.print(",\"Temp\":");
+            n += PayloadWriter::printFixed(out, sample.temperature / 10.0f, 1);
+            n += out.print(",\"Hum\":");
+            n += PayloadWriter::printFixed(out, sample.humidity / 10.0f, 1);
+            n += out.print('}');
+        }
+
+        // this wake counts as far as it got, with the radio on
+        float awakeMs = state.awakeMs + awake;
+        float radioMs = state.radioMs + awake;
+        float totalMs = awakeMs + state.sleepMs;
+        float microAmpMs = state.sleepMs * (float)sleepMicroAmps + (awakeMs - radioMs) * awakeMicroAmps +
+                           radioMs * radioMicroAmps;
+
+        n += out.print("],\"wakes\":");
+        n += out.print(state.wakes + 1);
+        n += out.print(",\"failures\":");
+        n += out.print(state.failures);
+        n += out.print(",\"duty\":");
+        n += PayloadWriter::printFixed(out, 100 * awakeMs / totalMs, 3);
+        n += out.print(",\"avgCurrent\":");
+        n += PayloadWriter::printFixed(out, microAmpMs / totalMs, 1);
+        n += out.print(",\"energyPerSample\":");
+        n += PayloadWriter::printFixed(out, microAmpMs * supplyMilliVolts / 1e9f / (state.count ? state.count : 1), 3);
+        n += out.print('}');
+        return n;
+    }
+};
+
+#endif
@@ -0,0 +1,542 @@
+/**** Sensor sampling, filtering and report-on-change.
+A source is something that measures, such as the DHT22, and gives one or more sensor values: the
+temperature and the humidity. Every source is sampled at its own period. Its start function begins
+a measurement, and the values come back through add(), one per sensor, then commit(). Values are
+hundredths of their unit.
+
+Every sensor filters its samples: a median over the last few rejects single bad readings, then an
+exponential moving average smooths the noise. A source reports its filtered values when one of
+them moved at least its deadband since the last report, or when its last report is older than its
+interval, so a stable value is sent rarely and a real change right away.
+
+Every source also closes a window of samples at its own length. The raw samples of the window, the
+short spikes between two reports included, are summed up in a WindowStats per sensor: min, max,
+mean, deviation and percentiles. The window function gets them once the window is over, one record
+for all the samples, before they are cleared for the next window.
+
+The settings are changed at runtime with a text of sensor names and their settings, and stored in
+SPIFFS:
+
+  dht period 2 interval 3600 window 300, temp median 3 ema 50 deadband 0.2, hum deadband 2
+
+void startDht()
+{
+  dht.start();
+}
+
+const SensorSource sources[] = {{"dht", startDht, 2, 3600, 300}};
+const SensorDescriptor table[] = {{"temp", 0, 3, 50, 20}, {"hum", 0, 3, 50, 200}};
+
+SensorPipeline<1, 2> sensors("/sensors.bin", sources, table, onReport, onWindow);
+
+void onWindow(uint8_t source)
+{
+  sensors.statsOf(0).printJson(Serial);  // the temperatures of the last 5 minutes
+}
+
+void onDhtRead(bool isValid)
+{
+  if (isValid) {
+    sensors.add(0, lroundf(dht.temperature * 100));
+    sensors.add(1, lroundf(dht.humidity * 100));
+    sensors.commit(0);
+  }
+}
+
+void loop()
+{
+  sensors.loop();
+}
+*/
+#ifndef SENSOR_PIPELINE_CPP
+#define SENSOR_PIPELINE_CPP
+
+#include <Arduino.h>
+#include <FS.h>
+
+#include "ConfigStore.cpp"
+#include "WindowStats.cpp"
+
+struct SensorSource {
+    const char *name;
+    void (*start)();     // begins a measurement, its values come back through add() and commit()
+    uint16_t periodS;    // default sample period
+    uint16_t intervalS;  // default longest time without a report, 0 for none
+    uint16_t windowS;    // default length of a window of statistics, 0 for none
+};
+
+struct SensorDescriptor {
+    const char *name;
+    uint8_t source;  // index in the source table
+    // default settings: samples in the median, weight of a new sample in the average in percent,
+    // and the change that is reported, in hundredths
+    uint8_t median;
+    uint8_t ema;
+    uint16_t deadband;
+};
+
+template <uint8_t Sources, uint8_t Sensors>
+struct SensorPipeline {
+    static const uint32_t magic = 0x534e4553;  // "SENS"
+    static const uint16_t version = 2;
+
+    static const uint8_t maxMedian = 5;
+    // the DHT22 measures at most every 2 seconds
+    static const uint16_t minPeriodS = 2;
+    static const uint16_t maxPeriodS = 3600;
+    static const uint16_t minWindowS = 10;
+
+    typedef void (*ReportFunction)(uint8_t source);
+    typedef void (*WindowFunction)(uint8_t source);
+
+    struct SourceSettings {
+        uint16_t periodS;
+        uint16_t intervalS;
+        uint16_t windowS;
+    };
+
+    struct SensorSettings {
+        uint8_t median;
+        uint8_t ema;
+        uint16_t deadband;
+    };
+
+    struct Settings {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t size;
+        SourceSettings sources[Sources];
+        SensorSettings sensors[Sensors];
+        uint32_t crc;  // over everything before it
+    };
+
+    struct SourceState {
+        uint32_t due;         // millis() of the next sample
+        uint32_t reportTime;  // millis() of the last report
+        uint32_t windowStart;  // millis() at the start of the window
+        bool hasReported;
+        bool isRequested;  // the next sample is reported whatever it is
+        bool isFailing;
+        uint32_t samples;
+        uint32_t reports;
+        uint32_t failures;
+    };
+
+    struct SensorState {
+        int32_t window[maxMedian];  // the last samples, oldest first from `next`
+        uint8_t count;
+        uint8_t next;
+        int32_t average;  // 1/256 of hundredths
+        int32_t value;
+        int32_t reported;
+        WindowStats stats;  // of the raw samples of the window, in the unit
+    };
+
+    const char *const path;
+    const SensorSource *const sourceTable;
+    const SensorDescriptor *const sensorTable;
+    const ReportFunction onReport;
+    const WindowFunction onWindow;
+
+    Settings settings;
+    SourceState sources[Sources];
+    SensorState sensors[Sensors];
+
+    // why the last settings were not taken
+    const char *error = NULL;
+
+    SensorPipeline(const char *path, const SensorSource *sourceTable, const SensorDescriptor *sensorTable,
+                   ReportFunction onReport, WindowFunction onWindow)
+        : path(path), sourceTable(sourceTable), sensorTable(sensorTable), onReport(onReport), onWindow(onWindow) {
+        memset(sources, 0, sizeof(sources));
+        for (SensorState &sensor : sensors) {
+            sensor.count = 0;
+            sensor.next = 0;
+            sensor.average = 0;
+            sensor.value = 0;
+            sensor.reported = 0;
+        }
+        restoreDefaults();
+    }
+
+    void restoreDefaults() {
+        Settings old = settings;
+        for (uint8_t i = 0; i < Sources; i++)
+            settings.sources[i] = {sourceTable[i].periodS, sourceTable[i].intervalS, sourceTable[i].windowS};
+        for (uint8_t i = 0; i < Sensors; i++)
+            settings.sensors[i] = {sensorTable[i].median, sensorTable[i].ema, sensorTable[i].deadband};
+        reschedule(old);
+    }
+
+    // the stored settings, or the defaults; every source samples right away
+    bool load() {
+        File file = SPIFFS.open(path, "r");
+        Settings stored;
+        bool isValid = file && file.read((uint8_t *)&stored, sizeof(stored)) == sizeof(stored) &&
+                       stored.magic == magic && stored.version == version && stored.size == sizeof(stored) &&
+                       stored.crc == crc32(&stored, offsetof(Settings, crc));
+        if (file)
+            file.close();
+
+        if (isValid)
+            settings = stored;
+        else
+            restoreDefaults();
+
+        uint32_t now = millis();
+        for (uint8_t i = 0; i < Sources; i++) {
+            sources[i].due = now;
+            restartWindow(i);
+        }
+        return isValid;
+    }
+
+    bool save() {
+        settings.magic = magic;
+        settings.version = version;
+        settings.size = sizeof(settings);
+        settings.crc = crc32(&settings, offsetof(Settings, crc));
+
+        File file = SPIFFS.open(path, "w");
+        if (!file)
+            return false;
+        bool isSaved = file.write((const uint8_t *)&settings, sizeof(settings)) == sizeof(settings);
+        file.close();
+        return isSaved;
+    }
+
+    // start the sources whose sample is due
+    void loop() {
+        uint32_t now = millis();
+        for (uint8_t i = 0; i < Sources; i++) {
+            if ((int32_t)(now - sources[i].due) >= 0) {
+                sources[i].due = now + settings.sources[i].periodS * 1000UL;
+                sourceTable[i].start();
+            }
+        }
+    }
+
+    // milliseconds until the next sample, for the idle sleep of the main loop
+    uint32_t timeToNext() const {
+        uint32_t now = millis();
+        uint32_t next = UINT32_MAX;
+        for (const SourceState &source : sources) {
+            int32_t remaining = (int32_t)(source.due - now);
+            next = min(next, remaining > 0 ? (uint32_t)remaining : 0);
+        }
+        return next;
+    }
+
+    // measure now and report the result whatever it is
+    void request(uint8_t source) {
+        sources[source].isRequested = true;
+        sourceTable[source].start();
+    }
+
+    // a sample of a sensor, in hundredths
+    void add(uint8_t sensor, int32_t sample) {
+        SensorState &state = sensors[sensor];
+        const SensorSettings &config = settings.sensors[sensor];
+
+        state.stats.add(sample / 100.0f);
+
+        state.window[state.next] = sample;
+        state.next = (state.next + 1) % maxMedian;
+        if (state.count < maxMedian)
+            state.count++;
+
+        // the median of the newest samples, the lower one of the middle two for an even number
+        uint8_t n = min(state.count, config.median);
+        int32_t sorted[maxMedian];
+        for (uint8_t i = 0; i < n; i++) {
+            int32_t value = state.window[(state.next + maxMedian - 1 - i) % maxMedian];
+            uint8_t j = i;
+            for (; j > 0 && sorted[j - 1] > value; j--)
+                sorted[j] = sorted[j - 1];
+            sorted[j] = value;
+        }
+        int32_t median = sorted[(n - 1) / 2];
+
+        if (state.count == 1)
+            state.average = median * 256;
+        else
+            state.average += (int32_t)((int64_t)(median * 256 - state.average) * config.ema / 100);
+
+        state.value = state.average >= 0 ? (state.average + 128) / 256 : -((-state.average + 128) / 256);
+    }
+
+    // all values of a sample of the source are added, report them if they changed or are old
+    void commit(uint8_t source) {
+        SourceState &state = sources[source];
+        state.samples++;
+        state.isFailing = false;
+
+        uint32_t now = millis();
+        uint32_t intervalMs = settings.sources[source].intervalS * 1000UL;
+        bool isDue = !state.hasReported || state.isRequested || (intervalMs > 0 && now - state.reportTime >= intervalMs);
+
+        for (uint8_t i = 0; i < Sensors && !isDue; i++) {
+            if (sensorTable[i].source == source && sensors[i].count > 0)
+                isDue = abs(sensors[i].value - sensors[i].reported) >= settings.sensors[i].deadband;
+        }
+
+        if (isDue)
+            report(source);
+
+        // the sample that ends the window is still part of it
+        uint32_t windowMs = settings.sources[source].windowS * 1000UL;
+        if (windowMs > 0 && now - state.windowStart >= windowMs) {
+            onWindow(source);
+            restartWindow(source);
+
+            // on the grid of the window, unless the samples stopped for longer than a window
+            state.windowStart += windowMs;
+            if (now - state.windowStart >= windowMs)
+                state.windowStart = now;
+        }
+    }
+
+    // clear the statistics of the sensors of the source
+    void restartWindow(uint8_t source) {
+        for (uint8_t i = 0; i < Sensors; i++) {
+            if (sensorTable[i].source == source)
+                sensors[i].stats.reset();
+        }
+        sources[source].windowStart = millis();
+    }
+
+    // a measurement of the source failed, true for the first one after a good one
+    bool failed(uint8_t source) {
+        SourceState &state = sources[source];
+        state.failures++;
+        bool isFirst = !state.isFailing;
+        state.isFailing = true;
+        return isFirst;
+    }
+
+    // report the filtered values of the source now
+    void report(uint8_t source) {
+        for (uint8_t i = 0; i < Sensors; i++) {
+            if (sensorTable[i].source == source)
+                sensors[i].reported = sensors[i].value;
+        }
+
+        SourceState &state = sources[source];
+        state.reportTime = millis();
+        state.hasReported = true;
+        state.isRequested = false;
+        state.reports++;
+        onReport(source);
+    }
+
+    // every sensor of the source has a value
+    bool hasValues(uint8_t source) const {
+        for (uint8_t i = 0; i < Sensors; i++) {
+            if (sensorTable[i].source == source && sensors[i].count == 0)
+                return false;
+        }
+        return true;
+    }
+
+    // filtered value in hundredths
+    int32_t value(uint8_t sensor) const {
+        return sensors[sensor].value;
+    }
+
+    // the statistics of the window so far
+    const WindowStats &statsOf(uint8_t sensor) const {
+        return sensors[sensor].stats;
+    }
+
+    // "<name> <setting> <value> ..., <name> ...", all taken or none, `error` tells why not
+    bool configure(const char *text, size_t length) {
+        const char *end = text + length;
+        Settings changed = settings;
+        error = NULL;
+
+        for (;;) {
+            const char *word;
+            size_t wordLength;
+            if (!readWord(text, end, word, wordLength))
+                return fail("missing sensor name");
+
+            int8_t source = -1;
+            int8_t sensor = -1;
+            for (uint8_t i = 0; i < Sources; i++) {
+                if (isWord(word, wordLength, sourceTable[i].name))
+                    source = i;
+            }
+            for (uint8_t i = 0; i < Sensors; i++) {
+                if (isWord(word, wordLength, sensorTable[i].name))
+                    sensor = i;
+            }
+            if (source < 0 && sensor < 0)
+                return fail("unknown sensor");
+
+            uint8_t count = 0;
+            while (readWord(text, end, word, wordLength)) {
+                const char *key = word;
+                size_t keyLength = wordLength;
+                int32_t value;
+                if (!readWord(text, end, word, wordLength) || !readHundredths(word, wordLength, value))
+                    return fail("invalid value");
+
+                // all settings but the deadband are whole numbers
+                bool isWhole = value % 100 == 0;
+                int32_t whole = value / 100;
+                if (source >= 0 && isWord(key, keyLength, "period")) {
+                    if (!isWhole || whole < minPeriodS || whole > maxPeriodS)
+                        return fail("period out of range");
+                    changed.sources[source].periodS = whole;
+                } else if (source >= 0 && isWord(key, keyLength, "interval")) {
+                    if (!isWhole || whole > UINT16_MAX)
+                        return fail("interval out of range");
+                    changed.sources[source].intervalS = whole;
+                } else if (source >= 0 && isWord(key, keyLength, "window")) {
+                    if (!isWhole || (whole > 0 && whole < minWindowS) || whole > UINT16_MAX)
+                        return fail("window out of range");
+                    changed.sources[source].windowS = whole;
+                } else if (sensor >= 0 && isWord(key, keyLength, "median")) {
+                    if (!isWhole || whole < 1 || whole > maxMedian)
+                        return fail("median out of range");
+                    changed.sensors[sensor].median = whole;
+                } else if (sensor >= 0 && isWord(key, keyLength, "ema")) {
+                    if (!isWhole || whole < 1 || whole > 100)
+                        return fail("ema out of range");
+                    changed.sensors[sensor].ema = whole;
+                } else if (sensor >= 0 && isWord(key, keyLength, "deadband")) {
+                    if (value > UINT16_MAX)
+                        return fail("deadband out of range");
+                    changed.sensors[sensor].deadband = value;
+                } else {
+                    return fail("unknown setting");
+                }
+                count++;
+            }
+            if (count == 0)
+                return fail("missing setting");
+
+            if (text == end)
+                break;
+            text++;  // ','
+        }
+
+        Settings old = settings;
+        settings = changed;
+        reschedule(old);
+        return true;
+    }
+
+    bool fail(const char *reason) {
+        error = reason;
+        return false;
+    }
+
+    // a shorter period takes effect from now, a window of another length starts over
+    void reschedule(const Settings &old) {
+        uint32_t now = millis();
+        for (uint8_t i = 0; i < Sources; i++) {
+            uint32_t due = now + settings.sources[i].periodS * 1000UL;
+            if ((int32_t)(sources[i].due - due) > 0)
+                sources[i].due = due;
+            if (settings.sources[i].windowS != old.sources[i].windowS)
+                restartWindow(i);
+        }
+    }
+
+    // the next word before a ',' or the end, moves text past it
+    static bool readWord(const char *&text, const char *end, const char *&word, size_t &wordLength) {
+        while (text < end && *text == ' ')
+            text++;
+        word = text;
+        while (text < end && *text != ' ' && *text != ',')
+            text++;
+        wordLength = text - word;
+        while (text < end && *text == ' ')
+            text++;
+        return wordLength > 0;
+    }
+
+    // "12", "0.5" or "2.25" in hundredths
+    static bool readHundredths(const char *word, size_t wordLength, int32_t &value) {
+        if (wordLength == 0 || wordLength > 8)
+            return false;
+
+        value = 0;
+        int8_t decimals = -1;
+        for (size_t i = 0; i < wordLength; i++) {
+            if (word[i] == '.' && decimals < 0) {
+                decimals = 0;
+            } else if (word[i] >= '0' && word[i] <= '9' && decimals < 2) {
+                value = value * 10 + (word[i] - '0');
+                if (decimals >= 0)
+                    decimals++;
+            } else {
+                return false;
+            }
+        }
+        for (int8_t i = decimals < 0 ? 0 : decimals; i < 2; i++)
+            value *= 10;
+        return true;
+    }
+
+    static bool isWord(const char *word, size_t wordLength, const char *expected) {
+        return strlen(expected) == wordLength && memcmp(word, expected, wordLength) == 0;
+    }
+
+    static size_t printHundredths(Print &out, int32_t value) {
+        size_t n = 0;
+        if (value < 0) {
+            n += out.print('-');
+            value = -value;
+        }
+        n += out.print(value / 100);
+        n += out.print('.');
+        n += out.print(value / 10 % 10);
+        n += out.print(value % 10);
+        return n;
+    }
+
+    // {"dht":{"period":2,"interval":3600,"window":300,"samples":1800,"reports":4,"failures":0},
+    //  "temp":{"median":3,"ema":50,"deadband":0.20,"value":23.10},..}
+    size_t printJson(Print &out) const {
+        size_t n = out.print('{');
+        for (uint8_t i = 0; i < Sources; i++) {
+            n += out.print(i ? ",\"" : "\"");
+            n += out.print(sourceTable[i].name);
+            n += out.print("\":{\"period\":");
+            n += out.print(settings.sources[i].periodS);
+            n += out.print(",\"interval\":");
+            n += out.print(settings.sources[i].intervalS);
+            n += out.print(",\"window\":");
+            n += out.print(settings.sources[i].windowS);
+            n += out.print(",\"samples\":");
+            n += out.print(sources[i].samples);
+            n += out.print(",\"reports\":");
+            n += out.print(sources[i].reports);
+            n += out.print(",\"failures\":");
+            n += out.print(sources[i].failures);
+            n += out.print('}');
+        }
+        for (uint8_t i = 0; i < Sensors; i++) {
+            n += out.print(",\"");
+            n += out.print(sensorTable[i].name);
+            n += out.print("\":{\"median\":");
+            n += out.print(settings.sensors[i].median);
+            n += out.print(",\"ema\":");
+            n += out.print(settings.sensors[i].ema);
+            n += out.print(",\"deadband\":");
+            n += printHundredths(out, settings.sensors[i].deadband);
+            n += out.print(",\"value\":");
+            if (sensors[i].count > 0)
+                n += printHundredths(out, sensors[i].value);
+            else
+                n += out.print("null");
+            n += out.print('}');
+        }
+        n += out.print('}');
+        return n;
+    }
+};
+
+#endif
@@ -0,0 +1,560 @@
+/**** Rolling history of sensor samples, compressed in a fixed amount of flash.
+Samples of a few series, such as the temperature and the humidity once a minute, are appended to
+blocks of 512 bytes, compressed the way Gorilla compresses time series. A timestamp is stored as the
+change of its distance to the one before: a single 0 bit while the samples come at a steady rate. A
+value is stored as the XOR with the one before: a single 0 bit while it stays the same, otherwise
+only the bits that changed, within the window of bits that changed before when they fit. Values are
+whole numbers such as tenths of a degree, so the small steps of a slow sensor take a few bits.
+
+The blocks are the slots of one file of a fixed size, a new block overwrites the oldest one. The
+block being filled is kept in RAM and written to its slot every few samples, a reboot loses at most
+those. Every block has its sequence number and the time range of its samples. The headers of all
+slots are kept in RAM as well, so a query skips the blocks outside of its range without touching
+the flash, and reads the others one at a time into a second block buffer, and the statistics
+cost no flash reads.
+
+A query streams its samples in chunks small enough for the packet buffer of PubSubClient, a few
+every 100 ms while connected, through the publish function. A sample is its time in seconds from
+the time of the chunk, then its values in tenths:
+
+  {"seq":0,"time":1760788800,"samples":[[0,23.1,45.2],[60,23.1,45.3],..]}
+  ..
+  {"seq":41,"time":1761393540,"samples":[[0,22.8,47.0]],"last":true}
+
+bool publishChunk(const char *payload, size_t length)
+{
+  return mqttClient.publish("devices/esp01/get/history", (const uint8_t *)payload, length);
+}
+
+SeriesHistory<2> history("/history.bin", publishChunk);
+
+void setup()
+{
+  SPIFFS.begin();
+  history.begin();
+}
+
+void everyMinute()
+{
+  int32_t values[] = {231, 452};  // 23.1 C, 45.2 %
+  history.add(time(NULL), values);
+}
+
+void onHistoryCommand()
+{
+  history.query(time(NULL) - 86400, time(NULL));  // the last day
+}
+
+void loop()
+{
+  history.loop(mqttClient.connected());
+}
+*/
+#ifndef SERIES_HISTORY_CPP
+#define SERIES_HISTORY_CPP
+
+#include <Arduino.h>
+#include <FS.h>
+
+template <uint8_t Series>
+struct SeriesHistory {
+    typedef bool (*PublishFunction)(const char *payload, size_t length);
+
+    // 48 blocks of 512 bytes, 24 KiB of flash
+    static const uint16_t blockSize = 512;
+    static const uint8_t maxBlocks = 48;
+
+    // the block in RAM is written to its slot every this many samples
+    static const uint8_t saveInterval = 10;
+
+    // a chunk and its topic fit PubSubClient's default 256 byte packet buffer
+    static const uint16_t maxChunk = 200;
+    // at most 4 chunks every 100 ms
+    static const uint8_t batchSize = 4;
+    static const uint16_t chunkInterval = 100;
+
+    // the longest row, "[-2147483648" and a ",-214748364.8" for every value, then "]"
+    static const uint16_t maxRow = 13 + 13 * Series;
+    // what a chunk takes around its rows at most, {"seq":65535,"time":4294967295,"samples":[
+    // and ],"last":true}
+    static const uint16_t maxChunkFrame = 42 + 14;
+    static_assert(maxChunkFrame + maxRow <= maxChunk, "a row of the history must fit in a chunk");
+
+    struct Header {
+        uint32_t sequence;  // from 1, 0 for a slot never written
+        uint32_t firstTime;
+        uint32_t minTime;  // the clock can be set back, the samples are not always in order
+        uint32_t maxTime;
+        uint16_t count;
+        uint16_t bits;
+    };
+
+    struct Block {
+        Header header;
+        uint8_t bits[blockSize - sizeof(Header)];
+    };
+
+    static const uint16_t maxBits = sizeof(Block::bits) * 8;
+
+    // the most a sample can take: a timestamp of '1111' and 32 bits, every value '11', its window
+    // and 32 bits
+    static const uint16_t maxSampleBits = 36 + 44 * Series;
+
+    // what the encoder and the decoder know of the samples before
+    struct State {
+        uint16_t bit;    // position in the bits of the block
+        uint16_t index;  // samples decoded
+        uint32_t time;
+        int32_t delta;
+        int32_t values[Series];
+        // the bits that changed in the value before, from its leading and trailing zeros, a
+        // leading of 32 for none yet
+        uint8_t leading[Series];
+        uint8_t trailing[Series];
+    };
+
+    const char *const path;
+    const PublishFunction publish;
+
+    // the block being filled, the oldest and the newest block
+    Block block;
+    State state;
+    // the header of every slot as it is on flash
+    Header headers[maxBlocks];
+    uint32_t head = 1;
+    uint32_t tail = 1;
+    uint8_t unsaved = 0;
+
+    // the query being streamed, the next sample to send and the chunk waiting to be published
+    bool isQuerying = false;
+    uint32_t queryFrom = 0;
+    uint32_t queryTo = 0;
+    uint32_t cursor = 0;  // the next block to decode
+    Block cursorBlock;
+    State cursorState;
+    bool hasPending = false;
+    uint32_t pendingTime = 0;
+    int32_t pendingValues[Series];
+    uint16_t chunkSequence = 0;
+    char chunk[maxChunk + 1];
+    uint16_t chunkLength = 0;
+    bool isChunkLast = false;
+    uint32_t lastChunkTime = 0;
+    // as given to the last loop(), a query waits while the broker is not connected
+    bool isConnected = true;
+
+    // statistics
+    uint32_t writes = 0;
+    uint32_t chunks = 0;
+
+    SeriesHistory(const char *path, PublishFunction publish) : path(path), publish(publish) {
+        memset(headers, 0, sizeof(headers));
+        clear(1);
+    }
+
+    // find the blocks left over from before a reboot and go on filling the newest, SPIFFS must be
+    // mounted
+    void begin() {
+        File file = SPIFFS.open(path, "r");
+        bool isSized = file && file.size() == (size_t)blockSize * maxBlocks;
+
+        uint32_t oldest = 0;
+        uint32_t newest = 0;
+        memset(headers, 0, sizeof(headers));
+        for (uint8_t slot = 0; isSized && slot < maxBlocks; slot++) {
+            Header header;
+            if (!file.seek((uint32_t)slot * blockSize, SeekSet) ||
+                file.read((uint8_t *)&header, sizeof(header)) != sizeof(header) || !isValid(header) ||
+                slotOf(header.sequence) != slot)
+                continue;
+            headers[slot] = header;
+            if (oldest == 0 || header.sequence < oldest)
+                oldest = header.sequence;
+            newest = max(newest, header.sequence);
+        }
+        if (file)
+            file.close();
+
+        // the whole budget is taken at once
+        if (!isSized)
+            create();
+
+        if (newest == 0) {
+            head = tail = 1;
+            clear(1);
+            return;
+        }
+
+        tail = newest;
+        head = max(oldest, newest >= maxBlocks ? newest - maxBlocks + 1 : 1);
+        if (!readSlot(tail, block)) {
+            clear(tail);
+            return;
+        }
+
+        // the slot still has the bytes of an older block after the ones in use
+        uint16_t used = (block.header.bits + 7) / 8;
+        memset(block.bits + used, 0, sizeof(block.bits) - used);
+
+        // decoding the newest block gives the encoder its state after the last sample
+        resetState(state);
+        uint32_t time;
+        int32_t values[Series];
+        while (state.index < block.header.count)
+            decode(block, state, time, values);
+    }
+
+    // a sample, its time in seconds and a value of every series
+    void add(uint32_t time, const int32_t *values) {
+        if (block.header.count > 0 && state.bit + maxSampleBits > maxBits)
+            seal();
+
+        encode(time, values);
+        if (++unsaved >= saveInterval)
+            save();
+    }
+
+    // write the block being filled to its slot
+    bool save() {
+        unsaved = 0;
+        File file = SPIFFS.open(path, "r+");
+        if (!file)
+            return false;
+
+        size_t length = sizeof(Header) + (block.header.bits + 7) / 8;
+        uint8_t slot = slotOf(block.header.sequence);
+        bool isSaved = file.seek((uint32_t)slot * blockSize, SeekSet) &&
+                       file.write((const uint8_t *)&block, length) == length;
+        file.close();
+        writes++;
+        if (isSaved)
+            headers[slot] = block.header;
+        return isSaved;
+    }
+
+    // stream the samples from `from` to `to` in seconds, both included, instead of a query in
+    // progress
+    void query(uint32_t from, uint32_t to) {
+        queryFrom = from;
+        queryTo = to;
+        cursor = head;
+        cursorBlock.header.count = 0;
+        resetState(cursorState);
+
+        chunkSequence = 0;
+        chunkLength = 0;
+        hasPending = next(pendingTime, pendingValues);
+        isQuerying = true;
+    }
+
+    // publish the next chunks of the query
+    void loop(bool isConnected) {
+        this->isConnected = isConnected;
+        uint32_t now = millis();
+        if (!isQuerying || !isConnected || now - lastChunkTime < chunkInterval)
+            return;
+
+        lastChunkTime = now;
+        for (uint8_t i = 0; i < batchSize && isQuerying; i++) {
+            if (chunkLength == 0)
+                fillChunk();
+            if (!publish(chunk, chunkLength))
+                break;
+
+            chunks++;
+            chunkLength = 0;
+            if (isChunkLast)
+                isQuerying = false;
+        }
+    }
+
+    // milliseconds until loop() has work, for the idle sleep of the main loop; none while offline,
+    // the loop passes of the reconnect go on anyway
+    uint32_t timeToNext() const {
+        if (!isQuerying || !isConnected)
+            return UINT32_MAX;
+        uint32_t elapsed = millis() - lastChunkTime;
+        return elapsed >= chunkInterval ? 0 : chunkInterval - elapsed;
+    }
+
+    // the next sample of the query, false after the last one
+    bool next(uint32_t &time, int32_t *values) {
+        for (;;) {
+            while (cursorState.index < cursorBlock.header.count) {
+                decode(cursorBlock, cursorState, time, values);
+                if (time >= queryFrom && time <= queryTo)
+                    return true;
+            }
+
+            if (cursor > tail)
+                return false;
+
+            // a block without samples in the range is skipped by its header in RAM
+            uint32_t sequence = cursor++;
+            resetState(cursorState);
+            cursorBlock.header.count = 0;
+            Header header;
+            if (readHeader(sequence, header) && header.maxTime >= queryFrom && header.minTime <= queryTo &&
+                !load(sequence, cursorBlock))
+                cursorBlock.header.count = 0;
+        }
+    }
+
+    // the samples of the query that fit in a chunk, the pending one first
+    void fillChunk() {
+        static const char end[] = "],\"last\":true}";
+
+        uint32_t start = hasPending ? pendingTime : queryFrom;
+        int length = snprintf(chunk, sizeof(chunk), "{\"seq\":%u,\"time\":%lu,\"samples\":[", chunkSequence,
+                              (unsigned long)start);
+
+        bool isFirst = true;
+        while (hasPending) {
+            char row[maxRow + 1];
+            int rowLength = formatRow(row, sizeof(row), (int32_t)(pendingTime - start), pendingValues);
+            if (!isFirst && length + 1 + rowLength + (int)sizeof(end) - 1 > maxChunk)
+                break;
+
+            if (!isFirst)
+                chunk[length++] = ',';
+            memcpy(chunk + length, row, rowLength);
+            length += rowLength;
+            isFirst = false;
+
+            hasPending = next(pendingTime, pendingValues);
+        }
+
+        isChunkLast = !hasPending;
+        length += snprintf(chunk + length, sizeof(chunk) - length, "%s", isChunkLast ? end : "]}");
+        chunkLength = length;
+        chunkSequence++;
+    }
+
+    // [60,23.1,45.2] for values in tenths, its length without what did not fit in `size`
+    static int formatRow(char *row, size_t size, int32_t offset, const int32_t *values) {
+        size_t length = snprintf(row, size, "[%ld", (long)offset);
+        for (uint8_t i = 0; i < Series && length < size; i++) {
+            // the magnitude as unsigned, INT32_MIN has no positive int32_t
+            uint32_t magnitude = values[i] < 0 ? 0u - (uint32_t)values[i] : (uint32_t)values[i];
+            length += snprintf(row + length, size - length, ",%s%lu.%lu", values[i] < 0 ? "-" : "",
+                               (unsigned long)(magnitude / 10), (unsigned long)(magnitude % 10));
+        }
+        if (length < size)
+            length += snprintf(row + length, size - length, "]");
+        return min(length, size - 1);
+    }
+
+    void encode(uint32_t time, const int32_t *values) {
+        Header &header = block.header;
+
+        if (header.count == 0) {
+            header.firstTime = header.minTime = header.maxTime = time;
+            state.time = time;
+            state.delta = 0;
+        } else {
+            int32_t delta = (int32_t)(time - state.time);
+            int32_t change = delta - state.delta;
+            if (change == 0) {
+                writeBits(0, 1);
+            } else if (change >= -63 && change <= 64) {
+                writeBits(0b10, 2);
+                writeBits(change + 63, 7);
+            } else if (change >= -255 && change <= 256) {
+                writeBits(0b110, 3);
+                writeBits(change + 255, 9);
+            } else if (change >= -2047 && change <= 2048) {
+                writeBits(0b1110, 4);
+                writeBits(change + 2047, 12);
+            } else {
+                writeBits(0b1111, 4);
+                writeBits((uint32_t)change, 32);
+            }
+            state.time = time;
+            state.delta = delta;
+            header.minTime = min(header.minTime, time);
+            header.maxTime = max(header.maxTime, time);
+        }
+
+        for (uint8_t i = 0; i < Series; i++) {
+            uint32_t changed = (uint32_t)values[i] ^ (uint32_t)state.values[i];
+            state.values[i] = values[i];
+            if (changed == 0) {
+                writeBits(0, 1);
+                continue;
+            }
+
+            uint8_t leading = __builtin_clz(changed);
+            uint8_t trailing = __builtin_ctz(changed);
+            if (state.leading[i] < 32 && leading >= state.leading[i] && trailing >= state.trailing[i]) {
+                writeBits(0b10, 2);
+                writeBits(changed >> state.trailing[i], 32 - state.leading[i] - state.trailing[i]);
+            } else {
+                uint8_t length = 32 - leading - trailing;
+                writeBits(0b11, 2);
+                writeBits(leading, 5);
+                writeBits(length - 1, 5);
+                writeBits(changed >> trailing, length);
+                state.leading[i] = leading;
+                state.trailing[i] = trailing;
+            }
+        }
+
+        header.count++;
+        header.bits = state.bit;
+    }
+
+    // the next sample of a block
+    static void decode(const Block &source, State &from, uint32_t &time, int32_t *values) {
+        if (from.index == 0) {
+            from.time = source.header.firstTime;
+            from.delta = 0;
+        } else {
+            int32_t change;
+            if (!readBits(source, from, 1))
+                change = 0;
+            else if (!readBits(source, from, 1))
+                change = (int32_t)readBits(source, from, 7) - 63;
+            else if (!readBits(source, from, 1))
+                change = (int32_t)readBits(source, from, 9) - 255;
+            else if (!readBits(source, from, 1))
+                change = (int32_t)readBits(source, from, 12) - 2047;
+            else
+                change = (int32_t)readBits(source, from, 32);
+            from.delta += change;
+            from.time += from.delta;
+        }
+        time = from.time;
+
+        for (uint8_t i = 0; i < Series; i++) {
+            if (readBits(source, from, 1)) {
+                if (readBits(source, from, 1)) {
+                    from.leading[i] = readBits(source, from, 5);
+                    uint8_t length = readBits(source, from, 5) + 1;
+                    from.trailing[i] = 32 - from.leading[i] - length;
+                }
+                uint8_t length = 32 - from.leading[i] - from.trailing[i];
+                from.values[i] ^= readBits(source, from, length) << from.trailing[i];
+            }
+            values[i] = from.values[i];
+        }
+        from.index++;
+    }
+
+    void writeBits(uint32_t value, uint8_t count) {
+        for (uint8_t i = count; i-- > 0; state.bit++) {
+            if ((value >> i) & 1)
+                block.bits[state.bit >> 3] |= 0x80 >> (state.bit & 7);
+        }
+    }
+
+    static uint32_t readBits(const Block &source, State &from, uint8_t count) {
+        uint32_t value = 0;
+        for (uint8_t i = 0; i < count; i++, from.bit++)
+            value = (value << 1) | ((source.bits[from.bit >> 3] >> (7 - (from.bit & 7))) & 1);
+        return value;
+    }
+
+    // the block is full, write it and start the next one in the slot of the oldest
+    void seal() {
+        save();
+        tail++;
+        if (tail - head >= maxBlocks)
+            head = tail - maxBlocks + 1;
+        clear(tail);
+    }
+
+    void clear(uint32_t sequence) {
+        memset(&block, 0, sizeof(block));
+        block.header.sequence = sequence;
+        resetState(state);
+        unsaved = 0;
+    }
+
+    static void resetState(State &from) {
+        memset(&from, 0, sizeof(from));
+        for (uint8_t i = 0; i < Series; i++)
+            from.leading[i] = 32;
+    }
+
+    // the file of all slots, never written blocks are zeros
+    void create() {
+        File file = SPIFFS.open(path, "w");
+        if (!file)
+            return;
+        uint8_t zeros[64];
+        memset(zeros, 0, sizeof(zeros));
+        for (uint32_t written = 0; written < (uint32_t)blockSize * maxBlocks; written += sizeof(zeros))
+            file.write(zeros, sizeof(zeros));
+        file.close();
+    }
+
+    // a block from its slot, or from RAM for the one being filled
+    bool load(uint32_t sequence, Block &target) const {
+        if (sequence == tail) {
+            target = block;
+            return true;
+        }
+        return readSlot(sequence, target);
+    }
+
+    bool readSlot(uint32_t sequence, Block &target) const {
+        File file = SPIFFS.open(path, "r");
+        if (!file)
+            return false;
+        bool isLoaded = file.seek((uint32_t)slotOf(sequence) * blockSize, SeekSet) &&
+                        file.read((uint8_t *)&target, sizeof(target)) == sizeof(target) &&
+                        target.header.sequence == sequence && isValid(target.header);
+        file.close();
+        return isLoaded;
+    }
+
+    // the header of a block, from RAM
+    bool readHeader(uint32_t sequence, Header &header) const {
+        header = sequence == tail ? block.header : headers[slotOf(sequence)];
+        return sequence == tail || (header.sequence == sequence && isValid(header));
+    }
+
+    static bool isValid(const Header &header) {
+        return header.sequence > 0 && header.count > 0 && header.bits <= maxBits;
+    }
+
+    static uint8_t slotOf(uint32_t sequence) {
+        return (sequence - 1) % maxBlocks;
+    }
+
+    // {"blocks":12,"samples":4320,"bytes":5890,"from":1760700000,"to":1760788800,"writes":450}
+    size_t printJson(Print &out) const {
+        uint32_t blocks = 0;
+        uint32_t samples = 0;
+        uint32_t bytes = 0;
+        uint32_t from = UINT32_MAX;
+        uint32_t to = 0;
+        for (uint32_t sequence = head; sequence <= tail; sequence++) {
+            Header header;
+            if (!readHeader(sequence, header) || header.count == 0)
+                continue;
+            blocks++;
+            samples += header.count;
+            bytes += sizeof(Header) + (header.bits + 7) / 8;
+            from = min(from, header.minTime);
+            to = max(to, header.maxTime);
+        }
+
+        size_t n = out.print("{\"blocks\":");
+        n += out.print(blocks);
+        n += out.print(",\"samples\":");
+        n += out.print(samples);
+        n += out.print(",\"bytes\":");
+        n += out.print(bytes);
+        n += out.print(",\"from\":");
+        n += out.print(samples ? from : 0);
+        n += out.print(",\"to\":");
+        n += out.print(to);
+        n += out.print(",\"writes\":");
+        n += out.print(writes);
+        n += out.print('}');
+        return n;
+    }
+};
+
+#endif
@@ -0,0 +1,179 @@
+/**** Wall clock of the device, kept on the time server by the SNTP client of lwIP.
+The SNTP client of the core asks the server in the background and sets the system time, nothing
+waits for its answer. sync() is called from the time-set callback with the UTC time that was just
+set. The clock counts on micros64(), which neither wraps nor goes back, and is put on the server
+time at every sync. Between syncs it is corrected for the drift of the crystal, measured from how
+far off the clock was at each sync, so it stays close to the server for the whole update
+interval. A sync more than maxErrorUs off steps the clock and measures the drift again.
+
+Before the first sync the clock counts from 01-Jan-1970 00:00:00 at boot.
+
+Log lines are stamped with the local time in seconds, many in the same second, and format() keeps
+the text of the last second, so the text is only written again when the second has changed.
+
+SystemClock systemClock;
+
+void onTimeSet(bool isFromSntp)
+{
+  timeval tv;
+  gettimeofday(&tv, NULL);
+  systemClock.sync((int64_t)tv.tv_sec * 1000000 + tv.tv_usec);
+}
+
+void setup()
+{
+  systemClock.offset = 5 * 60 * 60;
+  settimeofday_cb(onTimeSet);
+  configTime(0, 0, "pool.ntp.org");
+}
+
+void loop()
+{
+  Serial.println(systemClock.format(systemClock.now()));  // "04-Nov-2020 23:52:57"
+}
+*/
+#ifndef SYSTEM_CLOCK_CPP
+#define SYSTEM_CLOCK_CPP
+
+#include <Arduino.h>
+
+struct SystemClock {
+    // a sync further off steps the clock
+    static const int64_t maxErrorUs = 1000000;
+    // syncs closer together only correct the time, the delay of the answer would be too large a
+    // share of the interval to measure the drift over it
+    static const uint64_t minDriftIntervalUs = 60ULL * 1000000;
+    // more than any crystal is off, a larger drift is a changed server
+    static const int32_t maxDriftPpb = 500000;
+
+    int32_t offset = 0;  // seconds of the local time ahead of UTC
+
+    uint32_t syncs = 0;
+    uint32_t steps = 0;       // syncs that were further off than maxErrorUs
+    int32_t driftPpb = 0;     // added to the local clock, in parts per billion
+    bool isDriftKnown = false;
+    int32_t lastErrorUs = 0;  // how far off the clock was at the last sync, server minus clock
+
+    // the last sync, micros64() and the UTC time in microseconds since 1970
+    uint64_t syncMicros = 0;
+    int64_t syncUtcUs = 0;
+
+    // the text of formattedTime
+    uint32_t formattedTime = 0;
+    bool isFormatted = false;
+    char formatted[21];
+
+    bool isSynced() const {
+        return syncs > 0;
+    }
+
+    // UTC in microseconds since 1970
+    int64_t utcMicros() const {
+        return utcAt(micros64());
+    }
+
+    int64_t utcAt(uint64_t micros) const {
+        int64_t elapsed = (int64_t)(micros - syncMicros);
+        return syncUtcUs + elapsed + elapsed * driftPpb / 1000000000;
+    }
+
+    // local time in seconds since 1970
+    uint32_t now() const {
+        int64_t seconds = utcMicros() / 1000000 + offset;
+        return seconds > 0 ? (uint32_t)seconds : 0;
+    }
+
+    // the UTC time that SNTP has just set, in microseconds since 1970
+    void sync(int64_t utcUs) {
+        uint64_t micros = micros64();
+        int64_t error = utcUs - utcAt(micros);
+
+        if (syncs > 0 && error >= -maxErrorUs && error <= maxErrorUs) {
+            lastErrorUs = (int32_t)error;
+            uint64_t elapsed = micros - syncMicros;
+            if (elapsed >= minDriftIntervalUs) {
+                // the drift left over from the estimate, half of it is taken against the delay
+                // jitter of the answers once the drift is known
+                int32_t measured = (int32_t)(error * 1000000000 / (int64_t)elapsed);
+                driftPpb += isDriftKnown ? measured / 2 : measured;
+                driftPpb = constrain(driftPpb, -maxDriftPpb, maxDriftPpb);
+                isDriftKnown = true;
+            }
+        } else {
+            if (syncs > 0)
+                steps++;
+            lastErrorUs = 0;
+            driftPpb = 0;
+            isDriftKnown = false;
+        }
+
+        syncMicros = micros;
+        syncUtcUs = utcUs;
+        syncs++;
+    }
+
+    // "dd-Mmm-yyyy hh:mm:ss" of a time from now(), valid until the next call
+    const char *format(uint32_t time) {
+        if (isFormatted && time == formattedTime)
+            return formatted;
+
+        static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+        // civil date from the days since 1970, in eras of 400 years that start on 1-Mar
+        uint32_t seconds = time % 86400;
+        uint32_t days = time / 86400 + 719468;
+        uint32_t era = days / 146097;
+        uint32_t dayOfEra = days - era * 146097;
+        uint32_t yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+        uint32_t dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+        uint32_t monthOfYear = (5 * dayOfYear + 2) / 153;  // from March
+        uint32_t day = dayOfYear - (153 * monthOfYear + 2) / 5 + 1;
+        uint32_t month = monthOfYear < 10 ? monthOfYear + 2 : monthOfYear - 10;  // from January
+        uint32_t year = yearOfEra + era * 400 + (month < 2);
+
+        char *text = formatted;
+        text = printDigits(text, day, 2);
+        *text++ = '-';
+        memcpy(text, months + month * 3, 3);
+        text += 3;
+        *text++ = '-';
+        text = printDigits(text, year, 4);
+        *text++ = ' ';
+        text = printDigits(text, seconds / 3600, 2);
+        *text++ = ':';
+        text = printDigits(text, seconds / 60 % 60, 2);
+        *text++ = ':';
+        text = printDigits(text, seconds % 60, 2);
+        *text = 0;
+
+        formattedTime = time;
+        isFormatted = true;
+        return formatted;
+    }
+
+    static char *printDigits(char *text, uint32_t value, uint8_t digits) {
+        for (uint8_t i = digits; i > 0; i--) {
+            text[i - 1] = '0' + value % 10;
+            value /= 10;
+        }
+        return text + digits;
+    }
+
+    // {"synced":true,"syncs":3,"steps":0,"drift":-12.345,"error":-1520}, drift in ppm, error in us
+    size_t printJson(Print &out) const {
+        size_t n = out.print("{\"synced\":");
+        n += out.print(isSynced() ? "true" : "false");
+        n += out.print(",\"syncs\":");
+        n += out.print(syncs);
+        n += out.print(",\"steps\":");
+        n += out.print(steps);
+        n += out.print(",\"drift\":");
+        n += out.print(driftPpb / 1000.0, 3);
+        n += out.print(",\"error\":");
+        n += out.print(lastErrorUs);
+        n += out.print('}');
+        return n;
+    }
+};
+
+#endif
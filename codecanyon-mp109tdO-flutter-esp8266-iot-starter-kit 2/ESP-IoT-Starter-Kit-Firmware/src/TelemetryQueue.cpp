@@ -0,0 +1,311 @@
+/**** Store-and-forward queue for outbound MQTT telemetry, kept on SPIFFS.
+Messages that cannot be published while the broker is unreachable are appended to numbered
+segment files `/q/<n>`, and drained oldest first in small rate-limited batches once the device
+is connected again. Records are compact: topic id, length and payload. They are collected in a
+page-sized RAM buffer and written to flash one page at a time, so a multi-hour outage costs few
+flash writes. The queue is bounded: when it holds `maxSegments` segments the oldest segment is
+dropped to make room. A record is removed only after it was published (at least once delivery).
+Where publishing only buffers a record, the send function writes the batch out, and the records
+are removed only when it succeeded; a batch lost with the connection is published again later.
+`pending` counts the records exactly, also those lost to a full flash or a corrupt segment tail.
+
+bool publishRecord(uint8_t topicId, const uint8_t *payload, uint16_t length)
+{
+  return publishQueue.publish(topics[topicId], payload, length);
+}
+
+bool sendRecords()
+{
+  return publishQueue.sendAll();
+}
+
+TelemetryQueue queue(publishRecord, sendRecords);
+
+void setup()
+{
+  SPIFFS.begin();
+  queue.begin();
+}
+
+void loop()
+{
+  queue.loop(mqttClient.connected());
+}
+
+// while offline
+queue.push(TOPIC_LOG, (const uint8_t *)message, strlen(message));
+*/
+#ifndef TELEMETRY_QUEUE_CPP
+#define TELEMETRY_QUEUE_CPP
+
+#include <Arduino.h>
+#include <FS.h>
+
+struct TelemetryQueue {
+    typedef bool (*PublishFunction)(uint8_t topicId, const uint8_t *payload, uint16_t length);
+    typedef bool (*SendFunction)();
+
+    // record header: topic id, payload length (little endian)
+    static const uint8_t headerSize = 3;
+
+    // the largest payload that still fits PubSubClient's default 256 byte packet buffer
+    static const uint16_t maxPayload = 200;
+
+    const PublishFunction publish;
+    const SendFunction send;
+
+    // bounds: segments of 4 KiB, 64 KiB in total, about 12 hours of the default telemetry
+    const uint16_t segmentSize = 4096;
+    const uint8_t maxSegments = 16;
+
+    // drain at most 4 records every 250 ms after reconnecting
+    const uint8_t batchSize = 4;
+    const uint16_t drainInterval = 250;
+
+    // write the RAM buffer to flash when a page is full, or after this long
+    const uint32_t flushInterval = 30000;
+
+    uint32_t headSegment = 0;  // oldest segment, read position is headOffset
+    uint32_t tailSegment = 0;  // segment being appended to
+    uint32_t headOffset = 0;
+    uint32_t tailSize = 0;
+
+    // one SPIFFS page
+    static const uint16_t bufferSize = 256;
+    uint8_t buffer[bufferSize];
+    uint16_t bufferLength = 0;
+
+    uint32_t lastFlushTime = 0;
+    uint32_t lastDrainTime = 0;
+
+    // true while a batch is published, its records stay on flash until they were sent
+    bool isDraining = false;
+
+    // statistics, in records
+    uint32_t pending = 0;
+    uint32_t dropped = 0;
+
+    TelemetryQueue(PublishFunction publish, SendFunction send = NULL) : publish(publish), send(send) {
+    }
+
+    // find the segments left over from before a reboot, SPIFFS must be mounted
+    void begin() {
+        bool isFound = false;
+        Dir dir = SPIFFS.openDir("/q/");
+        while (dir.next()) {
+            uint32_t segment = strtoul(dir.fileName().c_str() + 3, NULL, 10);
+            if (!isFound || segment < headSegment)
+                headSegment = segment;
+            if (!isFound || segment > tailSegment) {
+                tailSegment = segment;
+                tailSize = dir.fileSize();
+            }
+            isFound = true;
+        }
+        headOffset = 0;
+        lastFlushTime = millis();
+
+        for (uint32_t segment = headSegment; isFound && segment <= tailSegment; segment++)
+            pending += countRecords(segment);
+    }
+
+    bool isEmpty() const {
+        return bufferLength == 0 && headSegment == tailSegment && headOffset >= tailSize;
+    }
+
+    // append one message, returns false if it is too large to ever be published
+    bool push(uint8_t topicId, const uint8_t *payload, uint16_t length) {
+        if (length > maxPayload) {
+            dropped++;
+            return false;
+        }
+
+        if (bufferLength + headerSize + length > bufferSize)
+            flush();
+
+        uint8_t *record = buffer + bufferLength;
+        record[0] = topicId;
+        record[1] = length & 0xff;
+        record[2] = length >> 8;
+        memcpy(record + headerSize, payload, length);
+        bufferLength += headerSize + length;
+        pending++;
+
+        return true;
+    }
+
+    // write the RAM buffer to the tail segment
+    void flush() {
+        lastFlushTime = millis();
+        if (bufferLength == 0)
+            return;
+
+        if (tailSize + bufferLength > segmentSize && tailSize > 0) {
+            tailSegment++;
+            tailSize = 0;
+
+            // bounded: drop the oldest segment
+            if (tailSegment - headSegment >= maxSegments) {
+                dropSegment();
+            }
+        }
+
+        char path[16];
+        segmentPath(path, tailSegment);
+        File file = SPIFFS.open(path, "a");
+        size_t written = 0;
+        if (file) {
+            written = file.write(buffer, bufferLength);
+            file.close();
+        }
+        tailSize += written;
+
+        // a full or failing flash: the records without a header on flash are lost, one cut short
+        // is counted until drain() skips it, and the next flush starts a new segment behind it
+        if (written < bufferLength) {
+            uint32_t lost = 0;
+            uint16_t offset = 0;
+            while (offset < bufferLength) {
+                lost += (size_t)offset + headerSize > written;
+                offset += headerSize + (buffer[offset + 1] | (buffer[offset + 2] << 8));
+            }
+            pending -= min(pending, lost);
+            dropped += lost;
+            if (written > 0)
+                tailSize = segmentSize;
+        }
+        bufferLength = 0;
+    }
+
+    void loop(bool isConnected) {
+        uint32_t now = millis();
+
+        if (bufferLength > 0 && now - lastFlushTime >= flushInterval)
+            flush();
+
+        if (!isConnected || isEmpty() || now - lastDrainTime < drainInterval)
+            return;
+
+        lastDrainTime = now;
+        drain();
+    }
+
+    // publish the next batch of records, oldest first
+    void drain() {
+        flush();
+
+        // what was published before goes out first, the batch must not be lost with it
+        if (send && !send())
+            return;
+
+        char path[16];
+        segmentPath(path, headSegment);
+        File file = SPIFFS.open(path, "r");
+        if (!file) {
+            nextSegment();
+            return;
+        }
+
+        file.seek(headOffset, SeekSet);
+
+        uint32_t offset = headOffset;
+        uint32_t published = 0;
+        bool isCorrupt = false;
+        isDraining = true;
+
+        uint8_t record[headerSize + maxPayload];
+        for (uint8_t i = 0; i < batchSize; i++) {
+            if (file.read(record, headerSize) != headerSize) {
+                isCorrupt = offset < file.size();
+                break;
+            }
+
+            uint16_t length = record[1] | (record[2] << 8);
+            if (length > maxPayload || file.read(record + headerSize, length) != length) {
+                isCorrupt = true;
+                break;
+            }
+
+            // replayed messages are never retained, the live value on the broker is newer
+            if (!publish(record[0], record + headerSize, length))
+                break;
+
+            offset += headerSize + length;
+            published++;
+        }
+
+        // removed once written, a batch lost with the connection is read again
+        if (published > 0 && send && !send()) {
+            offset = headOffset;
+            published = 0;
+            isCorrupt = false;
+        }
+        isDraining = false;
+
+        headOffset = offset;
+        pending -= min(pending, published);
+
+        // corrupt tail of a segment, from a write cut short, skip the rest of it with its records
+        if (isCorrupt) {
+            uint32_t lost = countRecords(headSegment, headOffset);
+            pending -= min(pending, lost);
+            dropped += lost;
+            headOffset = file.size();
+        }
+
+        bool isExhausted = headOffset >= file.size();
+        file.close();
+
+        if (isExhausted)
+            nextSegment();
+    }
+
+    // advance past a fully drained head segment, the tail segment is reused from the start
+    void nextSegment() {
+        if (headSegment == tailSegment) {
+            char path[16];
+            segmentPath(path, headSegment);
+            SPIFFS.remove(path);
+            headOffset = tailSize = 0;
+            return;
+        }
+        dropSegment();
+    }
+
+    // forget the head segment, counting its unsent records as dropped
+    void dropSegment() {
+        uint32_t lost = countRecords(headSegment, headOffset);
+        pending -= min(pending, lost);
+        dropped += lost;
+
+        char path[16];
+        segmentPath(path, headSegment);
+        SPIFFS.remove(path);
+        headSegment++;
+        headOffset = 0;
+    }
+
+    // walk the record headers of a segment from an offset
+    static uint32_t countRecords(uint32_t segment, uint32_t offset = 0) {
+        char path[16];
+        segmentPath(path, segment);
+        File file = SPIFFS.open(path, "r");
+        if (!file)
+            return 0;
+
+        uint32_t count = 0;
+        uint8_t header[headerSize];
+        while (file.seek(offset, SeekSet) && file.read(header, headerSize) == headerSize) {
+            offset += headerSize + (header[1] | (header[2] << 8));
+            count++;
+        }
+        file.close();
+        return count;
+    }
+
+    static void segmentPath(char *path, uint32_t segment) {
+        sprintf(path, "/q/%lu", (unsigned long)segment);
+    }
+};
+
+#endif
@@ -0,0 +1,93 @@
+/**** MQTT topics of the device, built once at boot below a base topic with its device ID.
+`begin()` writes the base ("devices/<id>") and every topic (base and suffix) into one fixed
+buffer, so publishing looks a topic up by its ID without building strings. Characters that MQTT
+does not allow in a topic level ('/', '+', '#' and control characters) are replaced in the ID.
+
+enum Topic : uint8_t { TOPIC_PONG, TOPIC_COMMANDS, TOPIC_COUNT };
+const char *const suffixes[TOPIC_COUNT] = {"/get/ping", "/set/#"};
+
+TopicTable<TOPIC_COUNT, 128> topics;
+
+void setup()
+{
+  topics.begin("devices/", "esp123456", suffixes);
+  mqttClient.subscribe(topics[TOPIC_COMMANDS]);   // devices/esp123456/set/#
+  mqttClient.publish(topics[TOPIC_PONG], "pong");  // devices/esp123456/get/ping
+}
+*/
+#ifndef TOPIC_TABLE_CPP
+#define TOPIC_TABLE_CPP
+
+#include <Arduino.h>
+
+template <uint8_t Count, uint16_t Capacity>
+struct TopicTable {
+    char buffer[Capacity];
+    const char *topics[Count];
+    uint16_t length = 0;
+    uint16_t baseEnd = 0;
+
+    TopicTable() {
+        buffer[0] = 0;
+        for (uint8_t i = 0; i < Count; i++)
+            topics[i] = buffer;
+    }
+
+    // false when the topics do not fit the buffer, those that do not fit are empty
+    bool begin(const char *prefix, const char *id, const char *const suffixes[Count]) {
+        length = 0;
+        bool isComplete = append(prefix, false) && append(id, true);
+        if (!isComplete)
+            length = 0;
+        baseEnd = length;
+        buffer[length++] = 0;
+
+        for (uint8_t i = 0; i < Count; i++) {
+            uint16_t start = length;
+            isComplete = isComplete && append(buffer, baseEnd, false) && append(suffixes[i], false);
+            if (isComplete) {
+                topics[i] = buffer + start;
+                buffer[length++] = 0;
+            } else {
+                // the zero at the end of the base is an empty topic
+                topics[i] = buffer + baseEnd;
+                length = start;
+            }
+        }
+
+        return isComplete;
+    }
+
+    // "devices/<id>"
+    const char *base() const {
+        return buffer;
+    }
+
+    size_t baseLength() const {
+        return baseEnd;
+    }
+
+    const char *operator[](uint8_t topic) const {
+        return topics[topic];
+    }
+
+    bool append(const char *text, bool isLevel) {
+        return append(text, strlen(text), isLevel);
+    }
+
+    bool append(const char *text, size_t size, bool isLevel) {
+        // leave room for the zero at the end
+        if (length + size >= Capacity)
+            return false;
+
+        for (size_t i = 0; i < size; i++) {
+            char c = text[i];
+            if (isLevel && (c == '/' || c == '+' || c == '#' || (uint8_t)c < 0x20))
+                c = '_';
+            buffer[length++] = c;
+        }
+        return true;
+    }
+};
+
+#endif
@@ -89,4 +89,12 @@ struct Uptime
 
     return Days + hours_o + Hours + mins_o + Minutes + secs_o + Seconds;
   }
+
+  // Print system uptime, same as getUptime() without building strings
+  size_t printTo(Print &out)
+  {
+    char text[24];
+    snprintf(text, sizeof(text), "%ld:%02d:%02d:%02d", Days, Hours, Minutes, Seconds);
+    return out.print(text);
+  }
 };
@@ -0,0 +1,202 @@
+/**** Streaming statistics of the samples in a window, in a fixed amount of memory.
+Every sample updates the count, min, max, and the mean and variance with Welford's method, which
+stays exact where a sum of squares would cancel out. Percentiles are estimated with the P-square
+algorithm of Jain and Chlamtac: five markers per percentile, at the min, the max, the percentile
+and half way to it on both sides, follow the sample heights as they come in, moved along a
+parabola through their neighbours. No sample is stored, so a window of any length takes the same
+48 bytes per percentile, and an add costs the same however many samples came before.
+
+WindowStats stats;
+
+void onSample(float value)
+{
+  stats.add(value);
+}
+
+void onWindowEnd()
+{
+  stats.printJson(Serial);  // {"n":150,"min":22.9,"max":26.1,"mean":23.12,"sd":0.21,"p50":23.1,"p95":23.3}
+  stats.reset();
+}
+*/
+#ifndef WINDOW_STATS_CPP
+#define WINDOW_STATS_CPP
+
+#include <Arduino.h>
+#include <math.h>
+
+// one percentile of a stream of samples, estimated by the P-square algorithm
+struct QuantileSketch {
+    static const uint8_t markerCount = 5;
+
+    const float quantile;  // 0.5 for the median
+
+    // heights of the markers, and their positions among the samples so far, from 0
+    float heights[markerCount];
+    uint32_t positions[markerCount];
+    uint32_t count;
+
+    QuantileSketch(uint8_t percent) : quantile(percent / 100.0f) {
+        reset();
+    }
+
+    void reset() {
+        count = 0;
+    }
+
+    void add(float sample) {
+        // the first samples are kept sorted, they are the markers once there are five
+        if (count < markerCount) {
+            uint8_t i = count;
+            for (; i > 0 && heights[i - 1] > sample; i--)
+                heights[i] = heights[i - 1];
+            heights[i] = sample;
+            positions[count] = count;
+            count++;
+            return;
+        }
+
+        // the cell of the sample, the extremes move with it
+        uint8_t cell;
+        if (sample < heights[0]) {
+            heights[0] = sample;
+            cell = 0;
+        } else if (sample >= heights[markerCount - 1]) {
+            heights[markerCount - 1] = sample;
+            cell = markerCount - 2;
+        } else {
+            cell = 0;
+            while (sample >= heights[cell + 1])
+                cell++;
+        }
+        for (uint8_t i = cell + 1; i < markerCount; i++)
+            positions[i]++;
+        count++;
+
+        // the middle markers move by one towards where they should be
+        for (uint8_t i = 1; i < markerCount - 1; i++) {
+            float offset = desiredPosition(i) - positions[i];
+            int8_t step = 0;
+            if (offset >= 1 && positions[i + 1] - positions[i] > 1)
+                step = 1;
+            else if (offset <= -1 && positions[i] - positions[i - 1] > 1)
+                step = -1;
+            if (step == 0)
+                continue;
+
+            float height = parabolic(i, step);
+            if (height <= heights[i - 1] || height >= heights[i + 1])
+                height = linear(i, step);
+            heights[i] = height;
+            positions[i] += step;
+        }
+    }
+
+    // the estimate, exact while there are no more than five samples, NAN without any
+    float value() const {
+        if (count == 0)
+            return NAN;
+        if (count < markerCount)
+            return heights[(uint8_t)lroundf((count - 1) * quantile)];
+        return heights[2];
+    }
+
+    // where a marker belongs for the samples so far: min, half way, the quantile, half way, max
+    float desiredPosition(uint8_t marker) const {
+        static const float fractions[markerCount] = {0, 0.5f, 1, 1.5f, 2};
+        float last = count - 1;
+        if (marker <= 2)
+            return last * quantile * fractions[marker];
+        return last * quantile + (last - last * quantile) * (fractions[marker] - 1);
+    }
+
+    float parabolic(uint8_t i, int8_t step) const {
+        float below = (float)positions[i] - positions[i - 1];
+        float above = (float)positions[i + 1] - positions[i];
+        return heights[i] + step / (below + above) *
+                                ((below + step) * (heights[i + 1] - heights[i]) / above +
+                                 (above - step) * (heights[i] - heights[i - 1]) / below);
+    }
+
+    float linear(uint8_t i, int8_t step) const {
+        uint8_t neighbour = i + step;
+        return heights[i] + step * (heights[neighbour] - heights[i]) /
+                                ((float)positions[neighbour] - positions[i]);
+    }
+};
+
+struct WindowStats {
+    // the upper percentile, for the highs of a window without its single extremes
+    static const uint8_t highPercent = 95;
+
+    uint32_t count;
+    float minimum;
+    float maximum;
+    float mean;
+    float squares;  // sum of the squared distances from the mean, for the variance
+
+    QuantileSketch median;
+    QuantileSketch high;
+
+    WindowStats() : median(50), high(highPercent) {
+        reset();
+    }
+
+    void reset() {
+        count = 0;
+        minimum = INFINITY;
+        maximum = -INFINITY;
+        mean = 0;
+        squares = 0;
+        median.reset();
+        high.reset();
+    }
+
+    void add(float sample) {
+        count++;
+        minimum = min(minimum, sample);
+        maximum = max(maximum, sample);
+
+        float delta = sample - mean;
+        mean += delta / count;
+        squares += delta * (sample - mean);
+
+        median.add(sample);
+        high.add(sample);
+    }
+
+    // sample variance, 0 for a single sample
+    float variance() const {
+        return count > 1 ? squares / (count - 1) : 0;
+    }
+
+    float deviation() const {
+        return sqrtf(variance());
+    }
+
+    // {"n":150,"min":22.9,"max":26.1,"mean":23.12,"sd":0.21,"p50":23.1,"p95":23.3}, null without
+    // samples
+    size_t printJson(Print &out) const {
+        if (count == 0)
+            return out.print("null");
+
+        size_t n = out.print("{\"n\":");
+        n += out.print(count);
+        n += out.print(",\"min\":");
+        n += out.print(minimum, 1);
+        n += out.print(",\"max\":");
+        n += out.print(maximum, 1);
+        n += out.print(",\"mean\":");
+        n += out.print(mean, 2);
+        n += out.print(",\"sd\":");
+        n += out.print(deviation(), 2);
+        n += out.print(",\"p50\":");
+        n += out.print(median.value(), 1);
+        n += out.print(",\"p95\":");
+        n += out.print(high.value(), 1);
+        n += out.print('}');
+        return n;
+    }
+};
+
+#endif
@@ -9,238 +9,1066 @@ Copyright 2020 (c) Orison Technologies <https://orison.biz/>
 
 #include <FS.h>  //this needs to be first
 // the rest of the includes
-#include <Adafruit_Sensor.h>
 #include <Arduino.h>
 #include <ArduinoJson.h>
-#include <AsyncDelay.h>
-#include <DHT.h>
-#include <DebounceEvent.h>
 #include <ESP8266WiFi.h>
-#include <NTPClient.h>
 #include <PubSubClient.h>
-#include <Ticker.h>
-#include <Time.h>
-#include <TimeLib.h>
 #include <WiFiManager.h>
-#include <WiFiUdp.h>
-
-#include "Flasher.cpp"
+#include <coredecls.h>
+#include <sys/time.h>
+
+#include "CommandBatch.cpp"
+#include "ConfigStore.cpp"
+#include "ConnectionManager.cpp"
+#include "Dht22.cpp"
+#include "FadeEngine.cpp"
+#include "HeapTracer.cpp"
+#include "InputCapture.cpp"
+#include "LatencyStats.cpp"
+#include "LogBuffer.cpp"
+#include "MqttDispatcher.cpp"
+#include "PatternEngine.cpp"
+#include "PayloadWriter.cpp"
+#include "PortEngine.cpp"
+#include "PublishQueue.cpp"
+#include "RuleEngine.cpp"
+#include "Scheduler.cpp"
+#include "SensorNode.cpp"
+#include "SensorPipeline.cpp"
+#include "SeriesHistory.cpp"
+#include "SystemClock.cpp"
+#include "TelemetryQueue.cpp"
+#include "TopicTable.cpp"
 #include "Uptime.cpp"
+#include "WindowStats.cpp"
 
 // SERVER INFO
 #define _VERSION "ESP IoT Device Starter Kit v1.4.0"
 #define _HOSTNAME "ESP-IoT-Device1-"
 
-// MQTT TOPICS
-#define _MQTT_BASE "devices/esp01"
-
-#define _MQTT_LOG _MQTT_BASE "/log"
-#define _MQTT_UPTIME _MQTT_BASE "/uptime"
-
-#define _MQTT_SET_PING _MQTT_BASE "/set/ping"
-#define _MQTT_GET_PING _MQTT_BASE "/get/ping"
-
-#define _MQTT_SET_PORT1 _MQTT_BASE "/set/port1"
-#define _MQTT_GET_PORT1 _MQTT_BASE "/get/port1"
-
-#define _MQTT_SET_PORT2 _MQTT_BASE "/set/port2"
-#define _MQTT_GET_PORT2 _MQTT_BASE "/get/port2"
-
-#define _MQTT_SET_BEEPER _MQTT_BASE "/set/beeper"
-#define _MQTT_GET_BEEPER _MQTT_BASE "/get/beeper"
+// version of the binary config record, change with DeviceConfig
+#define _CONFIG_VERSION 3
 
-#define _MQTT_SET_SENSOR_DATA _MQTT_BASE "/set/sensor_data"
-#define _MQTT_GET_SENSOR_DATA _MQTT_BASE "/get/sensor_data"
+// MQTT TOPICS
+// all topics are below "devices/<device id>", the ID is set in the config portal, or else taken
+// from the MAC address ("esp" and its last 3 bytes)
+#define _MQTT_PREFIX "devices/"
+#define _DEVICE_ID_PREFIX "esp"
+// the fixed ID of the firmware before the ID was configurable, kept by a config.json without one
+// so the app still finds an upgraded device
+#define _DEVICE_ID_LEGACY "esp01"
+
+// command topic suffixes, also used as keys for the MQTT dispatcher
+#define _MQTT_SUFFIX_PING "/set/ping"
+// "/set/port1" for port 1 of the port table
+#define _MQTT_SUFFIX_PORT "/set/port+"
+// "/set/fade1" for dimmer 1 of the dimmer pins
+#define _MQTT_SUFFIX_FADE "/set/fade+"
+#define _MQTT_SUFFIX_BEEPER "/set/beeper"
+#define _MQTT_SUFFIX_SENSOR_DATA "/set/sensor_data"
+#define _MQTT_SUFFIX_STATS "/set/stats"
+#define _MQTT_SUFFIX_HEAP "/set/heap"
+#define _MQTT_SUFFIX_BATCH "/set/batch"
+#define _MQTT_SUFFIX_RULES "/set/rules"
+#define _MQTT_SUFFIX_SENSORS "/set/sensors"
+#define _MQTT_SUFFIX_HISTORY "/set/history"
 
 // OUTPUT PINS
 #define _PIN_OUT_PORT1 4
 #define _PIN_OUT_PORT2 5
 #define _PIN_OUT_BEEPER 13
 #define _PIN_OUT_LED 15
+// PWM dimmer, GPIO0 has to be high at boot, the driver must not pull it low
+#define _PIN_OUT_DIMMER1 0
 
 // INPUT PINS
 #define _PIN_IN_PORT1 14
 #define _PIN_IN_PORT2 2
+#define _INPUT_COUNT 2
 
 // SENSOR PINS
+// DHT22 (AM2302) data line, it needs an interrupt capable pin
 #define _PIN_DHT_SENSOR 12
 
+// pulse of a momentary port
 #define _DELAY_BUTTON 500
 #define _DELAY_BEEPER 1000
 #define _DELAY_BUTTON_LONG_PRESS 8000
+// bounces of a button edge are ignored for this long
+#define _DELAY_BUTTON_DEBOUNCE 40
 
-// every 5 minutes
+// a sensor node samples every 5 minutes
 #define _DELAY_SENSOR_DATA 300 * 1000
 
+// SENSOR PIPELINE
+// defaults, changed on /set/sensors: the DHT22 is sampled every 2 seconds, as often as it measures,
+// its values are reported when the temperature moved by 0.2 C or the humidity by 2 %, or else every
+// hour, and the statistics of all samples every 5 minutes
+#define _SENSOR_PERIOD 2
+#define _SENSOR_INTERVAL 3600
+#define _SENSOR_WINDOW 300
+#define _SENSOR_MEDIAN 3
+#define _SENSOR_EMA 50
+#define _SENSOR_DEADBAND_TEMP 20
+#define _SENSOR_DEADBAND_HUM 200
+
+// HISTORY
+// the filtered sensor values are kept on flash once a minute, several days of them in 24 KiB, see
+// SeriesHistory.cpp
+#define _DELAY_HISTORY_SAMPLE 60 * 1000
+
+// every minute
+#define _DELAY_UPTIME 60 * 1000
+
+// TIME
+// defaults for an empty time server or offset in the config, the offset is in minutes ahead of UTC
+#define _NTP_SERVER "europe.pool.ntp.org"
+#define _TIME_OFFSET 300
+// the SNTP client asks the time server every hour
+#define _DELAY_NTP_UPDATE 60 * 60 * 1000
+
+// MQTT log lines are collected and sent together after at most 5 seconds, errors right away
+#define _DELAY_LOG_FLUSH 5000
+
+// heap samples every second, a heap report every 10 minutes
+#define _DELAY_HEAP_SAMPLE 1000
+#define _DELAY_HEAP_REPORT 600 * 1000
+
+// alarm while a publish still fits: a full TCP segment plus the strings that build the message
+#define _HEAP_ALARM_BLOCK 2048
+
+// longest idle sleep between loop passes, and how often a sleep checks for MQTT data
+#define _DELAY_IDLE_MAX 100
+#define _DELAY_IDLE_POLL 10
+
 #define _DELAY_SYSTEM_STEPS 1500
 
-//#define DHT_TYPE  DHT11   // for DHT 11 type sensor
-#define DHT_TYPE DHT22  // for DHT 22 (AM2302), AM2321 type sensor
+// longest a single DNS lookup, TCP connect or MQTT handshake may block the loop
+#define _DELAY_CONNECT_BUDGET 1000
+
+// publishes written per loop pass, one TCP segment
+#define _MQTT_WRITE_BUDGET 1460
+
+// WiFi power saving between deadlines. WIFI_LIGHT_SLEEP saves more, but it stops the CPU clock
+// between beacons, and with it the timer0 patterns, the PWM of the dimmers and the DHT22 edge
+// capture, so it only suits a board without them
+#define _WIFI_SLEEP_MODE WIFI_MODEM_SLEEP
+
+// SENSOR NODE
+// define _SENSOR_NODE (see the nodemcuv2_sensor_node environment) for a battery powered device that
+// deep sleeps between samples and publishes them in batches, GPIO16 must be wired to RST
+#define _NODE_SAMPLE_PERIOD _DELAY_SENSOR_DATA
+#define _NODE_BATCH_WAKES 6
+// longest a publishing wake waits for WiFi and the broker
+#define _NODE_CONNECT_TIMEOUT 10000
+
+// OUTPUT PORTS
+// port N is switched on /set/portN and reports on /get/portN, see PortEngine.cpp for the modes.
+// Ports on an I2C expander give the index of their expander in portExpanders and its channel,
+// the expander takes GPIO 4 (SDA) and GPIO 5 (SCL), so ports 1 and 2 have to move to other pins.
+constexpr PortDescriptor portTable[] = {
+    // auto close: a button press of _DELAY_BUTTON, active low
+    {PORT_GPIO, _PIN_OUT_PORT1, PORT_MOMENTARY, _DELAY_BUTTON, true},
+    // toggle: open is high, close is low
+    {PORT_GPIO, _PIN_OUT_PORT2, PORT_TOGGLE, 0, false},
+};
+
+#define PORT_COUNT (sizeof(portTable) / sizeof(portTable[0]))
+
+// DIMMERS
+// dimmer N fades through the keyframes sent on /set/fadeN, see FadeEngine.cpp, up to 8 pins can
+// dim at once
+const uint8_t dimmerPins[] = {_PIN_OUT_DIMMER1};
+
+#define DIMMER_COUNT (sizeof(dimmerPins) / sizeof(dimmerPins[0]))
+
+// 50 fade frames per second while a dimmer fades
+#define _DELAY_FADE_FRAME 20
+
+// I2C port expanders, none on the starter kit board, e.g.
+//   PortExpander portExpanders[] = {PortExpander(PortExpander::MCP23017, 0x20)};
+PortExpander *const portExpanders = NULL;
+#define _PORT_EXPANDER_COUNT 0
+
+// topics the device publishes and subscribes, telemetry topics first, their IDs are queued on flash
+enum MqttTopic : uint8_t {
+    TOPIC_LOG,
+    TOPIC_UPTIME,
+    TOPIC_SENSOR_DATA,
+    TOPIC_PING,
+    TOPIC_BEEPER,
+    TOPIC_SENSOR_BATCH,
+    TOPIC_STATS,
+    TOPIC_HEAP,
+    TOPIC_BATCH,
+    TOPIC_RULES,
+    TOPIC_SENSORS,
+    TOPIC_SENSOR_STATS,
+    TOPIC_HISTORY,
+    TOPIC_COMMANDS,
+    TOPIC_COUNT
+};
+
+const char *const mqttTopicSuffixes[TOPIC_COUNT] = {
+    "/log",
+    "/uptime",
+    "/get/sensor_data",
+    "/get/ping",
+    "/get/beeper",
+    "/get/sensor_batch",
+    "/get/stats",
+    "/get/heap",
+    "/get/batch",
+    "/get/rules",
+    "/get/sensors",
+    "/get/sensor_stats",
+    "/get/history",
+    "/set/#",
+};
+
+// the topics with the longest device ID and base
+#define _MQTT_TOPICS_SIZE 512
+
+// "devices/<id>/get/port255", the port and dimmer topics are formatted when they are published
+#define _MQTT_NUMBERED_TOPIC_SIZE 48
+
+// stages of loop() and slow calls, timed into latency histograms
+enum LatencyStage : uint8_t {
+    STAGE_LOOP,  // one pass without the idle sleep
+    STAGE_BUTTONS,
+    STAGE_CONNECTION,
+    STAGE_MQTT,
+    STAGE_TELEMETRY_QUEUE,
+    STAGE_TASKS,
+    STAGE_DHT_READ,
+    STAGE_SERIAL_LOG,
+    STAGE_PUBLISH,
+    STAGE_PORTS,
+    STAGE_RULES,
+    STAGE_SENSORS,
+    STAGE_HISTORY,
+    STAGE_COUNT
+};
+
+const char *const latencyStageNames[STAGE_COUNT] = {"loop",    "buttons", "connection", "mqtt",  "queue", "tasks",
+                                                    "dht",     "serial",  "publish",    "ports", "rules", "sensors",
+                                                    "history"};
+
+// subsystems that heap allocations are attributed to
+enum HeapTag : uint8_t {
+    HEAP_OTHER,
+    HEAP_LOG,
+    HEAP_MQTT,
+    HEAP_NETWORK,
+    HEAP_QUEUE,
+    HEAP_SENSOR,
+    HEAP_CONFIG,
+    HEAP_COUNT
+};
+
+const char *const heapTagNames[HEAP_COUNT] = {"other", "log",    "mqtt",  "network",
+                                              "queue", "sensor", "config"};
 
 // ***************** function declarations ********************
 void mqttCallback(char *topic, byte *payload, unsigned int length);
-void log(String message, bool sendMQTT = false);
+bool onPingCommand(const byte *payload, unsigned int length);
+bool onSensorDataCommand(const byte *payload, unsigned int length);
+bool onBeeperCommand(const byte *payload, unsigned int length);
+bool onPortCommand(const byte *payload, unsigned int length);
+bool onFadeCommand(const byte *payload, unsigned int length);
+bool onStatsCommand(const byte *payload, unsigned int length);
+void publishStats();
+bool onHeapCommand(const byte *payload, unsigned int length);
+bool onBatchCommand(const byte *payload, unsigned int length);
+void runBatch();
+CommandBatch::Result runCommand(const char *name, const byte *payload, unsigned int length);
+bool isQuietCommand(MqttHandler handler);
+bool onRulesCommand(const byte *payload, unsigned int length);
+void publishRules();
+bool onSensorsCommand(const byte *payload, unsigned int length);
+void publishSensorSettings();
+bool onHistoryCommand(const byte *payload, unsigned int length);
+void recordHistory();
+bool publishHistoryChunk(const char *payload, size_t length);
+bool readRuleVariable(RuleEngine::Variable variable, uint8_t index, int32_t &value);
+bool runRuleCommand(uint8_t rule, const char *name, const char *payload);
+void publishAck(MqttTopic topic, const char *payload);
+void publishAck(const char *topic, const char *payload);
+void sampleHeap();
+void publishHeapReport();
+void log(const char *message, bool sendMQTT = false);
+void log(const String &message, bool sendMQTT = false);
+size_t printLogTime(Print &out, uint32_t time);
+void flushLog();
 boolean isValidNumber(String str);
 
-void connectWiFi();
-void connectMqtt();
+void runWiFiConfigPortal();
+bool connectBroker(IPAddress ip);
+void onConnectionChange(ConnectionManager::State state);
 void resetWiFiSettings();
 void wifiConfigModeCallback(WiFiManager *myWiFiManager);
-void tickerWifiMqttConfigCallback();
-void tickerOneSecondCallback();
+void onInputChange();
+void onButton(const InputCapture<_INPUT_COUNT>::Event &event);
+bool isIdle();
 
-time_t syncSystemTime();
-String getSystemDateTime();
+void beginClock();
+void onTimeSet(bool isFromSntp);
 void publishUptime();
-
+void publishTelemetry(MqttTopic topic, const char *payload, bool retain = false);
+bool isTelemetryLive();
+bool publishQueuedRecord(uint8_t topicId, const uint8_t *payload, uint16_t length);
+bool sendQueuedRecords();
+void onPublishUnsent(const uint8_t *topic, uint16_t topicLength, const uint8_t *payload, size_t length);
+
+void beginTopics();
+bool loadConfig();
+bool saveConfig();
 bool loadConfigFile();
 bool saveConfigFile();
 void saveConfigCallback();
 
-void openPort(int portNumber);
+void switchPort(uint8_t port, bool isActive);
+void formatNumberedTopic(char *topic, size_t size, const char *suffix, uint8_t index);
+void onPortExpired(uint8_t port);
 void startBeeper();
 void getSensorData();
+void startDht();
+void onSensorRead(bool isValid);
+void onSensorReport(uint8_t source);
+void publishSensorData();
+void onSensorWindow(uint8_t source);
+void publishSensorStats();
+size_t printSensorStats(Print &out, const char *time);
+void runSensorNode();
 
 // Strings
 String systemIpInfo;
+String hostName;
+
+// millis() at the start of setup, and from there to the first MQTT connection
+uint32_t bootTime = 0;
+uint32_t bootToMqttMs = 0;
 
 WiFiClient wifiClient;
 PubSubClient mqttClient(wifiClient);
 
+// publishes of a loop pass, written to the connection together, unsent telemetry goes to the queue
+PublishQueue publishQueue(wifiClient, onPublishUnsent);
+
+// built at boot, once the device ID is known
+TopicTable<TOPIC_COUNT, _MQTT_TOPICS_SIZE> mqttTopics;
+
 // for wifiManager
 // to save settings, Spiffs, FS
 const char *CONFIG_FILE = "/config.json";
 
+// compiled automation rules
+const char *RULES_FILE = "/rules.bin";
+
+// settings of the sensor pipeline
+const char *SENSORS_FILE = "/sensors.bin";
+
+// compressed history of the sensor values
+const char *HISTORY_FILE = "/history.bin";
+
 bool shouldSaveConfig = false;
 
-char mqttServer[40] = "";
-char mqttPort[7] = "";
-char mqttUser[40] = "";
-char mqttPass[40] = "";
+// MQTT settings, stored as a binary record in the EEPROM sector, JSON is only for import and export
+struct DeviceConfig {
+    char mqttServer[40];
+    char mqttPort[7];
+    char mqttUser[40];
+    char mqttPass[40];
+    char deviceId[24];  // empty for the ID from the MAC address
+    char ntpServer[40];   // empty for _NTP_SERVER
+    char timeOffset[7];   // minutes ahead of UTC, empty for _TIME_OFFSET
+};
+
+DeviceConfig config = {"", "", "", "", "", "", ""};
+ConfigStore<DeviceConfig> configStore(_CONFIG_VERSION);
+
+uint16_t mqttPortNumber = 1883;
 
 Uptime systemUptime;
 
-// time string
-char strTime[32];
+// wall clock, synced by the SNTP client of lwIP in the background
+SystemClock systemClock;
+
+// WiFi and MQTT reconnection, never blocks a loop pass for longer than the budget per step
+ConnectionManager connection(connectBroker, onConnectionChange, _DELAY_CONNECT_BUDGET);
+
+// outbound telemetry kept on SPIFFS during broker outages
+TelemetryQueue telemetryQueue(publishQueuedRecord, sendQueuedRecords);
+
+// MQTT log lines waiting to be sent in one batch
+LogBuffer logBuffer(printLogTime);
 
-// NTP clock
-WiFiUDP ntpUDP;
+// all periodic and one-shot work, the loop sleeps until the next deadline
+Scheduler scheduler(_DELAY_IDLE_MAX, _DELAY_IDLE_POLL);
 
-// You can specify the time server pool and the offset (in seconds, can be
-// changed later with setTimeOffset() ). Additionally you can specify the
-// update interval (in milliseconds, can be changed using setUpdateInterval() ).
-NTPClient timeClient(ntpUDP, "europe.pool.ntp.org", (60 * 60 * 5), (60000 * 60));
+PortEngine<PORT_COUNT> ports(portTable, portExpanders, _PORT_EXPANDER_COUNT, onPortExpired);
 
-Ticker tickerWiFiMqttConfig;
-Ticker tickerOneSecond;
+// button edges are captured by interrupts with their times, the loop classifies them
+const uint8_t inputPins[_INPUT_COUNT] = {_PIN_IN_PORT1, _PIN_IN_PORT2};
+InputCapture<_INPUT_COUNT> buttons(inputPins, _DELAY_BUTTON_DEBOUNCE, onButton, onInputChange);
 
-// delays
-AsyncDelay delayPort1;
-AsyncDelay delayPort2;  // for auto reset the state (not used)
-AsyncDelay delayBeeper;
-AsyncDelay delaySensorData;
+// LED and buzzer patterns, milliseconds on, off, on..., played by the timer interrupt
+enum PatternChannel : uint8_t {
+    CHANNEL_LED,
+    CHANNEL_BEEPER,
+    CHANNEL_COUNT
+};
 
-bool isPort1Pressed = false;
-bool isPort2Pressed = false;
-bool isBeeperStarted = false;
+// a higher layer shows over the lower ones, which keep their timing underneath
+enum PatternLayer : uint8_t {
+    LAYER_BACKGROUND,  // ready
+    LAYER_STATUS,      // connecting WiFi or the broker, config portal
+    LAYER_ALERT,       // ping, beep, WiFi reset
+    LAYER_COUNT
+};
 
-DebounceEvent *buttonPort1;
-DebounceEvent *buttonPort2;
+enum PatternId : uint8_t {
+    PATTERN_READY,
+    PATTERN_WIFI,
+    PATTERN_BROKER,
+    PATTERN_PING,
+    PATTERN_BEEP,
+    PATTERN_RESET,
+    PATTERN_COUNT
+};
 
-// LED and buzzer flash patterns
-uint32_t sequencePing[] = {100, 80, 100, 80, 100, 80, 0};
-uint32_t sequenceBeep[] = {500, 250, 0};
-uint32_t sequenceReady[] = {1600, 800, 0};
+const uint16_t stepsReady[] = {800, 1600, 0};
+const uint16_t stepsWiFi[] = {150, 150, 0};
+const uint16_t stepsBroker[] = {50, 50, 0};
+const uint16_t stepsPing[] = {100, 80, 100, 80, 100, 80, 0};
+const uint16_t stepsBeep[] = {_DELAY_BEEPER, 0};
+const uint16_t stepsReset[] = {120, 120, 120, 120, 120, 120, 0};
 
-Flasher flasherPing(_PIN_OUT_LED, sequencePing, false);
-Flasher flasherBeep(_PIN_OUT_BEEPER, sequenceBeep, false);
-Flasher flasherReady(_PIN_OUT_LED, sequenceReady, true);
+const Pattern patternTable[PATTERN_COUNT] = {
+    {stepsReady, true}, {stepsWiFi, true},  {stepsBroker, true},
+    {stepsPing, false}, {stepsBeep, false},      {stepsReset, false},
+};
+
+// the beeper is active low
+const PatternOutput patternOutputs[CHANNEL_COUNT] = {{_PIN_OUT_LED, false}, {_PIN_OUT_BEEPER, true}};
+
+PatternEngine<CHANNEL_COUNT, LAYER_COUNT> patterns(patternOutputs, patternTable);
+
+// dimmers, faded in fixed point by a Ticker while they fade
+FadeEngine<DIMMER_COUNT> fades(dimmerPins, _DELAY_FADE_FRAME);
 
 // Sensors
-DHT dht(_PIN_DHT_SENSOR, DHT_TYPE);
+Dht22 dhtSensor(_PIN_DHT_SENSOR, onSensorRead);
+
+// what measures, sampled at its own period
+enum SensorSourceId : uint8_t {
+    SOURCE_DHT,
+    SOURCE_COUNT
+};
+
+// the values of the sources, filtered and reported on change
+enum SensorId : uint8_t {
+    SENSOR_TEMP,
+    SENSOR_HUM,
+    SENSOR_COUNT
+};
+
+const SensorSource sensorSources[SOURCE_COUNT] = {{"dht", startDht, _SENSOR_PERIOD, _SENSOR_INTERVAL, _SENSOR_WINDOW}};
+
+const SensorDescriptor sensorTable[SENSOR_COUNT] = {
+    {"temp", SOURCE_DHT, _SENSOR_MEDIAN, _SENSOR_EMA, _SENSOR_DEADBAND_TEMP},
+    {"hum", SOURCE_DHT, _SENSOR_MEDIAN, _SENSOR_EMA, _SENSOR_DEADBAND_HUM},
+};
+
+SensorPipeline<SOURCE_COUNT, SENSOR_COUNT> sensors(SENSORS_FILE, sensorSources, sensorTable, onSensorReport,
+                                                   onSensorWindow);
+
+// the sensor values of the last days, streamed on /get/history
+SeriesHistory<SENSOR_COUNT> history(HISTORY_FILE, publishHistoryChunk);
+
+SensorNode sensorNode(_NODE_BATCH_WAKES);
+
+// MQTT command routes, matched against the topic suffix below the base of the device
+const MqttRoute mqttRoutes[] = {
+    MQTT_ROUTE(_MQTT_SUFFIX_PING, onPingCommand),
+    MQTT_ROUTE(_MQTT_SUFFIX_SENSOR_DATA, onSensorDataCommand),
+    MQTT_ROUTE(_MQTT_SUFFIX_BEEPER, onBeeperCommand),
+    MQTT_ROUTE(_MQTT_SUFFIX_PORT, onPortCommand),
+    MQTT_ROUTE(_MQTT_SUFFIX_FADE, onFadeCommand),
+    MQTT_ROUTE(_MQTT_SUFFIX_STATS, onStatsCommand),
+    MQTT_ROUTE(_MQTT_SUFFIX_HEAP, onHeapCommand),
+    MQTT_ROUTE(_MQTT_SUFFIX_BATCH, onBatchCommand),
+    MQTT_ROUTE(_MQTT_SUFFIX_RULES, onRulesCommand),
+    MQTT_ROUTE(_MQTT_SUFFIX_SENSORS, onSensorsCommand),
+    MQTT_ROUTE(_MQTT_SUFFIX_HISTORY, onHistoryCommand),
+};
+
+#define MQTT_ROUTE_COUNT (sizeof(mqttRoutes) / sizeof(mqttRoutes[0]))
+
+MqttDispatcher mqttDispatcher(mqttTopics.base(), mqttRoutes, MQTT_ROUTE_COUNT);
+
+// the commands of the last "batch" message, while it runs or waits
+CommandBatch commandBatch;
+
+// set while a batch or a rule runs a command, which then does not acknowledge it
+bool isAckMuted = false;
+
+// local automation, evaluated on sensor, input, port and network changes without the broker
+RuleEngine rules(RULES_FILE, _INPUT_COUNT, PORT_COUNT, readRuleVariable, runRuleCommand);
+
+// the number of a numbered command route, the port of "/set/port2" is 2
+uint8_t commandNumber = 0;
+
+// latency statistics of the loop stages and of every MQTT command handler
+LatencyHistogram latencyStages[STAGE_COUNT];
+LatencyHistogram latencyHandlers[MQTT_ROUTE_COUNT];
+
+// from the button edge to its action
+LatencyHistogram latencyPressToAction;
 
 // ************************ Functions ***********************
 // ==========================================================
 // called when data in MQTT is received
 void mqttCallback(char *topic, byte *payload, unsigned int length) {
-    String strPayload = "";
-    String strTopic = String(topic);
+    HeapScope heapScope(HEAP_MQTT);
+
+    // log topic and payload in place, without building temporary strings
+    Serial.print("Log: MQTT: ");
+    Serial.print(topic);
+    Serial.print(": ");
+    Serial.write(payload, length);
+    Serial.println();
+
+    // run the handler registered for the topic
+    const MqttRoute *route = mqttDispatcher.find(topic, &commandNumber);
+    if (route) {
+        LatencyTimer timer(latencyHandlers[route - mqttRoutes]);
+        route->handler(payload, length);
+    }
+}
+
+// ==========================================================
+// "ping" command
+bool onPingCommand(const byte *payload, unsigned int length) {
+    if (!payloadIs(payload, length, "ping"))
+        return false;
+
+    publishAck(TOPIC_PING, "pong");
+    log("Ping replied");
+    publishUptime();
+
+    patterns.play(CHANNEL_LED, LAYER_ALERT, PATTERN_PING);
+    return true;
+}
+
+// ==========================================================
+// "data" command
+bool onSensorDataCommand(const byte *payload, unsigned int length) {
+    if (!payloadIs(payload, length, "data"))
+        return false;
 
-    for (uint8_t i = 0; i < length; i++) {
-        strPayload += (char)payload[i];
+    getSensorData();
+    return true;
+}
+
+// ==========================================================
+// "beep" command
+bool onBeeperCommand(const byte *payload, unsigned int length) {
+    if (!payloadIs(payload, length, "beep"))
+        return false;
+
+    startBeeper();
+    return true;
+}
+
+// ==========================================================
+// "open", "close" or "toggle" command for a port, a momentary port only opens
+bool onPortCommand(const byte *payload, unsigned int length) {
+    uint8_t port = commandNumber - 1;
+    if (port >= PORT_COUNT)
+        return false;
+
+    bool isMomentary = portTable[port].mode == PORT_MOMENTARY;
+    if (payloadIs(payload, length, "open")) {
+        switchPort(port, true);
+    } else if (payloadIs(payload, length, "close") && !isMomentary) {
+        switchPort(port, false);
+    } else if (payloadIs(payload, length, "toggle") && !isMomentary) {
+        switchPort(port, !ports.isActive(port));
+    } else {
+        return false;
     }
+    return true;
+}
 
-    String msg = "MQTT: " + strTopic + ": " + strPayload;
-    log(msg);
+// ==========================================================
+// "fade" command: keyframes for a dimmer, or "stop" to keep its level; replies with the level the
+// dimmer ends at, or "repeat"
+bool onFadeCommand(const byte *payload, unsigned int length) {
+    uint8_t dimmer = commandNumber - 1;
+    if (dimmer >= DIMMER_COUNT)
+        return false;
 
-    // check for matching mqtt topic
-    // "ping" command
-    if (strTopic.indexOf(_MQTT_SET_PING) >= 0) {
-        if (strPayload == "ping") {
-            mqttClient.publish(_MQTT_GET_PING, "pong");
-            log("Ping replied");
-            publishUptime();
+    FadeSequence sequence;
+    char reply[8];
+    if (payloadIs(payload, length, "stop")) {
+        fades.stop(dimmer);
+        snprintf(reply, sizeof(reply), "%u", fades.level(dimmer));
+    } else if (sequence.parse((const char *)payload, length) && fades.play(dimmer, sequence)) {
+        if (sequence.isRepeating)
+            strcpy(reply, "repeat");
+        else
+            snprintf(reply, sizeof(reply), "%u", sequence.keyframes[sequence.count - 1].level);
+    } else {
+        return false;
+    }
 
-            flasherPing.start();
-        }
+    char topic[_MQTT_NUMBERED_TOPIC_SIZE];
+    formatNumberedTopic(topic, sizeof(topic), "/get/fade", dimmer);
+    publishAck(topic, reply);
+    return true;
+}
+
+// ==========================================================
+// acknowledge a command, a batch replies once for all its commands instead, a rule not at all
+void publishAck(MqttTopic topic, const char *payload) {
+    publishAck(mqttTopics[topic], payload);
+}
+
+void publishAck(const char *topic, const char *payload) {
+    if (!isAckMuted)
+        publishQueue.publish(topic, payload);
+}
+
+// ==========================================================
+// "batch" command, a list of commands run in order, replaced by a newer batch while it waits
+bool onBatchCommand(const byte *payload, unsigned int length) {
+    if (commandBatch.isRunning) {
+        scheduler.cancel(runBatch);
+        commandBatch.cancel();
+        runBatch();
     }
 
-    // "data" command
-    if (strTopic.indexOf(_MQTT_SET_SENSOR_DATA) >= 0) {
-        if (strPayload == "data")
-            getSensorData();
+    if (!commandBatch.begin(payload, length)) {
+        char message[48];
+        snprintf(message, sizeof(message), "ERR - invalid command batch, %u bytes", length);
+        log(message, true);
+        return false;
     }
 
-    // "beep" command
-    if (strTopic.indexOf(_MQTT_SET_BEEPER) >= 0) {
-        if (strPayload == "beep")
-            startBeeper();
+    runBatch();
+    return true;
+}
+
+// ==========================================================
+// run the commands of the batch up to its next wait, reply when it is done
+void runBatch() {
+    CommandBatch::Command command;
+    for (;;) {
+        switch (commandBatch.next(command)) {
+            case CommandBatch::STEP_COMMAND:
+                commandBatch.add(runCommand(command.name, command.payload, command.payloadLength));
+                break;
+
+            case CommandBatch::STEP_WAIT:
+                scheduler.after(runBatch, command.delayMs);
+                return;
+
+            case CommandBatch::STEP_END: {
+                PrintCounter counter;
+                commandBatch.printJson(counter);
+                if (publishQueue.beginPublish(mqttTopics[TOPIC_BATCH], counter.length, false)) {
+                    commandBatch.printJson(publishQueue);
+                    publishQueue.endPublish();
+                }
+
+                char message[48];
+                snprintf(message, sizeof(message), "Batch done, %u commands, %u failed", commandBatch.count,
+                         commandBatch.failed);
+                log(message);
+                return;
+            }
+        }
     }
+}
 
-    // "open" command for port 1
-    if (strTopic.indexOf(_MQTT_SET_PORT1) >= 0) {
-        if (strPayload == "open") {
-            openPort(1);
+// ==========================================================
+// run a command of a batch or a rule without acknowledging it, they cannot start a batch, change rules or
+// request a report, which is published on its own topic
+CommandBatch::Result runCommand(const char *name, const byte *payload, unsigned int length) {
+    // "port1" runs the handler of "/set/port+" for port 1
+    char suffix[24];
+    snprintf(suffix, sizeof(suffix), "/set/%s", name);
+    const MqttRoute *route = mqttDispatcher.findSuffix(suffix, &commandNumber);
+    if (route == NULL || !isQuietCommand(route->handler))
+        return CommandBatch::RESULT_UNKNOWN;
+
+    LatencyTimer timer(latencyHandlers[route - mqttRoutes]);
+    isAckMuted = true;
+    bool isAccepted = route->handler(payload, length);
+    isAckMuted = false;
+    return isAccepted ? CommandBatch::RESULT_OK : CommandBatch::RESULT_INVALID;
+}
+
+// ==========================================================
+// a command that replies only with an acknowledge, so a batch or a rule can run it muted
+bool isQuietCommand(MqttHandler handler) {
+    return handler != onBatchCommand && handler != onRulesCommand && handler != onStatsCommand &&
+           handler != onHeapCommand && handler != onSensorsCommand && handler != onHistoryCommand;
+}
+
+// ==========================================================
+// "rules" command: a new rule set, "clear" to remove all rules, "stats" for the hit counters
+bool onRulesCommand(const byte *payload, unsigned int length) {
+    char message[64];
+    if (payloadIs(payload, length, "clear")) {
+        rules.compile("", 0);
+    } else if (!payloadIs(payload, length, "stats")) {
+        if (!rules.compile((const char *)payload, length)) {
+            snprintf(message, sizeof(message), "ERR - rule %u: %s", rules.errorRule, rules.error);
+            log(message, true);
+            publishRules();
+            return false;
         }
     }
 
-    // "open" or "close" command for port 2
-    if (strTopic.indexOf(_MQTT_SET_PORT2) >= 0) {
-        if (strPayload == "open") {
-            isPort2Pressed = false;
-            openPort(2);
+    if (!payloadIs(payload, length, "stats")) {
+        if (!rules.save())
+            log("ERR - failed to save rules", true);
+        snprintf(message, sizeof(message), "%u rules set", rules.program.count);
+        log(message, true);
+    }
+
+    publishRules();
+    return true;
+}
+
+// ==========================================================
+// {"rules":3,"hits":[..],"evaluations":..}, or why the last rule set did not compile
+void publishRules() {
+    PrintCounter counter;
+    rules.printJson(counter);
+    if (publishQueue.beginPublish(mqttTopics[TOPIC_RULES], counter.length, false)) {
+        rules.printJson(publishQueue);
+        publishQueue.endPublish();
+    }
+}
+
+// ==========================================================
+// "sensors" command: settings of the sensor pipeline, "sensors" to read them, "defaults" to restore
+// the defaults
+bool onSensorsCommand(const byte *payload, unsigned int length) {
+    if (payloadIs(payload, length, "defaults")) {
+        sensors.restoreDefaults();
+    } else if (!payloadIs(payload, length, "sensors")) {
+        if (!sensors.configure((const char *)payload, length)) {
+            log(String("ERR - sensor settings: ") + sensors.error, true);
+
+            char reply[48];
+            snprintf(reply, sizeof(reply), "{\"error\":\"%s\"}", sensors.error);
+            publishQueue.publish(mqttTopics[TOPIC_SENSORS], reply);
+            return false;
         }
-        if (strPayload == "close") {
-            isPort2Pressed = true;
-            openPort(2);
+    }
+
+    if (!payloadIs(payload, length, "sensors")) {
+        if (!sensors.save())
+            log("ERR - failed to save sensor settings", true);
+        log("Sensor settings changed", true);
+    }
+
+    publishSensorSettings();
+    return true;
+}
+
+// ==========================================================
+// {"dht":{..},"temp":{..},"hum":{..}}
+void publishSensorSettings() {
+    PrintCounter counter;
+    sensors.printJson(counter);
+    if (publishQueue.beginPublish(mqttTopics[TOPIC_SENSORS], counter.length, false)) {
+        sensors.printJson(publishQueue);
+        publishQueue.endPublish();
+    }
+}
+
+// ==========================================================
+// "history" command: the samples of the last <seconds>, or from <from> to <to> in UTC seconds
+// since 1970, streamed in chunks on /get/history
+bool onHistoryCommand(const byte *payload, unsigned int length) {
+    char text[24];
+    unsigned long from = 0;
+    unsigned long to = 0;
+    int fields = 0;
+    if (length < sizeof(text)) {
+        memcpy(text, payload, length);
+        text[length] = 0;
+        fields = sscanf(text, "%lu %lu", &from, &to);
+    }
+
+    const char *error = NULL;
+    if (fields == 1 && !systemClock.isSynced()) {
+        error = "time not set";
+    } else if (fields == 1) {
+        to = systemClock.utcMicros() / 1000000;
+        from = from < to ? to - from : 0;
+    } else if (fields != 2 || from > to) {
+        error = "invalid range";
+    }
+
+    if (error) {
+        char message[40];
+        snprintf(message, sizeof(message), "ERR - history: %s", error);
+        log(message, true);
+
+        char reply[40];
+        snprintf(reply, sizeof(reply), "{\"error\":\"%s\"}", error);
+        publishQueue.publish(mqttTopics[TOPIC_HISTORY], reply);
+        return false;
+    }
+
+    history.query(from, to);
+
+    char message[48];
+    snprintf(message, sizeof(message), "History from %lu to %lu", from, to);
+    log(message);
+    return true;
+}
+
+// ==========================================================
+// the filtered sensor values in tenths, once a minute while the time is known
+void recordHistory() {
+    if (!systemClock.isSynced() || !sensors.hasValues(SOURCE_DHT))
+        return;
+
+    int32_t values[SENSOR_COUNT];
+    for (uint8_t i = 0; i < SENSOR_COUNT; i++) {
+        int32_t value = sensors.value(i);
+        values[i] = (value + (value < 0 ? -5 : 5)) / 10;
+    }
+    history.add(systemClock.utcMicros() / 1000000, values);
+}
+
+// ==========================================================
+// one chunk of a history query
+bool publishHistoryChunk(const char *payload, size_t length) {
+    return publishQueue.publish(mqttTopics[TOPIC_HISTORY], (const uint8_t *)payload, length);
+}
+
+// ==========================================================
+// the values that rules compare, the filtered sensor values as reported, once there is a sample
+bool readRuleVariable(RuleEngine::Variable variable, uint8_t index, int32_t &value) {
+    switch (variable) {
+        case RuleEngine::VAR_TEMP:
+            value = sensors.value(SENSOR_TEMP);
+            return sensors.hasValues(SOURCE_DHT);
+        case RuleEngine::VAR_HUM:
+            value = sensors.value(SENSOR_HUM);
+            return sensors.hasValues(SOURCE_DHT);
+        case RuleEngine::VAR_ONLINE:
+            value = connection.isConnected() && mqttClient.connected();
+            return true;
+        case RuleEngine::VAR_INPUT:
+            if (index >= _INPUT_COUNT)
+                return false;
+            value = buttons.inputs[index].isPressed;
+            return true;
+        case RuleEngine::VAR_PORT:
+            if (index >= PORT_COUNT)
+                return false;
+            value = ports.isActive(index);
+            return true;
+        default:
+            return false;
+    }
+}
+
+// ==========================================================
+// the command of a rule whose condition became true, or whose timer is due
+bool runRuleCommand(uint8_t rule, const char *name, const char *payload) {
+    CommandBatch::Result result = runCommand(name, (const byte *)payload, strlen(payload));
+    if (result != CommandBatch::RESULT_OK) {
+        char message[64];
+        snprintf(message, sizeof(message), "ERR - rule %u failed: %s %s", rule + 1, name, payload);
+        log(message, true);
+        return false;
+    }
+
+    Serial.printf("Log: Rule %u: %s %s\n", rule + 1, name, payload);
+    return true;
+}
+
+// ==========================================================
+// wake the loop when a button changes state
+void IRAM_ATTR onInputChange() {
+    scheduler.wake();
+}
+
+// ==========================================================
+// a short press of button 1 opens port 1, a long press resets WiFi, button 2 toggles port 2
+void onButton(const InputCapture<_INPUT_COUNT>::Event &event) {
+    rules.notify(RuleEngine::SOURCE_INPUT);
+    if (event.type != InputCapture<_INPUT_COUNT>::RELEASE)
+        return;
+
+    if (event.input == 0) {
+        if (event.lengthMs >= _DELAY_BUTTON_LONG_PRESS) {
+            // button1 long pressed!
+            // reset wifi settings
+            resetWiFiSettings();
+            return;
         }
+        switchPort(0, true);
+    } else {
+        switchPort(1, !ports.isActive(1));
+    }
+
+    latencyPressToAction.add(micros() - event.time);
+}
+
+// ==========================================================
+// the loop may keep sleeping while no input changed and no MQTT data arrived
+bool isIdle() {
+    return !buttons.isPending() && wifiClient.available() == 0;
+}
+
+// ==========================================================
+// "stats" or "reset" command, "reset" starts new statistics after publishing
+bool onStatsCommand(const byte *payload, unsigned int length) {
+    bool isReset = payloadIs(payload, length, "reset");
+    if (!isReset && !payloadIs(payload, length, "stats"))
+        return false;
+
+    publishStats();
+
+    if (isReset) {
+        for (LatencyHistogram &histogram : latencyStages)
+            histogram.reset();
+        for (LatencyHistogram &histogram : latencyHandlers)
+            histogram.reset();
+        latencyPressToAction.reset();
     }
+    return true;
 }
 
 // ==========================================================
-void tickerOneSecondCallback() {
-    //publish system uptime every hour
-    // if ((systemUptime.Minutes + systemUptime.Seconds) == 0) {}
+// {"uptime":"..","network":{..},"publish":{..},"pressToAction":{..},"stages":{"loop":{..},..},
+//  "handlers":{"ping":{..},..}}
+size_t printStats(Print &out) {
+    size_t n = out.print("{\"uptime\":\"");
+    n += systemUptime.printTo(out);
+    n += out.print("\",\"network\":{\"bootToMqtt\":");
+    n += out.print(bootToMqttMs);
+    n += out.print(",\"outage\":");
+    n += out.print(connection.outageMs);
+    n += out.print(",\"association\":");
+    n += out.print(connection.associationMs);
+    n += out.print(",\"fast\":");
+    n += out.print(connection.fastAssociations);
+    n += out.print(",\"full\":");
+    n += out.print(connection.fullAssociations);
+    n += out.print("},\"publish\":{\"packets\":");
+    n += out.print(publishQueue.packets);
+    n += out.print(",\"writes\":");
+    n += out.print(publishQueue.writes);
+    n += out.print(",\"bytes\":");
+    n += out.print(publishQueue.bytes);
+    n += out.print(",\"dropped\":");
+    n += out.print(publishQueue.dropped);
+    n += out.print("},\"patterns\":");
+    n += patterns.printJson(out);
+    n += out.print(",\"fades\":");
+    n += fades.printJson(out);
+    n += out.print(",\"history\":");
+    n += history.printJson(out);
+    n += out.print(",\"clock\":");
+    n += systemClock.printJson(out);
+    n += out.print(",\"pressToAction\":");
+    n += latencyPressToAction.printJson(out);
+    n += out.print(",\"stages\":{");
+    for (uint8_t i = 0; i < STAGE_COUNT; i++) {
+        n += out.print(i ? ",\"" : "\"");
+        n += out.print(latencyStageNames[i]);
+        n += out.print("\":");
+        n += latencyStages[i].printJson(out);
+    }
+    n += out.print("},\"handlers\":{");
+    for (uint8_t i = 0; i < MQTT_ROUTE_COUNT; i++) {
+        // the name of the command, "/set/ping" is "ping"
+        n += out.print(i ? ",\"" : "\"");
+        n += out.print(strrchr(mqttRoutes[i].suffix, '/') + 1);
+        n += out.print("\":");
+        n += latencyHandlers[i].printJson(out);
+    }
+    n += out.print("}}");
+    return n;
+}
+
+// ==========================================================
+// stream the statistics, they are larger than the MQTT packet buffer
+void publishStats() {
+    systemUptime.update();
 
-    //publish system uptime every minute
-    if (systemUptime.Seconds == 0) {
-        publishUptime();
+    PrintCounter counter;
+    printStats(counter);
+
+    if (publishQueue.beginPublish(mqttTopics[TOPIC_STATS], counter.length, false)) {
+        printStats(publishQueue);
+        publishQueue.endPublish();
     }
 
-    //publish sensor data every 5 minutes
-    // if ((systemUptime.Minutes % 5) == 0) {
-    //     if (systemUptime.Seconds == 0) {
-    //         log("tickerOneSecondCallback: Send sensor data");
-    //         getSensorData();
-    //     }
-    // }
+    char message[40];
+    snprintf(message, sizeof(message), "Stats published, %u bytes", (unsigned)counter.length);
+    log(message);
+}
+
+// ==========================================================
+// "heap" command, publishes the heap report now
+bool onHeapCommand(const byte *payload, unsigned int length) {
+    if (!payloadIs(payload, length, "heap"))
+        return false;
+
+    publishHeapReport();
+    return true;
 }
 
 // ==========================================================
-void tickerWifiMqttConfigCallback() {
-    //toggle state
-    int state = digitalRead(_PIN_OUT_LED);  // get the current state of GPIO pin
-    digitalWrite(_PIN_OUT_LED, !state);     // set pin to the opposite state
+// track the heap over time, and warn before it cannot hold a publish anymore
+void sampleHeap() {
+    // formatted on the stack, the heap is short when the alarm is raised
+    char message[96];
+    switch (heapTracer().sample(_HEAP_ALARM_BLOCK)) {
+        case HeapTracer::ALARM_RAISED:
+            snprintf(message, sizeof(message), "ERR - low memory, largest free block %lu bytes, %lu bytes free",
+                     (unsigned long)ESP.getMaxFreeBlockSize(), (unsigned long)ESP.getFreeHeap());
+            log(message, true);
+            break;
+
+        case HeapTracer::ALARM_CLEARED:
+            snprintf(message, sizeof(message), "Memory recovered, largest free block %lu bytes",
+                     (unsigned long)ESP.getMaxFreeBlockSize());
+            log(message, true);
+            break;
+
+        default:
+            break;
+    }
+}
+
+// ==========================================================
+// stream the heap report, then start the minimums of the next period
+void publishHeapReport() {
+    HeapTracer &tracer = heapTracer();
+
+    PrintCounter counter;
+    tracer.printJson(counter, heapTagNames, HEAP_COUNT);
+
+    if (mqttClient.connected() && publishQueue.beginPublish(mqttTopics[TOPIC_HEAP], counter.length, false)) {
+        tracer.printJson(publishQueue, heapTagNames, HEAP_COUNT);
+        publishQueue.endPublish();
+    }
+
+    tracer.resetPeriod();
 }
 
 // ==========================================================
@@ -254,17 +1082,14 @@ void wifiConfigModeCallback(WiFiManager *myWiFiManager) {
 }
 
 // ==========================================================
-void connectWiFi() {
+// blocking captive portal, only used while the device has no WiFi credentials
+void runWiFiConfigPortal() {
     WiFi.enableAP(false);
 
-    log("Connecting WiFi...");
+    log("Starting WiFi config portal...");
 
-    // Set hostname, called before WiFi.begin()
-    String hostName = String(_HOSTNAME) + WiFi.macAddress().substring(9);
-    hostName.replace(":", "");
-    WiFi.hostname(hostName);
-
-    tickerWiFiMqttConfig.attach(0.15, tickerWifiMqttConfigCallback);
+    // the pattern keeps blinking from the timer interrupt while the portal blocks
+    patterns.play(CHANNEL_LED, LAYER_STATUS, PATTERN_WIFI);
 
     // Connect using WiFiManager
     // Local initialization. Once its business is done, there is no need to keep it around
@@ -286,21 +1111,27 @@ void connectWiFi() {
     //sets timeout to attempt conecting WiFI
     wifiManager.setConnectTimeout(15);
 
-    loadConfigFile();
-
     // set up some additional parameters
     WiFiManagerParameter custom_text("<p><b>MQTT Settings</b></p><hr/>");
 
-    WiFiManagerParameter custom_mqtt_server("mqttServer", "MQTT Broker", mqttServer, 40);
-    WiFiManagerParameter custom_mqtt_port("mqttPort", "MQTT Port", mqttPort, 10);
-    WiFiManagerParameter custom_mqtt_user("mqttUser", "MQTT User", mqttUser, 40);
-    WiFiManagerParameter custom_mqtt_pass("mqttPass", "MQTT Password", mqttPass, 40);
+    WiFiManagerParameter custom_mqtt_server("mqttServer", "MQTT Broker", config.mqttServer, sizeof(config.mqttServer));
+    WiFiManagerParameter custom_mqtt_port("mqttPort", "MQTT Port", config.mqttPort, sizeof(config.mqttPort));
+    WiFiManagerParameter custom_mqtt_user("mqttUser", "MQTT User", config.mqttUser, sizeof(config.mqttUser));
+    WiFiManagerParameter custom_mqtt_pass("mqttPass", "MQTT Password", config.mqttPass, sizeof(config.mqttPass));
+    WiFiManagerParameter custom_device_id("deviceId", "Device ID (empty for MAC)", config.deviceId, sizeof(config.deviceId));
+    WiFiManagerParameter custom_ntp_server("ntpServer", "Time Server (empty for " _NTP_SERVER ")", config.ntpServer,
+                                           sizeof(config.ntpServer));
+    WiFiManagerParameter custom_time_offset("timeOffset", "Time Offset in minutes", config.timeOffset,
+                                            sizeof(config.timeOffset));
 
     wifiManager.addParameter(&custom_text);
     wifiManager.addParameter(&custom_mqtt_server);
     wifiManager.addParameter(&custom_mqtt_port);
     wifiManager.addParameter(&custom_mqtt_user);
     wifiManager.addParameter(&custom_mqtt_pass);
+    wifiManager.addParameter(&custom_device_id);
+    wifiManager.addParameter(&custom_ntp_server);
+    wifiManager.addParameter(&custom_time_offset);
 
     //fetches SSID and password and tries to connect
     //if it does not connect it starts an access point with the specified name
@@ -309,57 +1140,49 @@ void connectWiFi() {
     if (!wifiManager.autoConnect(String(hostName + "-ConfigAP").c_str())) {
         log("Failed to connect and hit timeout");
 
-        digitalWrite(_PIN_OUT_LED, LOW);
+        patterns.stop(CHANNEL_LED, LAYER_STATUS);
 
         //reset and try again, or maybe put it to deep sleep
         ESP.restart();
         delay(_DELAY_SYSTEM_STEPS);
     }
 
-    //if you get here you have connected to the WiFi
-    // log("Connected... yey :)");
-    // Serial.println();
+    // the cached access point may be from another network
+    connection.wifiCache.invalidate();
 
-    strcpy(mqttServer, custom_mqtt_server.getValue());
-    strcpy(mqttPort, custom_mqtt_port.getValue());
-    strcpy(mqttUser, custom_mqtt_user.getValue());
-    strcpy(mqttPass, custom_mqtt_pass.getValue());
+    strlcpy(config.mqttServer, custom_mqtt_server.getValue(), sizeof(config.mqttServer));
+    strlcpy(config.mqttPort, custom_mqtt_port.getValue(), sizeof(config.mqttPort));
+    strlcpy(config.mqttUser, custom_mqtt_user.getValue(), sizeof(config.mqttUser));
+    strlcpy(config.mqttPass, custom_mqtt_pass.getValue(), sizeof(config.mqttPass));
+    strlcpy(config.deviceId, custom_device_id.getValue(), sizeof(config.deviceId));
+    strlcpy(config.ntpServer, custom_ntp_server.getValue(), sizeof(config.ntpServer));
+    strlcpy(config.timeOffset, custom_time_offset.getValue(), sizeof(config.timeOffset));
 
-    // save the custom parameters to FS
+    // save the custom parameters
     if (shouldSaveConfig) {
-        saveConfigFile();
+        saveConfig();
         shouldSaveConfig = false;
     }
 
-    String ip = WiFi.localIP().toString();
-    systemIpInfo = "IP: " + ip + " Hostname: " + hostName;
-    log("WiFi connected at SSID: [" + WiFi.SSID() + "] " + systemIpInfo);
-
-    digitalWrite(_PIN_OUT_LED, LOW);
-    tickerWiFiMqttConfig.detach();
-    delay(_DELAY_SYSTEM_STEPS);
+    patterns.stop(CHANNEL_LED, LAYER_STATUS);
 }
 
 // ==========================================================
 void resetWiFiSettings() {
-    flasherReady.stop();
+    patterns.stop(CHANNEL_LED, LAYER_BACKGROUND);
 
     log("Going to reset WiFi settings...");
 
-    // blink LED
-    for (byte i = 0; i < 3; i++) {
-        digitalWrite(_PIN_OUT_LED, HIGH);
-        delay(120);
-        digitalWrite(_PIN_OUT_LED, LOW);
-        delay(120);
-    }
-
+    // blink LED, it is done within the delay
+    patterns.play(CHANNEL_LED, LAYER_ALERT, PATTERN_RESET);
     delay(_DELAY_SYSTEM_STEPS);
 
     WiFiManager wifiManager;
 
-    //reset wifi settings
+    //reset wifi settings, in flash too, the connection keeps the station config out of flash
+    WiFi.persistent(true);
     wifiManager.resetSettings();
+    connection.wifiCache.invalidate();
 
     log("Rebooting device...");
     delay(500);
@@ -370,98 +1193,366 @@ void resetWiFiSettings() {
 }
 
 // ==========================================================
-void connectMqtt() {
-    log("Connecting to MQTT broker [" + String(mqttServer) + "]...");
+// one MQTT connect attempt, called by the connection state machine
+bool connectBroker(IPAddress ip) {
+    HeapScope heapScope(HEAP_NETWORK);
 
-    tickerWiFiMqttConfig.attach(0.05, tickerWifiMqttConfigCallback);
+    char message[72];
+    snprintf(message, sizeof(message), "Connecting to MQTT broker [%s]...", config.mqttServer);
+    log(message);
 
-    int port = 1883;
-    if (isValidNumber(String(mqttPort))) {
-        port = atoi(mqttPort);
-    } else {
-        log("ERR - Invalid MQTT port defined in configs, using default port 1883");
+    mqttClient.setServer(ip, mqttPortNumber);
+
+    if (!mqttClient.connect(config.mqttServer, config.mqttUser, config.mqttPass)) {
+        snprintf(message, sizeof(message), "ERR - MQTT connect failed, state %d", mqttClient.state());
+        log(message);
+        return false;
     }
 
-    mqttClient.setServer(mqttServer, port);
-    mqttClient.setCallback(mqttCallback);
+    // small packets go out at once, the publish queue coalesces them instead; what it still holds
+    // from before the outage goes out after the CONNECT
+    wifiClient.setNoDelay(true);
 
-    // connect and re-try until connected
-    while (!mqttClient.connect(mqttServer, mqttUser, mqttPass)) {
-        delay(500);
+    // one subscription for all commands, the dispatcher routes them
+    mqttClient.subscribe(mqttTopics[TOPIC_COMMANDS]);
 
-        digitalWrite(_PIN_OUT_LED, LOW);
-        tickerWiFiMqttConfig.detach();
+    return true;
+}
 
-        delay(_DELAY_SYSTEM_STEPS);
+// ==========================================================
+// called by the connection state machine on every state change
+void onConnectionChange(ConnectionManager::State state) {
+    static bool isAnnounced = false;
+    char message[96];
+
+    rules.notify(RuleEngine::SOURCE_NETWORK);
+
+    switch (state) {
+        case ConnectionManager::STATE_WIFI_CONNECTING:
+            log("Connecting WiFi...");
+            patterns.play(CHANNEL_LED, LAYER_STATUS, PATTERN_WIFI);
+            break;
+
+        case ConnectionManager::STATE_WIFI_BACKOFF:
+            log("ERR - WiFi connect timed out, retrying");
+            break;
+
+        case ConnectionManager::STATE_BROKER_BACKOFF:
+            if (connection.previousState == ConnectionManager::STATE_WIFI_CONNECTING) {
+                systemIpInfo = "IP: " + WiFi.localIP().toString() + " Hostname: " + hostName;
+                snprintf(message, sizeof(message), "WiFi connected at SSID: [%s] %s", WiFi.SSID().c_str(),
+                         systemIpInfo.c_str());
+                log(message);
+            }
+            patterns.play(CHANNEL_LED, LAYER_STATUS, PATTERN_BROKER);
+            break;
+
+        case ConnectionManager::STATE_ONLINE:
+            patterns.stop(CHANNEL_LED, LAYER_STATUS);
+
+            snprintf(message, sizeof(message), "MQTT broker connected after %lu attempts, longest attempt %lu ms",
+                     (unsigned long)connection.attempts, (unsigned long)connection.longestStepMs);
+            log(message, true);
+
+            // how long the radio searched for the access point, and how long the device was offline
+            if (bootToMqttMs == 0) {
+                bootToMqttMs = millis() - bootTime;
+                snprintf(message, sizeof(message), "Online %lu ms after boot, WiFi associated in %lu ms %s",
+                         (unsigned long)bootToMqttMs, (unsigned long)connection.associationMs,
+                         connection.isFastAssociation ? "with the cached access point" : "after a scan");
+                log(message, true);
+            } else {
+                snprintf(message, sizeof(message), "Online again after %lu ms, WiFi associated in %lu ms",
+                         (unsigned long)connection.outageMs, (unsigned long)connection.associationMs);
+                log(message, true);
+            }
 
-        return;
-    }
+            if (telemetryQueue.pending > 0) {
+                snprintf(message, sizeof(message), "Sending %lu queued telemetry messages",
+                         (unsigned long)telemetryQueue.pending);
+                log(message);
+            }
 
-    // subscribe to data streams
-    mqttClient.subscribe(_MQTT_SET_PING);
-    mqttClient.subscribe(_MQTT_SET_PORT1);
-    mqttClient.subscribe(_MQTT_SET_PORT2);
-    mqttClient.subscribe(_MQTT_SET_BEEPER);
-    mqttClient.subscribe(_MQTT_SET_SENSOR_DATA);
+#ifdef _SENSOR_NODE
+            // a sensor node only publishes its batch, the samples carry their age instead of a time
+            break;
+#endif
 
-    log("MQTT broker connected", true);
+            // publish uptime and system ready message once after boot
+            if (!isAnnounced) {
+                isAnnounced = true;
 
-    digitalWrite(_PIN_OUT_LED, LOW);
-    tickerWiFiMqttConfig.detach();
-    delay(_DELAY_SYSTEM_STEPS);
+                publishUptime();
+
+                snprintf(message, sizeof(message), "System %s", systemIpInfo.c_str());
+                log(message, true);
+                log(_VERSION " | System ready", true);
+            }
+            break;
+    }
 }
 
 // ==========================================================
-// sync system time
-time_t syncSystemTime() {
-    // update time from NTP to system time
-    return timeClient.getEpochTime();
+// start the SNTP client, it asks the time server in the background and calls onTimeSet()
+void beginClock() {
+    systemClock.offset = _TIME_OFFSET * 60;
+    if (isValidNumber(String(config.timeOffset))) {
+        systemClock.offset = atoi(config.timeOffset) * 60;
+    } else if (config.timeOffset[0]) {
+        log("ERR - Invalid time offset defined in configs, using default offset " + String(_TIME_OFFSET));
+    }
+
+    settimeofday_cb(onTimeSet);
+
+    // the system time is UTC, systemClock adds the offset; lwIP keeps the pointer to the name
+    configTime(0, 0, config.ntpServer[0] ? config.ntpServer : _NTP_SERVER);
+}
+
+// how often the SNTP client asks the time server, called by lwIP
+uint32_t sntp_update_delay_MS_rfc_not_less_than_15000() {
+    return _DELAY_NTP_UPDATE;
 }
 
 // ==========================================================
-// get system date time string
-String getSystemDateTime() {
-    // "dd-Mmm-yyyy hh:mm:ss"
-    sprintf(strTime, "%02d-%s-%04d %02d:%02d:%02d", day(), monthShortStr(month()), year(), hour(), minute(), second());
-    return strTime;
+// the system time was set, by SNTP in the background
+void onTimeSet(bool isFromSntp) {
+    if (!isFromSntp)
+        return;
+
+    timeval tv;
+    gettimeofday(&tv, NULL);
+    systemClock.sync((int64_t)tv.tv_sec * 1000000 + tv.tv_usec);
+
+    char message[64];
+    snprintf(message, sizeof(message), "Time synced, %ld us off, drift %ld ppb", (long)systemClock.lastErrorUs,
+             (long)systemClock.driftPpb);
+    log(message);
 }
 
 // ==========================================================
 void publishUptime() {
-    String timeString = systemUptime.getUptime();
+    systemUptime.update();
+
+    char uptime[24];
+    BufferPrint out(uptime, sizeof(uptime));
+    systemUptime.printTo(out);
 
     // publish update on MQTT
-    mqttClient.publish(_MQTT_UPTIME, timeString.c_str(), true);
+    publishTelemetry(TOPIC_UPTIME, uptime, true);
 
-    log("System Uptime: " + timeString, true);
+    char message[40];
+    snprintf(message, sizeof(message), "System Uptime: %s", uptime);
+    log(message, true);
 }
 
 // ==========================================================
 // log to serial and MQTT
-void log(String message, bool sendMQTT) {
-    String logMessage = "Log: " + message;
+void log(const char *message, bool sendMQTT) {
+    HeapScope heapScope(HEAP_LOG);
 
     // write to serial
-    Serial.println(logMessage);
+    {
+        LatencyTimer timer(latencyStages[STAGE_SERIAL_LOG]);
+        Serial.print("Log: ");
+        Serial.println(message);
+    }
+
+    if (!sendMQTT)
+        return;
+
+    // collect for MQTT, formatted and sent with the next batch
+    size_t length = strlen(message);
+    if (!logBuffer.push(systemClock.now(), message, length)) {
+        flushLog();
+        logBuffer.push(systemClock.now(), message, length);
+    }
+
+    if (strncmp(message, "ERR", 3) == 0)
+        scheduler.after(flushLog, 0);
+    else if (!scheduler.isScheduled(flushLog))
+        scheduler.after(flushLog, _DELAY_LOG_FLUSH);
+}
+
+void log(const String &message, bool sendMQTT) {
+    log(message.c_str(), sendMQTT);
+}
+
+// ==========================================================
+// time of a log line, "dd-Mmm-yyyy hh:mm:ss"
+size_t printLogTime(Print &out, uint32_t time) {
+    return out.print(systemClock.format(time));
+}
+
+// ==========================================================
+// send the collected log lines, one line per record, or queue them while the broker is unreachable
+void flushLog() {
+    HeapScope heapScope(HEAP_LOG);
+    scheduler.cancel(flushLog);
+
+    while (!logBuffer.isEmpty()) {
+        size_t length;
+
+        // all lines in one streamed message
+        if (isTelemetryLive()) {
+            uint16_t records = logBuffer.fit(SIZE_MAX, length);
+            if (publishQueue.beginPublish(mqttTopics[TOPIC_LOG], length, false)) {
+                logBuffer.printTo(publishQueue, records);
+                if (publishQueue.endPublish()) {
+                    logBuffer.remove(records);
+                    continue;
+                }
+            }
+        }
+
+        // in messages small enough for the telemetry queue
+        char batch[TelemetryQueue::maxPayload + 1];
+        BufferPrint out(batch, sizeof(batch));
+        uint16_t records = logBuffer.fit(TelemetryQueue::maxPayload, length);
+        logBuffer.printTo(out, records);
+        logBuffer.remove(records);
+        publishTelemetry(TOPIC_LOG, batch);
+    }
+}
+
+// ==========================================================
+// publish telemetry, or store it on flash while the broker is unreachable or older telemetry waits
+// there
+void publishTelemetry(MqttTopic topic, const char *payload, bool retain) {
+    HeapScope heapScope(HEAP_QUEUE);
+    size_t length = strlen(payload);
+
+    // encoded into the publish queue, not the packet buffer of the client
+    if (isTelemetryLive() && publishQueue.publish(mqttTopics[topic], (const uint8_t *)payload, length, retain))
+        return;
+
+    if (!telemetryQueue.push(topic, (const uint8_t *)payload, length))
+        Serial.println("Log: ERR - telemetry message too large to queue");
+}
 
-    // send to MQTT
-    if (sendMQTT && mqttClient.connected()) {
-        String mqttMessage = getSystemDateTime() + " | " + message;
-        mqttClient.publish(_MQTT_LOG, mqttMessage.c_str());
+// ==========================================================
+// telemetry is published right away, it queues behind what the flash queue still holds so it
+// arrives in order
+bool isTelemetryLive() {
+    return connection.isConnected() && mqttClient.connected() && telemetryQueue.isEmpty();
+}
+
+// ==========================================================
+// publish one record drained from the telemetry queue
+bool publishQueuedRecord(uint8_t topicId, const uint8_t *payload, uint16_t length) {
+    return publishQueue.publish(mqttTopics[topicId], payload, length);
+}
+
+// ==========================================================
+// write a batch drained from the telemetry queue, its records are removed once this succeeds
+bool sendQueuedRecords() {
+    return publishQueue.sendAll();
+}
+
+// ==========================================================
+// telemetry that was in the publish queue but never written goes to the flash queue, replies are
+// dropped
+void onPublishUnsent(const uint8_t *topic, uint16_t topicLength, const uint8_t *payload, size_t length) {
+    // a batch drained from the queue is still on flash
+    if (telemetryQueue.isDraining)
+        return;
+
+    for (uint8_t id = TOPIC_LOG; id <= TOPIC_SENSOR_DATA; id++) {
+        if (strlen(mqttTopics[id]) != topicLength || memcmp(mqttTopics[id], topic, topicLength) != 0)
+            continue;
+
+        // a streamed log goes back in pieces of whole lines
+        while (id == TOPIC_LOG && length > TelemetryQueue::maxPayload) {
+            size_t piece = TelemetryQueue::maxPayload;
+            for (size_t i = piece; i > 0; i--) {
+                if (payload[i] == '\n') {
+                    piece = i;
+                    break;
+                }
+            }
+            telemetryQueue.push(id, payload, piece);
+            piece += payload[piece] == '\n';
+            payload += piece;
+            length -= piece;
+        }
+
+        if (!telemetryQueue.push(id, payload, length))
+            Serial.println("Log: ERR - telemetry message too large to queue");
+        return;
+    }
+}
+
+// ==========================================================
+// build the topics of the device from its configured ID, or from the MAC address
+void beginTopics() {
+    char id[sizeof(config.deviceId)];
+    if (config.deviceId[0]) {
+        strlcpy(id, config.deviceId, sizeof(id));
+    } else {
+        uint8_t mac[6];
+        WiFi.macAddress(mac);
+        snprintf(id, sizeof(id), _DEVICE_ID_PREFIX "%02x%02x%02x", mac[3], mac[4], mac[5]);
+    }
+
+    if (!mqttTopics.begin(_MQTT_PREFIX, id, mqttTopicSuffixes))
+        log("ERR - MQTT topics do not fit, increase _MQTT_TOPICS_SIZE");
+    mqttDispatcher.setBase(mqttTopics.base());
+
+    log("MQTT topics below " + String(mqttTopics.base()));
+}
+
+// ==========================================================
+// load the settings from the binary record, or import them once from the JSON file of older versions
+bool loadConfig() {
+    HeapScope heapScope(HEAP_CONFIG);
+
+    if (configStore.load(config)) {
+        log("Config loaded");
+        return true;
+    }
+
+    if (!SPIFFS.exists(CONFIG_FILE) || !loadConfigFile())
+        return false;
+
+    if (!configStore.save(config)) {
+        log("ERR - failed to save config record");
+        return false;
+    }
+
+    log("Config imported from " + String(CONFIG_FILE));
+    return true;
+}
+
+// ==========================================================
+// save the settings as the binary record, and export them as JSON
+bool saveConfig() {
+    HeapScope heapScope(HEAP_CONFIG);
+
+    if (!configStore.save(config)) {
+        log("ERR - failed to save config record");
+        return false;
     }
+
+    log("Config saved");
+    return saveConfigFile();
 }
 
 // ==========================================================
+// export the settings to the JSON file
 bool saveConfigFile() {
+    HeapScope heapScope(HEAP_CONFIG);
+
     // write configs to local file store
     log("Saving config file...");
     DynamicJsonBuffer jsonBuffer;
     JsonObject &json = jsonBuffer.createObject();
 
-    json["mqttServer"] = mqttServer;
-    json["mqttPort"] = mqttPort;
-    json["mqttUser"] = mqttUser;
-    json["mqttPass"] = mqttPass;
+    json["mqttServer"] = config.mqttServer;
+    json["mqttPort"] = config.mqttPort;
+    json["mqttUser"] = config.mqttUser;
+    json["mqttPass"] = config.mqttPass;
+    json["deviceId"] = config.deviceId;
+    json["ntpServer"] = config.ntpServer;
+    json["timeOffset"] = config.timeOffset;
 
     // Open file for writing
     File file = SPIFFS.open(CONFIG_FILE, "w");
@@ -470,10 +1561,7 @@ bool saveConfigFile() {
         return false;
     }
 
-    json.prettyPrintTo(Serial);
-    Serial.println("");
-
-    // Write data to file and close it
+    // Write data to file and close it, not to Serial, it holds the MQTT password
     json.printTo(file);
     file.close();
 
@@ -489,60 +1577,59 @@ void saveConfigCallback() {
 }
 
 // ==========================================================
+// import the settings from the JSON file, FS must be mounted
 bool loadConfigFile() {
-    //clean FS, for testing
-    //SPIFFS.format(); // <<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
+    HeapScope heapScope(HEAP_CONFIG);
 
     //read configuration from FS json
-    log("Mounting FS...");
-
-    if (SPIFFS.begin()) {
-        log("FS mounted.");
-        if (SPIFFS.exists(CONFIG_FILE)) {
-            //file exists, reading and loading
-            log("Reading config file... ");
-            File configFile = SPIFFS.open(CONFIG_FILE, "r");
-            if (configFile) {
-                log("Config file opened and retrieved data: ");
-                size_t size = configFile.size();
-
-                // Allocate a buffer to store contents of the file.
-                std::unique_ptr<char[]> buf(new char[size]);
-
-                configFile.readBytes(buf.get(), size);
-                DynamicJsonBuffer jsonBuffer;
-                JsonObject &json = jsonBuffer.parseObject(buf.get());
-                json.prettyPrintTo(Serial);
-                Serial.println("");
-
-                if (json.success()) {
-                    // set up the extra parameters
-                    if (json.containsKey("mqttServer")) {
-                        strcpy(mqttServer, json["mqttServer"]);
-                    }
-                    if (json.containsKey("mqttPort")) {
-                        strcpy(mqttPort, json["mqttPort"]);
-                    }
-                    if (json.containsKey("mqttUser")) {
-                        strcpy(mqttUser, json["mqttUser"]);
-                    }
-                    if (json.containsKey("mqttPass")) {
-                        strcpy(mqttPass, json["mqttPass"]);
-                    }
-
-                    log("Successfully loaded json config");
-                } else {
-                    log("ERR - failed to load json config");
-                    return false;
-                }
-            }
-        }
-    } else {
-        log("ERR - failed to mount FS");
+    log("Reading config file... ");
+    File configFile = SPIFFS.open(CONFIG_FILE, "r");
+    if (!configFile) {
+        log("ERR - failed to open config file");
+        return false;
+    }
+
+    size_t size = configFile.size();
+
+    // Allocate a buffer to store contents of the file.
+    std::unique_ptr<char[]> buf(new char[size]);
+
+    configFile.readBytes(buf.get(), size);
+    configFile.close();
+    DynamicJsonBuffer jsonBuffer;
+    JsonObject &json = jsonBuffer.parseObject(buf.get());
+
+    if (!json.success()) {
+        log("ERR - failed to load json config");
         return false;
     }
-    //end read
 
+    // set up the extra parameters, values too long for the record are cut
+    if (json.containsKey("mqttServer")) {
+        strlcpy(config.mqttServer, json["mqttServer"], sizeof(config.mqttServer));
+    }
+    if (json.containsKey("mqttPort")) {
+        strlcpy(config.mqttPort, json["mqttPort"], sizeof(config.mqttPort));
+    }
+    if (json.containsKey("mqttUser")) {
+        strlcpy(config.mqttUser, json["mqttUser"], sizeof(config.mqttUser));
+    }
+    if (json.containsKey("mqttPass")) {
+        strlcpy(config.mqttPass, json["mqttPass"], sizeof(config.mqttPass));
+    }
+    if (json.containsKey("deviceId")) {
+        strlcpy(config.deviceId, json["deviceId"], sizeof(config.deviceId));
+    } else {
+        strlcpy(config.deviceId, _DEVICE_ID_LEGACY, sizeof(config.deviceId));
+    }
+    if (json.containsKey("ntpServer")) {
+        strlcpy(config.ntpServer, json["ntpServer"], sizeof(config.ntpServer));
+    }
+    if (json.containsKey("timeOffset")) {
+        strlcpy(config.timeOffset, json["timeOffset"], sizeof(config.timeOffset));
+    }
+
+    log("Successfully loaded json config");
     return true;
 }
 
@@ -559,140 +1646,274 @@ boolean isValidNumber(String str) {
 }
 
 // ==========================================================
-// sound the beeper
+// sound the beeper for _DELAY_BEEPER, with the LED on
 void startBeeper() {
-    isBeeperStarted = true;
-    delayBeeper.start(_DELAY_BEEPER, AsyncDelay::MILLIS);
-
-    // sound the beeper
-    digitalWrite(_PIN_OUT_BEEPER, LOW);
-    digitalWrite(_PIN_OUT_LED, HIGH);
+    patterns.play(CHANNEL_BEEPER, LAYER_ALERT, PATTERN_BEEP);
+    patterns.play(CHANNEL_LED, LAYER_ALERT, PATTERN_BEEP);
 
     // send MQTT ack
-    mqttClient.publish(_MQTT_GET_BEEPER, "beep");
+    publishAck(TOPIC_BEEPER, "beep");
 
     log("Beeper started");
 }
 
 // ==========================================================
-// open the port
-void openPort(int portNumber) {
-    if (portNumber <= 0 || portNumber >= 10) {
-        log("ERR: Invalid port number");
+// switch a port by command or button, a momentary port acknowledges, the others report their state
+void switchPort(uint8_t port, bool isActive) {
+    ports.set(port, isActive);
+    rules.notify(RuleEngine::SOURCE_PORT);
+    startBeeper();
+
+    char topic[_MQTT_NUMBERED_TOPIC_SIZE];
+    formatNumberedTopic(topic, sizeof(topic), "/get/port", port);
+
+    bool isMomentary = portTable[port].mode == PORT_MOMENTARY;
+    if (isMomentary)
+        publishAck(topic, "open");
+    else
+        publishQueue.publish(topic, isActive ? "open" : "close", true);
+
+    char message[24];
+    snprintf(message, sizeof(message), "Port %u: %s", port + 1, isActive ? "OPEN" : "CLOSED");
+    log(message, isMomentary);
+}
+
+// ==========================================================
+// "devices/<id>/get/port<n>" for the suffix "/get/port" and the port at index n - 1
+void formatNumberedTopic(char *topic, size_t size, const char *suffix, uint8_t index) {
+    size_t length = min(mqttTopics.baseLength(), size - 1);
+    memcpy(topic, mqttTopics.base(), length);
+    snprintf(topic + length, size - length, "%s%u", suffix, index + 1);
+}
+
+// ==========================================================
+// the pulse of a port ended, a timed port reports that it closed
+void onPortExpired(uint8_t port) {
+    rules.notify(RuleEngine::SOURCE_PORT);
+    if (portTable[port].mode != PORT_TIMED)
         return;
-    }
 
-    if (portNumber == 1) {
-        isPort1Pressed = true;
-        delayPort1.start(_DELAY_BUTTON, AsyncDelay::MILLIS);
+    char topic[_MQTT_NUMBERED_TOPIC_SIZE];
+    formatNumberedTopic(topic, sizeof(topic), "/get/port", port);
+    publishQueue.publish(topic, "close", true);
+
+    char message[24];
+    snprintf(message, sizeof(message), "Port %u: CLOSED", port + 1);
+    log(message);
+}
+
+// ==========================================================
+// get sensor data: temperature and humidity, reported now
+void getSensorData() {
+    // the sensor measures at most every 2 seconds, a sample from within that time is current
+    if (dhtSensor.isFresh() && sensors.hasValues(SOURCE_DHT)) {
+        sensors.report(SOURCE_DHT);
+        return;
+    }
 
-        // set Port 1 to ON
-        digitalWrite(_PIN_OUT_PORT1, LOW);
-        startBeeper();
+    // measured in the background, the pipeline reports the result
+    sensors.request(SOURCE_DHT);
+}
 
-        // send MQTT ack
-        mqttClient.publish(_MQTT_GET_PORT1, "open");
+// ==========================================================
+// a sample of the DHT sensor is due
+void startDht() {
+    dhtSensor.start();
+}
 
-        //debug: write to serial
-        log("Port 1: OPEN", true);
+// ==========================================================
+// called by the DHT reader when a measurement is decoded
+void onSensorRead(bool isValid) {
+    if (!isValid) {
+        // once while the sensor keeps failing, not for every sample
+        if (sensors.failed(SOURCE_DHT))
+            log("ERR: Failed to read from DHT sensor!");
+        return;
     }
 
-    if (portNumber == 2) {
-        // Toggle Port 2
-        if (isPort2Pressed == true) {
-            // set Port 2 to OFF
-            digitalWrite(_PIN_OUT_PORT2, LOW);
-            // send MQTT ack
-            mqttClient.publish(_MQTT_GET_PORT2, "close", true);
+    // a sensor node collects the sample in runSensorNode()
+#ifndef _SENSOR_NODE
+    sensors.add(SENSOR_TEMP, lroundf(dhtSensor.temperature * 100));
+    sensors.add(SENSOR_HUM, lroundf(dhtSensor.humidity * 100));
+    sensors.commit(SOURCE_DHT);
+    rules.notify(RuleEngine::SOURCE_SENSOR);
+#endif
+}
 
-            startBeeper();
-            isPort2Pressed = false;
-        } else if (isPort2Pressed == false) {
-            // set Port 2 to ON
-            digitalWrite(_PIN_OUT_PORT2, HIGH);
-            // send MQTT ack
-            mqttClient.publish(_MQTT_GET_PORT2, "open", true);
+// ==========================================================
+// the values of a source changed, or were not reported for too long
+void onSensorReport(uint8_t source) {
+    if (source == SOURCE_DHT)
+        publishSensorData();
+}
 
-            startBeeper();
-            isPort2Pressed = true;
-        }
+// ==========================================================
+// publish the filtered values of the DHT sensor
+void publishSensorData() {
+    HeapScope heapScope(HEAP_SENSOR);
+
+    const char *time = systemClock.format(systemClock.now());
+
+    // {"Temp":"-40.00","TempUnit":"C","Hum":"100.00","Time":"dd-Mmm-yyyy hh:mm:ss"} fits with room to spare
+    char payload[96];
+    BufferPrint out(payload, sizeof(payload));
+
+    PayloadWriter json(out);
+    json.beginObject();
+    json.fixed("Temp", sensors.value(SENSOR_TEMP) / 100.0f, 2, true);
+    json.field("TempUnit", "C");
+    json.fixed("Hum", sensors.value(SENSOR_HUM) / 100.0f, 2, true);
+    json.field("Time", time);
+    json.endObject();
 
-        //debug: write to serial
-        log("Port 2: " + String(isPort2Pressed ? "OPEN" : "CLOSED"), false);
+    // send MQTT response, queued while offline
+    publishTelemetry(TOPIC_SENSOR_DATA, payload);
+
+    //debug: write to serial
+    Serial.print("Log: DHT Data: ");
+    Serial.println(payload);
+}
+
+// ==========================================================
+// a window of samples ended
+void onSensorWindow(uint8_t source) {
+    if (source == SOURCE_DHT)
+        publishSensorStats();
+}
+
+// ==========================================================
+// publish the statistics of the samples of the DHT sensor in the window, not queued while offline,
+// the filtered values are
+void publishSensorStats() {
+    HeapScope heapScope(HEAP_SENSOR);
+
+    const char *time = systemClock.format(systemClock.now());
+
+    PrintCounter counter;
+    printSensorStats(counter, time);
+    if (publishQueue.beginPublish(mqttTopics[TOPIC_SENSOR_STATS], counter.length, false)) {
+        printSensorStats(publishQueue, time);
+        publishQueue.endPublish();
     }
 }
 
 // ==========================================================
-// get sensor data: temperature and humidity
-void getSensorData() {
-    // Reading temperature or humidity takes about 250 milliseconds!
-    // Sensor readings may also be up to 2 seconds 'old' (its a very slow sensor)
-    float hum = dht.readHumidity();
-    // Read temperature as Celsius (the default)
-    float temp = dht.readTemperature();
-    // Read temperature as Fahrenheit (isFahrenheit = true)
-    // float f = dht.readTemperature(true);
-
-    // Check if any reads failed and exit early (to try again).
-    if (isnan(hum) || isnan(temp)) {
-        log("ERR: Failed to read from DHT sensor!");
-        return;
+// {"Window":300,"Temp":{"n":150,"min":22.9,..},"TempUnit":"C","Hum":{..},"Time":"dd-Mmm-yyyy hh:mm:ss"}
+size_t printSensorStats(Print &out, const char *time) {
+    PayloadWriter json(out);
+    json.beginObject();
+    json.field("Window", (uint32_t)sensors.settings.sources[SOURCE_DHT].windowS);
+    json.name("Temp");
+    json.length += sensors.statsOf(SENSOR_TEMP).printJson(out);
+    json.field("TempUnit", "C");
+    json.name("Hum");
+    json.length += sensors.statsOf(SENSOR_HUM).printJson(out);
+    json.field("Time", time);
+    json.endObject();
+    return json.length;
+}
+
+// ==========================================================
+// one wake of the sensor node: sample, publish every few wakes, deep sleep, never returns
+void runSensorNode() {
+    sensorNode.begin();
+
+    // the measurement takes about 5 ms, interrupts capture it during the delays
+    uint32_t failures = dhtSensor.failures;
+    dhtSensor.start();
+    while (dhtSensor.isMeasuring) {
+        delay(1);
+        dhtSensor.loop();
     }
 
-    // // Compute heat index in Fahrenheit (the default)
-    // float hif = dht.computeHeatIndex(f, hum);
-    // // Compute heat index in Celsius (isFahrenheit = false)
-    // float hic = dht.computeHeatIndex(temp, hum, false);
+    if (dhtSensor.failures == failures) {
+        sensorNode.add(dhtSensor.temperature, dhtSensor.humidity);
+    } else {
+        sensorNode.failed();
+    }
 
-    // generate playload
-    char buffer[5];
-    // JSON message template
-    String dhtPlayload =
-        "{\r\n \
-        \"Temp\": \"{TEMP}\",\r\n \
-        \"TempUnit\": \"C\",\r\n \
-        \"Hum\": \"{HUM}\",\r\n \
-        \"Time\": \"{TIME}\"\r\n}";
+    if (sensorNode.isPublishDue()) {
+        sensorNode.isRadioOn = true;
 
-    dhtPlayload.replace("{TEMP}", dtostrf(temp, 4, 2, buffer));
-    dhtPlayload.replace("{HUM}", dtostrf(hum, 4, 2, buffer));
-    dhtPlayload.replace("{TIME}", getSystemDateTime());
+        hostName = String(_HOSTNAME) + WiFi.macAddress().substring(9);
+        hostName.replace(":", "");
+        WiFi.hostname(hostName);
 
-    // send MQTT response
-    mqttClient.publish(_MQTT_GET_SENSOR_DATA, dhtPlayload.c_str());
+        if (SPIFFS.begin())
+            loadConfig();
+        if (isValidNumber(String(config.mqttPort)))
+            mqttPortNumber = atoi(config.mqttPort);
+        beginTopics();
 
-    //debug: write to serial
-    log("DHT Data: \r\n" + dhtPlayload, false);
+        wifiClient.setTimeout(_DELAY_CONNECT_BUDGET);
+        mqttClient.setSocketTimeout((_DELAY_CONNECT_BUDGET + 999) / 1000);
+        connection.begin(config.mqttServer);
+
+        while (!connection.isConnected() && sensorNode.awakeTime() < _NODE_CONNECT_TIMEOUT) {
+            connection.loop();
+            delay(10);
+        }
+
+        // both passes print the same ages, a payload longer than its header would be cut off
+        uint32_t awake = sensorNode.awakeTime();
+        PrintCounter counter;
+        sensorNode.printJson(counter, awake);
+
+        bool isPublished =
+            connection.isConnected() && publishQueue.beginPublish(mqttTopics[TOPIC_SENSOR_BATCH], counter.length, false);
+        if (isPublished) {
+            sensorNode.printJson(publishQueue, awake);
+            // the samples leave RTC memory only once the batch was written to the connection
+            isPublished = publishQueue.endPublish() && publishQueue.sendAll();
+        }
+
+        if (isPublished) {
+            sensorNode.published();
+            char message[48];
+            snprintf(message, sizeof(message), "Sensor batch published, %u bytes", (unsigned)counter.length);
+            log(message);
+        } else {
+            sensorNode.failed();
+            log("ERR - sensor batch not published, kept for the next batch");
+        }
+
+        if (connection.isConnected()) {
+            flushLog();
+            publishQueue.flush();
+            mqttClient.disconnect();
+        }
+    }
+
+    sensorNode.sleep(_NODE_SAMPLE_PERIOD);
 }
 
 // ==========================================================
 void setup() {
+    bootTime = millis();
+    bootToMqttMs = 0;
+
     // init serial
     Serial.begin(115200);
     Serial.println("\n\n===== STARTING =====");
 
-    // init IOs
-    pinMode(_PIN_OUT_PORT1, OUTPUT);
-    pinMode(_PIN_OUT_PORT2, OUTPUT);
-    pinMode(_PIN_OUT_BEEPER, OUTPUT);
-    pinMode(_PIN_OUT_LED, OUTPUT);
+    // init IOs, all ports inactive
+    ports.begin();
 
-    // reset pins
-    digitalWrite(_PIN_OUT_PORT1, HIGH);
-    digitalWrite(_PIN_OUT_PORT2, HIGH);
-    digitalWrite(_PIN_OUT_BEEPER, HIGH);
-    digitalWrite(_PIN_OUT_LED, LOW);
+    // LED and beeper off
+    patterns.begin();
 
-    // inputs
-    pinMode(_PIN_IN_PORT1, INPUT_PULLUP);
-    pinMode(_PIN_IN_PORT2, INPUT_PULLUP);
+    // dimmers off
+    fades.begin();
 
     // DHT sensor
-    dht.begin();
+    dhtSensor.begin();
+
+#ifdef _SENSOR_NODE
+    runSensorNode();
+#endif
 
-    // to handle longpress
-    buttonPort1 = new DebounceEvent(_PIN_IN_PORT1, BUTTON_PUSHBUTTON | BUTTON_DEFAULT_HIGH | BUTTON_SET_PULLUP, 40, 0);
-    buttonPort2 = new DebounceEvent(_PIN_IN_PORT2, BUTTON_PUSHBUTTON | BUTTON_DEFAULT_HIGH | BUTTON_SET_PULLUP, 40, 0);
+    // inputs, button edges are captured by interrupts and wake the loop
+    buttons.begin();
 
     // read Button1 for input, if pressed, reset WiFi settings
     if (digitalRead(_PIN_IN_PORT1) == LOW) {
@@ -700,113 +1921,176 @@ void setup() {
         resetWiFiSettings();
     }
 
-    connectWiFi();
-    connectMqtt();
+    // Set hostname, called before WiFi.begin()
+    hostName = String(_HOSTNAME) + WiFi.macAddress().substring(9);
+    hostName.replace(":", "");
+    WiFi.hostname(hostName);
+
+    //clean FS, for testing
+    //SPIFFS.format(); // <<<<<<<<<<<<<<<<<<<<<<<<<<<
+
+    if (!SPIFFS.begin())
+        log("ERR - failed to mount FS");
+
+    loadConfig();
 
-    // NTP Clock setup
-    timeClient.begin();
-    timeClient.update();
+    // rules work offline from boot, they are evaluated as their inputs change
+    if (rules.load()) {
+        char message[24];
+        snprintf(message, sizeof(message), "%u rules loaded", rules.program.count);
+        log(message);
+    }
 
-    setSyncProvider(syncSystemTime);
-    setSyncInterval(60 * 5);
+    // the sensors are sampled from the first loop pass on
+    if (sensors.load())
+        log("Sensor settings loaded");
 
-    // sync time for the first time
-    setTime(syncSystemTime());
+    // the history goes on in the newest block kept on flash
+    history.begin();
 
-    // to send system uptime
-    tickerOneSecond.attach(1, tickerOneSecondCallback);
+    // pick up telemetry queued before a reboot
+    telemetryQueue.begin();
+    if (telemetryQueue.pending > 0)
+        log(String(telemetryQueue.pending) + " telemetry messages queued on flash");
 
-    // start async delay for sensor data
-    delaySensorData.start(_DELAY_SENSOR_DATA, AsyncDelay::MILLIS);
+    // without stored credentials there is nothing to connect to, wait in the config portal
+    if (WiFi.SSID().length() == 0) {
+        runWiFiConfigPortal();
+    }
 
-    // signal ready state - 3 blinks
-    for (byte i = 0; i < 3; i++) {
-        digitalWrite(_PIN_OUT_LED, HIGH);
-        delay(120);
-        digitalWrite(_PIN_OUT_LED, LOW);
-        delay(120);
+    if (isValidNumber(String(config.mqttPort))) {
+        mqttPortNumber = atoi(config.mqttPort);
+    } else {
+        log("ERR - Invalid MQTT port defined in configs, using default port 1883");
     }
 
-    // publish uptime
-    systemUptime.update();
-    publishUptime();
+    beginTopics();
+
+    // bound every blocking step of a connect attempt
+    wifiClient.setTimeout(_DELAY_CONNECT_BUDGET);
+    mqttClient.setSocketTimeout((_DELAY_CONNECT_BUDGET + 999) / 1000);
+    mqttClient.setCallback(mqttCallback);
+
+    // spread the reconnect backoff of devices that lost the broker together
+    randomSeed(ESP.getChipId() ^ micros());
+
+    connection.begin(config.mqttServer);
+
+    // let WiFi save power while the loop sleeps
+    WiFi.setSleepMode(_WIFI_SLEEP_MODE);
+
+    // the time is synced in the background from here on
+    beginClock();
 
-    // system ready message
-    log("System " + systemIpInfo, true);
-    String msg = String(_VERSION);
-    msg.concat(" | System ready");
-    log(msg, true);
+    // send system uptime periodically, the sensor data goes out when it changes
+    scheduler.every(publishUptime, _DELAY_UPTIME);
 
-    flasherPing.setup();
-    flasherBeep.setup();
-    flasherReady.setup();
+    // the sensor values for the history on flash
+    scheduler.every(recordHistory, _DELAY_HISTORY_SAMPLE);
 
-    flasherReady.start();
+    // heap tracking and its periodic report
+    scheduler.every(sampleHeap, _DELAY_HEAP_SAMPLE);
+    scheduler.every(publishHeapReport, _DELAY_HEAP_REPORT);
+
+    systemUptime.update();
+
+    // signal ready state - 3 blinks over the ready pattern
+    patterns.play(CHANNEL_LED, LAYER_BACKGROUND, PATTERN_READY);
+    patterns.play(CHANNEL_LED, LAYER_ALERT, PATTERN_PING);
 }
 
 // ==========================================================
 void loop() {
-    systemUptime.update();
+    uint32_t passStart = ESP.getCycleCount();
 
-    flasherPing.loop();
-    flasherBeep.loop();
-    flasherReady.loop();
+    // classify the captured button edges, the actions run from onButton()
+    {
+        LatencyTimer timer(latencyStages[STAGE_BUTTONS]);
+        buttons.loop();
+    }
 
-    // check inputs
-    // check for buttonPort1 is released
-    if (unsigned int event = buttonPort1->loop()) {
-        if (event == EVENT_RELEASED) {
-            if (buttonPort1->getEventLength() < _DELAY_BUTTON_LONG_PRESS) {
-                openPort(1);
-            } else {
-                // button1 long pressed!
-                // reset wifi settings
-                resetWiFiSettings();
-            }
-        }
+    // (re)connect WiFi and MQTT, one bounded step per pass
+    {
+        LatencyTimer timer(latencyStages[STAGE_CONNECTION]);
+        HeapScope heapScope(HEAP_NETWORK);
+        connection.loop();
     }
 
-    // check for buttonPort2 is released
-    if (unsigned int event = buttonPort2->loop()) {
-        if (event == EVENT_RELEASED) {
-            openPort(2);
+    if (connection.isConnected()) {
+        if (mqttClient.connected()) {
+            // process mqtt mesages
+            LatencyTimer timer(latencyStages[STAGE_MQTT]);
+            mqttClient.loop();
+        } else {
+            log("ERR - MQTT connection lost");
+            // the telemetry that was not written goes back to the flash queue
+            publishQueue.clear();
+            connection.disconnected();
         }
     }
 
-    // NTP Clock update
-    timeClient.update();
+    // flush queued telemetry to flash, drain it in small batches while online
+    {
+        LatencyTimer timer(latencyStages[STAGE_TELEMETRY_QUEUE]);
+        HeapScope heapScope(HEAP_QUEUE);
+        telemetryQueue.loop(connection.isConnected() && mqttClient.connected());
+    }
 
-    if (WiFi.status() != WL_CONNECTED) {
-        // reconnect wifi
-        connectWiFi();
+    // decode a finished DHT measurement
+    {
+        LatencyTimer timer(latencyStages[STAGE_DHT_READ]);
+        dhtSensor.loop();
     }
 
-    if (!mqttClient.connected()) {
-        // reconnect mqtt
-        connectMqtt();
-    } else {
-        // process mqtt mesages
-        mqttClient.loop();
+    // start the sensor samples that are due, the values are reported when they changed
+    {
+        LatencyTimer timer(latencyStages[STAGE_SENSORS]);
+        sensors.loop();
     }
 
-    // reset port PIN states automatically after delay
-    if (isPort1Pressed && delayPort1.isExpired()) {
-        digitalWrite(_PIN_OUT_PORT1, HIGH);
-        isPort1Pressed = false;
+    // stream the chunks of a history query
+    {
+        LatencyTimer timer(latencyStages[STAGE_HISTORY]);
+        history.loop(connection.isConnected() && mqttClient.connected());
     }
 
-    // stop beeper automatically after delay
-    if (isBeeperStarted && delayBeeper.isExpired()) {
-        isBeeperStarted = false;
-        digitalWrite(_PIN_OUT_BEEPER, HIGH);
-        digitalWrite(_PIN_OUT_LED, LOW);
+    // run due tasks, then sleep until the next deadline, input change or MQTT data
+    uint32_t idleTime;
+    {
+        LatencyTimer timer(latencyStages[STAGE_TASKS]);
+        idleTime = scheduler.run();
     }
 
-    // send sensor data and re-arm the timer
-    if (delaySensorData.isExpired()) {
-        delaySensorData.repeat();
-        getSensorData();
+    // end due port pulses, and write the port changes of this pass to the expanders
+    {
+        LatencyTimer timer(latencyStages[STAGE_PORTS]);
+        ports.loop();
     }
 
-    delay(10);
+    // rules whose inputs changed while rules ran commands, and timed rules
+    {
+        LatencyTimer timer(latencyStages[STAGE_RULES]);
+        rules.loop();
+    }
+
+    // write the publishes of this pass, coalesced into as few TCP segments as possible
+    {
+        LatencyTimer timer(latencyStages[STAGE_PUBLISH]);
+        publishQueue.loop(_MQTT_WRITE_BUDGET);
+    }
+    // publishes wait for the connection, they do not keep the loop awake
+    if (!publishQueue.isEmpty() && mqttClient.connected())
+        idleTime = 0;
+    // the engines keep their own deadlines instead of scheduler tasks, see Scheduler.cpp
+    idleTime = min(idleTime, connection.timeToNext());
+    idleTime = min(idleTime, dhtSensor.timeToNext());
+    idleTime = min(idleTime, sensors.timeToNext());
+    idleTime = min(idleTime, history.timeToNext());
+    idleTime = min(idleTime, ports.timeToNext());
+    idleTime = min(idleTime, buttons.timeToNext());
+    idleTime = min(idleTime, rules.timeToNext());
+
+    latencyStages[STAGE_LOOP].addCycles(ESP.getCycleCount() - passStart);
+
+    scheduler.sleep(idleTime, isIdle);
 }